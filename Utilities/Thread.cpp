@@ -465,9 +465,28 @@ void NamedThreadBase::WaitForAnySignal(u64 time) // wait for Notify() signal or
 	m_signal_cv.wait_for(lock, std::chrono::milliseconds(time));
 }
 
-void NamedThreadBase::Notify() // wake up waiting thread or nothing
+u64 NamedThreadBase::GetSignalCount()
 {
-	m_signal_cv.notify_one();
+	std::lock_guard<std::mutex> lock(m_signal_mtx);
+	return m_signal_count;
+}
+
+void NamedThreadBase::WaitForSignal(u64 count, u64 time)
+{
+	std::unique_lock<std::mutex> lock(m_signal_mtx);
+
+	if (m_signal_count == count)
+	{
+		m_signal_cv.wait_for(lock, std::chrono::milliseconds(time));
+	}
+}
+
+void NamedThreadBase::Notify() // wake up waiting threads or nothing
+{
+	// the mutex is locked, so the signal can't be missed between the condition check and the wait
+	std::lock_guard<std::mutex> lock(m_signal_mtx);
+	m_signal_count++;
+	m_signal_cv.notify_all();
 }
 
 ThreadBase::ThreadBase(const std::string& name)
@@ -727,6 +746,111 @@ bool thread_t::joinable() const
 	return m_state == TS_JOINABLE;
 }
 
+thread_pool_t::thread_pool_t(const std::string& name, u32 count)
+	: m_name(name)
+	, m_count(std::max<u32>(count, 1))
+	, m_stop(0)
+{
+}
+
+thread_pool_t::~thread_pool_t()
+{
+	stop();
+}
+
+void thread_pool_t::work(u32 index)
+{
+	while (true)
+	{
+		job_t job;
+
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+
+			while (m_queue.empty() && !m_stop)
+			{
+				m_queue_cv.wait(lock);
+			}
+
+			if (m_stop)
+			{
+				break;
+			}
+
+			job = std::move(m_queue.front());
+			m_queue.pop_front();
+		}
+
+		job(index);
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		m_done_cv.notify_all();
+	}
+}
+
+bool thread_pool_t::push(job_t job)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (m_stop)
+	{
+		// the workers may be gone already, the job would stay in the queue
+		return false;
+	}
+
+	if (m_workers.empty())
+	{
+		for (u32 i = 0; i < m_count; i++)
+		{
+			m_workers.emplace_back(new thread_t(fmt::Format("%s[%d]", m_name.c_str(), i), true, [this, i](){ work(i); }));
+		}
+	}
+
+	m_queue.push_back(std::move(job));
+	m_queue_cv.notify_one();
+	return true;
+}
+
+bool thread_pool_t::wait(const std::function<bool()>& pred)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	while (!pred())
+	{
+		if (m_stop)
+		{
+			return false;
+		}
+
+		m_done_cv.wait_for(lock, std::chrono::milliseconds(10));
+	}
+
+	return true;
+}
+
+void thread_pool_t::stop()
+{
+	std::vector<std::unique_ptr<thread_t>> workers;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		m_stop++;
+		m_workers.swap(workers);
+		m_queue.clear();
+		m_queue_cv.notify_all();
+		m_done_cv.notify_all();
+	}
+
+	// join the threads outside of the lock (they take it to finish), new workers can't be started until m_stop is cleared
+	workers.clear();
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	m_stop--;
+}
+
 bool waiter_map_t::is_stopped(u64 signal_id)
 {
 	if (Emu.IsStopped())
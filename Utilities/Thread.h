@@ -1,5 +1,6 @@
 #pragma once
 #include "Emu/Memory/atomic_type.h"
+#include <deque>
 
 static std::thread::id main_thread;
 
@@ -8,15 +9,16 @@ class NamedThreadBase
 	std::string m_name;
 	std::condition_variable m_signal_cv;
 	std::mutex m_signal_mtx;
+	u64 m_signal_count; // count of Notify() calls (protected by m_signal_mtx)
 
 public:
 	std::atomic<bool> m_tls_assigned;
 
-	NamedThreadBase(const std::string& name) : m_name(name), m_tls_assigned(false)
+	NamedThreadBase(const std::string& name) : m_name(name), m_signal_count(0), m_tls_assigned(false)
 	{
 	}
 
-	NamedThreadBase() : m_tls_assigned(false)
+	NamedThreadBase() : m_signal_count(0), m_tls_assigned(false)
 	{
 	}
 
@@ -25,6 +27,12 @@ public:
 
 	void WaitForAnySignal(u64 time = 1);
 
+	// get the count of Notify() calls (should be read before checking the condition the thread waits for)
+	u64 GetSignalCount();
+
+	// wait for Notify() unless it was called since GetSignalCount() returned specified value
+	void WaitForSignal(u64 count, u64 time = 1);
+
 	void Notify();
 };
 
@@ -88,6 +96,44 @@ public:
 	bool joinable() const;
 };
 
+// fixed number of threads running queued jobs in FIFO order (the threads are started by the first job)
+class thread_pool_t
+{
+public:
+	// the argument is the index of the worker running the job (for per-worker state of the owner)
+	typedef std::function<void(u32 worker)> job_t;
+
+private:
+	std::string m_name;
+	u32 m_count;
+	std::vector<std::unique_ptr<thread_t>> m_workers;
+	std::deque<job_t> m_queue;
+	std::mutex m_mutex;
+	std::condition_variable m_queue_cv;
+	std::condition_variable m_done_cv;
+	u32 m_stop; // count of stop() calls in progress
+
+	void work(u32 index);
+
+public:
+	thread_pool_t(const std::string& name, u32 count);
+	~thread_pool_t();
+
+	thread_pool_t(const thread_pool_t& right) = delete;
+	thread_pool_t& operator =(const thread_pool_t& right) = delete;
+
+	u32 size() const { return m_count; }
+
+	// returns false (and drops the job) if the pool is being stopped
+	bool push(job_t job);
+
+	// wait until pred() returns true (it's checked under the pool lock after every finished job and periodically), returns false if the pool was stopped before
+	bool wait(const std::function<bool()>& pred);
+
+	// drop queued jobs and join the threads (running jobs are finished), the pool can be used again then
+	void stop();
+};
+
 class slw_mutex_t
 {
 
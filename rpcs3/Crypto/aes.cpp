@@ -31,6 +31,7 @@
 
 #include "stdafx.h"
 #include "aes.h"
+#include "aesni.h"
 
 /*
  * 32-bit integer manipulation macros (little endian)
@@ -644,6 +645,11 @@ int aes_crypt_ecb( aes_context *ctx,
     int i;
     uint32_t *RK, X0, X1, X2, X3, Y0, Y1, Y2, Y3;
 
+#if defined(POLARSSL_AESNI_C)
+    if( aesni_supports( POLARSSL_AESNI_AES ) )
+        return( aesni_crypt_ecb( ctx, mode, input, output ) );
+#endif
+
     RK = ctx->rk;
 
     GET_UINT32_LE( X0, input,  0 ); X0 ^= *RK++;
@@ -744,6 +750,11 @@ int aes_crypt_cbc( aes_context *ctx,
     if( length % 16 )
         return( POLARSSL_ERR_AES_INVALID_INPUT_LENGTH );
 
+#if defined(POLARSSL_AESNI_C)
+    if( aesni_supports( POLARSSL_AESNI_AES ) )
+        return( aesni_crypt_cbc( ctx, mode, length, iv, input, output ) );
+#endif
+
     if( mode == AES_DECRYPT )
     {
         while( length > 0 )
@@ -840,6 +851,11 @@ int aes_crypt_ctr( aes_context *ctx,
     int c, i;
     size_t n = *nc_off;
 
+#if defined(POLARSSL_AESNI_C)
+    if( aesni_supports( POLARSSL_AESNI_AES ) )
+        return( aesni_crypt_ctr( ctx, length, nc_off, nonce_counter, stream_block, input, output ) );
+#endif
+
     while( length-- )
     {
         if( n == 0 ) {
@@ -961,10 +977,19 @@ void aes_cmac(aes_context *ctx, int length, unsigned char *input, unsigned char
     }
 
     for (i = 0; i < 16; i++) X[i] = 0;
-    for (i = 0; i < n - 1; i++) 
+#if defined(POLARSSL_AESNI_C)
+    if (aesni_supports(POLARSSL_AESNI_AES))
     {
-        xor_128(X, &input[16*i], Y);
-		aes_crypt_ecb(ctx, AES_ENCRYPT, Y, X); 
+        aesni_cbc_mac(ctx, X, input, n - 1);
+    }
+    else
+#endif
+    {
+        for (i = 0; i < n - 1; i++)
+        {
+            xor_128(X, &input[16*i], Y);
+            aes_crypt_ecb(ctx, AES_ENCRYPT, Y, X);
+        }
     }
 
     xor_128(X,M_last,Y);
@@ -0,0 +1,415 @@
+/*
+ *  AES-NI and SHA extensions support functions
+ *
+ *  The instructions are used only if CPUID reports them (the rest of the emulator
+ *  requires only SSE2), so the functions are compiled for the target ISA separately.
+ */
+
+#include "stdafx.h"
+#include <atomic>
+#include "aesni.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define POLARSSL_TARGET(isa)
+#else
+#include <cpuid.h>
+#if defined(POLARSSL_AESNI_C)
+#include <wmmintrin.h>
+#include <immintrin.h>
+#endif
+#define POLARSSL_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+/*
+ * The results of CPUID are cached in atomics, as the functions are called by several
+ * threads at once (PKG decrypters). Racing threads store the same value.
+ */
+static std::atomic<int> aesni_scalar( 0 );
+
+static void aesni_cpuid( unsigned int leaf, unsigned int regs[4] )
+{
+#ifdef _MSC_VER
+    __cpuidex( (int *) regs, leaf, 0 );
+#else
+    __cpuid_count( leaf, 0, regs[0], regs[1], regs[2], regs[3] );
+#endif
+}
+
+int aesni_supports( unsigned int what )
+{
+#if defined(POLARSSL_AESNI_C)
+    static std::atomic<uint64_t> features( 0 ); /* CPUID.1:ECX, bit 32 is set when valid */
+    uint64_t c = features.load();
+
+    if( c == 0 )
+    {
+        unsigned int regs[4];
+        aesni_cpuid( 1, regs );
+        c = regs[2] | ( 1ull << 32 );
+        features.store( c );
+    }
+
+    return( ( c & what ) != 0 && ! aesni_scalar.load() );
+#else
+    return( 0 );
+#endif
+}
+
+int shani_supports( void )
+{
+#if defined(POLARSSL_SHANI_C)
+    static std::atomic<int> supported( -1 );
+    int s = supported.load();
+
+    if( s < 0 )
+    {
+        unsigned int regs[4];
+        aesni_cpuid( 0, regs );
+        s = 0;
+
+        if( regs[0] >= 7 )
+        {
+            aesni_cpuid( 7, regs );
+            s = ( regs[1] >> 29 ) & 1; /* CPUID.7:EBX bit 29 */
+        }
+
+        supported.store( s );
+    }
+
+    return( s && ! aesni_scalar.load() );
+#else
+    return( 0 );
+#endif
+}
+
+void aesni_force_scalar( int force )
+{
+    aesni_scalar.store( force );
+}
+
+#if defined(POLARSSL_AESNI_C)
+
+/*
+ * The round keys are stored as 16-byte blocks in the order used by the instructions:
+ * aes_setkey_dec() produces the keys of the equivalent inverse cipher, as AESDEC expects.
+ */
+#define RK(i) _mm_loadu_si128( (const __m128i *) ctx->rk + (i) )
+
+POLARSSL_TARGET("aes")
+static __m128i aesni_encrypt( aes_context *ctx, __m128i b )
+{
+    int i;
+
+    b = _mm_xor_si128( b, RK( 0 ) );
+
+    for( i = 1; i < ctx->nr; i++ )
+        b = _mm_aesenc_si128( b, RK( i ) );
+
+    return( _mm_aesenclast_si128( b, RK( ctx->nr ) ) );
+}
+
+POLARSSL_TARGET("aes")
+static __m128i aesni_decrypt( aes_context *ctx, __m128i b )
+{
+    int i;
+
+    b = _mm_xor_si128( b, RK( 0 ) );
+
+    for( i = 1; i < ctx->nr; i++ )
+        b = _mm_aesdec_si128( b, RK( i ) );
+
+    return( _mm_aesdeclast_si128( b, RK( ctx->nr ) ) );
+}
+
+/*
+ * Four independent blocks at once (the instructions are pipelined)
+ */
+POLARSSL_TARGET("aes")
+static void aesni_encrypt4( aes_context *ctx, __m128i b[4] )
+{
+    __m128i k = RK( 0 );
+    int i;
+
+    b[0] = _mm_xor_si128( b[0], k );
+    b[1] = _mm_xor_si128( b[1], k );
+    b[2] = _mm_xor_si128( b[2], k );
+    b[3] = _mm_xor_si128( b[3], k );
+
+    for( i = 1; i < ctx->nr; i++ )
+    {
+        k = RK( i );
+        b[0] = _mm_aesenc_si128( b[0], k );
+        b[1] = _mm_aesenc_si128( b[1], k );
+        b[2] = _mm_aesenc_si128( b[2], k );
+        b[3] = _mm_aesenc_si128( b[3], k );
+    }
+
+    k = RK( ctx->nr );
+    b[0] = _mm_aesenclast_si128( b[0], k );
+    b[1] = _mm_aesenclast_si128( b[1], k );
+    b[2] = _mm_aesenclast_si128( b[2], k );
+    b[3] = _mm_aesenclast_si128( b[3], k );
+}
+
+POLARSSL_TARGET("aes")
+static void aesni_decrypt4( aes_context *ctx, __m128i b[4] )
+{
+    __m128i k = RK( 0 );
+    int i;
+
+    b[0] = _mm_xor_si128( b[0], k );
+    b[1] = _mm_xor_si128( b[1], k );
+    b[2] = _mm_xor_si128( b[2], k );
+    b[3] = _mm_xor_si128( b[3], k );
+
+    for( i = 1; i < ctx->nr; i++ )
+    {
+        k = RK( i );
+        b[0] = _mm_aesdec_si128( b[0], k );
+        b[1] = _mm_aesdec_si128( b[1], k );
+        b[2] = _mm_aesdec_si128( b[2], k );
+        b[3] = _mm_aesdec_si128( b[3], k );
+    }
+
+    k = RK( ctx->nr );
+    b[0] = _mm_aesdeclast_si128( b[0], k );
+    b[1] = _mm_aesdeclast_si128( b[1], k );
+    b[2] = _mm_aesdeclast_si128( b[2], k );
+    b[3] = _mm_aesdeclast_si128( b[3], k );
+}
+
+#undef RK
+
+POLARSSL_TARGET("aes")
+int aesni_crypt_ecb( aes_context *ctx,
+                     int mode,
+                     const unsigned char input[16],
+                     unsigned char output[16] )
+{
+    __m128i b = _mm_loadu_si128( (const __m128i *) input );
+
+    b = mode == AES_DECRYPT ? aesni_decrypt( ctx, b ) : aesni_encrypt( ctx, b );
+
+    _mm_storeu_si128( (__m128i *) output, b );
+
+    return( 0 );
+}
+
+POLARSSL_TARGET("aes")
+int aesni_crypt_cbc( aes_context *ctx,
+                     int mode,
+                     size_t length,
+                     unsigned char iv[16],
+                     const unsigned char *input,
+                     unsigned char *output )
+{
+    __m128i v = _mm_loadu_si128( (const __m128i *) iv );
+
+    if( length % 16 )
+        return( POLARSSL_ERR_AES_INVALID_INPUT_LENGTH );
+
+    if( mode == AES_DECRYPT )
+    {
+        /* decryption of the blocks doesn't depend on each other */
+        for( ; length >= 64; length -= 64, input += 64, output += 64 )
+        {
+            __m128i c[4], b[4];
+            int i;
+
+            for( i = 0; i < 4; i++ )
+                b[i] = c[i] = _mm_loadu_si128( (const __m128i *) input + i );
+
+            aesni_decrypt4( ctx, b );
+
+            _mm_storeu_si128( (__m128i *) output + 0, _mm_xor_si128( b[0], v ) );
+            _mm_storeu_si128( (__m128i *) output + 1, _mm_xor_si128( b[1], c[0] ) );
+            _mm_storeu_si128( (__m128i *) output + 2, _mm_xor_si128( b[2], c[1] ) );
+            _mm_storeu_si128( (__m128i *) output + 3, _mm_xor_si128( b[3], c[2] ) );
+            v = c[3];
+        }
+
+        for( ; length > 0; length -= 16, input += 16, output += 16 )
+        {
+            __m128i c = _mm_loadu_si128( (const __m128i *) input );
+            _mm_storeu_si128( (__m128i *) output, _mm_xor_si128( aesni_decrypt( ctx, c ), v ) );
+            v = c;
+        }
+    }
+    else
+    {
+        for( ; length > 0; length -= 16, input += 16, output += 16 )
+        {
+            v = aesni_encrypt( ctx, _mm_xor_si128( _mm_loadu_si128( (const __m128i *) input ), v ) );
+            _mm_storeu_si128( (__m128i *) output, v );
+        }
+    }
+
+    _mm_storeu_si128( (__m128i *) iv, v );
+
+    return( 0 );
+}
+
+/*
+ * store the 128-bit big-endian counter and increment it
+ */
+static void aesni_next_counter( unsigned char nonce_counter[16], unsigned char block[16] )
+{
+    int i;
+
+    memcpy( block, nonce_counter, 16 );
+
+    for( i = 16; i > 0; i-- )
+        if( ++nonce_counter[i - 1] != 0 )
+            break;
+}
+
+POLARSSL_TARGET("aes")
+int aesni_crypt_ctr( aes_context *ctx,
+                     size_t length,
+                     size_t *nc_off,
+                     unsigned char nonce_counter[16],
+                     unsigned char stream_block[16],
+                     const unsigned char *input,
+                     unsigned char *output )
+{
+    size_t n = *nc_off;
+    unsigned char counters[64];
+
+    /* the rest of the current stream block */
+    for( ; n != 0 && length > 0; length-- )
+    {
+        *output++ = (unsigned char)( *input++ ^ stream_block[n] );
+        n = ( n + 1 ) & 0x0F;
+    }
+
+    for( ; length >= 64; length -= 64, input += 64, output += 64 )
+    {
+        __m128i b[4];
+        int i;
+
+        for( i = 0; i < 4; i++ )
+        {
+            aesni_next_counter( nonce_counter, counters + i * 16 );
+            b[i] = _mm_loadu_si128( (const __m128i *) counters + i );
+        }
+
+        aesni_encrypt4( ctx, b );
+
+        for( i = 0; i < 4; i++ )
+            _mm_storeu_si128( (__m128i *) output + i, _mm_xor_si128( b[i], _mm_loadu_si128( (const __m128i *) input + i ) ) );
+
+        _mm_storeu_si128( (__m128i *) stream_block, b[3] );
+    }
+
+    for( ; length > 0; length-- )
+    {
+        if( n == 0 )
+        {
+            aesni_next_counter( nonce_counter, counters );
+            _mm_storeu_si128( (__m128i *) stream_block, aesni_encrypt( ctx, _mm_loadu_si128( (const __m128i *) counters ) ) );
+        }
+
+        *output++ = (unsigned char)( *input++ ^ stream_block[n] );
+        n = ( n + 1 ) & 0x0F;
+    }
+
+    *nc_off = n;
+
+    return( 0 );
+}
+
+POLARSSL_TARGET("aes")
+void aesni_cbc_mac( aes_context *ctx,
+                    unsigned char X[16],
+                    const unsigned char *input,
+                    size_t blocks )
+{
+    __m128i x = _mm_loadu_si128( (const __m128i *) X );
+
+    for( ; blocks > 0; blocks--, input += 16 )
+        x = aesni_encrypt( ctx, _mm_xor_si128( x, _mm_loadu_si128( (const __m128i *) input ) ) );
+
+    _mm_storeu_si128( (__m128i *) X, x );
+}
+
+#endif /* POLARSSL_AESNI_C */
+
+#if defined(POLARSSL_SHANI_C)
+
+/*
+ * SHA-1 with SHA extensions: every SHA1RNDS4 performs four rounds,
+ * the message schedule is computed four words at once by SHA1MSG1, XOR and SHA1MSG2
+ */
+#define SHANI_ROUNDS(Ein, Eout, M0, M1, M2, M3, f)          \
+{                                                           \
+    Ein  = _mm_sha1nexte_epu32( Ein, M0 );                  \
+    Eout = ABCD;                                            \
+    M1   = _mm_sha1msg2_epu32( M1, M0 );                    \
+    ABCD = _mm_sha1rnds4_epu32( ABCD, Ein, f );             \
+    M3   = _mm_sha1msg1_epu32( M3, M0 );                    \
+    M2   = _mm_xor_si128( M2, M0 );                         \
+}
+
+POLARSSL_TARGET("sha,ssse3")
+void shani_sha1_process( uint32_t state[5], const unsigned char data[64] )
+{
+    const __m128i MASK = _mm_set_epi64x( 0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL );
+    __m128i ABCD, ABCD_SAVE, E0, E0_SAVE, E1;
+    __m128i MSG0, MSG1, MSG2, MSG3;
+
+    ABCD = _mm_shuffle_epi32( _mm_loadu_si128( (const __m128i *) state ), 0x1B );
+    E0 = _mm_set_epi32( state[4], 0, 0, 0 );
+
+    ABCD_SAVE = ABCD;
+    E0_SAVE = E0;
+
+    /* Rounds 0-3 */
+    MSG0 = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *) ( data + 0 ) ), MASK );
+    E0 = _mm_add_epi32( E0, MSG0 );
+    E1 = ABCD;
+    ABCD = _mm_sha1rnds4_epu32( ABCD, E0, 0 );
+
+    /* Rounds 4-7 */
+    MSG1 = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *) ( data + 16 ) ), MASK );
+    E1 = _mm_sha1nexte_epu32( E1, MSG1 );
+    E0 = ABCD;
+    ABCD = _mm_sha1rnds4_epu32( ABCD, E1, 0 );
+    MSG0 = _mm_sha1msg1_epu32( MSG0, MSG1 );
+
+    /* Rounds 8-11 */
+    MSG2 = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *) ( data + 32 ) ), MASK );
+    E0 = _mm_sha1nexte_epu32( E0, MSG2 );
+    E1 = ABCD;
+    ABCD = _mm_sha1rnds4_epu32( ABCD, E0, 0 );
+    MSG1 = _mm_sha1msg1_epu32( MSG1, MSG2 );
+    MSG0 = _mm_xor_si128( MSG0, MSG2 );
+
+    /* Rounds 12-79 (the schedule computed during the last rounds isn't used) */
+    MSG3 = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *) ( data + 48 ) ), MASK );
+    SHANI_ROUNDS( E1, E0, MSG3, MSG0, MSG1, MSG2, 0 );
+    SHANI_ROUNDS( E0, E1, MSG0, MSG1, MSG2, MSG3, 0 );
+    SHANI_ROUNDS( E1, E0, MSG1, MSG2, MSG3, MSG0, 1 );
+    SHANI_ROUNDS( E0, E1, MSG2, MSG3, MSG0, MSG1, 1 );
+    SHANI_ROUNDS( E1, E0, MSG3, MSG0, MSG1, MSG2, 1 );
+    SHANI_ROUNDS( E0, E1, MSG0, MSG1, MSG2, MSG3, 1 );
+    SHANI_ROUNDS( E1, E0, MSG1, MSG2, MSG3, MSG0, 1 );
+    SHANI_ROUNDS( E0, E1, MSG2, MSG3, MSG0, MSG1, 2 );
+    SHANI_ROUNDS( E1, E0, MSG3, MSG0, MSG1, MSG2, 2 );
+    SHANI_ROUNDS( E0, E1, MSG0, MSG1, MSG2, MSG3, 2 );
+    SHANI_ROUNDS( E1, E0, MSG1, MSG2, MSG3, MSG0, 2 );
+    SHANI_ROUNDS( E0, E1, MSG2, MSG3, MSG0, MSG1, 2 );
+    SHANI_ROUNDS( E1, E0, MSG3, MSG0, MSG1, MSG2, 3 );
+    SHANI_ROUNDS( E0, E1, MSG0, MSG1, MSG2, MSG3, 3 );
+    SHANI_ROUNDS( E1, E0, MSG1, MSG2, MSG3, MSG0, 3 );
+    SHANI_ROUNDS( E0, E1, MSG2, MSG3, MSG0, MSG1, 3 );
+    SHANI_ROUNDS( E1, E0, MSG3, MSG0, MSG1, MSG2, 3 );
+
+    E0 = _mm_sha1nexte_epu32( E0, E0_SAVE );
+    ABCD = _mm_add_epi32( ABCD, ABCD_SAVE );
+
+    _mm_storeu_si128( (__m128i *) state, _mm_shuffle_epi32( ABCD, 0x1B ) );
+    state[4] = _mm_cvtsi128_si32( _mm_srli_si128( E0, 12 ) );
+}
+
+#endif /* POLARSSL_SHANI_C */
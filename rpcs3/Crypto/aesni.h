@@ -0,0 +1,117 @@
+#pragma once
+
+/**
+ * \file aesni.h
+ *
+ * \brief AES-NI and SHA extensions for hardware acceleration of aes.cpp and sha1.cpp
+ *
+ * The functions have the same semantics as their aes_* and sha1_* counterparts, they are
+ * called by them when aesni_supports() (or shani_supports()) reports the instructions.
+ */
+#include "aes.h"
+
+#define POLARSSL_AESNI_AES      0x02000000u  /**< CPUID.1:ECX bit 25 */
+
+/*
+ * The functions are compiled with __attribute__((target)), which supports intrinsics
+ * since GCC 4.9 (SHA intrinsics since GCC 5) and Clang 3.8. Older compilers use only
+ * the scalar code (aesni_supports() and shani_supports() report 0).
+ */
+#if defined(__clang__)
+#if __clang_major__ > 3 || ( __clang_major__ == 3 && __clang_minor__ >= 8 )
+#define POLARSSL_AESNI_C
+#define POLARSSL_SHANI_C
+#endif
+#elif defined(__GNUC__)
+#if __GNUC__ > 4 || ( __GNUC__ == 4 && __GNUC_MINOR__ >= 9 )
+#define POLARSSL_AESNI_C
+#endif
+#if __GNUC__ >= 5
+#define POLARSSL_SHANI_C
+#endif
+#elif defined(_MSC_VER)
+#define POLARSSL_AESNI_C
+/* SHA intrinsics require Visual Studio 2015 */
+#if _MSC_VER >= 1900
+#define POLARSSL_SHANI_C
+#endif
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief          AES-NI features detection routine
+ *
+ * \param what     The feature to detect (POLARSSL_AESNI_AES)
+ *
+ * \return         1 if CPU has support for the feature, 0 otherwise
+ */
+int aesni_supports( unsigned int what );
+
+/**
+ * \brief          SHA extensions detection routine
+ *
+ * \return         1 if CPU supports SHA-1 instructions, 0 otherwise
+ */
+int shani_supports( void );
+
+/**
+ * \brief          Make aesni_supports() and shani_supports() report 0 (used by the
+ *                 self test to check the scalar code on any CPU)
+ *
+ * \param force    1 to use only the scalar code, 0 to use the instructions if supported
+ */
+void aesni_force_scalar( int force );
+
+/**
+ * \brief          Known-answer tests of AES (ECB, CBC, CTR, CMAC) and SHA-1, done with
+ *                 the scalar code and with the instructions (if the CPU supports them)
+ *
+ * \return         0 if successful, 1 if any test failed (failures are logged)
+ */
+int aesni_self_test( void );
+
+#if defined(POLARSSL_AESNI_C)
+int aesni_crypt_ecb( aes_context *ctx,
+                     int mode,
+                     const unsigned char input[16],
+                     unsigned char output[16] );
+
+int aesni_crypt_cbc( aes_context *ctx,
+                     int mode,
+                     size_t length,
+                     unsigned char iv[16],
+                     const unsigned char *input,
+                     unsigned char *output );
+
+int aesni_crypt_ctr( aes_context *ctx,
+                     size_t length,
+                     size_t *nc_off,
+                     unsigned char nonce_counter[16],
+                     unsigned char stream_block[16],
+                     const unsigned char *input,
+                     unsigned char *output );
+
+/**
+ * \brief          CBC-MAC of the blocks (used by aes_cmac)
+ *
+ * \param X        The chaining value, updated by the function
+ */
+void aesni_cbc_mac( aes_context *ctx,
+                    unsigned char X[16],
+                    const unsigned char *input,
+                    size_t blocks );
+#endif
+
+#if defined(POLARSSL_SHANI_C)
+/**
+ * \brief          SHA-1 compression of one 64-byte block
+ */
+void shani_sha1_process( uint32_t state[5], const unsigned char data[64] );
+#endif
+
+#ifdef __cplusplus
+}
+#endif
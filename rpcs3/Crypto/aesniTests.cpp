@@ -0,0 +1,174 @@
+/*
+ *  Known-answer tests of AES and SHA-1, run with the scalar code and with AES-NI/SHA extensions
+ *
+ *  Vectors: FIPS-197 appendix C (ECB), SP 800-38A F.2.1 and F.5.1 (CBC, CTR),
+ *  RFC 4493 example 4 (CMAC), FIPS 180-2 appendix A (SHA-1)
+ */
+
+#include "stdafx.h"
+#include "Utilities/Log.h"
+#include "aes.h"
+#include "sha1.h"
+#include "aesni.h"
+
+static const unsigned char fips197_key[32] =
+{
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+    0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f
+};
+
+static const unsigned char fips197_pt[16] =
+{
+    0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff
+};
+
+static const unsigned char fips197_ct[3][16] =
+{
+    { 0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30, 0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a },
+    { 0xdd, 0xa9, 0x7c, 0xa4, 0x86, 0x4c, 0xdf, 0xe0, 0x6e, 0xaf, 0x70, 0xa0, 0xec, 0x0d, 0x71, 0x91 },
+    { 0x8e, 0xa2, 0xb7, 0xca, 0x51, 0x67, 0x45, 0xbf, 0xea, 0xfc, 0x49, 0x90, 0x4b, 0x49, 0x60, 0x89 }
+};
+
+static const unsigned char sp800_key[16] =
+{
+    0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c
+};
+
+static const unsigned char sp800_pt[64] =
+{
+    0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+    0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+    0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11, 0xe5, 0xfb, 0xc1, 0x19, 0x1a, 0x0a, 0x52, 0xef,
+    0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b, 0x17, 0xad, 0x2b, 0x41, 0x7b, 0xe6, 0x6c, 0x37, 0x10
+};
+
+static const unsigned char sp800_cbc_iv[16] =
+{
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f
+};
+
+static const unsigned char sp800_cbc_ct[64] =
+{
+    0x76, 0x49, 0xab, 0xac, 0x81, 0x19, 0xb2, 0x46, 0xce, 0xe9, 0x8e, 0x9b, 0x12, 0xe9, 0x19, 0x7d,
+    0x50, 0x86, 0xcb, 0x9b, 0x50, 0x72, 0x19, 0xee, 0x95, 0xdb, 0x11, 0x3a, 0x91, 0x76, 0x78, 0xb2,
+    0x73, 0xbe, 0xd6, 0xb8, 0xe3, 0xc1, 0x74, 0x3b, 0x71, 0x16, 0xe6, 0x9e, 0x22, 0x22, 0x95, 0x16,
+    0x3f, 0xf1, 0xca, 0xa1, 0x68, 0x1f, 0xac, 0x09, 0x12, 0x0e, 0xca, 0x30, 0x75, 0x86, 0xe1, 0xa7
+};
+
+static const unsigned char sp800_ctr_nonce[16] =
+{
+    0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff
+};
+
+static const unsigned char sp800_ctr_ct[64] =
+{
+    0x87, 0x4d, 0x61, 0x91, 0xb6, 0x20, 0xe3, 0x26, 0x1b, 0xef, 0x68, 0x64, 0x99, 0x0d, 0xb6, 0xce,
+    0x98, 0x06, 0xf6, 0x6b, 0x79, 0x70, 0xfd, 0xff, 0x86, 0x17, 0x18, 0x7b, 0xb9, 0xff, 0xfd, 0xff,
+    0x5a, 0xe4, 0xdf, 0x3e, 0xdb, 0xd5, 0xd3, 0x5e, 0x5b, 0x4f, 0x09, 0x02, 0x0d, 0xb0, 0x3e, 0xab,
+    0x1e, 0x03, 0x1d, 0xda, 0x2f, 0xbe, 0x03, 0xd1, 0x79, 0x21, 0x70, 0xa0, 0xf3, 0x00, 0x9c, 0xee
+};
+
+static const unsigned char rfc4493_mac[16] =
+{
+    0x51, 0xf0, 0xbe, 0xbf, 0x7e, 0x3b, 0x9d, 0x92, 0xfc, 0x49, 0x74, 0x17, 0x79, 0x36, 0x3c, 0xfe
+};
+
+static const char* sha1_msg[2] =
+{
+    "abc",
+    "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"
+};
+
+static const unsigned char sha1_hash[3][20] =
+{
+    { 0xa9, 0x99, 0x3e, 0x36, 0x47, 0x06, 0x81, 0x6a, 0xba, 0x3e, 0x25, 0x71, 0x78, 0x50, 0xc2, 0x6c, 0x9c, 0xd0, 0xd8, 0x9d },
+    { 0x84, 0x98, 0x3e, 0x44, 0x1c, 0x3b, 0xd2, 0x6e, 0xba, 0xae, 0x4a, 0xa1, 0xf9, 0x51, 0x29, 0xe5, 0xe5, 0x46, 0x70, 0xf1 },
+    { 0x34, 0xaa, 0x97, 0x3c, 0xd4, 0xc4, 0xda, 0xa4, 0xf6, 0x1e, 0xeb, 0x2b, 0xdb, 0xad, 0x27, 0x31, 0x65, 0x34, 0x01, 0x6f } /* one million 'a' */
+};
+
+static int aesni_check( const char *name, const char *impl, const unsigned char *result, const unsigned char *expected, size_t size )
+{
+    if( memcmp( result, expected, size ) == 0 )
+        return( 0 );
+
+    LOG_ERROR( GENERAL, "Crypto self test: %s (%s) failed", name, impl );
+    return( 1 );
+}
+
+static int aesni_run_tests( const char *impl )
+{
+    aes_context ctx;
+    sha1_context sha;
+    unsigned char buf[64], iv[16], stream[16];
+    size_t nc_off;
+    int i, failed = 0;
+
+    for( i = 0; i < 3; i++ )
+    {
+        aes_setkey_enc( &ctx, fips197_key, 128 + i * 64 );
+        aes_crypt_ecb( &ctx, AES_ENCRYPT, fips197_pt, buf );
+        failed |= aesni_check( "AES-ECB encryption", impl, buf, fips197_ct[i], 16 );
+
+        aes_setkey_dec( &ctx, fips197_key, 128 + i * 64 );
+        aes_crypt_ecb( &ctx, AES_DECRYPT, fips197_ct[i], buf );
+        failed |= aesni_check( "AES-ECB decryption", impl, buf, fips197_pt, 16 );
+    }
+
+    aes_setkey_enc( &ctx, sp800_key, 128 );
+    memcpy( iv, sp800_cbc_iv, 16 );
+    aes_crypt_cbc( &ctx, AES_ENCRYPT, 64, iv, sp800_pt, buf );
+    failed |= aesni_check( "AES-CBC encryption", impl, buf, sp800_cbc_ct, 64 );
+
+    aes_setkey_dec( &ctx, sp800_key, 128 );
+    memcpy( iv, sp800_cbc_iv, 16 );
+    aes_crypt_cbc( &ctx, AES_DECRYPT, 64, iv, sp800_cbc_ct, buf );
+    failed |= aesni_check( "AES-CBC decryption", impl, buf, sp800_pt, 64 );
+
+    /* an odd length and a continued stream check the partial block handling */
+    aes_setkey_enc( &ctx, sp800_key, 128 );
+    memcpy( iv, sp800_ctr_nonce, 16 );
+    nc_off = 0;
+    aes_crypt_ctr( &ctx, 23, &nc_off, iv, stream, sp800_pt, buf );
+    aes_crypt_ctr( &ctx, 41, &nc_off, iv, stream, sp800_pt + 23, buf + 23 );
+    failed |= aesni_check( "AES-CTR", impl, buf, sp800_ctr_ct, 64 );
+
+    aes_setkey_enc( &ctx, sp800_key, 128 );
+    memcpy( buf, sp800_pt, 64 );
+    aes_cmac( &ctx, 64, buf, buf );
+    failed |= aesni_check( "AES-CMAC", impl, buf, rfc4493_mac, 16 );
+
+    for( i = 0; i < 2; i++ )
+    {
+        sha1( (const unsigned char *) sha1_msg[i], strlen( sha1_msg[i] ), buf );
+        failed |= aesni_check( "SHA-1", impl, buf, sha1_hash[i], 20 );
+    }
+
+    memset( buf, 'a', 64 );
+    sha1_starts( &sha );
+
+    for( i = 0; i < 1000000 / 64; i++ )
+        sha1_update( &sha, buf, 64 );
+
+    sha1_update( &sha, buf, 1000000 % 64 );
+    sha1_finish( &sha, buf );
+    failed |= aesni_check( "SHA-1 (one million 'a')", impl, buf, sha1_hash[2], 20 );
+
+    return( failed );
+}
+
+int aesni_self_test( void )
+{
+    int failed;
+
+    aesni_force_scalar( 1 );
+    failed = aesni_run_tests( "scalar" );
+    aesni_force_scalar( 0 );
+
+    if( aesni_supports( POLARSSL_AESNI_AES ) || shani_supports() )
+        failed |= aesni_run_tests( aesni_supports( POLARSSL_AESNI_AES ) ? ( shani_supports() ? "AES-NI, SHA" : "AES-NI" ) : "SHA" );
+
+    LOG_NOTICE( GENERAL, "Crypto self test %s (AES-NI: %s, SHA: %s)", failed ? "failed" : "passed",
+        aesni_supports( POLARSSL_AESNI_AES ) ? "yes" : "no", shani_supports() ? "yes" : "no" );
+
+    return( failed );
+}
@@ -3,6 +3,7 @@
 #include "unedat.h"
 #include "Utilities/Log.h"
 #include "Utilities/rFile.h"
+#include "Emu/FS/vfsLocalFile.h"
 
 void generate_key(int crypto_mode, int version, unsigned char *key_final, unsigned char *iv_final, unsigned char *key, unsigned char *iv)
 {
@@ -135,212 +136,208 @@ unsigned char* get_block_key(int block, NPD_HEADER *npd)
 	return dest_key;
 }
 
-// EDAT/SDAT decryption.
-int decrypt_data(rFile *in, rFile *out, EDAT_HEADER *edat, NPD_HEADER *npd, unsigned char* crypt_key, bool verbose)
+// EDAT/SDAT block decryption (and decompression), out must hold edat->block_size bytes.
+// Returns the size of the decrypted data or -1 on error.
+int decrypt_block(vfsStream *in, unsigned char *out, EDAT_HEADER *edat, NPD_HEADER *npd, unsigned char* crypt_key, u32 block_num, bool verbose)
 {
-	// Get metadata info and setup buffers.
-	int block_num = (int)((edat->file_size + edat->block_size - 1) / edat->block_size);
-	int metadata_section_size = ((edat->flags & EDAT_COMPRESSED_FLAG) != 0 || (edat->flags & EDAT_FLAG_0x20) != 0) ? 0x20 : 0x10;
-	int metadata_offset = 0x100;
-
-	unsigned char *enc_data;
-	unsigned char *dec_data;
-	unsigned char *b_key;
-	unsigned char *iv;
-
-	unsigned char hash[0x10];
-	unsigned char key_result[0x10];
-	unsigned char hash_result[0x14];
-	memset(hash, 0, 0x10);
-	memset(key_result, 0, 0x10);
-	memset(hash_result, 0, 0x14);
+	// Get metadata info.
+	const int total_blocks = (int)((edat->file_size + edat->block_size - 1) / edat->block_size);
+	const int metadata_section_size = ((edat->flags & EDAT_COMPRESSED_FLAG) != 0 || (edat->flags & EDAT_FLAG_0x20) != 0) ? 0x20 : 0x10;
+	const int metadata_offset = 0x100;
+	const int i = (int)block_num;
+
+	unsigned char hash[0x10] = {};
+	unsigned char key_result[0x10] = {};
+	unsigned char hash_result[0x14] = {};
+	unsigned char empty_iv[0x10] = {};
 
 	unsigned long long offset = 0;
 	unsigned long long metadata_sec_offset = 0;
 	int length = 0;
 	int compression_end = 0;
-	unsigned char empty_iv[0x10] = {};
 
-	// Decrypt the metadata.
-	int i;
-	for (i = 0; i < block_num; i++)
+	if ((edat->flags & EDAT_COMPRESSED_FLAG) != 0)
 	{
-		memset(hash_result, 0, 0x14);
+		metadata_sec_offset = metadata_offset + (unsigned long long) i * metadata_section_size;
+		in->Seek(metadata_sec_offset);
 
-		if ((edat->flags & EDAT_COMPRESSED_FLAG) != 0)
-		{
-			metadata_sec_offset = metadata_offset + (unsigned long long) i * metadata_section_size;
-			in->Seek(metadata_sec_offset);
-
-			unsigned char metadata[0x20];
-			memset(metadata, 0, 0x20);
-			in->Read(metadata, 0x20);
+		unsigned char metadata[0x20] = {};
+		in->Read(metadata, 0x20);
 
-			// If the data is compressed, decrypt the metadata.
-			// NOTE: For NPD version 1 the metadata is not encrypted.
-			if (npd->version <= 1)
-			{
-				offset = swap64(*(unsigned long long*)&metadata[0x10]);
-				length = swap32(*(int*)&metadata[0x18]);
-				compression_end = swap32(*(int*)&metadata[0x1C]);
-			}
-			else
-			{
-				unsigned char *result = dec_section(metadata);
-				offset = swap64(*(unsigned long long*)&result[0]);
-				length = swap32(*(int*)&result[8]);
-				compression_end = swap32(*(int*)&result[12]);
-				delete[] result;
-			}
-			
-			memcpy(hash_result, metadata, 0x10);
+		// If the data is compressed, decrypt the metadata.
+		// NOTE: For NPD version 1 the metadata is not encrypted.
+		if (npd->version <= 1)
+		{
+			offset = swap64(*(unsigned long long*)&metadata[0x10]);
+			length = swap32(*(int*)&metadata[0x18]);
+			compression_end = swap32(*(int*)&metadata[0x1C]);
 		}
-		else if ((edat->flags & EDAT_FLAG_0x20) != 0)
+		else
 		{
-			// If FLAG 0x20, the metadata precedes each data block.
-			metadata_sec_offset = metadata_offset + (unsigned long long) i * (metadata_section_size + length);
-			in->Seek(metadata_sec_offset);
+			unsigned char *result = dec_section(metadata);
+			offset = swap64(*(unsigned long long*)&result[0]);
+			length = swap32(*(int*)&result[8]);
+			compression_end = swap32(*(int*)&result[12]);
+			delete[] result;
+		}
 
-			unsigned char metadata[0x20];
-			memset(metadata, 0, 0x20);
-			in->Read(metadata, 0x20);
-			memcpy(hash_result, metadata, 0x14);
+		memcpy(hash_result, metadata, 0x10);
+	}
+	else if ((edat->flags & EDAT_FLAG_0x20) != 0)
+	{
+		// If FLAG 0x20, the metadata precedes each data block.
+		metadata_sec_offset = metadata_offset + (unsigned long long) i * (metadata_section_size + edat->block_size);
+		in->Seek(metadata_sec_offset);
 
-			// If FLAG 0x20 is set, apply custom xor.
-			int j;
-			for (j = 0; j < 0x10; j++)
-				hash_result[j] = (unsigned char)(metadata[j] ^ metadata[j + 0x10]);
+		unsigned char metadata[0x20] = {};
+		in->Read(metadata, 0x20);
+		memcpy(hash_result, metadata, 0x14);
 
-			offset = metadata_sec_offset + 0x20;
-			length = edat->block_size;
+		// If FLAG 0x20 is set, apply custom xor.
+		int j;
+		for (j = 0; j < 0x10; j++)
+			hash_result[j] = (unsigned char)(metadata[j] ^ metadata[j + 0x10]);
 
-			if ((i == (block_num - 1)) && (edat->file_size % edat->block_size))
-				length = (int)(edat->file_size % edat->block_size);
-		}
-		else
-		{
-			metadata_sec_offset = metadata_offset + (unsigned long long) i * metadata_section_size;
-			in->Seek(metadata_sec_offset);
+		offset = metadata_sec_offset + 0x20;
+		length = edat->block_size;
 
-			in->Read(hash_result, 0x10);
-			offset = metadata_offset + (unsigned long long) i * edat->block_size + (unsigned long long) block_num * metadata_section_size;
-			length = edat->block_size;
+		if ((i == (total_blocks - 1)) && (edat->file_size % edat->block_size))
+			length = (int)(edat->file_size % edat->block_size);
+	}
+	else
+	{
+		metadata_sec_offset = metadata_offset + (unsigned long long) i * metadata_section_size;
+		in->Seek(metadata_sec_offset);
 
-			if ((i == (block_num - 1)) && (edat->file_size % edat->block_size))
-				length = (int)(edat->file_size % edat->block_size);
-		}
+		in->Read(hash_result, 0x10);
+		offset = metadata_offset + (unsigned long long) i * edat->block_size + (unsigned long long) total_blocks * metadata_section_size;
+		length = edat->block_size;
+
+		if ((i == (total_blocks - 1)) && (edat->file_size % edat->block_size))
+			length = (int)(edat->file_size % edat->block_size);
+	}
 
-		// Locate the real data.
-		int pad_length = length;
-		length = (int)((pad_length + 0xF) & 0xFFFFFFF0);
+	// Locate the real data.
+	const int pad_length = length;
+	length = (int)((pad_length + 0xF) & 0xFFFFFFF0);
 
-		// Setup buffers for decryption and read the data.
-		enc_data = new unsigned char[length];
-		dec_data = new unsigned char[length];
-		memset(enc_data, 0, length);
-		memset(dec_data, 0, length);
-		memset(hash, 0, 0x10);
-		memset(key_result, 0, 0x10);
+	if (length <= 0 || (pad_length > edat->block_size && ((edat->flags & EDAT_COMPRESSED_FLAG) == 0 || !compression_end)))
+	{
+		LOG_ERROR(LOADER, "EDAT: Block %d has invalid size (0x%x)!", i, pad_length);
+		return -1;
+	}
 
-		in->Seek(offset);
-		in->Read(enc_data, length);
+	// Setup buffers for decryption and read the data.
+	std::vector<unsigned char> enc_data(length);
+	std::vector<unsigned char> dec_data(length);
 
-		// Generate a key for the current block.
-		b_key = get_block_key(i, npd);
+	in->Seek(offset);
+	in->Read(enc_data.data(), length);
 
-		// Encrypt the block key with the crypto key.
-		aesecb128_encrypt(crypt_key, b_key, key_result);
-		if ((edat->flags & EDAT_FLAG_0x10) != 0)
-			aesecb128_encrypt(crypt_key, key_result, hash);  // If FLAG 0x10 is set, encrypt again to get the final hash.
-		else
-			memcpy(hash, key_result, 0x10);
+	// Generate a key for the current block.
+	unsigned char *b_key = get_block_key(i, npd);
 
-		// Setup the crypto and hashing mode based on the extra flags.
-		int crypto_mode = ((edat->flags & EDAT_FLAG_0x02) == 0) ? 0x2 : 0x1;
-		int hash_mode;
+	// Encrypt the block key with the crypto key.
+	aesecb128_encrypt(crypt_key, b_key, key_result);
+	if ((edat->flags & EDAT_FLAG_0x10) != 0)
+		aesecb128_encrypt(crypt_key, key_result, hash);  // If FLAG 0x10 is set, encrypt again to get the final hash.
+	else
+		memcpy(hash, key_result, 0x10);
 
-		if ((edat->flags  & EDAT_FLAG_0x10) == 0)
-			hash_mode = 0x02;
-		else if ((edat->flags & EDAT_FLAG_0x20) == 0)
-			hash_mode = 0x04;
-		else
-			hash_mode = 0x01;
+	delete[] b_key;
 
-		if ((edat->flags  & EDAT_ENCRYPTED_KEY_FLAG) != 0)
+	// Setup the crypto and hashing mode based on the extra flags.
+	int crypto_mode = ((edat->flags & EDAT_FLAG_0x02) == 0) ? 0x2 : 0x1;
+	int hash_mode;
+
+	if ((edat->flags  & EDAT_FLAG_0x10) == 0)
+		hash_mode = 0x02;
+	else if ((edat->flags & EDAT_FLAG_0x20) == 0)
+		hash_mode = 0x04;
+	else
+		hash_mode = 0x01;
+
+	if ((edat->flags  & EDAT_ENCRYPTED_KEY_FLAG) != 0)
+	{
+		crypto_mode |= 0x10000000;
+		hash_mode |= 0x10000000;
+	}
+
+	if ((edat->flags  & EDAT_DEBUG_DATA_FLAG) != 0)
+	{
+		// Reset the flags.
+		crypto_mode |= 0x01000000;
+		hash_mode |= 0x01000000;
+		// Simply copy the data without the header or the footer.
+		memcpy(dec_data.data(), enc_data.data(), length);
+	}
+	else
+	{
+		// IV is null if NPD version is 1 or 0.
+		unsigned char *iv = (npd->version <= 1) ? empty_iv : npd->digest;
+		// Call main crypto routine on this data block.
+		if (!decrypt(hash_mode, crypto_mode, (npd->version == 4), enc_data.data(), dec_data.data(), length, key_result, iv, hash, hash_result))
 		{
-			crypto_mode |= 0x10000000;
-			hash_mode |= 0x10000000;
+			if (verbose)
+				LOG_WARNING(LOADER, "EDAT: Block at offset 0x%llx has invalid hash!", (u64)offset);
+
+			return -1;
 		}
+	}
+
+	// Apply additional compression if needed.
+	if (((edat->flags & EDAT_COMPRESSED_FLAG) != 0) && compression_end)
+	{
+		const int decomp_size = (int)std::min<u64>(edat->block_size, edat->file_size - (u64)i * edat->block_size);
 
-		if ((edat->flags  & EDAT_DEBUG_DATA_FLAG) != 0)
+		if (verbose)
+			LOG_NOTICE(LOADER, "EDAT: Decompressing data...");
+
+		const int res = decompress(out, dec_data.data(), decomp_size);
+
+		if (verbose)
 		{
-			// Reset the flags.
-			crypto_mode |= 0x01000000;
-			hash_mode |= 0x01000000;
-			// Simply copy the data without the header or the footer.
-			memcpy(dec_data, enc_data, length);
-		}
-		else
-		{
-			// IV is null if NPD version is 1 or 0.
-			iv = (npd->version <= 1) ? empty_iv : npd->digest;
-			// Call main crypto routine on this data block.
-			if (!decrypt(hash_mode, crypto_mode, (npd->version == 4), enc_data, dec_data, length, key_result, iv, hash, hash_result))
-			{
-				if (verbose)
-					LOG_WARNING(LOADER, "EDAT: Block at offset 0x%llx has invalid hash!", (u64)offset);
-					
-				return 1;
-			}
+			LOG_NOTICE(LOADER, "EDAT: Compressed block size: %d", pad_length);
+			LOG_NOTICE(LOADER, "EDAT: Decompressed block size: %d", res);
 		}
 
-		// Apply additional compression if needed and write the decrypted data.
-		if (((edat->flags & EDAT_COMPRESSED_FLAG) != 0) && compression_end)
+		if (res < 0)
 		{
-			int decomp_size = (int)edat->file_size;
-			unsigned char *decomp_data = new unsigned char[decomp_size];
-			memset(decomp_data, 0, decomp_size);
+			LOG_ERROR(LOADER, "EDAT: Decompression failed!");
+			return -1;
+		}
 
-			if (verbose)
-				LOG_NOTICE(LOADER, "EDAT: Decompressing data...");
+		return res;
+	}
 
-			int res = decompress(decomp_data, dec_data, decomp_size);
-			out->Write(decomp_data, res);
+	memcpy(out, dec_data.data(), pad_length);
 
-			if (verbose)
-			{
-				LOG_NOTICE(LOADER, "EDAT: Compressed block size: %d", pad_length);
-				LOG_NOTICE(LOADER, "EDAT: Decompressed block size: %d", res);
-			}
+	return pad_length;
+}
 
-			edat->file_size -= res;
+// EDAT/SDAT decryption.
+int decrypt_data(vfsStream *in, rFile *out, EDAT_HEADER *edat, NPD_HEADER *npd, unsigned char* crypt_key, bool verbose)
+{
+	const int block_num = (int)((edat->file_size + edat->block_size - 1) / edat->block_size);
+	std::vector<unsigned char> data(edat->block_size);
 
-			if (edat->file_size == 0)
-			{
-				if (res < 0)
-				{
-					LOG_ERROR(LOADER, "EDAT: Decompression failed!");
-					return 1;
-				}
-				else
-					LOG_NOTICE(LOADER, "EDAT: Successfully decompressed!");
-			}
+	for (int i = 0; i < block_num; i++)
+	{
+		const int size = decrypt_block(in, data.data(), edat, npd, crypt_key, i, verbose);
 
-			delete[] decomp_data;
-		}
-		else
+		if (size < 0)
 		{
-			out->Write(dec_data, pad_length);
+			return 1;
 		}
 
-		delete[] enc_data;
-		delete[] dec_data;
+		out->Write(data.data(), size);
 	}
 
 	return 0;
 }
 
-int check_data(unsigned char *key, EDAT_HEADER *edat, NPD_HEADER *npd, rFile *f, bool verbose)
+// Check the version, flags and header hash (validates the key).
+int check_header(unsigned char *key, EDAT_HEADER *edat, NPD_HEADER *npd, vfsStream *f, bool verbose)
 {
 	f->Seek(0);
 	unsigned char header[0xA0];
@@ -422,6 +419,31 @@ int check_data(unsigned char *key, EDAT_HEADER *edat, NPD_HEADER *npd, rFile *f,
 		}
 	}
 
+	return 0;
+}
+
+int check_data(unsigned char *key, EDAT_HEADER *edat, NPD_HEADER *npd, vfsStream *f, bool verbose)
+{
+	if (check_header(key, edat, npd, f, verbose))
+	{
+		return 1;
+	}
+
+	// Setup the hashing mode and the crypto mode used in the file.
+	int crypto_mode = 0x1;
+	int hash_mode = ((edat->flags & EDAT_ENCRYPTED_KEY_FLAG) == 0) ? 0x00000002 : 0x10000002;
+	if ((edat->flags & EDAT_DEBUG_DATA_FLAG) != 0)
+	{
+		hash_mode |= 0x01000000;
+	}
+
+	unsigned char header_key[0x10] = {};
+	unsigned char header_iv[0x10] = {};
+	unsigned char metadata_hash[0x10] = {};
+
+	f->Seek(0x90);
+	f->Read(metadata_hash, 0x10);
+
 	// Parse the metadata info.
 	int metadata_section_size = ((edat->flags & EDAT_COMPRESSED_FLAG) != 0 || (edat->flags & EDAT_FLAG_0x20) != 0) ? 0x20 : 0x10;
 	if (((edat->flags & EDAT_COMPRESSED_FLAG) != 0))
@@ -639,15 +661,13 @@ int validate_npd_hashes(const char* file_name, unsigned char *klicensee, NPD_HEA
 	return (title_hash_result && dev_hash_result);
 }
 
-bool extract_data(rFile *input, rFile *output, const char* input_file_name, unsigned char* devklic, unsigned char* rifkey, bool verbose)
+// Read the NPD and EDAT/SDAT headers and select the decryption key.
+int read_header(vfsStream *input, const char* input_file_name, unsigned char* devklic, unsigned char* rifkey, NPD_HEADER *NPD, EDAT_HEADER *EDAT, unsigned char* key, bool verbose)
 {
-	// Setup NPD and EDAT/SDAT structs.
-	NPD_HEADER *NPD = new NPD_HEADER();
-	EDAT_HEADER *EDAT = new EDAT_HEADER();
-
 	// Read in the NPD and EDAT/SDAT headers.
 	char npd_header[0x80];
 	char edat_header[0x10];
+	input->Seek(0);
 	input->Read(npd_header, sizeof(npd_header));
 	input->Read(edat_header, sizeof(edat_header));
 
@@ -666,8 +686,6 @@ bool extract_data(rFile *input, rFile *output, const char* input_file_name, unsi
 	if (memcmp(NPD->magic, npd_magic, 4))
 	{
 		LOG_ERROR(LOADER, "EDAT: %s has invalid NPD header or already decrypted.", input_file_name);
-		delete NPD;
-		delete EDAT;
 		return 1;
 	}
 
@@ -675,6 +693,12 @@ bool extract_data(rFile *input, rFile *output, const char* input_file_name, unsi
 	EDAT->block_size = swap32(*(int*)&edat_header[4]);
 	EDAT->file_size = swap64(*(u64*)&edat_header[8]);
 
+	if (EDAT->block_size <= 0)
+	{
+		LOG_ERROR(LOADER, "EDAT: %s has invalid block size (0x%x).", input_file_name, EDAT->block_size);
+		return 1;
+	}
+
 	if (verbose)
 	{
 		LOG_NOTICE(LOADER, "NPD HEADER");
@@ -684,7 +708,6 @@ bool extract_data(rFile *input, rFile *output, const char* input_file_name, unsi
 	}
 
 	// Set decryption key.
-	unsigned char key[0x10];
 	memset(key, 0, 0x10);
 
 	// Check EDAT/SDAT flag.
@@ -720,8 +743,6 @@ bool extract_data(rFile *input, rFile *output, const char* input_file_name, unsi
 			if ((EDAT->flags & EDAT_DEBUG_DATA_FLAG) != EDAT_DEBUG_DATA_FLAG)
 			{
 				LOG_ERROR(LOADER, "EDAT: NPD hash validation failed!");
-				delete NPD;
-				delete EDAT;
 				return 1;
 			}
 		}
@@ -747,16 +768,12 @@ bool extract_data(rFile *input, rFile *output, const char* input_file_name, unsi
 			if (!test)
 			{
 				LOG_ERROR(LOADER, "EDAT: A valid RAP file is needed for this EDAT file!");
-				delete NPD;
-				delete EDAT;
 				return 1;
 			}
 		}
 		else if ((NPD->license & 0x1) == 0x1)      // Type 1: Use network activation.
 		{
 			LOG_ERROR(LOADER, "EDAT: Network license not supported!");
-			delete NPD;
-			delete EDAT;
 			return 1;
 		}
 
@@ -781,38 +798,46 @@ bool extract_data(rFile *input, rFile *output, const char* input_file_name, unsi
 			LOG_NOTICE(LOADER, "%02X", key[i]);
 	}
 
+	return 0;
+}
+
+bool extract_data(vfsStream *input, rFile *output, const char* input_file_name, unsigned char* devklic, unsigned char* rifkey, bool verbose)
+{
+	NPD_HEADER NPD;
+	EDAT_HEADER EDAT;
+	unsigned char key[0x10];
+
+	if (read_header(input, input_file_name, devklic, rifkey, &NPD, &EDAT, key, verbose))
+	{
+		return 1;
+	}
+
 	LOG_NOTICE(LOADER, "EDAT: Parsing data...");
-	if (check_data(key, EDAT, NPD, input, verbose))
+	if (check_data(key, &EDAT, &NPD, input, verbose))
 	{
 		LOG_ERROR(LOADER, "EDAT: Data parsing failed!");
-		delete NPD;
-		delete EDAT;
 		return 1;
 	}
 	else
 		LOG_NOTICE(LOADER, "EDAT: Data successfully parsed!");
 
 	LOG_NOTICE(LOADER, "EDAT: Decrypting data...");
-	if (decrypt_data(input, output, EDAT, NPD, key, verbose))
+	if (decrypt_data(input, output, &EDAT, &NPD, key, verbose))
 	{
 		LOG_ERROR(LOADER, "EDAT: Data decryption failed!");
-		delete NPD;
-		delete EDAT;
 		return 1;
 	}
 	else
 		LOG_NOTICE(LOADER, "EDAT: Data successfully decrypted!");
 
-	delete NPD;
-	delete EDAT;
-
 	return 0;
 }
 
 int DecryptEDAT(const std::string& input_file_name, const std::string& output_file_name, int mode, const std::string& rap_file_name, unsigned char *custom_klic, bool verbose)
 {
 	// Prepare the files.
-	rFile input(input_file_name.c_str());
+	vfsLocalFile input(nullptr);
+	input.Open(input_file_name, vfsRead);
 	rFile output(output_file_name.c_str(), rFile::write);
 	rFile rap(rap_file_name.c_str());
 
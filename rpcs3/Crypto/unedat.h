@@ -33,4 +33,15 @@ typedef struct
 	unsigned long long file_size;
 } EDAT_HEADER;
 
+struct vfsStream;
+
+// Read the NPD and EDAT/SDAT headers and select the decryption key (devklic and rifkey are used for EDAT files only).
+int read_header(vfsStream *input, const char* input_file_name, unsigned char* devklic, unsigned char* rifkey, NPD_HEADER *NPD, EDAT_HEADER *EDAT, unsigned char* key, bool verbose);
+
+// Check the version, flags and header hash (doesn't read the metadata section).
+int check_header(unsigned char *key, EDAT_HEADER *edat, NPD_HEADER *npd, vfsStream *f, bool verbose);
+
+// Decrypt (and decompress) the block, out must hold edat->block_size bytes. Returns the size of the data or -1 on error.
+int decrypt_block(vfsStream *in, unsigned char *out, EDAT_HEADER *edat, NPD_HEADER *npd, unsigned char* crypt_key, u32 block_num, bool verbose);
+
 int DecryptEDAT(const std::string& input_file_name, const std::string& output_file_name, int mode, const std::string& rap_file_name, unsigned char *custom_klic, bool verbose);
\ No newline at end of file
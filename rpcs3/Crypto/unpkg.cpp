@@ -4,13 +4,10 @@
 #include "sha1.h"
 #include "key_vault.h"
 #include "unpkg.h"
-#include "restore_new.h"
-#pragma warning(disable : 4996)
-#include <wx/progdlg.h>
-#include "define_new_memleakdetect.h"
 
 #include "Utilities/Log.h"
 #include "Utilities/rFile.h"
+#include "Utilities/Thread.h"
 
 // Decryption.
 bool CheckHeader(rFile& pkg_f, PKGHeader* m_header)
@@ -71,83 +68,199 @@ bool LoadHeader(rFile& pkg_f, PKGHeader* m_header)
 	return true;
 }
 
-int Decrypt(rFile& pkg_f, rFile& dec_pkg_f, PKGHeader* m_header)
+// Decryption.
+// Both encryption schemes are seekable (the keystream of every 16-byte block depends only on its index),
+// so any part of the package data can be decrypted independently.
+void DecryptData(const PKGHeader& header, u64 offset, u8* data, u32 size)
 {
-	if (!LoadHeader(pkg_f, m_header))
-		return -1;
+	const u64 block = offset / HASH_LEN;
+	const u32 skip = offset % HASH_LEN;
 
-	aes_context c;
-	u8 iv[HASH_LEN];
-	u8 buf[BUF_SIZE];
-	u8 ctr[BUF_SIZE];
-	
-	// Debug key
-	u8 key[0x40];
-	memset(key, 0, 0x40);
-	memcpy(key+0x00, &m_header->qa_digest[0], 8); // &data[0x60]
-	memcpy(key+0x08, &m_header->qa_digest[0], 8); // &data[0x60]
-	memcpy(key+0x10, &m_header->qa_digest[8], 8); // &data[0x68]
-	memcpy(key+0x18, &m_header->qa_digest[8], 8); // &data[0x68]
+	if (header.pkg_type == PKG_RELEASE_TYPE_DEBUG)
+	{
+		// Debug key
+		u8 key[0x40];
+		memset(key, 0, 0x40);
+		memcpy(key+0x00, &header.qa_digest[0], 8); // &data[0x60]
+		memcpy(key+0x08, &header.qa_digest[0], 8); // &data[0x60]
+		memcpy(key+0x10, &header.qa_digest[8], 8); // &data[0x68]
+		memcpy(key+0x18, &header.qa_digest[8], 8); // &data[0x68]
+		*(be_t<u64>*)&key[0x38] = block;
+
+		for (u32 pos = 0, j = skip; pos < size; j = 0)
+		{
+			u8 hash[0x14];
+			sha1(key, 0x40, hash);
 
-	pkg_f.Seek(m_header->data_offset);
-	u32 parts = (m_header->data_size + BUF_SIZE - 1) / BUF_SIZE;
+			for (; j < HASH_LEN && pos < size; j++)
+			{
+				data[pos++] ^= hash[j];
+			}
 
-	wxProgressDialog pdlg("PKG Decrypter / Installer", "Please wait, decrypting...", parts, 0, wxPD_AUTO_HIDE | wxPD_APP_MODAL);
+			*(be_t<u64>*)&key[0x38] += 1;
+		}
+	}
 
-	memcpy(iv, m_header->klicensee, sizeof(iv));
-	aes_setkey_enc(&c, PKG_AES_KEY, 128);
-	
-	for (u32 i=0; i<parts; i++)
+	if (header.pkg_type == PKG_RELEASE_TYPE_RELEASE)
 	{
-		memset(buf, 0, sizeof(buf));
-		u32 length = pkg_f.Read(buf, BUF_SIZE);
-		u32 bits = (length + HASH_LEN - 1) / HASH_LEN;
-		
-		if (m_header->pkg_type == PKG_RELEASE_TYPE_DEBUG)
+		aes_context c;
+		aes_setkey_enc(&c, PKG_AES_KEY, 128);
+
+		// the counter is klicensee + block index (128-bit big-endian)
+		u8 iv[HASH_LEN];
+		be_t<u64> hi = *(be_t<u64>*)&header.klicensee[0];
+		be_t<u64> lo = *(be_t<u64>*)&header.klicensee[8];
+		const u64 sum = lo + block;
+
+		if (sum < lo)
+			hi += 1;
+
+		lo = sum;
+		*(be_t<u64>*)&iv[0] = hi;
+		*(be_t<u64>*)&iv[8] = lo;
+
+		u8 stream[HASH_LEN];
+		size_t nc_off = 0;
+
+		if (skip)
 		{
-			for (u32 j=0; j<bits; j++)
-			{
-				u8 hash[0x14];
-				sha1(key, 0x40, hash);
-				*(u64*)&buf[j*HASH_LEN + 0] ^= *(u64*)&hash[0];
-				*(u64*)&buf[j*HASH_LEN + 8] ^= *(u64*)&hash[8];
-				*(be_t<u64>*)&key[0x38] += 1;
-			}
+			// start in the middle of the block
+			u8 dummy[HASH_LEN] = {};
+			aes_crypt_ctr(&c, skip, &nc_off, iv, stream, dummy, dummy);
 		}
 
-		if (m_header->pkg_type == PKG_RELEASE_TYPE_RELEASE)
+		aes_crypt_ctr(&c, size, &nc_off, iv, stream, data, data);
+	}
+}
+
+// read and decrypt the package data
+u32 ReadData(rFile& pkg_f, const PKGHeader& header, u64 offset, void* data, u32 size)
+{
+	pkg_f.Seek(header.data_offset + offset);
+	const u32 length = (u32)pkg_f.Read(data, size);
+	DecryptData(header, offset, (u8*)data, length);
+	return length;
+}
+
+// Decrypts the file contents on all cores. Chunks are read and written by the calling thread in package order.
+class PKGUnpacker
+{
+	struct Chunk
+	{
+		std::vector<u8> data;
+		u64 offset; // offset in the package data
+		u32 size;
+		std::shared_ptr<rFile> out; // extracted file (closed when its last chunk is written)
+		std::atomic<bool> done;
+	};
+
+	const PKGHeader& m_header;
+	rFile& m_pkg_f;
+	const PKGProgress& m_progress;
+	u64 m_processed;
+
+	std::vector<std::unique_ptr<Chunk>> m_chunks; // ring of chunks
+	u32 m_next; // the oldest chunk in the ring
+
+	thread_pool_t m_pool;
+
+	// write the chunk to its file when it's decrypted
+	void Finish(Chunk& chunk)
+	{
+		if (!chunk.out)
 		{
-			for (u32 j=0; j<bits; j++)
-			{
-				aes_crypt_ecb(&c, AES_ENCRYPT, iv, ctr+j*HASH_LEN);
+			return;
+		}
 
-				be_t<u64> hi = *(be_t<u64>*)&iv[0];
-				be_t<u64> lo = *(be_t<u64>*)&iv[8];
-				lo++;
+		m_pool.wait([&chunk]() { return chunk.done.load(); });
 
-				if (lo == 0)
-					hi += 1;
+		chunk.out->Write(chunk.data.data(), chunk.size);
+		chunk.out.reset();
 
-				*(be_t<u64>*)&iv[0] = hi;
-				*(be_t<u64>*)&iv[8] = lo;
-			}
-		
-			for (u32 j=0; j<length; j++) {
-				buf[j] ^= ctr[j];
+		m_processed += chunk.size;
+
+		if (m_progress)
+		{
+			m_progress(m_processed, m_header.data_size);
+		}
+	}
+
+public:
+	PKGUnpacker(rFile& pkg_f, const PKGHeader& header, const PKGProgress& progress)
+		: m_header(header)
+		, m_pkg_f(pkg_f)
+		, m_progress(progress)
+		, m_processed(0)
+		, m_next(0)
+		, m_pool("PKG Decrypter", std::thread::hardware_concurrency())
+	{
+		for (u32 i = 0; i < m_pool.size() * 2; i++)
+		{
+			m_chunks.emplace_back(new Chunk);
+			m_chunks.back()->data.resize(PKG_CHUNK_SIZE);
+		}
+	}
+
+	~PKGUnpacker()
+	{
+		Flush();
+	}
+
+	// read the file contents and queue them for decryption
+	// returns false if the package is too short (the queued part of the file is written, the caller should remove it)
+	bool Add(const std::shared_ptr<rFile>& out, u64 offset, u64 size)
+	{
+		for (u64 pos = 0; pos < size;)
+		{
+			Chunk& chunk = *m_chunks[m_next];
+			m_next = (m_next + 1) % m_chunks.size();
+
+			Finish(chunk);
+
+			chunk.offset = offset + pos;
+			chunk.size = (u32)std::min<u64>(size - pos, PKG_CHUNK_SIZE);
+			chunk.out = out;
+			chunk.done = false;
+
+			m_pkg_f.Seek(m_header.data_offset + chunk.offset);
+			if (m_pkg_f.Read(chunk.data.data(), chunk.size) != chunk.size)
+			{
+				LOG_ERROR(LOADER, "PKG: Package file is too short!");
+				chunk.out.reset();
+
+				// release the file held by the queued chunks
+				Flush();
+				return false;
 			}
-		}		
-		dec_pkg_f.Write(buf, length);
-		pdlg.Update(i);
+
+			pos += chunk.size;
+
+			Chunk* job = &chunk;
+
+			m_pool.push([this, job](u32 worker)
+			{
+				DecryptData(m_header, job->offset, job->data.data(), job->size);
+				job->done = true;
+			});
+		}
+
+		return true;
 	}
-	pdlg.Update(parts);
-	return 0;
-}
+
+	// write all queued chunks
+	void Flush()
+	{
+		for (u32 i = 0; i < m_chunks.size(); i++)
+		{
+			Finish(*m_chunks[(m_next + i) % m_chunks.size()]);
+		}
+	}
+};
 
 // Unpacking.
-bool LoadEntries(rFile& dec_pkg_f, PKGHeader* m_header, PKGEntry *m_entries)
+bool LoadEntries(rFile& pkg_f, PKGHeader* m_header, PKGEntry *m_entries)
 {
-	dec_pkg_f.Seek(0);
-	dec_pkg_f.Read(m_entries, sizeof(PKGEntry) * m_header->file_count);
+	ReadData(pkg_f, *m_header, 0, m_entries, sizeof(PKGEntry) * m_header->file_count);
 	
 	if (m_entries->name_offset / sizeof(PKGEntry) != m_header->file_count) {
 		LOG_ERROR(LOADER, "PKG: Entries are damaged!");
@@ -157,13 +270,14 @@ bool LoadEntries(rFile& dec_pkg_f, PKGHeader* m_header, PKGEntry *m_entries)
 	return true;
 }
 
-bool UnpackEntry(rFile& dec_pkg_f, const PKGEntry& entry, std::string dir)
+bool UnpackEntry(rFile& pkg_f, PKGHeader* m_header, PKGUnpacker& unpacker, const PKGEntry& entry, std::string dir)
 {
-	char buf[BUF_SIZE];
+	std::string name(entry.name_size, '\0');
 
-	dec_pkg_f.Seek(entry.name_offset);
-	dec_pkg_f.Read(buf, entry.name_size);
-	buf[entry.name_size] = 0;
+	if (ReadData(pkg_f, *m_header, entry.name_offset, &name[0], entry.name_size) != entry.name_size) {
+		LOG_ERROR(LOADER, "PKG Loader: Entry name is damaged");
+		return false;
+	}
 	
 	switch (entry.type.data() >> 24)
 	{
@@ -172,25 +286,23 @@ bool UnpackEntry(rFile& dec_pkg_f, const PKGEntry& entry, std::string dir)
 	case PKG_FILE_ENTRY_SDAT:
 	case PKG_FILE_ENTRY_REGULAR:
 	{
-		rFile out;
-		auto path = dir + std::string(buf, entry.name_size);
+		std::shared_ptr<rFile> out(new rFile);
+		auto path = dir + name;
 		if (rExists(path))
 		{
 			LOG_WARNING(LOADER, "PKG Loader: File is overwritten: %s", path.c_str());
 		}
 
-		if (out.Create(path, true /* overwriting */))
+		if (out->Create(path, true /* overwriting */))
 		{
-			dec_pkg_f.Seek(entry.file_offset);
-
-			for (u64 size = 0; size < entry.file_size;) {
-				size += dec_pkg_f.Read(buf, BUF_SIZE);
-				if (size > entry.file_size)
-					out.Write(buf, BUF_SIZE - (size - entry.file_size));
-				else
-					out.Write(buf, BUF_SIZE);
+			if (!unpacker.Add(out, entry.file_offset, entry.file_size))
+			{
+				out.reset();
+				rRemoveFile(path);
+				LOG_ERROR(LOADER, "PKG Loader: Could not extract file: %s", path.c_str());
+				return false;
 			}
-			out.Close();
+
 			return true;
 		}
 		else
@@ -202,7 +314,7 @@ bool UnpackEntry(rFile& dec_pkg_f, const PKGEntry& entry, std::string dir)
 
 	case PKG_FILE_ENTRY_FOLDER:
 	{
-		auto path = dir + std::string(buf, entry.name_size);
+		auto path = dir + name;
 		if (!rExists(path) && !rMkdir(path))
 		{
 			LOG_ERROR(LOADER, "PKG Loader: Could not create directory: %s", path.c_str());
@@ -220,41 +332,36 @@ bool UnpackEntry(rFile& dec_pkg_f, const PKGEntry& entry, std::string dir)
 	}
 }
 
-int Unpack(rFile& pkg_f, std::string src, std::string dst)
+int Unpack(rFile& pkg_f, std::string src, std::string dst, const PKGProgress& progress)
 {
-	PKGHeader* m_header = (PKGHeader*) malloc (sizeof(PKGHeader));
-
-	rFile dec_pkg_f;
-	// TODO: This shouldn't use current dir
-	std::string decryptedFile = "./dev_hdd1/" + src + ".dec";
+	PKGHeader m_header;
 
-	dec_pkg_f.Create(decryptedFile, true);
-	
-	if (Decrypt(pkg_f, dec_pkg_f, m_header) < 0)
+	if (!LoadHeader(pkg_f, &m_header))
 		return -1;
-	
-	dec_pkg_f.Close();
-
-	rFile n_dec_pkg_f(decryptedFile, rFile::read);
 
 	std::vector<PKGEntry> m_entries;
-	m_entries.resize(m_header->file_count);
+	m_entries.resize(m_header.file_count);
 
 	PKGEntry *m_entries_ptr = &m_entries[0];
-	if (!LoadEntries(n_dec_pkg_f, m_header, m_entries_ptr))
+	if (!LoadEntries(pkg_f, &m_header, m_entries_ptr))
 		return -1;
 
-	wxProgressDialog pdlg("PKG Decrypter / Installer", "Please wait, unpacking...", m_entries.size(), 0, wxPD_AUTO_HIDE | wxPD_APP_MODAL);
+	PKGUnpacker unpacker(pkg_f, m_header, progress);
 
 	for (const PKGEntry& entry : m_entries)
 	{
-		UnpackEntry(n_dec_pkg_f, entry, dst + src + "/");
-		pdlg.Update(pdlg.GetValue() + 1);
+		if (!UnpackEntry(pkg_f, &m_header, unpacker, entry, dst + src + "/"))
+		{
+			return -1;
+		}
 	}
-	pdlg.Update(m_entries.size());
 
-	n_dec_pkg_f.Close();
-	wxRemoveFile(decryptedFile);
+	unpacker.Flush();
+
+	if (progress)
+	{
+		progress(m_header.data_size, m_header.data_size);
+	}
 
 	return 0;
 }
@@ -16,6 +16,7 @@
 
 #define HASH_LEN 16
 #define BUF_SIZE 4096
+#define PKG_CHUNK_SIZE 0x100000 // size of the part of a file decrypted by one thread
 
 // Structs
 struct PKGHeader
@@ -47,4 +48,10 @@ struct PKGEntry
 
 class rFile;
 
-extern int Unpack(rFile& dec_pkg_f, std::string src, std::string dst);
\ No newline at end of file
+// called with the count of bytes of the package data extracted so far and the total count
+typedef std::function<void(u64 done, u64 total)> PKGProgress;
+
+// decrypt size bytes of the package data (which starts at data_offset) located at specified offset
+void DecryptData(const PKGHeader& header, u64 offset, u8* data, u32 size);
+
+extern int Unpack(rFile& pkg_f, std::string src, std::string dst, const PKGProgress& progress = nullptr);
\ No newline at end of file
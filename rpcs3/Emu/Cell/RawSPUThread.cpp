@@ -42,6 +42,7 @@ bool RawSPUThread::Read32(const u64 addr, u32* value)
 	{
 		// if Out_MBox is empty, the result is undefined
 		SPU.Out_MBox.PopUncond(*value);
+		Notify();
 		break;
 	}
 
@@ -132,6 +133,7 @@ bool RawSPUThread::Write32(const u64 addr, const u32 value)
 	{
 		// if In_MBox is already full, the last message is overwritten  
 		SPU.In_MBox.PushUncond(value); 
+		Notify();
 		break;
 	}
 
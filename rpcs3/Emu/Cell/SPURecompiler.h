@@ -3,6 +3,7 @@
 #define ASMJIT_STATIC
 
 #include "asmjit.h"
+#include "SPURecompilerCache.h"
 
 using namespace asmjit;
 using namespace asmjit::host;
@@ -16,11 +17,29 @@ class SPURecompilerCore : public CPUDecoder
 	SPURecompiler* m_enc;
 	SPUThread& CPU;
 
+	std::vector<u16> m_area_blocks[0x100]; // positions of compiled blocks overlapping each LS area (1 KB)
+	u64 m_inv_stamp; // start of the current invalidation rate measurement
+	u32 m_inv_count; // invalidations since m_inv_stamp
+
+	bool m_background; // compile blocks in background and use the interpreter meanwhile
+	u32 m_fallback_pos; // next position if the interpreter is used for the current block
+	std::unordered_map<u16, std::shared_ptr<SPUCompileRequest>> m_requests; // background compilation requests
+
+	// register the block installed at specified position
+	void AddBlock(u16 pos);
+
+	// invalidate blocks overlapping LS areas marked as modified
+	void CheckModified(const u32* ls);
+
+	// request background compilation of the block at specified position (unless it's already in progress)
+	void RequestCompile(const u32* ls, u16 pos);
+
 public:
 	SPUInterpreter* inter;
-	JitRuntime runtime;
 	bool first;
 	bool need_check;
+	u32 chain_limit; // max count of compiled blocks executed by one DecodeMemory call
+	bool standalone; // executed outside of the thread loop (benchmark), the thread state isn't checked between blocks
 
 	struct SPURecEntry
 	{
@@ -28,6 +47,7 @@ public:
 		u16 count; // count of instructions compiled from current point (and to be checked)
 		u32 valid; // copy of valid opcode for validation
 		void* pointer; // pointer to executable memory object
+		std::shared_ptr<SPURecBlock> block; // compiled block (shared with other SPU threads)
 #ifdef _WIN32
 		//_IMAGE_RUNTIME_FUNCTION_ENTRY info;
 #endif
@@ -35,13 +55,20 @@ public:
 
 	SPURecEntry entry[0x10000];
 
-	std::vector<__m128i> imm_table;
+	std::vector<__m128i> imm_table; // constants of the block being compiled
 
 	SPURecompilerCore(SPUThread& cpu);
 
 	~SPURecompilerCore();
 
-	void Compile(u16 pos);
+	// compile the block starting at specified position (code points to the instruction at pos, size is the count of available instructions)
+	void Compile(const u32* code, u16 pos, u32 size);
+
+	// get the count of instructions from specified position to the end of the block (including the last instruction)
+	static u32 GetBlockSize(const u32* ls, u16 pos);
+
+	// release the block installed at specified position
+	void RemoveBlock(u16 pos);
 
 	virtual void Decode(const u32 code);
 
@@ -56,6 +83,7 @@ public:
 #define cpu_dword(x) dword_ptr(*cpu_var, (sizeof((*(SPUThread*)nullptr).x) == 4) ? (s32)offsetof(SPUThread, x) : throw "sizeof("#x") != 4")
 #define cpu_word(x) word_ptr(*cpu_var, (sizeof((*(SPUThread*)nullptr).x) == 2) ? (s32)offsetof(SPUThread, x) : throw "sizeof("#x") != 2")
 #define cpu_byte(x) byte_ptr(*cpu_var, (sizeof((*(SPUThread*)nullptr).x) == 1) ? (s32)offsetof(SPUThread, x) : throw "sizeof("#x") != 1")
+#define cpu_byte2(x, y) byte_ptr(*cpu_var, y, 0, (s32)offsetof(SPUThread, x))
 
 #define g_imm_xmm(x) oword_ptr(*g_imm_var, (s32)offsetof(g_imm_table_struct, x))
 #define g_imm2_xmm(x, y) oword_ptr(*g_imm_var, y, 0, (s32)offsetof(g_imm_table_struct, x))
@@ -65,6 +93,7 @@ public:
 #define cpu_dword(x) dword_ptr(*cpu_var, reinterpret_cast<uintptr_t>(&(((SPUThread*)0)->x)) )
 #define cpu_word(x) word_ptr(*cpu_var, reinterpret_cast<uintptr_t>(&(((SPUThread*)0)->x)) )
 #define cpu_byte(x) byte_ptr(*cpu_var, reinterpret_cast<uintptr_t>(&(((SPUThread*)0)->x)) )
+#define cpu_byte2(x, y) byte_ptr(*cpu_var, y, 0, reinterpret_cast<uintptr_t>(&(((SPUThread*)0)->x)))
 
 #define g_imm_xmm(x) oword_ptr(*g_imm_var, reinterpret_cast<uintptr_t>(&(((g_imm_table_struct*)0)->x)))
 #define g_imm2_xmm(x, y) oword_ptr(*g_imm_var, y, 0, reinterpret_cast<uintptr_t>(&(((g_imm_table_struct*)0)->x)))
@@ -1185,6 +1214,10 @@ private:
 		c.mov(qword_ptr(*ls_var, *addr, 0, 0), *qw1);
 		c.mov(qword_ptr(*ls_var, *addr, 0, 8), *qw0);
 
+		// mark LS area as modified
+		c.shr(*addr, 10);
+		c.mov(cpu_byte2(ls_dirty[0], *addr), 1);
+
 		LOG_OPCODE();
 	}
 	void BI(u32 intr, u32 ra)
@@ -2769,6 +2802,7 @@ private:
 		c.bswap(*qw1);
 		c.mov(qword_ptr(*ls_var, lsa), *qw1);
 		c.mov(qword_ptr(*ls_var, lsa + 8), *qw0);
+		c.mov(cpu_byte(ls_dirty[lsa >> 10]), 1);
 
 		LOG_OPCODE();
 	}
@@ -2820,6 +2854,7 @@ private:
 		c.bswap(*qw1);
 		c.mov(qword_ptr(*ls_var, lsa), *qw1);
 		c.mov(qword_ptr(*ls_var, lsa + 8), *qw0);
+		c.mov(cpu_byte(ls_dirty[lsa >> 10]), 1);
 
 		LOG_OPCODE();
 	}
@@ -3265,6 +3300,10 @@ private:
 		c.mov(qword_ptr(*ls_var, *addr, 0, 0), *qw1);
 		c.mov(qword_ptr(*ls_var, *addr, 0, 8), *qw0);
 
+		// mark LS area as modified
+		c.shr(*addr, 10);
+		c.mov(cpu_byte2(ls_dirty[0], *addr), 1);
+
 		LOG_OPCODE();
 	}
 	void LQD(u32 rt, s32 i10, u32 ra) // i10 is shifted left by 4 while decoding
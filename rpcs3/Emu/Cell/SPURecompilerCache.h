@@ -0,0 +1,109 @@
+#pragma once
+#include <unordered_map>
+#include "Utilities/Thread.h"
+
+// compiled SPU block, may be shared between SPU threads running the same code
+struct SPURecBlock
+{
+	u16 pos; // start position (in instructions)
+	u16 count; // count of compiled instructions
+	u64 hash; // hash of the position and the code
+	std::vector<u32> code; // original instructions (as stored in LS)
+	std::vector<__m128i> imm_table; // constants used by compiled function
+	void* pointer; // pointer to executable memory object
+
+	SPURecBlock(u16 pos, u16 count, const u32* code, u32 size);
+
+	~SPURecBlock();
+
+	// check if the block was compiled from specified code (starting from the block position)
+	bool Match(const u32* code, u32 size) const
+	{
+		return this->code.size() <= size && memcmp(code, this->code.data(), this->code.size() * sizeof(u32)) == 0;
+	}
+
+	// check if the block was compiled from the code currently stored in LS
+	bool Match(const u32* ls) const
+	{
+		return Match(ls + pos, 0x10000 - pos);
+	}
+
+	static u64 Hash(u16 pos, const u32* code, u32 size);
+};
+
+// request to compile the block at specified position in background
+struct SPUCompileRequest
+{
+	u16 pos;
+	std::vector<u32> code; // instructions from the position to the end of the block
+	std::atomic<bool> done;
+
+	SPUCompileRequest(u16 pos, const u32* code, u32 size)
+		: pos(pos)
+		, code(code, code + size)
+		, done(false)
+	{
+	}
+};
+
+// process-wide cache of compiled SPU blocks
+class SPURecompilerCache
+{
+	struct BlockInfo
+	{
+		u16 pos;
+		u16 count;
+		std::vector<u32> code;
+	};
+
+	std::mutex m_mutex;
+	std::unordered_multimap<u64, std::shared_ptr<SPURecBlock>> m_blocks; // key: position and the first instruction
+	std::unordered_map<u64, BlockInfo> m_known; // all blocks compiled or loaded since the start (key: block hash)
+
+	std::string m_path; // cache directory of the current title
+
+	struct Worker;
+	std::vector<std::unique_ptr<Worker>> m_worker_state; // compiler state of every pool thread
+	thread_pool_t m_pool; // compiler threads
+
+	static u64 Key(u16 pos, u32 first)
+	{
+		return (u64)pos << 32 | first;
+	}
+
+	std::shared_ptr<SPURecBlock> Lookup(const u32* code, u32 size, u16 pos);
+
+	void Work(const SPUCompileRequest& request, u32 worker);
+
+public:
+	std::atomic<u64> m_hits;
+	std::atomic<u64> m_misses;
+
+	SPURecompilerCache();
+	~SPURecompilerCache();
+
+	// find the block compiled from the code currently stored in LS at specified position
+	std::shared_ptr<SPURecBlock> Find(const u32* ls, u16 pos);
+
+	// add compiled block (returns existing block if the same code was compiled by another thread)
+	std::shared_ptr<SPURecBlock> Add(const std::shared_ptr<SPURecBlock>& block);
+
+	// release blocks which aren't used by any SPU thread
+	void Purge();
+
+	// add the request to the compiler threads queue (the result is added to the cache)
+	void Enqueue(const std::shared_ptr<SPUCompileRequest>& request);
+
+	// load the list of blocks from the cache directory and start compiling them in background
+	void Load(const std::string& path);
+
+	// save the list of blocks to the cache directory
+	void Save();
+
+	void Clear();
+};
+
+extern SPURecompilerCache g_spu_rec_cache;
+
+// measure execution of a synthetic loop of small SPU blocks with and without chaining (memory must be initialized), results are logged
+void spu_dispatch_benchmark();
@@ -1,4 +1,5 @@
 #include "stdafx.h"
+#include "rpcs3/Ini.h"
 #include "Utilities/Log.h"
 #include "Emu/Memory/Memory.h"
 #include "Emu/System.h"
@@ -13,16 +14,321 @@
 #include "SPUInterpreter.h"
 #include "SPURecompiler.h"
 
+#include <fstream>
+
 const g_imm_table_struct g_imm_table;
 
+JitRuntime g_spu_runtime; // shared by all SPU threads
+std::mutex g_spu_runtime_mutex;
+
+SPURecompilerCache g_spu_rec_cache;
+
+SPURecBlock::SPURecBlock(u16 pos, u16 count, const u32* code, u32 size)
+	: pos(pos)
+	, count(count)
+	, hash(Hash(pos, code, size))
+	, code(code, code + size)
+	, pointer(nullptr)
+{
+}
+
+SPURecBlock::~SPURecBlock()
+{
+	if (pointer)
+	{
+		std::lock_guard<std::mutex> lock(g_spu_runtime_mutex);
+
+		g_spu_runtime.release(pointer);
+	}
+}
+
+u64 SPURecBlock::Hash(u16 pos, const u32* code, u32 size)
+{
+	// FNV-1a
+	u64 hash = 0xcbf29ce484222325ull ^ pos;
+
+	for (u32 i = 0; i < size; i++)
+	{
+		hash = (hash ^ code[i]) * 0x100000001b3ull;
+	}
+
+	return hash;
+}
+
+struct SPURecompilerCache::Worker
+{
+	// allocated once per worker (SPURecompilerCore is too big for the thread stack)
+	std::unique_ptr<SPUThread> spu;
+	std::unique_ptr<SPURecompilerCore> rec;
+};
+
+SPURecompilerCache::SPURecompilerCache()
+	: m_pool("SPU Compiler", std::thread::hardware_concurrency() / 2)
+	, m_hits(0)
+	, m_misses(0)
+{
+	m_worker_state.resize(m_pool.size());
+}
+
+SPURecompilerCache::~SPURecompilerCache()
+{
+}
+
+std::shared_ptr<SPURecBlock> SPURecompilerCache::Lookup(const u32* code, u32 size, u16 pos)
+{
+	const auto range = m_blocks.equal_range(Key(pos, code[0]));
+
+	for (auto it = range.first; it != range.second; it++)
+	{
+		if (it->second->Match(code, size))
+		{
+			return it->second;
+		}
+	}
+
+	return nullptr;
+}
+
+std::shared_ptr<SPURecBlock> SPURecompilerCache::Find(const u32* ls, u16 pos)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (auto block = Lookup(ls + pos, 0x10000 - pos, pos))
+	{
+		m_hits++;
+		return block;
+	}
+
+	m_misses++;
+	return nullptr;
+}
+
+std::shared_ptr<SPURecBlock> SPURecompilerCache::Add(const std::shared_ptr<SPURecBlock>& block)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	const u64 key = Key(block->pos, block->code[0]);
+	const auto range = m_blocks.equal_range(key);
+
+	for (auto it = range.first; it != range.second; it++)
+	{
+		if (it->second->code == block->code)
+		{
+			return it->second;
+		}
+	}
+
+	if (m_blocks.size() >= 0x10000)
+	{
+		// release unused blocks if the cache grows too much
+		for (auto it = m_blocks.begin(); it != m_blocks.end();)
+		{
+			if (it->second.unique())
+			{
+				it = m_blocks.erase(it);
+			}
+			else
+			{
+				it++;
+			}
+		}
+	}
+
+	m_blocks.emplace(key, block);
+
+	if (!m_known.count(block->hash))
+	{
+		BlockInfo& info = m_known[block->hash];
+		info.pos = block->pos;
+		info.count = block->count;
+		info.code = block->code;
+	}
+
+	return block;
+}
+
+void SPURecompilerCache::Purge()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	for (auto it = m_blocks.begin(); it != m_blocks.end();)
+	{
+		if (it->second.unique())
+		{
+			it = m_blocks.erase(it);
+		}
+		else
+		{
+			it++;
+		}
+	}
+}
+
+void SPURecompilerCache::Work(const SPUCompileRequest& request, u32 worker)
+{
+	// only this worker's thread accesses its state
+	auto& state = m_worker_state[worker];
+
+	if (!state)
+	{
+		state.reset(new Worker);
+		state->spu.reset(new SPUThread(CPU_THREAD_SPU));
+		state->spu->SetId(0);
+		state->rec.reset(new SPURecompilerCore(*state->spu));
+	}
+
+	const u32 size = (u32)request.code.size();
+
+	bool found;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		found = Lookup(request.code.data(), size, request.pos) != nullptr;
+	}
+
+	if (!found)
+	{
+		state->spu->PC = request.pos * 4;
+		state->rec->Compile(request.code.data(), request.pos, size);
+
+		if (state->rec->entry[request.pos].pointer)
+		{
+			// the block is kept by the cache
+			state->rec->RemoveBlock(request.pos);
+		}
+	}
+}
+
+void SPURecompilerCache::Enqueue(const std::shared_ptr<SPUCompileRequest>& request)
+{
+	m_pool.push([this, request](u32 worker)
+	{
+		Work(*request, worker);
+		request->done = true;
+	});
+}
+
+static const u32 g_spu_cache_magic = 0x43555053; // "SPUC"
+static const u32 g_spu_cache_version = 1;
+
+void SPURecompilerCache::Load(const std::string& path)
+{
+	m_path = path;
+
+	std::ifstream f(path + "spu_blocks.bin", std::ios::binary);
+
+	u32 header[3] = {};
+
+	if (!f.read(reinterpret_cast<char*>(header), sizeof(header)) || header[0] != g_spu_cache_magic || header[1] != g_spu_cache_version)
+	{
+		return;
+	}
+
+	std::vector<BlockInfo> list;
+
+	for (u32 i = 0; i < header[2]; i++)
+	{
+		BlockInfo info;
+		u32 size;
+		u64 hash;
+
+		if (!f.read(reinterpret_cast<char*>(&info.pos), sizeof(info.pos)) ||
+			!f.read(reinterpret_cast<char*>(&info.count), sizeof(info.count)) ||
+			!f.read(reinterpret_cast<char*>(&size), sizeof(size)) ||
+			!f.read(reinterpret_cast<char*>(&hash), sizeof(hash)) ||
+			!size || size > 0x10000 - info.pos)
+		{
+			LOG_ERROR(Log::SPU, "SPU block cache is corrupted ('%s')", path.c_str());
+			break;
+		}
+
+		info.code.resize(size);
+
+		if (!f.read(reinterpret_cast<char*>(info.code.data()), size * sizeof(u32)) || SPURecBlock::Hash(info.pos, info.code.data(), size) != hash)
+		{
+			LOG_ERROR(Log::SPU, "SPU block cache is corrupted ('%s')", path.c_str());
+			break;
+		}
+
+		list.push_back(std::move(info));
+	}
+
+	LOG_NOTICE(Log::SPU, "SPU block cache: %d blocks loaded", list.size());
+
+	for (auto& info : list)
+	{
+		Enqueue(std::make_shared<SPUCompileRequest>(info.pos, info.code.data(), (u32)info.code.size()));
+	}
+}
+
+void SPURecompilerCache::Save()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (m_path.empty() || (!rExists(m_path) && !rMkpath(m_path)))
+	{
+		return;
+	}
+
+	std::ofstream f(m_path + "spu_blocks.bin", std::ios::binary | std::ios::trunc);
+
+	const u32 header[3] = { g_spu_cache_magic, g_spu_cache_version, (u32)m_known.size() };
+
+	f.write(reinterpret_cast<const char*>(header), sizeof(header));
+
+	for (auto& block : m_known)
+	{
+		const u32 size = (u32)block.second.code.size();
+
+		f.write(reinterpret_cast<const char*>(&block.second.pos), sizeof(block.second.pos));
+		f.write(reinterpret_cast<const char*>(&block.second.count), sizeof(block.second.count));
+		f.write(reinterpret_cast<const char*>(&size), sizeof(size));
+		f.write(reinterpret_cast<const char*>(&block.first), sizeof(block.first));
+		f.write(reinterpret_cast<const char*>(block.second.code.data()), size * sizeof(u32));
+	}
+}
+
+void SPURecompilerCache::Clear()
+{
+	// wait for background compilation
+	m_pool.stop();
+
+	for (auto& state : m_worker_state)
+	{
+		state.reset();
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	LOG_NOTICE(Log::SPU, "SPU block cache: %d blocks, hits=%lld, misses=%lld", m_blocks.size(), m_hits.load(), m_misses.load());
+
+	m_blocks.clear();
+	m_known.clear();
+	m_path.clear();
+	m_hits = 0;
+	m_misses = 0;
+}
+
 SPURecompilerCore::SPURecompilerCore(SPUThread& cpu)
 	: m_enc(new SPURecompiler(cpu, *this))
 	, inter(new SPUInterpreter(cpu))
 	, CPU(cpu)
 	, first(true)
 	, need_check(false)
+	, chain_limit(0x100)
+	, standalone(false)
+	, m_inv_stamp(0)
+	, m_inv_count(0)
+	, m_background(Ini.SPUBackgroundCompile.GetValue())
+	, m_fallback_pos(~0)
 {
-	memset(entry, 0, sizeof(entry));
+	for (auto& e : entry)
+	{
+		e.count = 0;
+		e.valid = 0;
+		e.pointer = nullptr;
+	}
+
 	X86CpuInfo inf;
 	X86CpuUtil::detect(&inf);
 	if (!inf.hasFeature(kX86CpuFeatureSSE4_1))
@@ -43,25 +349,72 @@ void SPURecompilerCore::Decode(const u32 code) // decode instruction and run wit
 	(*SPU_instr::rrr_list)(inter, code);
 }
 
-void SPURecompilerCore::Compile(u16 pos)
+u32 SPURecompilerCore::GetBlockSize(const u32* ls, u16 pos)
+{
+	using namespace SPU_opcodes;
+
+	// the block ends with the first instruction finalizing it in SPURecompiler (zero opcode, branch, halt, stop or sync)
+	for (u32 i = pos; i < 0x10000; i++)
+	{
+		const u32 opcode = re32(ls[i]);
+
+		if (!opcode)
+		{
+			return i - pos + 1;
+		}
+
+		switch (opcode >> 21)
+		{
+		case STOP: case SYNC: case STOPD:
+		case BIZ: case BINZ: case BIHZ: case BIHNZ:
+		case BI: case BISL: case IRET: case BISLED:
+		case HGT: case HLGT: case HEQ:
+			return i - pos + 1;
+		}
+
+		switch (opcode >> 23)
+		{
+		case BRZ: case BRNZ: case BRHZ: case BRHNZ:
+		case BRA: case BRASL: case BR: case BRSL:
+			return i - pos + 1;
+		}
+
+		switch (opcode >> 24)
+		{
+		case HGTI: case HLGTI: case HEQI:
+			return i - pos + 1;
+		}
+	}
+
+	return 0x10000 - pos;
+}
+
+void SPURecompilerCore::Compile(const u32* code, u16 pos, u32 size)
 {
 	const u64 stamp0 = get_system_time();
 	u64 time0 = 0;
 
+	const bool log_jit = Ini.SPULogJit.GetValue();
+
 	SPUDisAsm dis_asm(CPUDisAsm_InterpreterMode);
-	dis_asm.offset = vm::get_ptr<u8>(CPU.ls_offset);
+	dis_asm.offset = (u8*)(code - pos);
 
 	StringLogger stringLogger;
 	stringLogger.setOption(kLoggerOptionBinaryForm, true);
 
-	X86Compiler compiler(&runtime);
+	X86Compiler compiler(&g_spu_runtime);
 	m_enc->compiler = &compiler;
-	compiler.setLogger(&stringLogger);
+
+	if (log_jit)
+	{
+		compiler.setLogger(&stringLogger);
+	}
 
 	compiler.addFunc(kFuncConvHost, FuncBuilder4<u32, void*, void*, void*, u32>());
 	const u16 start = pos;
 	u32 excess = 0;
 	entry[start].count = 0;
+	imm_table.clear();
 
 	X86GpVar cpu_var(compiler, kVarTypeIntPtr, "cpu");
 	compiler.setArg(0, cpu_var);
@@ -103,15 +456,19 @@ void SPURecompilerCore::Compile(u16 pos)
 
 	while (true)
 	{
-		const u32 opcode = vm::read32(CPU.ls_offset + pos * 4);
+		// the end of available code is compiled as zero opcode
+		const u32 opcode = (u32)(pos - start) < size ? re32(code[pos - start]) : 0;
 		m_enc->do_finalize = false;
 		if (opcode)
 		{
 			const u64 stamp1 = get_system_time();
-			// disasm for logging:
-			dis_asm.dump_pc = pos * 4;
-			(*SPU_instr::rrr_list)(&dis_asm, opcode);
-			compiler.addComment(fmt::Format("SPU data: PC=0x%05x %s", pos * 4, dis_asm.last_opcode.c_str()).c_str());
+			if (log_jit)
+			{
+				// disasm for logging:
+				dis_asm.dump_pc = pos * 4;
+				(*SPU_instr::rrr_list)(&dis_asm, opcode);
+				compiler.addComment(fmt::Format("SPU data: PC=0x%05x %s", pos * 4, dis_asm.last_opcode.c_str()).c_str());
+			}
 			// compile single opcode:
 			(*SPU_instr::rrr_list)(m_enc, opcode);
 			// force finalization between every slice using absolute alignment
@@ -151,91 +508,215 @@ void SPURecompilerCore::Compile(u16 pos)
 	const u64 stamp1 = get_system_time();
 	compiler.ret(pos_var);
 	compiler.endFunc();
-	entry[start].pointer = compiler.make();
+
+	std::shared_ptr<SPURecBlock> block(new SPURecBlock(start, entry[start].count, code, std::min<u32>(pos - start + 1, size)));
+	block->imm_table = std::move(imm_table);
+
+	{
+		std::lock_guard<std::mutex> lock(g_spu_runtime_mutex);
+
+		block->pointer = compiler.make();
+	}
+
 	compiler.setLogger(nullptr); // crashes without it
 
-	rFile log;
-	log.Open(fmt::Format("SPUjit_%d.log", GetCurrentSPUThread().GetId()), first ? rFile::write : rFile::write_append);
-	log.Write(fmt::Format("========== START POSITION 0x%x ==========\n\n", start * 4));
-	log.Write(std::string(stringLogger.getString()));
+	if (block->pointer)
+	{
+		// use the block compiled by another thread if it was added first
+		entry[start].block = g_spu_rec_cache.Add(block);
+		entry[start].pointer = entry[start].block->pointer;
+		AddBlock(start);
+	}
+
 	if (!entry[start].pointer)
 	{
 		LOG_ERROR(Log::SPU, "SPURecompilerCore::Compile(pos=0x%x) failed", start * sizeof(u32));
-		log.Write("========== FAILED ============\n\n");
 		Emu.Pause();
 	}
-	else
-	{
-		log.Write(fmt::Format("========== COMPILED %d (excess %d), time: [start=%lld (decoding=%lld), finalize=%lld]\n\n",
-			entry[start].count, excess, stamp1 - stamp0, time0, get_system_time() - stamp1));
 #ifdef _WIN32
-		//if (!RtlAddFunctionTable(&info, 1, (u64)entry[start].pointer))
-		//{
-		//	LOG_ERROR(Log::SPU, "RtlAddFunctionTable() failed");
-		//}
+	//else if (!RtlAddFunctionTable(&info, 1, (u64)entry[start].pointer))
+	//{
+	//	LOG_ERROR(Log::SPU, "RtlAddFunctionTable() failed");
+	//}
 #endif
+
+	if (log_jit)
+	{
+		rFile log;
+		log.Open(fmt::Format("SPUjit_%d.log", CPU.GetId()), first ? rFile::write : rFile::write_append);
+		log.Write(fmt::Format("========== START POSITION 0x%x ==========\n\n", start * 4));
+		log.Write(std::string(stringLogger.getString()));
+		if (!entry[start].pointer)
+		{
+			log.Write("========== FAILED ============\n\n");
+		}
+		else
+		{
+			log.Write(fmt::Format("========== COMPILED %d (excess %d), time: [start=%lld (decoding=%lld), finalize=%lld]\n\n",
+				entry[start].count, excess, stamp1 - stamp0, time0, get_system_time() - stamp1));
+		}
+		log.Close();
+		first = false;
 	}
-	log.Close();
+
 	m_enc->compiler = nullptr;
-	first = false;
+}
+
+void SPURecompilerCore::AddBlock(u16 pos)
+{
+	const u32 last = pos + (u32)entry[pos].block->code.size() - 1;
+
+	for (u32 i = pos >> 8; i <= last >> 8; i++)
+	{
+		m_area_blocks[i].push_back(pos);
+	}
+}
+
+void SPURecompilerCore::RemoveBlock(u16 pos)
+{
+	const u32 last = pos + (u32)entry[pos].block->code.size() - 1;
+
+	for (u32 i = pos >> 8; i <= last >> 8; i++)
+	{
+		auto& list = m_area_blocks[i];
+		list.erase(std::find(list.begin(), list.end(), pos));
+	}
+
+	for (u32 i = pos; i <= last; i++)
+	{
+		entry[i].valid = 0;
+	}
+
+	// the block is released when no SPU thread uses it
+	entry[pos].block.reset();
+#ifdef _WIN32
+	//RtlDeleteFunctionTable(&entry[pos].info);
+#endif
+	entry[pos].pointer = nullptr;
+}
+
+void SPURecompilerCore::CheckModified(const u32* ls)
+{
+	u32 count = 0;
+
+	if (CPU.GetType() == CPU_THREAD_RAW_SPU)
+	{
+		// LS of raw SPU is mapped to PPU address space and may be modified by plain stores, so every area is checked
+		CPU.MarkLSDirty(0, 0x40000);
+	}
+
+	for (u32 i = 0; i < 0x100; i++)
+	{
+		if (!CPU.ls_dirty[i]) continue;
+
+		CPU.ls_dirty[i] = 0;
+
+		auto& list = m_area_blocks[i];
+
+		for (u32 j = 0; j < list.size();)
+		{
+			if (entry[list[j]].block->Match(ls))
+			{
+				j++;
+			}
+			else
+			{
+				//LOG_ERROR(Log::SPU, "SPURecompilerCore::DecodeMemory(ls=0x%x): code has changed", list[j] * sizeof(u32));
+				RemoveBlock(list[j]);
+				count++;
+			}
+		}
+	}
+
+	CPU.code_inv_count += count;
+	m_inv_count += count;
+
+	const u64 stamp = get_system_time();
+
+	if (stamp - m_inv_stamp >= 1000000)
+	{
+		// the rate is reset if no check occurred during the last second
+		CPU.code_inv_rate = stamp - m_inv_stamp < 2000000 ? m_inv_count : count;
+		m_inv_stamp = stamp;
+		m_inv_count = 0;
+	}
+}
+
+void SPURecompilerCore::RequestCompile(const u32* ls, u16 pos)
+{
+	auto& request = m_requests[pos];
+
+	if (request && !request->done)
+	{
+		return;
+	}
+
+	request = std::make_shared<SPUCompileRequest>(pos, ls + pos, GetBlockSize(ls, pos));
+	g_spu_rec_cache.Enqueue(request);
 }
 
 u32 SPURecompilerCore::DecodeMemory(const u32 address)
 {
 	assert(CPU.ls_offset == address - CPU.PC);
 	const u32 m_offset = CPU.ls_offset;
-	const u16 pos = (u16)(CPU.PC >> 2);
+	u16 pos = (u16)(CPU.PC >> 2);
 
 	//ConLog.Write("DecodeMemory: pos=%d", pos);
 	u32* ls = vm::get_ptr<u32>(m_offset);
 
-	if (entry[pos].pointer)
+	if (need_check && (pos != m_fallback_pos || entry[pos].pointer))
 	{
-		// check data (hard way)
-		bool is_valid = true;
-		if (need_check)
+		// check only blocks overlapping modified LS areas
+		CheckModified(ls);
+		need_check = false;
+	}
+
+	bool did_compile = false;
+	if (!entry[pos].pointer && pos != m_fallback_pos)
+	{
+		// the cache isn't searched while the block requested from this position is still being compiled
+		const auto request = m_requests.find(pos);
+		const bool pending = request != m_requests.end() && !request->second->done;
+
+		// check if the same code was already compiled by another SPU thread
+		if (auto block = pending ? nullptr : g_spu_rec_cache.Find(ls, pos))
 		{
-			for (u32 i = 0; i < 0x10000; i++)
+			if (request != m_requests.end())
 			{
-				if (entry[i].valid && entry[i].valid != ls[i])
-				{
-					is_valid = false;
-					break;
-				}
+				m_requests.erase(request);
 			}
-			need_check = false;
-		}
-		// invalidate if necessary
-		if (!is_valid)
-		{
-			for (u32 i = 0; i < 0x10000; i++)
-			{
-				if (!entry[i].pointer) continue;
 
-				if (!entry[i].valid || entry[i].valid != ls[i] ||
-					i + (u32)entry[i].count > (u32)pos &&
-					i < (u32)pos + (u32)entry[pos].count)
-				{
-					runtime.release(entry[i].pointer);
-#ifdef _WIN32
-					//RtlDeleteFunctionTable(&entry[i].info);
-#endif
-					entry[i].pointer = nullptr;
-					for (u32 j = i; j < i + (u32)entry[i].count; j++)
-					{
-						entry[j].valid = 0;
-					}
-					//need_check = true;
-				}
+			for (u32 i = 0; i < block->code.size(); i++)
+			{
+				entry[pos + i].valid = block->code[i];
 			}
-			//LOG_ERROR(Log::SPU, "SPURecompilerCore::DecodeMemory(ls=0x%x): code has changed", pos * sizeof(u32));
+
+			entry[pos].count = block->count;
+			entry[pos].pointer = block->pointer;
+			entry[pos].block = block;
+			AddBlock(pos);
 		}
 	}
 
-	bool did_compile = false;
+	if (!entry[pos].pointer && m_background)
+	{
+		if (pos != m_fallback_pos)
+		{
+			RequestCompile(ls, pos);
+		}
+
+		// execute the block with the interpreter until it's compiled
+		m_fallback_pos = pos + 1;
+		need_check = true; // the interpreter doesn't report code modification
+		Decode(re32(ls[pos]));
+		return 4;
+	}
+
+	m_fallback_pos = ~0;
+
 	if (!entry[pos].pointer)
 	{
-		Compile(pos);
+		Compile(ls + pos, pos, 0x10000 - pos);
 		did_compile = true;
 		if (entry[pos].valid == 0)
 		{
@@ -263,20 +744,38 @@ u32 SPURecompilerCore::DecodeMemory(const u32 address)
 		}
 	}
 
+	// blocks are executed one by one if breakpoints are set
+	const bool chain = Emu.GetBreakPoints().empty();
+
 	u32 res = pos;
-	res = func(cpu, vm::get_ptr<void>(m_offset), imm_table.data(), &g_imm_table);
 
-	if (res & 0x1000000)
+	for (u32 i = 0;; i++)
 	{
-		CPU.SPU.Status.SetValue(SPU_STATUS_STOPPED_BY_HALT);
-		CPU.Stop();
-		res &= ~0x1000000;
-	}
+		res = func(cpu, ls, entry[pos].block->imm_table.data(), &g_imm_table);
 
-	if (res & 0x2000000)
-	{
-		need_check = true;
-		res &= ~0x2000000;
+		if (res & 0x1000000)
+		{
+			CPU.SPU.Status.SetValue(SPU_STATUS_STOPPED_BY_HALT);
+			CPU.Stop();
+			res &= ~0x1000000;
+		}
+
+		if (res & 0x2000000)
+		{
+			need_check = true;
+			res &= ~0x2000000;
+		}
+
+		// jump directly to the next block if it's already compiled and the thread keeps running
+		// (code checks and thread state changes are processed by the caller)
+		if (!chain || need_check || i + 1 >= chain_limit || res >= 0x10000 || !entry[res].pointer || (!standalone && CPU.ThreadStatus() != CPUThread_Running))
+		{
+			break;
+		}
+
+		pos = (u16)res;
+		CPU.PC = pos << 2;
+		func = asmjit_cast<Func>(entry[pos].pointer);
 	}
 
 	if (did_compile)
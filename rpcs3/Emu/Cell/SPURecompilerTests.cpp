@@ -0,0 +1,92 @@
+#include "stdafx.h"
+#include "Utilities/Log.h"
+#include "Emu/Memory/Memory.h"
+#include "Emu/SysCalls/lv2/sys_time.h"
+
+#include "SPUOpcodes.h"
+#include "SPUThread.h"
+#include "SPUInterpreter.h"
+#include "SPURecompiler.h"
+
+// ai rt, ra, i10
+static u32 spu_ai(u32 rt, u32 ra, s32 i10)
+{
+	return SPU_opcodes::AI << 24 | (i10 & 0x3ff) << 14 | ra << 7 | rt;
+}
+
+// br i16 (relative to the instruction, in instructions)
+static u32 spu_br(s32 i16)
+{
+	return SPU_opcodes::BR << 23 | (i16 & 0xffff) << 7;
+}
+
+void spu_dispatch_benchmark()
+{
+	const u32 block_count = 64; // blocks in the loop
+	const u32 block_size = 4; // instructions in every block, the last one is the branch to the next block
+	const u32 calls = 100000; // DecodeMemory calls per measurement
+
+	const u32 ls = vm::alloc(0x40000, vm::main);
+
+	// every block increments r3 and branches to the next one, the last block branches back to the first
+	for (u32 i = 0; i < block_count; i++)
+	{
+		const u32 pos = i * block_size;
+
+		for (u32 j = 0; j < block_size - 1; j++)
+		{
+			vm::write32(ls + (pos + j) * 4, spu_ai(3, 3, 1));
+		}
+
+		vm::write32(ls + (pos + block_size - 1) * 4, spu_br(i + 1 < block_count ? 1 : -(s32)(pos + block_size - 1)));
+	}
+
+	// heap allocated like the compiler workers (SPURecompilerCore is too big for the thread stack)
+	std::unique_ptr<SPUThread> spu(new SPUThread(CPU_THREAD_SPU));
+	spu->SetOffset(ls);
+	spu->ls_offset = ls;
+
+	std::unique_ptr<SPURecompilerCore> rec(new SPURecompilerCore(*spu));
+	rec->standalone = true;
+
+	// compile all blocks in advance
+	for (u32 i = 0; i < block_count; i++)
+	{
+		const u16 pos = i * block_size;
+
+		spu->PC = pos * 4;
+		rec->Compile(vm::get_ptr<u32>(ls) + pos, pos, block_size);
+	}
+
+	for (u32 limit : { 1, 16, 256 })
+	{
+		rec->chain_limit = limit;
+		spu->PC = 0;
+		spu->GPR[3]._u32[3] = 0;
+
+		const u64 start = get_system_time();
+
+		for (u32 i = 0; i < calls; i++)
+		{
+			spu->NextPc(rec->DecodeMemory(spu->PC + ls));
+		}
+
+		const u64 time = std::max<u64>(get_system_time() - start, 1);
+		const u64 blocks = spu->GPR[3]._u32[3] / (block_size - 1);
+
+		if (blocks < calls || blocks > (u64)calls * limit)
+		{
+			LOG_ERROR(SPU, "SPU dispatch benchmark: %lld blocks executed by %d calls (chain limit %d)", blocks, calls, limit);
+		}
+
+		LOG_NOTICE(SPU, "SPU dispatch (chain limit %d): %.2f M blocks/s, %.1f ns per block", limit, (double)blocks / time, time * 1000.0 / blocks);
+	}
+
+	rec.reset();
+	spu.reset();
+
+	vm::dealloc(ls, vm::main);
+
+	// release the blocks kept only by the cache
+	g_spu_rec_cache.Purge();
+}
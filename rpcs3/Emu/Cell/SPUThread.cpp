@@ -63,6 +63,9 @@ void SPUThread::Task()
 	{
 		CPUThread::Task();
 	}
+
+	// complete transfers enqueued before stop or halt
+	FlushMfcQueue();
 	
 	if (std::fegetround() != FE_TOWARDZERO)
 	{
@@ -87,6 +90,18 @@ void SPUThread::InitRegs()
 
 	ls_offset = m_offset;
 
+	m_mfc_queue.clear();
+	m_mfc_queue_data.clear();
+	m_mfc_queue_cmds = 0;
+
+	memset(m_ch_wait_count, 0, sizeof(m_ch_wait_count));
+	memset(m_ch_wait_time, 0, sizeof(m_ch_wait_time));
+
+	// the image was loaded to LS before the start
+	memset(ls_dirty, 1, sizeof(ls_dirty));
+	code_inv_count = 0;
+	code_inv_rate = 0;
+
 	SPU.Status.SetValue(SPU_STATUS_STOPPED);
 
 	// TODO: check initialization if necessary
@@ -197,14 +212,67 @@ void SPUThread::WriteSNR(bool number, u32 value)
 	{
 		SPU.SNR[number ? 1 : 0].PushUncond(value); // overwrite
 	}
+
+	Notify();
+}
+
+template<typename T> bool SPUThread::WaitChannel(u32 ch, T pred)
+{
+	if (pred())
+	{
+		return true;
+	}
+
+	// the channel may be served by a thread waiting for results of enqueued transfers
+	FlushMfcQueue();
+
+	const u64 stamp = get_system_time();
+
+	bool result = false;
+
+	// spin for a short time before sleeping (channels are usually served quickly by another thread)
+	for (u32 i = 0; i < 100; i++)
+	{
+		_mm_pause();
+
+		if ((result = pred()))
+		{
+			break;
+		}
+	}
+
+	// wait for Notify() from the thread which changed the channel (the timeout is used for polled sources)
+	while (!result && !Emu.IsStopped())
+	{
+		// the signal count is read before the check, so Notify() called after it isn't missed
+		const u64 signal = GetSignalCount();
+
+		if (!(result = pred()))
+		{
+			WaitForSignal(signal, 1);
+		}
+	}
+
+	if (ch < 32)
+	{
+		m_ch_wait_count[ch]++;
+		m_ch_wait_time[ch] += get_system_time() - stamp;
+	}
+
+	return result;
 }
 
 #define LOG_DMAC(type, text) type(Log::SPU, "DMAC::ProcessCmd(cmd=0x%x, tag=0x%x, lsa=0x%x, ea=0x%llx, size=0x%x): " text, cmd, tag, lsa, ea, size)
 
-void SPUThread::ProcessCmd(u32 cmd, u32 tag, u32 lsa, u64 ea, u32 size)
+void SPUThread::ProcessCmd(u32 cmd, u32 tag, u32 lsa, u64 ea, u32 size, const u8* data)
 {
 	if (cmd & (MFC_BARRIER_MASK | MFC_FENCE_MASK)) _mm_mfence();
 
+	if (!data)
+	{
+		data = vm::get_ptr<u8>(ls_offset + lsa);
+	}
+
 	if (ea >= SYS_SPU_THREAD_BASE_LOW)
 	{
 		if (ea >= 0x100000000)
@@ -231,10 +299,15 @@ void SPUThread::ProcessCmd(u32 cmd, u32 tag, u32 lsa, u64 ea, u32 size)
 			{
 				// LS access
 				ea = ((SPUThread*)spu.get())->ls_offset + addr;
+
+				if (cmd & MFC_PUT_CMD)
+				{
+					((SPUThread*)spu.get())->MarkLSDirty(addr, size);
+				}
 			}
 			else if ((cmd & MFC_PUT_CMD) && size == 4 && (addr == SYS_SPU_THREAD_SNR1 || addr == SYS_SPU_THREAD_SNR2))
 			{
-				((SPUThread*)spu.get())->WriteSNR(SYS_SPU_THREAD_SNR2 == addr, vm::read32(ls_offset + lsa));
+				((SPUThread*)spu.get())->WriteSNR(SYS_SPU_THREAD_SNR2 == addr, re32(*(const u32*)data));
 				return;
 			}
 			else
@@ -257,7 +330,7 @@ void SPUThread::ProcessCmd(u32 cmd, u32 tag, u32 lsa, u64 ea, u32 size)
 		{
 		case MFC_PUT_CMD:
 		{
-			vm::write32((u32)ea, ReadLS32(lsa));
+			vm::write32((u32)ea, re32(*(const u32*)data));
 			return;
 		}
 
@@ -280,13 +353,14 @@ void SPUThread::ProcessCmd(u32 cmd, u32 tag, u32 lsa, u64 ea, u32 size)
 	{
 	case MFC_PUT_CMD:
 	{
-		memcpy(vm::get_ptr<void>((u32)ea), vm::get_ptr<void>(ls_offset + lsa), size);
+		memcpy(vm::get_ptr<void>((u32)ea), data, size);
 		return;
 	}
 
 	case MFC_GET_CMD:
 	{
 		memcpy(vm::get_ptr<void>(ls_offset + lsa), vm::get_ptr<void>((u32)ea), size);
+		MarkLSDirty(lsa, size);
 		return;
 	}
 
@@ -301,6 +375,90 @@ void SPUThread::ProcessCmd(u32 cmd, u32 tag, u32 lsa, u64 ea, u32 size)
 
 #undef LOG_CMD
 
+void SPUThread::QueueTransfer(u32 cmd, u16 tag, u32 lsa, u64 ea, u32 size, bool first)
+{
+	if (first && m_mfc_queue_cmds >= 16)
+	{
+		// the queue is full, wait for all commands
+		FlushMfcQueue();
+	}
+
+	const u32 data = (u32)m_mfc_queue_data.size();
+
+	if (cmd & MFC_PUT_CMD)
+	{
+		// LS may be modified before the transfer is executed
+		const u8* src = vm::get_ptr<u8>(ls_offset + lsa);
+		m_mfc_queue_data.insert(m_mfc_queue_data.end(), src, src + size);
+	}
+
+	m_mfc_queue.push_back({ cmd, lsa, ea, size, tag, first, data });
+
+	if (first)
+	{
+		m_mfc_queue_cmds++;
+	}
+}
+
+void SPUThread::FlushMfcQueue(u32 mask)
+{
+	if (m_mfc_queue.empty())
+	{
+		return;
+	}
+
+	const u32 direction_mask = MFC_PUT_CMD | MFC_GET_CMD;
+
+	size_t count = 0; // count of remaining transfers
+
+	for (size_t i = 0; i < m_mfc_queue.size();)
+	{
+		MFCTransfer t = m_mfc_queue[i++];
+
+		if (!(mask & (1 << (t.tag & 31))))
+		{
+			// keep the order of transfers which aren't completed
+			m_mfc_queue[count++] = t;
+			continue;
+		}
+
+		if (t.first)
+		{
+			m_mfc_queue_cmds--;
+		}
+
+		// coalesce following transfers of the same group which continue the current one in both LS and memory
+		while (i < m_mfc_queue.size() && t.ea + t.size < RAW_SPU_BASE_ADDR)
+		{
+			const MFCTransfer& next = m_mfc_queue[i];
+
+			if (!(mask & (1 << (next.tag & 31))) || (next.cmd & direction_mask) != (t.cmd & direction_mask) ||
+				next.cmd & (MFC_BARRIER_MASK | MFC_FENCE_MASK) || next.lsa != t.lsa + t.size || next.ea != t.ea + t.size ||
+				((t.cmd & MFC_PUT_CMD) && next.data != t.data + t.size))
+			{
+				break;
+			}
+
+			if (next.first)
+			{
+				m_mfc_queue_cmds--;
+			}
+
+			t.size += next.size;
+			i++;
+		}
+
+		ProcessCmd(t.cmd, t.tag, t.lsa, t.ea, t.size, (t.cmd & MFC_PUT_CMD) ? m_mfc_queue_data.data() + t.data : nullptr);
+	}
+
+	m_mfc_queue.resize(count);
+
+	if (!count)
+	{
+		m_mfc_queue_data.clear();
+	}
+}
+
 void SPUThread::ListCmd(u32 lsa, u64 ea, u16 tag, u16 size, u32 cmd, MFCReg& MFCArgs)
 {
 	const u32 list_addr = ea & 0x3ffff;
@@ -316,27 +474,37 @@ void SPUThread::ListCmd(u32 lsa, u64 ea, u16 tag, u16 size, u32 cmd, MFCReg& MFC
 
 	u32 result = MFC_PPU_DMA_CMD_ENQUEUE_SUCCESSFUL;
 
+	const bool queue = &MFCArgs == &MFC1; // proxy commands are executed immediately
+	const bool log = Ini.HLELogging.GetValue();
+
 	for (u32 i = 0; i < list_size; i++)
 	{
-		auto rec = vm::ptr<list_element>::make(ls_offset + list_addr + i * 8);
+		const list_element rec = *vm::get_ptr<list_element>(ls_offset + list_addr + i * 8);
 
-		const u32 size = rec->ts;
-		if (!(rec->s.data() & se16(0x8000)) && size < 16 && size != 1 && size != 2 && size != 4 && size != 8)
+		const u32 size = rec.ts;
+		if (!(rec.s.data() & se16(0x8000)) && size < 16 && size != 1 && size != 2 && size != 4 && size != 8)
 		{
 			LOG_ERROR(Log::SPU, "DMA List: invalid transfer size(%d)", size);
 			result = MFC_PPU_DMA_CMD_SEQUENCE_ERROR;
 			break;
 		}
 
-		const u32 addr = rec->ea;
+		const u32 addr = rec.ea;
 		if (size)
 		{
-			ProcessCmd(cmd, tag, lsa | (addr & 0xf), addr, size);
+			if (queue)
+			{
+				QueueTransfer(cmd, tag, lsa | (addr & 0xf), addr, size, i == 0);
+			}
+			else
+			{
+				ProcessCmd(cmd, tag, lsa | (addr & 0xf), addr, size);
+			}
 		}
 
-		if (Ini.HLELogging.GetValue() || rec->s.data())
+		if (log || rec.s.data())
 		{
-			LOG_NOTICE(Log::SPU, "*** list element(%d/%d): s = 0x%x, ts = 0x%x, low ea = 0x%x (lsa = 0x%x)", i, list_size, rec->s, rec->ts, rec->ea, lsa | (addr & 0xf));
+			LOG_NOTICE(Log::SPU, "*** list element(%d/%d): s = 0x%x, ts = 0x%x, low ea = 0x%x (lsa = 0x%x)", i, list_size, rec.s, rec.ts, rec.ea, lsa | (addr & 0xf));
 		}
 
 		if (size)
@@ -344,8 +512,11 @@ void SPUThread::ListCmd(u32 lsa, u64 ea, u16 tag, u16 size, u32 cmd, MFCReg& MFC
 			lsa += std::max<u32>(size, 16);
 		}
 
-		if (rec->s.data() & se16(0x8000))
+		if (rec.s.data() & se16(0x8000))
 		{
+			// transfers before the stall point are completed
+			FlushMfcQueue(1 << tag);
+
 			StallStat.PushUncond_OR(1 << tag);
 
 			if (StallList[tag].MFCArgs)
@@ -391,7 +562,15 @@ void SPUThread::EnqMfcCmd(MFCReg& MFCArgs)
 			(op & MFC_FENCE_MASK ? "F" : ""),
 			lsa, ea, tag, size, cmd);
 
-		ProcessCmd(cmd, tag, lsa, ea, size);
+		if (&MFCArgs == &MFC1)
+		{
+			QueueTransfer(cmd, tag, lsa, ea, size, true);
+		}
+		else
+		{
+			ProcessCmd(cmd, tag, lsa, ea, size);
+		}
+
 		MFCArgs.CMDStatus.SetValue(MFC_PPU_DMA_CMD_ENQUEUE_SUCCESSFUL);
 		break;
 	}
@@ -433,10 +612,15 @@ void SPUThread::EnqMfcCmd(MFCReg& MFCArgs)
 			return;
 		}
 
+		// atomic commands are executed after all previous commands
+		FlushMfcQueue();
+
 		if (op == MFC_GETLLAR_CMD) // get reservation
 		{
 			//std::this_thread::sleep_for(std::chrono::milliseconds(1)); // hack
 
+			MarkLSDirty(lsa, 128);
+
 			vm::reservation_acquire(vm::get_ptr(ls_offset + lsa), ea, 128, [this]()
 			{
 				//std::shared_ptr<CPUThread> t = Emu.GetCPU().GetThread(tid);
@@ -481,6 +665,15 @@ void SPUThread::EnqMfcCmd(MFCReg& MFCArgs)
 		break;
 	}
 
+	case MFC_BARRIER_CMD:
+	case MFC_EIEIO_CMD:
+	case MFC_SYNC_CMD:
+	{
+		FlushMfcQueue();
+		MFCArgs.CMDStatus.SetValue(MFC_PPU_DMA_CMD_ENQUEUE_SUCCESSFUL);
+		break;
+	}
+
 	default:
 		LOG_ERROR(Log::SPU, "Unknown MFC cmd. (opcode=0x%x, cmd=0x%x, lsa = 0x%x, ea = 0x%llx, tag = 0x%x, size = 0x%x)",
 			op, cmd, lsa, ea, tag, size);
@@ -491,12 +684,19 @@ void SPUThread::EnqMfcCmd(MFCReg& MFCArgs)
 bool SPUThread::CheckEvents()
 {
 	// checks events:
+	if ((m_event_mask & SPU_EVENT_LR) && vm::reservation_lost())
+	{
+		m_events |= SPU_EVENT_LR; // lock-free reservations can't notify their owner
+	}
 
 	return (m_events & m_event_mask) != 0;
 }
 
 u32 SPUThread::GetChannelCount(u32 ch)
 {
+	// SPU code polling channel counts never blocks, so the queued transfers are completed here (the PPU may wait for their data)
+	FlushMfcQueue();
+
 	u32 res = 0xdeafbeef;
 
 	switch (ch)
@@ -506,6 +706,7 @@ u32 SPUThread::GetChannelCount(u32 ch)
 	case SPU_WrOutMbox:       res = SPU.Out_MBox.GetFreeCount(); break;
 	case SPU_WrOutIntrMbox:   res = SPU.Out_IntrMBox.GetFreeCount(); break;
 	case SPU_RdInMbox:        res = SPU.In_MBox.GetCount(); break;
+	case MFC_Cmd:             res = 16 - m_mfc_queue_cmds; break;
 	case MFC_RdTagStat:       res = MFC1.TagStatus.GetCount(); break;
 	case MFC_RdListStallStat: res = StallStat.GetCount(); break;
 	case MFC_WrTagUpdate:     res = MFC1.TagStatus.GetCount(); break;// hack
@@ -539,17 +740,15 @@ void SPUThread::WriteChannel(u32 ch, const u128& r)
 		break;
 	case SPU_WrOutIntrMbox:
 	{
+		FlushMfcQueue(); // make results visible before notifying PPU
+
 		if (!group) // if RawSPU
 		{
 			if (Ini.HLELogging.GetValue()) LOG_NOTICE(Log::SPU, "SPU_WrOutIntrMbox: interrupt(v=0x%x)", v);
-			while (!SPU.Out_IntrMBox.Push(v))
+			if (!WaitChannel(ch, [&](){ return SPU.Out_IntrMBox.Push(v); }))
 			{
-				std::this_thread::sleep_for(std::chrono::milliseconds(1)); // hack
-				if (Emu.IsStopped())
-				{
-					LOG_WARNING(Log::SPU, "%s(%s) aborted", __FUNCTION__, spu_ch_name[ch]);
-					return;
-				}
+				LOG_WARNING(Log::SPU, "%s(%s) aborted", __FUNCTION__, spu_ch_name[ch]);
+				return;
 			}
 			m_intrtag[2].stat |= 1;
 			if (std::shared_ptr<CPUThread> t = Emu.GetCPU().GetThread(m_intrtag[2].thread))
@@ -746,10 +945,8 @@ void SPUThread::WriteChannel(u32 ch, const u128& r)
 
 	case SPU_WrOutMbox:
 	{
-		while (!SPU.Out_MBox.Push(v) && !Emu.IsStopped())
-		{
-			std::this_thread::sleep_for(std::chrono::milliseconds(1)); // hack
-		}
+		FlushMfcQueue(); // make results visible before notifying PPU
+		WaitChannel(ch, [&](){ return SPU.Out_MBox.Push(v); });
 		break;
 	}
 
@@ -761,6 +958,8 @@ void SPUThread::WriteChannel(u32 ch, const u128& r)
 
 	case MFC_WrTagUpdate:
 	{
+		// all transfers of the queried groups are completed at this point
+		FlushMfcQueue(MFC1.QueryMask.GetValue());
 		MFC1.TagStatus.PushUncond(MFC1.QueryMask.GetValue());
 		break;
 	}
@@ -863,19 +1062,13 @@ void SPUThread::ReadChannel(u128& r, u32 ch)
 		break;
 	case SPU_RdInMbox:
 	{
-		while (!SPU.In_MBox.Pop(v) && !Emu.IsStopped())
-		{
-			std::this_thread::sleep_for(std::chrono::milliseconds(1)); // hack
-		}
+		WaitChannel(ch, [&](){ return SPU.In_MBox.Pop(v); });
 		break;
 	}
 
 	case MFC_RdTagStat:
 	{
-		while (!MFC1.TagStatus.Pop(v) && !Emu.IsStopped())
-		{
-			std::this_thread::sleep_for(std::chrono::milliseconds(1)); // hack
-		}
+		WaitChannel(ch, [&](){ return MFC1.TagStatus.Pop(v); });
 		break;
 	}
 
@@ -889,17 +1082,11 @@ void SPUThread::ReadChannel(u128& r, u32 ch)
 	{
 		if (cfg.value & 1)
 		{
-			while (!SPU.SNR[0].Pop_XCHG(v) && !Emu.IsStopped())
-			{
-				std::this_thread::sleep_for(std::chrono::milliseconds(1)); // hack
-			}
+			WaitChannel(ch, [&](){ return SPU.SNR[0].Pop_XCHG(v); });
 		}
 		else
 		{
-			while (!SPU.SNR[0].Pop(v) && !Emu.IsStopped())
-			{
-				std::this_thread::sleep_for(std::chrono::milliseconds(1)); // hack
-			}
+			WaitChannel(ch, [&](){ return SPU.SNR[0].Pop(v); });
 		}
 		break;
 	}
@@ -908,36 +1095,24 @@ void SPUThread::ReadChannel(u128& r, u32 ch)
 	{
 		if (cfg.value & 2)
 		{
-			while (!SPU.SNR[1].Pop_XCHG(v) && !Emu.IsStopped())
-			{
-				std::this_thread::sleep_for(std::chrono::milliseconds(1)); // hack
-			}
+			WaitChannel(ch, [&](){ return SPU.SNR[1].Pop_XCHG(v); });
 		}
 		else
 		{
-			while (!SPU.SNR[1].Pop(v) && !Emu.IsStopped())
-			{
-				std::this_thread::sleep_for(std::chrono::milliseconds(1)); // hack
-			}
+			WaitChannel(ch, [&](){ return SPU.SNR[1].Pop(v); });
 		}
 		break;
 	}
 
 	case MFC_RdAtomicStat:
 	{
-		while (!MFC1.AtomicStat.Pop(v) && !Emu.IsStopped())
-		{
-			std::this_thread::sleep_for(std::chrono::milliseconds(1)); // hack
-		}
+		WaitChannel(ch, [&](){ return MFC1.AtomicStat.Pop(v); });
 		break;
 	}
 
 	case MFC_RdListStallStat:
 	{
-		while (!StallStat.Pop(v) && !Emu.IsStopped())
-		{
-			std::this_thread::sleep_for(std::chrono::milliseconds(1)); // hack
-		}
+		WaitChannel(ch, [&](){ return StallStat.Pop(v); });
 		break;
 	}
 
@@ -955,10 +1130,7 @@ void SPUThread::ReadChannel(u128& r, u32 ch)
 
 	case SPU_RdEventStat:
 	{
-		while (!CheckEvents() && !Emu.IsStopped())
-		{
-			std::this_thread::sleep_for(std::chrono::milliseconds(1)); // hack
-		}
+		WaitChannel(ch, [&](){ return CheckEvents(); });
 		v = m_events & m_event_mask;
 		break;
 	}
@@ -987,6 +1159,8 @@ void SPUThread::StopAndSignal(u32 code)
 	SetExitStatus(code); // exit code (not status)
 	// TODO: process interrupts for RawSPU
 
+	FlushMfcQueue();
+
 	switch (code)
 	{
 	case 0x001:
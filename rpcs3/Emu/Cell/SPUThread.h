@@ -456,6 +456,21 @@ public:
 	} StallList[32];
 	Channel<1> StallStat;
 
+	struct MFCTransfer
+	{
+		u32 cmd;
+		u32 lsa;
+		u64 ea;
+		u32 size;
+		u16 tag;
+		bool first; // first transfer of the command
+		u32 data; // offset of PUT data in m_mfc_queue_data
+	};
+
+	std::vector<MFCTransfer> m_mfc_queue; // transfers enqueued by SPU (executed when the tag group is waited for)
+	std::vector<u8> m_mfc_queue_data; // LS data of enqueued PUT transfers (copied when the command is enqueued)
+	u32 m_mfc_queue_cmds; // count of commands in the queue (16 max)
+
 	struct
 	{
 		Channel<1> Out_MBox;
@@ -478,12 +493,38 @@ public:
 
 	u32 ls_offset;
 
-	void ProcessCmd(u32 cmd, u32 tag, u32 lsa, u64 ea, u32 size);
+	mutable u8 ls_dirty[0x100]; // LS areas (1 KB each) written since compiled code was checked last time
+	u64 code_inv_count; // count of compiled blocks invalidated because of modified code
+	u32 code_inv_rate; // invalidations during the last second
+
+	u64 m_ch_wait_count[32]; // count of blocking channel operations
+	u64 m_ch_wait_time[32]; // time spent waiting on each channel (in microseconds)
+
+	// wait until pred() returns true or the emulator is stopped
+	template<typename T> bool WaitChannel(u32 ch, T pred);
+
+	void MarkLSDirty(u32 lsa, u32 size) const
+	{
+		if (!size) return;
+
+		for (u32 i = (lsa & 0x3ffff) >> 10, end = std::min<u32>((lsa & 0x3ffff) + size - 1, 0x3ffff) >> 10; i <= end; i++)
+		{
+			ls_dirty[i] = 1;
+		}
+	}
+
+	// data is the source of PUT transfer (LS is used if not specified)
+	void ProcessCmd(u32 cmd, u32 tag, u32 lsa, u64 ea, u32 size, const u8* data = nullptr);
 
 	void ListCmd(u32 lsa, u64 ea, u16 tag, u16 size, u32 cmd, MFCReg& MFCArgs);
 
 	void EnqMfcCmd(MFCReg& MFCArgs);
 
+	void QueueTransfer(u32 cmd, u16 tag, u32 lsa, u64 ea, u32 size, bool first);
+
+	// complete transfers of tag groups specified by the mask
+	void FlushMfcQueue(u32 mask = ~0);
+
 	bool CheckEvents();
 
 	u32 GetChannelCount(u32 ch);
@@ -500,11 +541,11 @@ public:
 	u64  ReadLS64 (const u32 lsa) const { return vm::read64 (lsa + m_offset); }
 	u128 ReadLS128(const u32 lsa) const { return vm::read128(lsa + m_offset); }
 
-	void WriteLS8  (const u32 lsa, const u8&   data) const { vm::write8  (lsa + m_offset, data); }
-	void WriteLS16 (const u32 lsa, const u16&  data) const { vm::write16 (lsa + m_offset, data); }
-	void WriteLS32 (const u32 lsa, const u32&  data) const { vm::write32 (lsa + m_offset, data); }
-	void WriteLS64 (const u32 lsa, const u64&  data) const { vm::write64 (lsa + m_offset, data); }
-	void WriteLS128(const u32 lsa, const u128& data) const { vm::write128(lsa + m_offset, data); }
+	void WriteLS8  (const u32 lsa, const u8&   data) const { vm::write8  (lsa + m_offset, data); ls_dirty[(lsa & 0x3ffff) >> 10] = 1; }
+	void WriteLS16 (const u32 lsa, const u16&  data) const { vm::write16 (lsa + m_offset, data); ls_dirty[(lsa & 0x3ffff) >> 10] = 1; }
+	void WriteLS32 (const u32 lsa, const u32&  data) const { vm::write32 (lsa + m_offset, data); ls_dirty[(lsa & 0x3ffff) >> 10] = 1; }
+	void WriteLS64 (const u32 lsa, const u64&  data) const { vm::write64 (lsa + m_offset, data); ls_dirty[(lsa & 0x3ffff) >> 10] = 1; }
+	void WriteLS128(const u32 lsa, const u128& data) const { vm::write128(lsa + m_offset, data); ls_dirty[(lsa & 0x3ffff) >> 10] = 1; }
 
 	std::function<void(SPUThread& SPU)> m_custom_task;
 	std::function<u64(SPUThread& SPU)> m_code3_func;
@@ -519,6 +560,16 @@ public:
 
 		for(uint i=0; i<128; ++i) ret += fmt::Format("GPR[%d] = 0x%s\n", i, GPR[i].to_hex().c_str());
 
+		ret += fmt::Format("\nCode invalidations: %lld (%d/s)\n", code_inv_count, code_inv_rate);
+
+		for (u32 i = 0; i < 32; i++)
+		{
+			if (m_ch_wait_count[i])
+			{
+				ret += fmt::Format("Channel %d: %lld waits, %lld us\n", i, m_ch_wait_count[i], m_ch_wait_time[i]);
+			}
+		}
+
 		return ret;
 	}
 
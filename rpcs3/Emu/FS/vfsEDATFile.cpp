@@ -0,0 +1,149 @@
+#include "stdafx.h"
+#include "Utilities/Log.h"
+#include "Emu/System.h"
+
+#include "VFS.h"
+#include "vfsEDATFile.h"
+
+vfsEDATFile::vfsEDATFile()
+	: vfsFileBase(nullptr)
+	, m_npd()
+	, m_edat()
+	, m_stamp(0)
+{
+}
+
+bool vfsEDATFile::Open(const std::string& path, const u8* klicensee)
+{
+	Close();
+
+	std::shared_ptr<vfsFileBase> file(Emu.GetVFS().OpenFile(path, vfsRead));
+
+	if (!file || !file->IsOpened())
+	{
+		return false;
+	}
+
+	NPD_HEADER npd;
+	EDAT_HEADER edat;
+	u8 key[0x10];
+	u8 devklic[0x10] = {};
+	u8 rifkey[0x10] = {};
+
+	if (klicensee)
+	{
+		memcpy(devklic, klicensee, 0x10);
+	}
+
+	// only the header is checked, the blocks are verified when they are decrypted
+	if (read_header(file.get(), path.c_str(), devklic, rifkey, &npd, &edat, key, false) ||
+		check_header(key, &edat, &npd, file.get(), false))
+	{
+		return false;
+	}
+
+	m_file = file;
+	m_npd = npd;
+	m_edat = edat;
+	memcpy(m_key, key, sizeof(m_key));
+	m_cache.reserve(g_edat_cached_blocks);
+
+	return vfsFileBase::Open(path, vfsRead);
+}
+
+bool vfsEDATFile::Open(const std::string& path, vfsOpenMode mode)
+{
+	return mode == vfsRead && Open(path, nullptr);
+}
+
+bool vfsEDATFile::Close()
+{
+	m_file.reset();
+	m_edat = {};
+	m_cache.clear();
+	m_stamp = 0;
+
+	return vfsFileBase::Close();
+}
+
+vfsEDATFile::CachedBlock* vfsEDATFile::GetBlock(u32 index)
+{
+	CachedBlock* block = nullptr;
+
+	for (auto& cached : m_cache)
+	{
+		if (cached.index == index)
+		{
+			cached.stamp = ++m_stamp;
+			return &cached;
+		}
+
+		if (!block || cached.stamp < block->stamp)
+		{
+			block = &cached;
+		}
+	}
+
+	// replace the least recently used block
+	if (m_cache.size() < g_edat_cached_blocks)
+	{
+		m_cache.emplace_back();
+		block = &m_cache.back();
+		block->data.resize(m_edat.block_size);
+	}
+
+	const int size = decrypt_block(m_file.get(), block->data.data(), &m_edat, &m_npd, m_key, index, false);
+
+	if (size < 0)
+	{
+		LOG_ERROR(HLE, "vfsEDATFile: failed to decrypt block %d of '%s'", index, m_path.c_str());
+		block->index = ~0;
+		block->stamp = 0;
+		return nullptr;
+	}
+
+	block->index = index;
+	block->size = size;
+	block->stamp = ++m_stamp;
+
+	return block;
+}
+
+u64 vfsEDATFile::GetSize()
+{
+	return m_edat.file_size;
+}
+
+u64 vfsEDATFile::Write(const void* src, u64 size)
+{
+	return 0;
+}
+
+u64 vfsEDATFile::Read(void* dst, u64 size)
+{
+	u64 done = 0;
+
+	while (done < size && m_pos < m_edat.file_size)
+	{
+		const u32 offset = m_pos % m_edat.block_size;
+		const CachedBlock* block = GetBlock((u32)(m_pos / m_edat.block_size));
+
+		if (!block || offset >= block->size)
+		{
+			break;
+		}
+
+		const u32 count = (u32)std::min<u64>(block->size - offset, size - done);
+
+		memcpy((u8*)dst + done, block->data.data() + offset, count);
+		done += count;
+		m_pos += count;
+	}
+
+	return done;
+}
+
+bool vfsEDATFile::IsOpened() const
+{
+	return m_file && m_file->IsOpened();
+}
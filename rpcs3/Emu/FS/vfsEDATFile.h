@@ -0,0 +1,41 @@
+#pragma once
+#include "vfsFileBase.h"
+#include "Crypto/unedat.h"
+
+static const u32 g_edat_cached_blocks = 4; // number of decrypted blocks kept by vfsEDATFile
+
+// EDAT or SDATA file opened for reading, the blocks are decrypted (and decompressed) when they are read
+class vfsEDATFile : public vfsFileBase
+{
+	struct CachedBlock
+	{
+		u32 index;
+		u32 size; // size of the decrypted data
+		u64 stamp; // last use
+		std::vector<u8> data;
+	};
+
+	std::shared_ptr<vfsFileBase> m_file; // encrypted file
+	NPD_HEADER m_npd;
+	EDAT_HEADER m_edat;
+	u8 m_key[0x10];
+	std::vector<CachedBlock> m_cache;
+	u64 m_stamp;
+
+	CachedBlock* GetBlock(u32 index);
+
+public:
+	vfsEDATFile();
+
+	// klicensee: key of EDAT file (not required for SDATA files)
+	bool Open(const std::string& path, const u8* klicensee);
+	virtual bool Open(const std::string& path, vfsOpenMode mode = vfsRead) override;
+	virtual bool Close() override;
+
+	virtual u64 GetSize() override;
+
+	virtual u64 Write(const void* src, u64 size) override;
+	virtual u64 Read(void* dst, u64 size) override;
+
+	virtual bool IsOpened() const override;
+};
@@ -340,6 +340,7 @@ bool MemoryBlock::IsMyAddress(const u64 addr)
 DynamicMemoryBlockBase::DynamicMemoryBlockBase()
 	: MemoryBlock()
 	, m_max_size(0)
+	, m_used_size(0)
 {
 }
 
@@ -347,14 +348,7 @@ const u32 DynamicMemoryBlockBase::GetUsedSize() const
 {
 	LV2_LOCK(0);
 
-	u32 size = 0;
-
-	for (u32 i = 0; i<m_allocated.size(); ++i)
-	{
-		size += m_allocated[i].size;
-	}
-
-	return size;
+	return m_used_size;
 }
 
 bool DynamicMemoryBlockBase::IsInMyRange(const u64 addr)
@@ -383,6 +377,13 @@ MemoryBlock* DynamicMemoryBlockBase::SetRange(const u64 start, const u32 size)
 		return nullptr;
 	}
 
+	m_allocated.clear();
+	m_free.clear();
+	for (auto& list : m_free_class) list.clear();
+	m_used_size = 0;
+
+	AddFreeRange(start, m_max_size);
+
 	return this;
 }
 
@@ -391,7 +392,10 @@ void DynamicMemoryBlockBase::Delete()
 	LV2_LOCK(0);
 
 	m_allocated.clear();
+	m_free.clear();
+	for (auto& list : m_free_class) list.clear();
 	m_max_size = 0;
+	m_used_size = 0;
 
 	MemoryBlock::Delete();
 }
@@ -410,19 +414,84 @@ bool DynamicMemoryBlockBase::AllocFixed(u64 addr, u32 size)
 
 	LV2_LOCK(0);
 
-	for (u32 i = 0; i<m_allocated.size(); ++i)
-	{
-		if (addr >= m_allocated[i].addr && addr < m_allocated[i].addr + m_allocated[i].size) return false;
-	}
+	if (!TakeFreeRange(addr, size)) return false;
 
 	AppendMem(addr, size);
 
 	return true;
 }
 
+u32 DynamicMemoryBlockBase::FreeClass(u32 size) /* private */
+{
+	u32 result = 0;
+	while (size >>= 1) result++;
+	return result;
+}
+
 void DynamicMemoryBlockBase::AppendMem(u64 addr, u32 size) /* private */
 {
-	m_allocated.emplace_back(addr, size);
+	m_allocated.emplace(addr, MemBlockInfo(addr, size));
+	m_used_size += size;
+}
+
+void DynamicMemoryBlockBase::AddFreeRange(u64 addr, u32 size) /* private */
+{
+	// merge with the previous range
+	auto next = m_free.lower_bound(addr);
+
+	if (next != m_free.begin())
+	{
+		auto prev = std::prev(next);
+
+		if (prev->first + prev->second == addr)
+		{
+			addr = prev->first;
+			size += prev->second;
+			RemoveFreeRange(prev);
+		}
+	}
+
+	// merge with the next range
+	if (next != m_free.end() && addr + size == next->first)
+	{
+		size += next->second;
+		RemoveFreeRange(next);
+	}
+
+	m_free.emplace(addr, size);
+	m_free_class[FreeClass(size)].insert(addr);
+}
+
+void DynamicMemoryBlockBase::RemoveFreeRange(std::map<u64, u32>::iterator range) /* private */
+{
+	m_free_class[FreeClass(range->second)].erase(range->first);
+	m_free.erase(range);
+}
+
+bool DynamicMemoryBlockBase::TakeFreeRange(u64 addr, u32 size) /* private */
+{
+	// find the free range containing the address
+	auto range = m_free.upper_bound(addr);
+
+	if (range == m_free.begin()) return false;
+
+	range--;
+
+	const u64 range_addr = range->first;
+	const u64 range_end = range->first + range->second;
+
+	if (addr >= range_end || addr + size > range_end) return false;
+
+	// zero-sized allocation only needs free address
+	if (!size) return true;
+
+	RemoveFreeRange(range);
+
+	// return unused parts
+	if (addr > range_addr) AddFreeRange(range_addr, (u32)(addr - range_addr));
+	if (addr + size < range_end) AddFreeRange(addr + size, (u32)(range_end - addr - size));
+
+	return true;
 }
 
 u64 DynamicMemoryBlockBase::AllocAlign(u32 size, u32 align)
@@ -449,36 +518,47 @@ u64 DynamicMemoryBlockBase::AllocAlign(u32 size, u32 align)
 
 	LV2_LOCK(0);
 
-	for (u64 addr = MemoryBlock::GetStartAddr(); addr <= MemoryBlock::GetEndAddr() - exsize;)
-	{
-		bool is_good_addr = true;
+	// first fit: find the free range with the lowest address which has at least exsize bytes
+	u64 addr = ~0ull;
+
+	// ranges of the size class of exsize may be too small, the first one which is big enough is taken
+	const u32 cls = FreeClass(exsize);
 
-		for (u32 i = 0; i<m_allocated.size(); ++i)
+	for (auto range : m_free_class[cls])
+	{
+		if (m_free.at(range) >= exsize)
 		{
-			if ((addr >= m_allocated[i].addr && addr < m_allocated[i].addr + m_allocated[i].size) ||
-				(m_allocated[i].addr >= addr && m_allocated[i].addr < addr + exsize))
-			{
-				is_good_addr = false;
-				addr = m_allocated[i].addr + m_allocated[i].size;
-				break;
-			}
+			addr = range;
+			break;
 		}
+	}
 
-		if (!is_good_addr) continue;
-
-		if (align)
+	// every range of bigger size classes is big enough, so only the lowest address of each class is checked
+	for (u32 i = cls + 1; i < 32; i++)
+	{
+		if (!m_free_class[i].empty())
 		{
-			addr = (addr + (align - 1)) & ~(align - 1);
+			addr = std::min(addr, *m_free_class[i].begin());
 		}
+	}
 
-		//LOG_NOTICE(MEMORY, "AllocAlign(size=0x%x) -> 0x%llx", size, addr);
-
-		AppendMem(addr, size);
+	if (addr == ~0ull)
+	{
+		return 0;
+	}
 
-		return addr;
+	if (align)
+	{
+		addr = (addr + (align - 1)) & ~(u64)(align - 1);
 	}
 
-	return 0;
+	//LOG_NOTICE(MEMORY, "AllocAlign(size=0x%x) -> 0x%llx", size, addr);
+
+	TakeFreeRange(addr, size);
+
+	AppendMem(addr, size);
+
+	return addr;
 }
 
 bool DynamicMemoryBlockBase::Alloc()
@@ -490,21 +570,25 @@ bool DynamicMemoryBlockBase::Free(u64 addr)
 {
 	LV2_LOCK(0);
 
-	for (u32 num = 0; num < m_allocated.size(); num++)
+	auto block = m_allocated.find(addr);
+
+	if (block != m_allocated.end())
 	{
-		if (addr == m_allocated[num].addr)
-		{
-			//LOG_NOTICE(MEMORY, "Free(0x%llx)", addr);
+		//LOG_NOTICE(MEMORY, "Free(0x%llx)", addr);
 
-			m_allocated.erase(m_allocated.begin() + num);
-			return true;
-		}
+		const u32 size = block->second.size;
+
+		m_allocated.erase(block);
+		m_used_size -= size;
+
+		if (size) AddFreeRange(addr, size);
+		return true;
 	}
 
 	LOG_ERROR(MEMORY, "DynamicMemoryBlock::Free(addr=0x%llx): failed", addr);
-	for (u32 i = 0; i < m_allocated.size(); i++)
+	for (auto& block : m_allocated)
 	{
-		LOG_NOTICE(MEMORY, "*** Memory Block: addr = 0x%llx, size = 0x%x", m_allocated[i].addr, m_allocated[i].size);
+		LOG_NOTICE(MEMORY, "*** Memory Block: addr = 0x%llx, size = 0x%x", block.second.addr, block.second.size);
 	}
 	return false;
 }
@@ -544,9 +628,31 @@ MemoryBlock* VirtualMemoryBlock::SetRange(const u64 start, const u32 size)
 	range_start = start;
 	range_size = size;
 
+	m_pages.assign(size >> 20, ~0ull);
+
+	for (auto& info : m_mapped_memory)
+	{
+		SetPages(info, true);
+	}
+
 	return this;
 }
 
+void VirtualMemoryBlock::SetPages(const VirtualMemInfo& info, bool mapped)
+{
+	if (info.addr < GetStartAddr() || ((info.addr - GetStartAddr()) | info.realAddress | info.size) & 0xfffff)
+	{
+		return;
+	}
+
+	const u64 first = (info.addr - GetStartAddr()) >> 20;
+
+	for (u64 i = 0; i < info.size >> 20 && first + i < m_pages.size(); i++)
+	{
+		m_pages[first + i] = mapped ? info.realAddress + (i << 20) : ~0ull;
+	}
+}
+
 bool VirtualMemoryBlock::IsInMyRange(const u64 addr)
 {
 	return addr >= GetStartAddr() && addr < GetStartAddr() + GetSize() - GetReservedAmount();
@@ -591,6 +697,7 @@ u64 VirtualMemoryBlock::Map(u64 realaddr, u32 size)
 		if (!is_good_addr) continue;
 
 		m_mapped_memory.emplace_back(addr, realaddr, size);
+		SetPages(m_mapped_memory.back(), true);
 
 		return addr;
 	}
@@ -604,6 +711,7 @@ bool VirtualMemoryBlock::Map(u64 realaddr, u32 size, u64 addr)
 		return false;
 
 	m_mapped_memory.emplace_back(addr, realaddr, size);
+	SetPages(m_mapped_memory.back(), true);
 	return true;
 }
 
@@ -614,6 +722,7 @@ bool VirtualMemoryBlock::UnmapRealAddress(u64 realaddr, u32& size)
 		if (m_mapped_memory[i].realAddress == realaddr && IsInMyRange(m_mapped_memory[i].addr, m_mapped_memory[i].size))
 		{
 			size = m_mapped_memory[i].size;
+			SetPages(m_mapped_memory[i], false);
 			m_mapped_memory.erase(m_mapped_memory.begin() + i);
 			return true;
 		}
@@ -629,6 +738,7 @@ bool VirtualMemoryBlock::UnmapAddress(u64 addr, u32& size)
 		if (m_mapped_memory[i].addr == addr && IsInMyRange(m_mapped_memory[i].addr, m_mapped_memory[i].size))
 		{
 			size = m_mapped_memory[i].size;
+			SetPages(m_mapped_memory[i], false);
 			m_mapped_memory.erase(m_mapped_memory.begin() + i);
 			return true;
 		}
@@ -657,6 +767,14 @@ bool VirtualMemoryBlock::Write32(const u64 addr, const u32 value)
 
 bool VirtualMemoryBlock::getRealAddr(u64 addr, u64& result)
 {
+	const u64 page = (addr - GetStartAddr()) >> 20;
+
+	if (page < m_pages.size() && m_pages[page] != ~0ull)
+	{
+		result = m_pages[page] + ((addr - GetStartAddr()) & 0xfffff);
+		return true;
+	}
+
 	for (u32 i = 0; i<m_mapped_memory.size(); ++i)
 	{
 		if (addr >= m_mapped_memory[i].addr && addr < m_mapped_memory[i].addr + m_mapped_memory[i].size)
@@ -685,6 +803,7 @@ u64 VirtualMemoryBlock::getMappedAddress(u64 realAddress)
 void VirtualMemoryBlock::Delete()
 {
 	m_mapped_memory.clear();
+	m_pages.clear();
 
 	MemoryBlock::Delete();
 }
@@ -1,4 +1,5 @@
 #pragma once
+#include <map>
 
 #define PAGE_4K(x) (x + 4095) & ~(4095)
 
@@ -116,8 +117,11 @@ public:
 
 class DynamicMemoryBlockBase : public MemoryBlock
 {
-	std::vector<MemBlockInfo> m_allocated; // allocation info
+	std::multimap<u64, MemBlockInfo> m_allocated; // allocation info (ordered by address, zero-sized allocations may share the address)
+	std::map<u64, u32> m_free; // free ranges (ordered by address, adjacent ranges are merged)
+	std::set<u64> m_free_class[32]; // addresses of free ranges by size class (floor(log2(size)))
 	u32 m_max_size;
+	u32 m_used_size;
 
 public:
 	DynamicMemoryBlockBase();
@@ -144,7 +148,11 @@ public:
 	virtual u8* GetMem(u64 addr) const;
 
 private:
+	static u32 FreeClass(u32 size);
 	void AppendMem(u64 addr, u32 size);
+	void AddFreeRange(u64 addr, u32 size);
+	void RemoveFreeRange(std::map<u64, u32>::iterator range);
+	bool TakeFreeRange(u64 addr, u32 size);
 };
 
 class VirtualMemoryBlock : public MemoryBlock
@@ -152,6 +160,11 @@ class VirtualMemoryBlock : public MemoryBlock
 	std::vector<VirtualMemInfo> m_mapped_memory;
 	u32 m_reserve_size;
 
+	// real addresses of 1 MB pages (only mappings aligned to 1 MB are stored, ~0 means the page should be searched in m_mapped_memory)
+	std::vector<u64> m_pages;
+
+	void SetPages(const VirtualMemInfo& info, bool mapped);
+
 public:
 	VirtualMemoryBlock();
 
@@ -198,6 +211,8 @@ public:
 
 	// return the mapped address given a real address, if not mapped return 0
 	u64 getMappedAddress(u64 realAddress);
+
+	const std::vector<VirtualMemInfo>& GetMappedMemory() const { return m_mapped_memory; }
 };
 
 typedef DynamicMemoryBlockBase DynamicMemoryBlock;
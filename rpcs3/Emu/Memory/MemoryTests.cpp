@@ -0,0 +1,168 @@
+#include "stdafx.h"
+#include <random>
+#include "Utilities/Log.h"
+#include "Utilities/Thread.h"
+#include "rpcs3/Ini.h"
+#include "Memory.h"
+#include "Emu/SysCalls/lv2/sys_time.h"
+
+namespace vm
+{
+	// increment the first u64 of the line with GETLLAR/PUTLLC loop, returns the number of failed updates
+	static u64 reservation_increment(u32 addr, u32 count)
+	{
+		u64 data[16];
+		u64 failed = 0;
+
+		for (u32 i = 0; i < count; i++)
+		{
+			while (true)
+			{
+				reservation_acquire(data, addr, 128);
+				data[0]++;
+
+				if (reservation_update(addr, data, 128))
+				{
+					break;
+				}
+
+				failed++;
+			}
+		}
+
+		return failed;
+	}
+
+	static void reservation_benchmark_run()
+	{
+		const u32 count = 100000; // updates per thread
+		const u32 max_threads = 8;
+		const u32 addr = alloc(max_threads * 4096, main);
+
+		for (auto mode : { reservation_protect, reservation_lockfree })
+		{
+			reservation_set_mode(mode);
+
+			for (u32 threads = 1; threads <= max_threads; threads *= 2)
+			{
+				// all threads update the same line or every thread updates its own page
+				for (bool shared : { true, false })
+				{
+					memset(get_ptr(addr), 0, max_threads * 4096);
+
+					std::atomic<u64> failed(0);
+					const u64 start = get_system_time();
+
+					{
+						std::vector<std::unique_ptr<thread_t>> workers;
+
+						for (u32 t = 0; t < threads; t++)
+						{
+							const u32 line = shared ? addr : addr + t * 4096;
+
+							workers.emplace_back(new thread_t(fmt::Format("Reservation Benchmark[%d]", t), true, [line, count, &failed]()
+							{
+								failed += reservation_increment(line, count);
+							}));
+						}
+					}
+
+					const u64 time = std::max<u64>(get_system_time() - start, 1);
+
+					for (u32 t = 0; t < (shared ? 1 : threads); t++)
+					{
+						const u64 value = get_ref<u64>(addr + t * 4096);
+
+						if (value != (shared ? threads * count : count))
+						{
+							LOG_ERROR(MEMORY, "Reservation benchmark: line 0x%x contains %lld (expected %d)", addr + t * 4096, value, shared ? threads * count : count);
+						}
+					}
+
+					LOG_NOTICE(MEMORY, "Reservations (%s, %d threads, %s): %.2f M updates/s, %lld failed updates",
+						mode == reservation_lockfree ? "lock-free" : "protection", threads, shared ? "same line" : "own lines", (double)threads * count / time, failed.load());
+				}
+			}
+		}
+
+		dealloc(addr, main);
+
+		reservation_set_mode(static_cast<reservation_mode_t>(Ini.CPUReservationMode.GetValue()));
+	}
+
+	void reservation_benchmark()
+	{
+		// plain stores to protected pages are only handled on named threads
+		thread_t("Reservation Benchmark", true, reservation_benchmark_run);
+	}
+
+	static void log_latency(const char* name, std::vector<u64>& time)
+	{
+		std::sort(time.begin(), time.end());
+
+		const auto percentile = [&time](u32 p) { return time[(time.size() - 1) * p / 100]; };
+
+		LOG_NOTICE(MEMORY, "%s latency: p50=%lldns, p90=%lldns, p99=%lldns, max=%lldns", name, percentile(50), percentile(90), percentile(99), time.back());
+	}
+
+	void alloc_benchmark()
+	{
+		const u32 count = 100000; // allocations
+		const u32 max_live = 4096; // allocations kept at once
+
+		std::mt19937 rng(0);
+		std::vector<u32> live;
+		std::vector<u64> alloc_time, free_time;
+		alloc_time.reserve(count);
+		free_time.reserve(count);
+
+		const auto now = []() -> u64
+		{
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now().time_since_epoch()).count();
+		};
+
+		const auto dealloc_random = [&]()
+		{
+			const size_t index = rng() % live.size();
+			const u32 addr = live[index];
+			live[index] = live.back();
+			live.pop_back();
+
+			const u64 start = now();
+			dealloc(addr, main);
+			free_time.push_back(now() - start);
+		};
+
+		for (u32 i = 0; i < count; i++)
+		{
+			// mostly small blocks (like stack temporaries), sometimes big ones, random alignment
+			const u32 size = rng() % 16 ? (rng() % 16 + 1) * 4096 : (rng() % 64 + 1) * 0x10000;
+			const u32 align = rng() % 4 ? 1 : 0x10000;
+
+			if (live.size() >= max_live || (live.size() && rng() % 2))
+			{
+				dealloc_random();
+			}
+
+			const u64 start = now();
+			const u32 addr = Memory.MainMem.AllocAlign(size, align);
+			alloc_time.push_back(now() - start);
+
+			if (!addr || addr % align)
+			{
+				LOG_ERROR(MEMORY, "Allocation benchmark: AllocAlign(size=0x%x, align=0x%x) returned 0x%x", size, align, addr);
+				break;
+			}
+
+			live.push_back(addr);
+		}
+
+		while (live.size())
+		{
+			dealloc_random();
+		}
+
+		log_latency("Allocation", alloc_time);
+		log_latency("Deallocation", free_time);
+	}
+}
@@ -1,5 +1,7 @@
 #include "stdafx.h"
+#include <unordered_map>
 #include "Utilities/Log.h"
+#include "rpcs3/Ini.h"
 #include "Memory.h"
 #include "Emu/System.h"
 #include "Emu/CPU/CPUThread.h"
@@ -133,13 +135,70 @@ namespace vm
 
 	};
 
-	std::function<void()> g_reservation_cb = nullptr;
-	NamedThreadBase* g_reservation_owner = nullptr;
+	// reservation granularity (the size of SPU lock line)
+	const u32 reservation_line_size = 128;
 
-	u32 g_reservation_addr = 0;
-	u32 g_reservation_size = 0;
+	// number of line version stamps (lines are hashed, collision may only cause spurious update failure)
+	const u32 reservation_line_count = 4096;
 
-	reservation_mutex_t g_reservation_mutex;
+	// number of independently locked groups of pages
+	const u32 reservation_stripe_count = 64;
+
+	struct reservation_t
+	{
+		NamedThreadBase* owner;
+		u32 addr;
+		u32 size;
+		u64 stamp; // line version at the moment of acquiring
+		std::function<void()> callback;
+
+		reservation_t(NamedThreadBase* owner, u32 addr, u32 size, u64 stamp, const std::function<void()>& callback)
+			: owner(owner)
+			, addr(addr)
+			, size(size)
+			, stamp(stamp)
+			, callback(callback)
+		{
+		}
+	};
+
+	struct reservation_stripe_t
+	{
+		reservation_mutex_t mutex;
+		std::vector<reservation_t> list; // active reservations on the pages of this stripe
+		std::unordered_map<u32, u32> pages; // lock-free mode: number of reservations on the page (key: page index)
+	};
+
+	std::atomic<u64> g_reservation_stamp[reservation_line_count];
+	reservation_stripe_t g_reservation_stripe[reservation_stripe_count];
+
+	std::atomic<u64> g_reservation_acquired(0);
+	std::atomic<u64> g_reservation_updated(0);
+	std::atomic<u64> g_reservation_failed(0);
+	std::atomic<u64> g_reservation_broken(0);
+
+	// address of the reservation of the current thread (may be already broken by another thread)
+	thread_local u32 g_tls_reservation_addr = 0;
+	thread_local bool g_tls_reservation_set = false;
+
+	// reservation size and line version of the current thread (lock-free mode only)
+	thread_local u32 g_tls_reservation_size = 0;
+	thread_local u64 g_tls_reservation_stamp = 0;
+
+	// pages made read-only by lock-free reservations to catch plain stores (bit per page, cleared when a store is caught)
+	std::atomic<u64> g_reservation_pages[0x100000 / 64];
+
+	reservation_mode_t g_reservation_mode = reservation_protect;
+
+	__forceinline std::atomic<u64>& reservation_stamp(u32 addr)
+	{
+		return g_reservation_stamp[(addr / reservation_line_size) % reservation_line_count];
+	}
+
+	__forceinline reservation_stripe_t& reservation_stripe(u32 addr)
+	{
+		return g_reservation_stripe[(addr >> 12) % reservation_stripe_count];
+	}
 
 	void _reservation_set(u32 addr, bool no_access = false)
 	{
@@ -158,120 +217,206 @@ namespace vm
 		//LOG_NOTICE(MEMORY, "VirtualProtect: %f us", (get_time() - stamp0) / 80.f);
 	}
 
-	bool _reservation_break(u32 addr)
+	void _reservation_unset(u32 addr)
 	{
-		if (g_reservation_addr >> 12 == addr >> 12)
-		{
-			//const auto stamp0 = get_time();
+		//const auto stamp0 = get_time();
 
 #ifdef _WIN32
-			DWORD old;
-			if (!VirtualProtect(vm::get_ptr(addr & ~0xfff), 4096, PAGE_READWRITE, &old))
+		DWORD old;
+		if (!VirtualProtect(vm::get_ptr(addr & ~0xfff), 4096, PAGE_READWRITE, &old))
 #else
-			if (mprotect(vm::get_ptr(addr & ~0xfff), 4096, PROT_READ | PROT_WRITE))
+		if (mprotect(vm::get_ptr(addr & ~0xfff), 4096, PROT_READ | PROT_WRITE))
 #endif
+		{
+			throw fmt::format("vm::_reservation_unset() failed (addr=0x%x)", addr);
+		}
+
+		//LOG_NOTICE(MEMORY, "VirtualAlloc: %f us", (get_time() - stamp0) / 80.f);
+	}
+
+	bool _reservation_page_used(reservation_stripe_t& stripe, u32 addr)
+	{
+		for (auto& r : stripe.list)
+		{
+			if (r.addr >> 12 == addr >> 12)
 			{
-				throw fmt::format("vm::_reservation_break() failed (addr=0x%x)", addr);
+				return true;
 			}
+		}
 
-			//LOG_NOTICE(MEMORY, "VirtualAlloc: %f us", (get_time() - stamp0) / 80.f);
+		return false;
+	}
 
-			if (g_reservation_cb)
+	// set memory protection according to the reservations left on the page
+	void _reservation_restore(reservation_stripe_t& stripe, u32 addr)
+	{
+		if (_reservation_page_used(stripe, addr))
+		{
+			_reservation_set(addr);
+		}
+		else
+		{
+			_reservation_unset(addr);
+		}
+	}
+
+	// break reservations of the line (or of the whole page) and notify their owners
+	bool _reservation_break(reservation_stripe_t& stripe, u32 addr, bool whole_page)
+	{
+		bool result = false;
+
+		for (auto r = stripe.list.begin(); r != stripe.list.end();)
+		{
+			if (whole_page ? r->addr >> 12 == addr >> 12 : r->addr / reservation_line_size == addr / reservation_line_size)
 			{
-				g_reservation_cb();
-				g_reservation_cb = nullptr;
+				reservation_stamp(r->addr)++;
+
+				if (r->callback)
+				{
+					r->callback();
+				}
+
+				r = stripe.list.erase(r);
+				g_reservation_broken++;
+				result = true;
 			}
+			else
+			{
+				r++;
+			}
+		}
 
-			g_reservation_owner = nullptr;
-			g_reservation_addr = 0;
-			g_reservation_size = 0;
+		return result;
+	}
 
-			return true;
+	// silently remove the reservation of the current thread, return true if it was still active
+	bool _reservation_free(NamedThreadBase* owner)
+	{
+		if (!g_tls_reservation_set)
+		{
+			return false;
+		}
+
+		g_tls_reservation_set = false;
+
+		const u32 addr = g_tls_reservation_addr;
+		reservation_stripe_t& stripe = reservation_stripe(addr);
+
+		std::lock_guard<reservation_mutex_t> lock(stripe.mutex);
+
+		for (auto r = stripe.list.begin(); r != stripe.list.end(); r++)
+		{
+			if (r->owner == owner)
+			{
+				stripe.list.erase(r);
+				_reservation_restore(stripe, addr);
+				return true;
+			}
 		}
 
 		return false;
 	}
 
-	bool reservation_break(u32 addr)
+	bool _protect_reservation_break(u32 addr)
 	{
-		std::lock_guard<reservation_mutex_t> lock(g_reservation_mutex);
+		reservation_stripe_t& stripe = reservation_stripe(addr);
 
-		return _reservation_break(addr);
+		std::lock_guard<reservation_mutex_t> lock(stripe.mutex);
+
+		if (_reservation_break(stripe, addr, true))
+		{
+			_reservation_unset(addr);
+			return true;
+		}
+
+		return false;
 	}
 
-	bool reservation_acquire(void* data, u32 addr, u32 size, const std::function<void()>& callback)
+	bool _protect_reservation_acquire(void* data, u32 addr, u32 size, const std::function<void()>& callback)
 	{
-		//const auto stamp0 = get_time();
+		NamedThreadBase* owner = GetCurrentNamedThread();
 
-		bool broken = false;
+		// free previous reservation of this thread
+		const bool released = _reservation_free(owner);
 
-		assert(size == 1 || size == 2 || size == 4 || size == 8 || size == 128);
-		assert((addr + size - 1 & ~0xfff) == (addr & ~0xfff));
+		reservation_stripe_t& stripe = reservation_stripe(addr);
 
 		{
-			std::lock_guard<reservation_mutex_t> lock(g_reservation_mutex);
-
-			// silent unlocking to prevent priority boost for threads going to break reservation
-			//g_reservation_mutex.do_notify = false;
+			std::lock_guard<reservation_mutex_t> lock(stripe.mutex);
 
-			// break previous reservation
-			if (g_reservation_owner)
+			// change memory protection to read-only (if it's the first reservation on the page)
+			if (!_reservation_page_used(stripe, addr))
 			{
-				broken = _reservation_break(g_reservation_addr);
+				_reservation_set(addr);
 			}
 
-			// change memory protection to read-only
-			_reservation_set(addr);
-
 			// may not be necessary
 			_mm_mfence();
 
 			// set additional information
-			g_reservation_addr = addr;
-			g_reservation_size = size;
-			g_reservation_owner = GetCurrentNamedThread();
-			g_reservation_cb = callback;
+			stripe.list.push_back(reservation_t(owner, addr, size, reservation_stamp(addr).load(), callback));
 
 			// copy data
 			memcpy(data, vm::get_ptr(addr), size);
 		}
 
-		return broken;
+		g_tls_reservation_addr = addr;
+		g_tls_reservation_set = true;
+
+		return released;
 	}
 
-	bool reservation_update(u32 addr, const void* data, u32 size)
+	bool _protect_reservation_update(u32 addr, const void* data, u32 size)
 	{
-		assert(size == 1 || size == 2 || size == 4 || size == 8 || size == 128);
-		assert((addr + size - 1 & ~0xfff) == (addr & ~0xfff));
+		NamedThreadBase* owner = GetCurrentNamedThread();
+		reservation_stripe_t& stripe = reservation_stripe(addr);
+
+		std::lock_guard<reservation_mutex_t> lock(stripe.mutex);
+
+		auto r = stripe.list.begin();
 
-		std::lock_guard<reservation_mutex_t> lock(g_reservation_mutex);
+		while (r != stripe.list.end() && r->owner != owner)
+		{
+			r++;
+		}
 
-		if (g_reservation_owner != GetCurrentNamedThread() || g_reservation_addr != addr || g_reservation_size != size)
+		if (r == stripe.list.end() || r->addr != addr || r->size != size || r->stamp != reservation_stamp(addr))
 		{
+			if (r != stripe.list.end())
+			{
+				g_tls_reservation_set = false;
+				stripe.list.erase(r);
+				_reservation_restore(stripe, addr);
+			}
+
 			// atomic update failed
 			return false;
 		}
 
+		// remove own reservation without calling the callback
+		g_tls_reservation_set = false;
+		stripe.list.erase(r);
+
 		// change memory protection to no access
 		_reservation_set(addr, true);
 
 		// update memory using privileged access
 		memcpy(vm::get_priv_ptr(addr), data, size);
 
-		// remove callback to not call it on successful update
-		g_reservation_cb = nullptr;
+		// update line version and break other reservations of the line
+		reservation_stamp(addr)++;
+		_reservation_break(stripe, addr, false);
 
-		// free the reservation and restore memory protection
-		_reservation_break(addr);
+		// restore memory protection
+		_reservation_restore(stripe, addr);
 
 		// atomic update succeeded
 		return true;
 	}
 
-	bool reservation_query(u32 addr, bool is_writing)
+	bool _protect_reservation_query(u32 addr, bool is_writing)
 	{
-		std::lock_guard<reservation_mutex_t> lock(g_reservation_mutex);
-
+		// checked before locking the stripe (the faulting thread may hold LV2 lock)
 		{
 			LV2_LOCK(0);
 
@@ -281,58 +426,383 @@ namespace vm
 			}
 		}
 
+		reservation_stripe_t& stripe = reservation_stripe(addr);
+
+		std::lock_guard<reservation_mutex_t> lock(stripe.mutex);
+
 		if (is_writing)
 		{
-			// break the reservation
-			_reservation_break(addr);
+			// memory protection is set per page, so all reservations of the page are broken
+			_reservation_break(stripe, addr, true);
+			_reservation_unset(addr);
 		}
 		
 		return true;
 	}
 
-	void reservation_free()
+
+	void _protect_reservation_op(u32 addr, u32 size, std::function<void()> proc)
 	{
-		std::lock_guard<reservation_mutex_t> lock(g_reservation_mutex);
+		// free previous reservation of this thread
+		_reservation_free(GetCurrentNamedThread());
 
-		if (g_reservation_owner == GetCurrentNamedThread())
+		reservation_stripe_t& stripe = reservation_stripe(addr);
+
+		std::lock_guard<reservation_mutex_t> lock(stripe.mutex);
+
+		// break other reservations of the line
+		reservation_stamp(addr)++;
+		_reservation_break(stripe, addr, false);
+
+		// change memory protection to no access
+		_reservation_set(addr, true);
+
+		// may not be necessary
+		_mm_mfence();
+
+		// do the operation
+		proc();
+
+		// restore memory protection
+		_reservation_restore(stripe, addr);
+	}
+
+	__forceinline bool _lockfree_page_protected(u32 addr)
+	{
+		return (g_reservation_pages[addr >> 18].load() & (1ull << ((addr >> 12) & 63))) != 0;
+	}
+
+	// make the page read-only if it isn't (add_ref: count one more reservation on the page)
+	void _lockfree_protect(u32 addr, bool add_ref)
+	{
+		if (!add_ref && _lockfree_page_protected(addr))
 		{
-			_reservation_break(g_reservation_addr);
+			return;
+		}
+
+		reservation_stripe_t& stripe = reservation_stripe(addr);
+
+		std::lock_guard<reservation_mutex_t> lock(stripe.mutex);
+
+		if (add_ref)
+		{
+			stripe.pages[addr >> 12]++;
+		}
+
+		if (!_lockfree_page_protected(addr))
+		{
+			_reservation_set(addr);
+			g_reservation_pages[addr >> 18] |= 1ull << ((addr >> 12) & 63);
 		}
 	}
 
-	void reservation_op(u32 addr, u32 size, std::function<void()> proc)
+	// release one reservation on the page, the page is unprotected when the last one is released
+	void _lockfree_unprotect(u32 addr)
 	{
-		assert(size == 1 || size == 2 || size == 4 || size == 8 || size == 128);
-		assert((addr + size - 1 & ~0xfff) == (addr & ~0xfff));
+		reservation_stripe_t& stripe = reservation_stripe(addr);
+
+		std::lock_guard<reservation_mutex_t> lock(stripe.mutex);
+
+		auto found = stripe.pages.find(addr >> 12);
+
+		if (found == stripe.pages.end() || --found->second)
+		{
+			return;
+		}
+
+		stripe.pages.erase(found);
 
-		std::lock_guard<reservation_mutex_t> lock(g_reservation_mutex);
+		if (_lockfree_page_protected(addr))
+		{
+			g_reservation_pages[addr >> 18] &= ~(1ull << ((addr >> 12) & 63));
+			_reservation_unset(addr);
+		}
+	}
+
+	// release the reservation of the current thread
+	void _lockfree_reservation_free()
+	{
+		if (g_tls_reservation_set)
+		{
+			g_tls_reservation_set = false;
+			_lockfree_unprotect(g_tls_reservation_addr);
+		}
+	}
 
-		// break previous reservation
-		if (g_reservation_owner != GetCurrentNamedThread() || g_reservation_addr != addr || g_reservation_size != size)
+	// forget all pages (restore: make protected pages writable, memory must be still mapped)
+	void _lockfree_reset(bool restore)
+	{
+		for (u32 i = 0; i < reservation_stripe_count; i++)
 		{
-			if (g_reservation_owner)
+			std::lock_guard<reservation_mutex_t> lock(g_reservation_stripe[i].mutex);
+
+			g_reservation_stripe[i].pages.clear();
+		}
+
+		for (u32 i = 0; i < sizeof(g_reservation_pages) / sizeof(g_reservation_pages[0]); i++)
+		{
+			const u64 bits = g_reservation_pages[i].exchange(0);
+
+			for (u32 j = 0; restore && j < 64; j++)
 			{
-				_reservation_break(g_reservation_addr);
+				if (bits & (1ull << j))
+				{
+					_reservation_unset((i * 64 + j) << 12);
+				}
 			}
 		}
+	}
 
-		// change memory protection to no access
-		_reservation_set(addr, true);
+	bool _lockfree_reservation_query(u32 addr, bool is_writing)
+	{
+		if (!is_writing || !_lockfree_page_protected(addr))
+		{
+			return false;
+		}
 
-		// set additional information
-		g_reservation_addr = addr;
-		g_reservation_size = size;
-		g_reservation_owner = GetCurrentNamedThread();
-		g_reservation_cb = nullptr;
+		// checked before locking the stripe (the faulting thread may hold LV2 lock)
+		{
+			LV2_LOCK(0);
 
-		// may not be necessary
-		_mm_mfence();
+			if (!Memory.IsGoodAddr(addr))
+			{
+				return false;
+			}
+		}
+
+		reservation_stripe_t& stripe = reservation_stripe(addr);
+
+		std::lock_guard<reservation_mutex_t> lock(stripe.mutex);
+
+		if (!_lockfree_page_protected(addr))
+		{
+			// already unprotected by another thread
+			return true;
+		}
+
+		// the page is protected again by the next reservation acquired on it
+		g_reservation_pages[addr >> 18] &= ~(1ull << ((addr >> 12) & 63));
+		_reservation_unset(addr);
+
+		// the store is repeated after return, so every line of the page gets new version after the page is unprotected
+		// (acquire checks the page bit again, so it can't take the new version and miss the store)
+		for (u32 line = addr & ~0xfff; line < (addr & ~0xfff) + 4096; line += reservation_line_size)
+		{
+			reservation_stamp(line) += 2;
+		}
+
+		g_reservation_broken++;
+		return true;
+	}
+
+	bool _lockfree_reservation_acquire(void* data, u32 addr, u32 size)
+	{
+		std::atomic<u64>& stamp = reservation_stamp(addr);
+
+		const bool released = g_tls_reservation_set;
+
+		// release the previous reservation, the page stays protected until this one is released
+		_lockfree_reservation_free();
+		_lockfree_protect(addr, true);
+
+		while (true)
+		{
+			_lockfree_protect(addr, false);
+
+			const u64 value = stamp.load();
+
+			// odd version means the line is being updated
+			if (value & 1)
+			{
+				_mm_pause();
+				continue;
+			}
+
+			memcpy(data, vm::get_ptr(addr), size);
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+
+			if (stamp.load() == value && _lockfree_page_protected(addr))
+			{
+				g_tls_reservation_stamp = value;
+				break;
+			}
+		}
+
+		g_tls_reservation_addr = addr;
+		g_tls_reservation_size = size;
+		g_tls_reservation_set = true;
+
+		return released;
+	}
+
+	bool _lockfree_reservation_update(u32 addr, const void* data, u32 size)
+	{
+		if (!g_tls_reservation_set || g_tls_reservation_addr != addr || g_tls_reservation_size != size)
+		{
+			_lockfree_reservation_free();
+			return false;
+		}
+
+		std::atomic<u64>& stamp = reservation_stamp(addr);
+
+		// lock the line if its version didn't change
+		u64 value = g_tls_reservation_stamp;
+
+		if (!stamp.compare_exchange_strong(value, value + 1))
+		{
+			_lockfree_reservation_free();
+			return false;
+		}
+
+		// plain stores to the page are caught by memory protection and change the version
+		memcpy(vm::get_priv_ptr(addr), data, size);
+
+		// unlock the line with new version
+		stamp.store(value + 2, std::memory_order_release);
+
+		_lockfree_reservation_free();
+		return true;
+	}
+
+	void _lockfree_reservation_op(u32 addr, u32 size, std::function<void()> proc)
+	{
+		_lockfree_reservation_free();
+
+		std::atomic<u64>& stamp = reservation_stamp(addr);
+
+		u64 value = stamp.load();
+
+		// lock the line
+		while ((value & 1) || !stamp.compare_exchange_weak(value, value + 1))
+		{
+			_mm_pause();
+			value = stamp.load();
+		}
 
-		// do the operation
 		proc();
 
-		// remove the reservation
-		_reservation_break(addr);
+		stamp.store(value + 2, std::memory_order_release);
+	}
+
+	void reservation_set_mode(reservation_mode_t mode)
+	{
+		// pages protected in lock-free mode aren't tracked in the other mode
+		_lockfree_reset(true);
+
+		g_reservation_mode = mode;
+	}
+
+	bool reservation_break(u32 addr)
+	{
+		if (g_reservation_mode == reservation_lockfree)
+		{
+			// unprotect the page and change versions of its lines
+			return _lockfree_reservation_query(addr, true);
+		}
+
+		return _protect_reservation_break(addr);
+	}
+
+	bool reservation_acquire(void* data, u32 addr, u32 size, const std::function<void()>& callback)
+	{
+		assert(size == 1 || size == 2 || size == 4 || size == 8 || size == 128);
+		assert((addr + size - 1 & ~0xfff) == (addr & ~0xfff));
+
+		g_reservation_acquired++;
+
+		if (g_reservation_mode == reservation_lockfree)
+		{
+			// callback can't be called in this mode, reservation_lost() should be polled instead
+			return _lockfree_reservation_acquire(data, addr, size);
+		}
+
+		return _protect_reservation_acquire(data, addr, size, callback);
+	}
+
+	bool reservation_update(u32 addr, const void* data, u32 size)
+	{
+		assert(size == 1 || size == 2 || size == 4 || size == 8 || size == 128);
+		assert((addr + size - 1 & ~0xfff) == (addr & ~0xfff));
+
+		const bool result = g_reservation_mode == reservation_lockfree
+			? _lockfree_reservation_update(addr, data, size)
+			: _protect_reservation_update(addr, data, size);
+
+		if (result)
+		{
+			g_reservation_updated++;
+		}
+		else
+		{
+			g_reservation_failed++;
+		}
+
+		return result;
+	}
+
+	bool reservation_query(u32 addr, bool is_writing)
+	{
+		if (g_reservation_mode == reservation_lockfree)
+		{
+			return _lockfree_reservation_query(addr, is_writing);
+		}
+
+		return _protect_reservation_query(addr, is_writing);
+	}
+
+	bool reservation_lost()
+	{
+		if (g_reservation_mode != reservation_lockfree || !g_tls_reservation_set)
+		{
+			return false;
+		}
+
+		const u32 addr = g_tls_reservation_addr;
+
+		if (reservation_stamp(addr).load() == g_tls_reservation_stamp)
+		{
+			return false;
+		}
+
+		_lockfree_reservation_free();
+		g_reservation_broken++;
+		return true;
+	}
+
+	void reservation_free()
+	{
+		if (g_reservation_mode == reservation_lockfree)
+		{
+			return _lockfree_reservation_free();
+		}
+
+		_reservation_free(GetCurrentNamedThread());
+	}
+
+	void reservation_op(u32 addr, u32 size, std::function<void()> proc)
+	{
+		assert(size == 1 || size == 2 || size == 4 || size == 8 || size == 128);
+		assert((addr + size - 1 & ~0xfff) == (addr & ~0xfff));
+
+		if (g_reservation_mode == reservation_lockfree)
+		{
+			return _lockfree_reservation_op(addr, size, proc);
+		}
+
+		_protect_reservation_op(addr, size, proc);
+	}
+
+	reservation_stats_t reservation_get_stats()
+	{
+		reservation_stats_t stats;
+
+		stats.acquired = g_reservation_acquired;
+		stats.updated = g_reservation_updated;
+		stats.failed = g_reservation_failed;
+		stats.broken = g_reservation_broken;
+
+		return stats;
 	}
 
 	bool check_addr(u32 addr)
@@ -449,6 +919,8 @@ namespace vm
 
 		void init()
 		{
+			reservation_set_mode(static_cast<reservation_mode_t>(Ini.CPUReservationMode.GetValue()));
+
 			Memory.Init(Memory_PS3);
 		}
 	}
@@ -457,6 +929,8 @@ namespace vm
 	{
 		void init()
 		{
+			reservation_set_mode(static_cast<reservation_mode_t>(Ini.CPUReservationMode.GetValue()));
+
 			Memory.Init(Memory_PSV);
 		}
 	}
@@ -465,6 +939,8 @@ namespace vm
 	{
 		void init()
 		{
+			reservation_set_mode(static_cast<reservation_mode_t>(Ini.CPUReservationMode.GetValue()));
+
 			Memory.Init(Memory_PSP);
 		}
 	}
@@ -482,6 +958,13 @@ namespace vm
 
 	void close()
 	{
+		const reservation_stats_t stats = reservation_get_stats();
+
+		LOG_NOTICE(MEMORY, "Reservations: acquired=%lld, updated=%lld, failed=%lld, broken=%lld", stats.acquired, stats.updated, stats.failed, stats.broken);
+
+		// the memory is unmapped, so protection isn't restored
+		_lockfree_reset(false);
+
 		Memory.Close();
 	}
 
@@ -28,16 +28,40 @@ namespace vm
 	extern void* g_priv_addr;
 	extern void* const g_base_addr;
 
-	// break the reservation, return true if it was successfully broken
+	enum reservation_mode_t : u8
+	{
+		reservation_protect, // memory protection is changed for reserved pages
+		reservation_lockfree, // line versions, reserved pages are read-only until the reservations are released or a plain store is caught
+	};
+
+	struct reservation_stats_t
+	{
+		u64 acquired; // reservations taken
+		u64 updated; // successful atomic updates
+		u64 failed; // failed atomic updates
+		u64 broken; // reservations lost because of another write
+	};
+
+	// break all reservations on the page, return true if any of them was broken
 	bool reservation_break(u32 addr);
-	// read memory and reserve it for further atomic update, return true if the previous reservation was broken
+	// read memory and reserve it for further atomic update, return true if the previous reservation of this thread was dropped
 	bool reservation_acquire(void* data, u32 addr, u32 size, const std::function<void()>& callback = nullptr);
 	// attempt to atomically update reserved memory
 	bool reservation_update(u32 addr, const void* data, u32 size);
 	bool reservation_query(u32 addr, bool is_writing);
+	// check if the reservation of the current thread was lost (lock-free mode only, callbacks are used otherwise)
+	bool reservation_lost();
 	void reservation_free();
 	// perform complete operation
 	void reservation_op(u32 addr, u32 size, std::function<void()> proc);
+	// select reservation engine (must be called before any thread is started)
+	void reservation_set_mode(reservation_mode_t mode);
+	// get reservation statistics since the start
+	reservation_stats_t reservation_get_stats();
+	// measure GETLLAR/PUTLLC throughput from several host threads in both modes (memory must be initialized), results are logged
+	void reservation_benchmark();
+	// measure latency of allocations and deallocations of random sizes in the main memory, results are logged
+	void alloc_benchmark();
 
 	bool map(u32 addr, u32 size, u32 flags);
 	bool unmap(u32 addr, u32 size = 0, u32 flags = 0);
@@ -102,7 +102,7 @@ std::string GLFragmentDecompilerThread::AddConst()
 		return name;
 	}
 
-	auto data = vm::ptr<u32>::make(m_addr + m_size + 4 * sizeof(u32));
+	auto data = m_data + (m_size + 4 * sizeof(u32)) / sizeof(u32);
 
 	m_offset = 2 * 4 * sizeof(u32);
 	u32 x = GetData(data[0]);
@@ -358,7 +358,7 @@ std::string GLFragmentDecompilerThread::BuildCode()
 
 void GLFragmentDecompilerThread::Task()
 {
-	auto data = vm::ptr<u32>::make(m_addr);
+	auto data = m_data;
 	m_size = 0;
 	m_location = 0;
 	m_loop_count = 0;
@@ -644,9 +644,14 @@ void GLFragmentProgram::Wait()
 	}
 }
 
+const char* GLFragmentProgram::GetDecompilerVersion()
+{
+	return __DATE__ " " __TIME__;
+}
+
 void GLFragmentProgram::Decompile(RSXFragmentProgram& prog)
 {
-	GLFragmentDecompilerThread decompiler(shader, parr, prog.addr, prog.size, prog.ctrl);
+	GLFragmentDecompilerThread decompiler(shader, parr, vm::get_ptr<be_t<u32>>(prog.addr), prog.ctrl);
 	decompiler.Task();
 }
 
@@ -664,7 +669,7 @@ void GLFragmentProgram::DecompileAsync(RSXFragmentProgram& prog)
 		m_decompiler_thread = nullptr;
 	}
 
-	m_decompiler_thread = new GLFragmentDecompilerThread(shader, parr, prog.addr, prog.size, prog.ctrl);
+	m_decompiler_thread = new GLFragmentDecompilerThread(shader, parr, vm::get_ptr<be_t<u32>>(prog.addr), prog.ctrl);
 	m_decompiler_thread->Start();
 }
 
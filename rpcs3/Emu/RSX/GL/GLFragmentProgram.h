@@ -120,8 +120,8 @@ struct GLFragmentDecompilerThread : public ThreadBase
 	std::string main;
 	std::string& m_shader;
 	GLParamArray& m_parr;
-	u32 m_addr;
-	u32& m_size;
+	const be_t<u32>* m_data; // program code (may be a copy of PS3 memory)
+	u32 m_size;
 	u32 m_const_index;
 	u32 m_offset;
 	u32 m_location;
@@ -131,17 +131,16 @@ struct GLFragmentDecompilerThread : public ThreadBase
 	std::vector<u32> m_end_offsets;
 	std::vector<u32> m_else_offsets;
 
-	GLFragmentDecompilerThread(std::string& shader, GLParamArray& parr, u32 addr, u32& size, u32 ctrl)
+	GLFragmentDecompilerThread(std::string& shader, GLParamArray& parr, const be_t<u32>* data, u32 ctrl)
 		: ThreadBase("Fragment Shader Decompiler Thread")
 		, m_shader(shader)
 		, m_parr(parr)
-		, m_addr(addr)
-		, m_size(size) 
+		, m_data(data)
+		, m_size(0)
 		, m_const_index(0)
 		, m_location(0)
 		, m_ctrl(ctrl)
 	{
-		m_size = 0;
 	}
 
 	std::string GetMask();
@@ -197,6 +196,9 @@ public:
 	/** Compile the decompiled fragment shader into a format we can use with OpenGL. */
 	void Compile();
 
+	/** Build time of the decompiler, changes whenever it's rebuilt (identifies its output in the program cache). */
+	static const char* GetDecompilerVersion();
+
 private:
 	/** Threaded fragment shader decompiler responsible for decompiling this program */
 	GLFragmentDecompilerThread* m_decompiler_thread;
@@ -5,6 +5,8 @@
 #include "Utilities/Log.h"
 #include "Emu/Memory/Memory.h"
 #include "Emu/System.h"
+#include "Emu/SysCalls/lv2/sys_time.h"
+#include "Emu/RSX/RSXTextureDecode.h"
 #include "GLGSRender.h"
 
 GetGSFrameCb GetGSFrame = nullptr;
@@ -95,31 +97,140 @@ float GLTexture::GetMaxAniso(int aniso)
 	return 1.0f;
 }
 
-void GLTexture::Init(RSXTexture& tex)
+// size of one level of the texture data (tightly packed)
+static u32 GetLevelSize(int format, u32 width, u32 height)
 {
-	if (tex.GetLocation() > 1)
+	switch (format)
 	{
-		return;
+	case CELL_GCM_TEXTURE_COMPRESSED_DXT1: return ((width + 3) / 4) * ((height + 3) / 4) * 8;
+	case CELL_GCM_TEXTURE_COMPRESSED_DXT23:
+	case CELL_GCM_TEXTURE_COMPRESSED_DXT45: return ((width + 3) / 4) * ((height + 3) / 4) * 16;
+	case CELL_GCM_TEXTURE_B8: return width * height;
+	case CELL_GCM_TEXTURE_A1R5G5B5:
+	case CELL_GCM_TEXTURE_A4R4G4B4:
+	case CELL_GCM_TEXTURE_R5G6B5:
+	case CELL_GCM_TEXTURE_G8B8:
+	case CELL_GCM_TEXTURE_R6G5B5:
+	case CELL_GCM_TEXTURE_DEPTH16:
+	case CELL_GCM_TEXTURE_DEPTH16_FLOAT:
+	case CELL_GCM_TEXTURE_X16:
+	case CELL_GCM_TEXTURE_R5G5B5A1:
+	case CELL_GCM_TEXTURE_D1R5G5B5:
+	case ~(CELL_GCM_TEXTURE_LN | CELL_GCM_TEXTURE_UN) & CELL_GCM_TEXTURE_COMPRESSED_B8R8_G8R8:
+	case ~(CELL_GCM_TEXTURE_LN | CELL_GCM_TEXTURE_UN) & CELL_GCM_TEXTURE_COMPRESSED_R8B8_R8G8: return width * height * 2;
+	case CELL_GCM_TEXTURE_W16_Z16_Y16_X16_FLOAT: return width * height * 8;
+	case CELL_GCM_TEXTURE_W32_Z32_Y32_X32_FLOAT: return width * height * 16;
 	}
 
-	Bind();
+	return width * height * 4;
+}
 
-	const u64 texaddr = GetAddress(tex.GetOffset(), tex.GetLocation());
-	if (!Memory.IsGoodAddr(texaddr))
+u32 GLTexture::GetDataSize(RSXTexture& tex)
+{
+	return GetLevelSize(tex.GetFormat() & ~(CELL_GCM_TEXTURE_LN | CELL_GCM_TEXTURE_UN), tex.GetWidth(), tex.GetHeight());
+}
+
+static bool IsCompressedFormat(int format)
+{
+	return format == CELL_GCM_TEXTURE_COMPRESSED_DXT1 || format == CELL_GCM_TEXTURE_COMPRESSED_DXT23 || format == CELL_GCM_TEXTURE_COMPRESSED_DXT45;
+}
+
+// count of levels stored in RSX memory (the mipmap count is limited by the dimensions)
+static u32 GetLevelCount(RSXTexture& tex)
+{
+	u32 count = 1;
+
+	while (count < tex.GetMipmap() && (tex.GetWidth() >> count || tex.GetHeight() >> count))
 	{
-		LOG_ERROR(RSX, "Bad texture address=0x%x", texaddr);
-		return;
+		count++;
+	}
+
+	return count;
+}
+
+u32 GLTexture::GetGuestSize(RSXTexture& tex)
+{
+	const int format = tex.GetFormat() & ~(CELL_GCM_TEXTURE_LN | CELL_GCM_TEXTURE_UN);
+	const bool is_linear = (tex.GetFormat() & CELL_GCM_TEXTURE_LN) != 0;
+	u32 size = 0;
+
+	for (u32 level = 0; level < GetLevelCount(tex); level++)
+	{
+		const u32 width = std::max(tex.GetWidth() >> level, 1);
+		const u32 height = std::max(tex.GetHeight() >> level, 1);
+		const u32 packed = GetLevelSize(format, width, height);
+		const u32 rows = IsCompressedFormat(format) ? (height + 3) / 4 : height;
+
+		// the pitch is the same for all levels
+		size += is_linear ? std::max(tex.m_pitch * rows, packed) : packed;
+	}
+
+	return size;
+}
+
+u32 GLTexture::GetUploadSize(RSXTexture& tex)
+{
+	const int format = tex.GetFormat() & ~(CELL_GCM_TEXTURE_LN | CELL_GCM_TEXTURE_UN);
+	u32 size = 0;
+
+	for (u32 level = 0; level < GetLevelCount(tex); level++)
+	{
+		const u32 width = std::max(tex.GetWidth() >> level, 1);
+		const u32 height = std::max(tex.GetHeight() >> level, 1);
+
+		// unsized GL formats take at least 4 bytes per texel
+		size += IsCompressedFormat(format) ? GetLevelSize(format, width, height) : std::max(GetLevelSize(format, width, height), width * height * 4);
+	}
+
+	return size;
+}
+
+// bytes per texel of the formats stored in Morton order when swizzled (0 for block-compressed formats)
+static u32 GetTexelSize(int format)
+{
+	switch (format)
+	{
+	case CELL_GCM_TEXTURE_COMPRESSED_DXT1:
+	case CELL_GCM_TEXTURE_COMPRESSED_DXT23:
+	case CELL_GCM_TEXTURE_COMPRESSED_DXT45:
+	case ~(CELL_GCM_TEXTURE_LN | CELL_GCM_TEXTURE_UN) & CELL_GCM_TEXTURE_COMPRESSED_B8R8_G8R8:
+	case ~(CELL_GCM_TEXTURE_LN | CELL_GCM_TEXTURE_UN) & CELL_GCM_TEXTURE_COMPRESSED_R8B8_R8G8: return 0;
+	case CELL_GCM_TEXTURE_B8: return 1;
+	case CELL_GCM_TEXTURE_A1R5G5B5:
+	case CELL_GCM_TEXTURE_A4R4G4B4:
+	case CELL_GCM_TEXTURE_R5G6B5:
+	case CELL_GCM_TEXTURE_G8B8:
+	case CELL_GCM_TEXTURE_R6G5B5:
+	case CELL_GCM_TEXTURE_DEPTH16:
+	case CELL_GCM_TEXTURE_DEPTH16_FLOAT:
+	case CELL_GCM_TEXTURE_X16:
+	case CELL_GCM_TEXTURE_R5G5B5A1:
+	case CELL_GCM_TEXTURE_D1R5G5B5: return 2;
+	case CELL_GCM_TEXTURE_W16_Z16_Y16_X16_FLOAT: return 8;
+	case CELL_GCM_TEXTURE_W32_Z32_Y32_X32_FLOAT: return 16;
 	}
-	//LOG_WARNING(RSX, "texture addr = 0x%x, width = %d, height = %d, max_aniso=%d, mipmap=%d, remap=0x%x, zfunc=0x%x, wraps=0x%x, wrapt=0x%x, wrapr=0x%x, minlod=0x%x, maxlod=0x%x", 
-	//	m_offset, m_width, m_height, m_maxaniso, m_mipmap, m_remap, m_zfunc, m_wraps, m_wrapt, m_wrapr, m_minlod, m_maxlod);
-	
-	//TODO: safe init
-	checkForGlError("GLTexture::Init() -> glBindTexture");
 
+	return 4;
+}
+
+const GLint* GLTexture::Upload(RSXTexture& tex, const u8* pixels)
+{
 	int format = tex.GetFormat() & ~(CELL_GCM_TEXTURE_LN | CELL_GCM_TEXTURE_UN);
 	bool is_swizzled = !(tex.GetFormat() & CELL_GCM_TEXTURE_LN);
 
-	auto pixels = vm::get_ptr<const u8>(texaddr);
+	// swizzled texture data is converted to linear order first (swizzled textures have power-of-2 dimensions)
+	std::vector<u8> linear;
+	const u32 texel_size = GetTexelSize(format);
+	const u32 width = tex.GetWidth();
+	const u32 height = tex.GetHeight();
+
+	if (is_swizzled && texel_size && !(width & (width - 1)) && !(height & (height - 1)))
+	{
+		linear.resize(width * height * texel_size);
+		UnswizzleTexture(linear.data(), pixels, width, height, texel_size);
+		pixels = linear.data();
+	}
+
 	u8 *unswizzledPixels;
 	static const GLint glRemapStandard[4] = { GL_ALPHA, GL_RED, GL_GREEN, GL_BLUE };
 	// NOTE: This must be in ARGB order in all forms below.
@@ -139,26 +250,27 @@ void GLTexture::Init(RSXTexture& tex)
 
 	case CELL_GCM_TEXTURE_A1R5G5B5:
 	{
-		glPixelStorei(GL_UNPACK_SWAP_BYTES, GL_TRUE);
-		checkForGlError("GLTexture::Init() -> glPixelStorei");
+		const u32 numPixels = tex.GetWidth() * tex.GetHeight();
+		unswizzledPixels = (u8 *)malloc(numPixels * 4);
+		ConvertA1R5G5B5(unswizzledPixels, pixels, numPixels);
 
-		// TODO: texture swizzling
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, tex.GetWidth(), tex.GetHeight(), 0, GL_BGRA, GL_UNSIGNED_SHORT_1_5_5_5_REV, pixels);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, tex.GetWidth(), tex.GetHeight(), 0, GL_RGBA, GL_UNSIGNED_BYTE, unswizzledPixels);
 		checkForGlError("GLTexture::Init() -> glTexImage2D(CELL_GCM_TEXTURE_A1R5G5B5)");
 
-		glPixelStorei(GL_UNPACK_SWAP_BYTES, GL_FALSE);
-		checkForGlError("GLTexture::Init() -> glPixelStorei(CELL_GCM_TEXTURE_A1R5G5B5)");
+		free(unswizzledPixels);
 		break;
 	}
 
 	case CELL_GCM_TEXTURE_A4R4G4B4:
 	{
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, tex.GetWidth(), tex.GetHeight(), 0, GL_RGBA, GL_UNSIGNED_SHORT_4_4_4_4, pixels);
+		const u32 numPixels = tex.GetWidth() * tex.GetHeight();
+		unswizzledPixels = (u8 *)malloc(numPixels * 4);
+		ConvertA4R4G4B4(unswizzledPixels, pixels, numPixels);
+
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, tex.GetWidth(), tex.GetHeight(), 0, GL_RGBA, GL_UNSIGNED_BYTE, unswizzledPixels);
 		checkForGlError("GLTexture::Init() -> glTexImage2D(CELL_GCM_TEXTURE_A4R4G4B4)");
 
-		// We read it in as R4G4B4A4, so we need to remap each component.
-		static const GLint swizzleMaskA4R4G4B4[] = { GL_BLUE, GL_ALPHA, GL_RED, GL_GREEN };
-		glRemap = swizzleMaskA4R4G4B4;
+		free(unswizzledPixels);
 		break;
 	}
 
@@ -177,28 +289,7 @@ void GLTexture::Init(RSXTexture& tex)
 
 	case CELL_GCM_TEXTURE_A8R8G8B8:
 	{
-		if (is_swizzled)
-		{
-			u32 *src, *dst;
-			u32 log2width, log2height;
-
-			unswizzledPixels = (u8*)malloc(tex.GetWidth() * tex.GetHeight() * 4);
-			src = (u32*)pixels;
-			dst = (u32*)unswizzledPixels;
-
-			log2width = log(tex.GetWidth()) / log(2);
-			log2height = log(tex.GetHeight()) / log(2);
-
-			for (int i = 0; i < tex.GetHeight(); i++)
-			{
-				for (int j = 0; j < tex.GetWidth(); j++)
-				{
-					dst[(i*tex.GetHeight()) + j] = src[LinearToSwizzleAddress(j, i, 0, log2width, log2height, 0)];
-				}
-			}
-		}
-
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, tex.GetWidth(), tex.GetHeight(), 0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8, is_swizzled ? unswizzledPixels : pixels);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, tex.GetWidth(), tex.GetHeight(), 0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8, pixels);
 		checkForGlError("GLTexture::Init() -> glTexImage2D(CELL_GCM_TEXTURE_A8R8G8B8)");
 		break;
 	}
@@ -242,17 +333,9 @@ void GLTexture::Init(RSXTexture& tex)
 
 	case CELL_GCM_TEXTURE_R6G5B5:
 	{
-		// TODO: Probably need to actually unswizzle if is_swizzled.
 		const u32 numPixels = tex.GetWidth() * tex.GetHeight();
 		unswizzledPixels = (u8 *)malloc(numPixels * 4);
-		// TODO: Speed.
-		for (u32 i = 0; i < numPixels; ++i) {
-			u16 c = reinterpret_cast<const be_t<u16> *>(pixels)[i];
-			unswizzledPixels[i * 4 + 0] = Convert6To8((c >> 10) & 0x3F);
-			unswizzledPixels[i * 4 + 1] = Convert5To8((c >> 5) & 0x1F);
-			unswizzledPixels[i * 4 + 2] = Convert5To8((c >> 0) & 0x1F);
-			unswizzledPixels[i * 4 + 3] = 255;
-		}
+		ConvertR6G5B5(unswizzledPixels, pixels, numPixels);
 
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, tex.GetWidth(), tex.GetHeight(), 0, GL_RGBA, GL_UNSIGNED_BYTE, unswizzledPixels);
 		checkForGlError("GLTexture::Init() -> glTexImage2D(CELL_GCM_TEXTURE_R6G5B5)");
@@ -263,8 +346,15 @@ void GLTexture::Init(RSXTexture& tex)
 
 	case CELL_GCM_TEXTURE_DEPTH24_D8: //  24-bit unsigned fixed-point number and 8 bits of garbage
 	{
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, tex.GetWidth(), tex.GetHeight(), 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_BYTE, pixels);
+		const u32 numPixels = tex.GetWidth() * tex.GetHeight();
+		unswizzledPixels = (u8 *)malloc(numPixels * 4);
+		ConvertDepth24(unswizzledPixels, pixels, numPixels);
+
+		// the garbage bits only affect the lowest bits of the depth
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, tex.GetWidth(), tex.GetHeight(), 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, unswizzledPixels);
 		checkForGlError("GLTexture::Init() -> glTexImage2D(CELL_GCM_TEXTURE_DEPTH24_D8)");
+
+		free(unswizzledPixels);
 		break;
 	}
 
@@ -277,8 +367,14 @@ void GLTexture::Init(RSXTexture& tex)
 
 	case CELL_GCM_TEXTURE_DEPTH16: // 16-bit unsigned fixed-point number
 	{
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT16, tex.GetWidth(), tex.GetHeight(), 0, GL_DEPTH_COMPONENT, GL_SHORT, pixels);
+		const u32 numPixels = tex.GetWidth() * tex.GetHeight();
+		unswizzledPixels = (u8 *)malloc(numPixels * 2);
+		ConvertX16(unswizzledPixels, pixels, numPixels);
+
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT16, tex.GetWidth(), tex.GetHeight(), 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_SHORT, unswizzledPixels);
 		checkForGlError("GLTexture::Init() -> glTexImage2D(CELL_GCM_TEXTURE_DEPTH16)");
+
+		free(unswizzledPixels);
 		break;
 	}
 
@@ -291,14 +387,14 @@ void GLTexture::Init(RSXTexture& tex)
 
 	case CELL_GCM_TEXTURE_X16: // A 16-bit fixed-point number
 	{
-		glPixelStorei(GL_UNPACK_SWAP_BYTES, GL_TRUE);
-		checkForGlError("GLTexture::Init() -> glPixelStorei(CELL_GCM_TEXTURE_X16)");
+		const u32 numPixels = tex.GetWidth() * tex.GetHeight();
+		unswizzledPixels = (u8 *)malloc(numPixels * 2);
+		ConvertX16(unswizzledPixels, pixels, numPixels);
 
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, tex.GetWidth(), tex.GetHeight(), 0, GL_RED, GL_UNSIGNED_SHORT, pixels);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, tex.GetWidth(), tex.GetHeight(), 0, GL_RED, GL_UNSIGNED_SHORT, unswizzledPixels);
 		checkForGlError("GLTexture::Init() -> glTexImage2D(CELL_GCM_TEXTURE_X16)");
 
-		glPixelStorei(GL_UNPACK_SWAP_BYTES, GL_FALSE);
-		checkForGlError("GLTexture::Init() -> glPixelStorei(CELL_GCM_TEXTURE_X16)");
+		free(unswizzledPixels);
 
 		static const GLint swizzleMaskX16[] = { GL_RED, GL_ONE, GL_RED, GL_ONE };
 		glRemap = swizzleMaskX16;
@@ -307,14 +403,14 @@ void GLTexture::Init(RSXTexture& tex)
 
 	case CELL_GCM_TEXTURE_Y16_X16: // Two 16-bit fixed-point numbers
 	{
-		glPixelStorei(GL_UNPACK_SWAP_BYTES, GL_TRUE);
-		checkForGlError("GLTexture::Init() -> glPixelStorei(CELL_GCM_TEXTURE_Y16_X16)");
+		const u32 numPixels = tex.GetWidth() * tex.GetHeight();
+		unswizzledPixels = (u8 *)malloc(numPixels * 4);
+		ConvertX16(unswizzledPixels, pixels, numPixels * 2);
 
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, tex.GetWidth(), tex.GetHeight(), 0, GL_RG, GL_UNSIGNED_SHORT, pixels);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, tex.GetWidth(), tex.GetHeight(), 0, GL_RG, GL_UNSIGNED_SHORT, unswizzledPixels);
 		checkForGlError("GLTexture::Init() -> glTexImage2D(CELL_GCM_TEXTURE_Y16_X16)");
 
-		glPixelStorei(GL_UNPACK_SWAP_BYTES, GL_FALSE);
-		checkForGlError("GLTexture::Init() -> glPixelStorei(CELL_GCM_TEXTURE_Y16_X16)");
+		free(unswizzledPixels);
 
 		static const GLint swizzleMaskX32_Y16_X16[] = { GL_GREEN, GL_RED, GL_GREEN, GL_RED };
 		glRemap = swizzleMaskX32_Y16_X16;
@@ -369,7 +465,6 @@ void GLTexture::Init(RSXTexture& tex)
 		glPixelStorei(GL_UNPACK_SWAP_BYTES, GL_TRUE);
 		checkForGlError("GLTexture::Init() -> glPixelStorei(CELL_GCM_TEXTURE_D1R5G5B5)");
 
-		// TODO: Texture swizzling
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, tex.GetWidth(), tex.GetHeight(), 0, GL_BGRA, GL_UNSIGNED_SHORT_1_5_5_5_REV, pixels);
 		checkForGlError("GLTexture::Init() -> glTexImage2D(CELL_GCM_TEXTURE_D1R5G5B5)");
 
@@ -412,20 +507,7 @@ void GLTexture::Init(RSXTexture& tex)
 	{
 		const u32 numPixels = tex.GetWidth() * tex.GetHeight();
 		unswizzledPixels = (u8 *)malloc(numPixels * 4);
-		// TODO: Speed.
-		for (u32 i = 0; i < numPixels; i += 2)
-		{
-			unswizzledPixels[i * 4 + 0 + 0] = pixels[i * 2 + 3];
-			unswizzledPixels[i * 4 + 0 + 1] = pixels[i * 2 + 2];
-			unswizzledPixels[i * 4 + 0 + 2] = pixels[i * 2 + 0];
-			unswizzledPixels[i * 4 + 0 + 3] = 255;
-
-			// The second pixel is the same, except for red.
-			unswizzledPixels[i * 4 + 4 + 0] = pixels[i * 2 + 1];
-			unswizzledPixels[i * 4 + 4 + 1] = pixels[i * 2 + 2];
-			unswizzledPixels[i * 4 + 4 + 2] = pixels[i * 2 + 0];
-			unswizzledPixels[i * 4 + 4 + 3] = 255;
-		}
+		ConvertB8R8_G8R8(unswizzledPixels, pixels, numPixels);
 
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, tex.GetWidth(), tex.GetHeight(), 0, GL_RGBA, GL_UNSIGNED_BYTE, unswizzledPixels);
 		checkForGlError("GLTexture::Init() -> glTexImage2D(CELL_GCM_TEXTURE_COMPRESSED_B8R8_G8R8 & ~(CELL_GCM_TEXTURE_LN | CELL_GCM_TEXTURE_UN)");
@@ -438,20 +520,7 @@ void GLTexture::Init(RSXTexture& tex)
 	{
 		const u32 numPixels = tex.GetWidth() * tex.GetHeight();
 		unswizzledPixels = (u8 *)malloc(numPixels * 4);
-		// TODO: Speed.
-		for (u32 i = 0; i < numPixels; i += 2)
-		{
-			unswizzledPixels[i * 4 + 0 + 0] = pixels[i * 2 + 2];
-			unswizzledPixels[i * 4 + 0 + 1] = pixels[i * 2 + 3];
-			unswizzledPixels[i * 4 + 0 + 2] = pixels[i * 2 + 1];
-			unswizzledPixels[i * 4 + 0 + 3] = 255;
-
-			// The second pixel is the same, except for red.
-			unswizzledPixels[i * 4 + 4 + 0] = pixels[i * 2 + 0];
-			unswizzledPixels[i * 4 + 4 + 1] = pixels[i * 2 + 3];
-			unswizzledPixels[i * 4 + 4 + 2] = pixels[i * 2 + 1];
-			unswizzledPixels[i * 4 + 4 + 3] = 255;
-		}
+		ConvertR8B8_R8G8(unswizzledPixels, pixels, numPixels);
 
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, tex.GetWidth(), tex.GetHeight(), 0, GL_RGBA, GL_UNSIGNED_BYTE, unswizzledPixels);
 		checkForGlError("GLTexture::Init() -> glTexImage2D(CELL_GCM_TEXTURE_COMPRESSED_R8B8_R8G8 & ~(CELL_GCM_TEXTURE_LN | CELL_GCM_TEXTURE_UN)");
@@ -467,6 +536,13 @@ void GLTexture::Init(RSXTexture& tex)
 	}
 	}
 
+	return glRemap;
+}
+
+void GLTexture::Init(RSXTexture& tex, const GLint* glRemap)
+{
+	int format = tex.GetFormat() & ~(CELL_GCM_TEXTURE_LN | CELL_GCM_TEXTURE_UN);
+
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, tex.GetMipmap() - 1);
 	glTexParameteri(GL_TEXTURE_2D, GL_GENERATE_MIPMAP, tex.GetMipmap() > 1);
 
@@ -553,11 +629,6 @@ void GLTexture::Init(RSXTexture& tex)
 	checkForGlError("GLTexture::Init() -> max anisotropy");
 
 	//Unbind();
-
-	if (is_swizzled && format == CELL_GCM_TEXTURE_A8R8G8B8)
-	{
-		free(unswizzledPixels);
-	}
 }
 
 void GLTexture::Save(RSXTexture& tex, const std::string& name)
@@ -794,9 +865,18 @@ GLGSRender::GLGSRender()
 	, m_frame(nullptr)
 	, m_fp_buf_num(-1)
 	, m_vp_buf_num(-1)
+	, m_read_back_pos(0)
+	, m_dirty_width(0)
+	, m_dirty_height(0)
+	, m_program_pending(false)
+	, m_flip_count(0)
+	, m_texture_cache_size(0)
 	, m_context(nullptr)
 {
 	m_frame = GetGSFrame();
+
+	memset(m_read_backs, 0, sizeof(m_read_backs));
+	memset(m_dirty_surfaces, 0, sizeof(m_dirty_surfaces));
 }
 
 GLGSRender::~GLGSRender()
@@ -830,12 +910,191 @@ void GLGSRender::Close()
 	m_ctrl = nullptr;
 }
 
+GLuint GLGSRender::BindCachedVertexBuffer(u32 index, u32 first, u32 count, u32 data_offset)
+{
+	RSXVertexData& vdata = m_vertex_data[index];
+
+	const u32 item_size = vdata.GetTypeSize() * vdata.size;
+	const u32 addr = vdata.addr + m_vertex_data_base_offset + vdata.stride * m_vertex_data_base_index;
+	const u32 layout = vdata.stride << 16 | vdata.type << 4 | vdata.size;
+
+	// elements from the first to the last used one
+	const u32 src_addr = addr + vdata.stride * first;
+	const u32 src_size = vdata.stride * (count - 1) + item_size;
+
+	GLCachedBuffer& buf = m_buffer_cache[(u64)addr << 32 | (layout ^ first * 0x9e3779b1 ^ count * 0x85ebca6b)];
+
+	// the source array is checked before it's converted
+	if (buf.id && buf.layout == layout && buf.first == first && buf.count == count && buf.src.Match(src_addr, src_size))
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, buf.id);
+		m_buffer_cache_hits++;
+		m_buffer_cache_saved += (first + count - data_offset) * item_size;
+	}
+	else
+	{
+		if (!buf.id)
+		{
+			glGenBuffers(1, &buf.id);
+		}
+
+		buf.layout = layout;
+		buf.first = first;
+		buf.count = count;
+		buf.src.Take(src_addr, src_size);
+
+		vdata.Load(first, count, m_vertex_data_base_offset, m_vertex_data_base_index);
+
+		glBindBuffer(GL_ARRAY_BUFFER, buf.id);
+		glBufferData(GL_ARRAY_BUFFER, vdata.data.size() - data_offset * item_size, vdata.data.data() + data_offset * item_size, GL_STATIC_DRAW);
+		m_buffer_cache_misses++;
+	}
+
+	buf.last_used = m_flip_count;
+	return buf.id;
+}
+
+void GLGSRender::BindCachedIndexBuffer()
+{
+	// indices are converted when the draw command is decoded (their range is needed), only the upload is skipped
+	const u8* data = m_indexed_array.m_data.data();
+	const u32 size = (u32)m_indexed_array.m_data.size();
+	const u32 layout = 0x80000000 | m_indexed_array.m_type;
+
+	GLCachedBuffer& buf = m_buffer_cache[(u64)m_indexed_array.m_addr << 32 | (layout ^ m_indexed_array.m_first * 0x9e3779b1 ^ size * 0x85ebca6b)];
+
+	const u64 hash = RSXMemorySnapshot::Hash(data, size);
+
+	// element array binding is a part of vao state
+	if (buf.id && buf.layout == layout && buf.first == m_indexed_array.m_first && buf.src.size == size && buf.src.hash == hash)
+	{
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buf.id);
+		m_buffer_cache_hits++;
+		m_buffer_cache_saved += size;
+	}
+	else
+	{
+		if (!buf.id)
+		{
+			glGenBuffers(1, &buf.id);
+		}
+
+		buf.layout = layout;
+		buf.first = m_indexed_array.m_first;
+		buf.count = m_indexed_array.m_count;
+		buf.src.addr = m_indexed_array.m_addr;
+		buf.src.size = size;
+		buf.src.hash = hash;
+
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buf.id);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, data, GL_STATIC_DRAW);
+		m_buffer_cache_misses++;
+	}
+
+	buf.last_used = m_flip_count;
+}
+
+void GLGSRender::PurgeBufferCache(bool all)
+{
+	for (auto it = m_buffer_cache.begin(); it != m_buffer_cache.end();)
+	{
+		if (all || m_flip_count - it->second.last_used > 60)
+		{
+			glDeleteBuffers(1, &it->second.id);
+			it = m_buffer_cache.erase(it);
+		}
+		else
+		{
+			it++;
+		}
+	}
+}
+
+void GLGSRender::BindCachedTexture(RSXTexture& tex)
+{
+	if (tex.GetLocation() > 1)
+	{
+		return;
+	}
+
+	const u32 texaddr = GetAddress(tex.GetOffset(), tex.GetLocation());
+	if (!Memory.IsGoodAddr(texaddr))
+	{
+		LOG_ERROR(RSX, "Bad texture address=0x%x", texaddr);
+		return;
+	}
+
+	// render to texture
+	SyncSurface(texaddr);
+
+	// the hash covers every byte the texture may be decoded from
+	const u32 size = GLTexture::GetGuestSize(tex);
+
+	const u64 key = (u64)texaddr << 32 | ((u32)tex.GetFormat() << 24 ^ (u32)tex.GetMipmap() << 20 ^ tex.m_pitch << 8 ^ (u32)tex.GetWidth() << 10 ^ tex.GetHeight());
+	GLCachedTexture& cached = m_texture_cache[key];
+
+	if (cached.tex.IsCreated() && cached.format == tex.GetFormat() && cached.width == tex.GetWidth() && cached.height == tex.GetHeight() &&
+		cached.mipmap == tex.GetMipmap() && cached.pitch == tex.m_pitch && cached.src.Match(texaddr, size))
+	{
+		cached.tex.Bind();
+		m_texture_cache_hits++;
+
+		// move to the front of the LRU list
+		m_texture_lru.splice(m_texture_lru.begin(), m_texture_lru, cached.lru);
+	}
+	else
+	{
+		if (cached.tex.IsCreated())
+		{
+			m_texture_cache_size -= cached.upload_size;
+			m_texture_lru.erase(cached.lru);
+			cached.tex.Bind();
+		}
+		else
+		{
+			cached.tex.Create();
+		}
+
+		cached.format = tex.GetFormat();
+		cached.width = tex.GetWidth();
+		cached.height = tex.GetHeight();
+		cached.mipmap = tex.GetMipmap();
+		cached.pitch = tex.m_pitch;
+		cached.upload_size = GLTexture::GetUploadSize(tex);
+		cached.src.Take(texaddr, size);
+		cached.remap = cached.tex.Upload(tex, vm::get_ptr<const u8>(texaddr));
+		cached.lru = m_texture_lru.insert(m_texture_lru.begin(), key);
+
+		m_texture_cache_size += cached.upload_size;
+		m_texture_cache_misses++;
+	}
+
+	checkForGlError("GLGSRender::BindCachedTexture()");
+
+	cached.tex.Init(tex, cached.remap);
+}
+
+void GLGSRender::PurgeTextureCache(bool all)
+{
+	while (m_texture_lru.size() && (all || m_texture_cache_size > g_gl_texture_cache_size))
+	{
+		const auto lru = m_texture_cache.find(m_texture_lru.back());
+
+		m_texture_cache_size -= lru->second.upload_size;
+		lru->second.tex.Delete();
+		m_texture_cache.erase(lru);
+		m_texture_lru.pop_back();
+	}
+}
+
 void GLGSRender::EnableVertexData(bool indexed_draw)
 {
-	static u32 offset_list[m_vertex_count];
-	u32 cur_offset = 0;
+	static GLuint buffer_list[m_vertex_count];
 
+	// indexed draws use absolute vertex numbers, so the buffer starts from the vertex 0
 	const u32 data_offset = indexed_draw ? 0 : m_draw_array_first;
+	const u32 first = indexed_draw ? m_indexed_array.index_min : m_draw_array_first;
+	const u32 count = indexed_draw ? m_indexed_array.index_max - m_indexed_array.index_min + 1 : m_draw_array_count;
 
 	for (u32 i = 0; i < m_vertex_count; ++i)
 	{
@@ -866,30 +1125,20 @@ void GLGSRender::EnableVertexData(bool indexed_draw)
 			int item_size = size * type_size;
 		}
 
-		offset_list[i] = cur_offset;
+		buffer_list[i] = 0;
 
-		if (!m_vertex_data[i].IsEnabled()) continue;
-		const size_t item_size = m_vertex_data[i].GetTypeSize() * m_vertex_data[i].size;
-		const size_t data_size = m_vertex_data[i].data.size() - data_offset * item_size;
-		const u32 pos = m_vdata.size();
+		if (!m_vertex_data[i].IsEnabled() || !m_vertex_data[i].addr) continue;
 
-		cur_offset += data_size;
-		m_vdata.resize(m_vdata.size() + data_size);
-		memcpy(&m_vdata[pos], &m_vertex_data[i].data[data_offset * item_size], data_size);
+		buffer_list[i] = BindCachedVertexBuffer(i, first, count, data_offset);
 	}
 
 	m_vao.Create();
 	m_vao.Bind();
 	checkForGlError("initializing vao");
 
-	m_vbo.Create(indexed_draw ? 2 : 1);
-	m_vbo.Bind(0);
-	m_vbo.SetData(m_vdata.data(), m_vdata.size());
-
 	if (indexed_draw)
 	{
-		m_vbo.Bind(GL_ELEMENT_ARRAY_BUFFER, 1);
-		m_vbo.SetData(GL_ELEMENT_ARRAY_BUFFER, m_indexed_array.m_data.data(), m_indexed_array.m_data.size());
+		BindCachedIndexBuffer();
 	}
 
 	checkForGlError("initializing vbo");
@@ -1031,7 +1280,8 @@ void GLGSRender::EnableVertexData(bool indexed_draw)
 
 			glEnableVertexAttribArray(i);
 			checkForGlError("glEnableVertexAttribArray");
-			glVertexAttribPointer(i, m_vertex_data[i].size, gltype, normalized, 0, reinterpret_cast<void*>(offset_list[i]));
+			glBindBuffer(GL_ARRAY_BUFFER, buffer_list[i]);
+			glVertexAttribPointer(i, m_vertex_data[i].size, gltype, normalized, 0, nullptr);
 			checkForGlError("glVertexAttribPointer");
 		}
 	}
@@ -1039,7 +1289,6 @@ void GLGSRender::EnableVertexData(bool indexed_draw)
 
 void GLGSRender::DisableVertexData()
 {
-	m_vdata.clear();
 	for (u32 i = 0; i < m_vertex_count; ++i)
 	{
 		if (!m_vertex_data[i].IsEnabled()) continue;
@@ -1114,6 +1363,67 @@ void GLGSRender::InitFragmentData()
 	//	LOG_NOTICE(HLE, "");
 }
 
+std::shared_ptr<GLDecompileRequest> GLGSRender::RequestFp()
+{
+	const u32 size = m_cur_fragment_prog->size;
+	const auto data = vm::get_ptr<const u8>(m_cur_fragment_prog->addr);
+	const u64 hash = GLProgramBuffer::HashFp(data, size, m_cur_fragment_prog->ctrl);
+
+	auto& request = m_fp_requests[hash];
+
+	if (!request || request->ctrl != m_cur_fragment_prog->ctrl || request->fp_data.size() != size + 32 || memcmp(request->fp_data.data(), data, size) != 0)
+	{
+		request.reset(new GLDecompileRequest(true, hash));
+		request->ctrl = m_cur_fragment_prog->ctrl;
+
+		// zeroed padding, in case the decompiler reads past the end of the size limited by GetFragmentProgramSize()
+		request->fp_data.resize(size + 32);
+		memcpy(request->fp_data.data(), data, size);
+
+		m_decompiler.Enqueue(request);
+	}
+
+	request->last_used = m_flip_count;
+	return request;
+}
+
+std::shared_ptr<GLDecompileRequest> GLGSRender::RequestVp()
+{
+	const std::vector<u32>& data = m_cur_vertex_prog->data;
+	const u64 hash = GLProgramBuffer::HashVp(data.data(), (u32)data.size());
+
+	auto& request = m_vp_requests[hash];
+
+	if (!request || request->vp_data != data)
+	{
+		request.reset(new GLDecompileRequest(false, hash));
+		request->vp_data = data;
+
+		m_decompiler.Enqueue(request);
+	}
+
+	request->last_used = m_flip_count;
+	return request;
+}
+
+void GLGSRender::PurgeDecompileRequests()
+{
+	for (auto requests : { &m_fp_requests, &m_vp_requests })
+	{
+		for (auto it = requests->begin(); it != requests->end();)
+		{
+			if (it->second->done && m_flip_count - it->second->last_used > 60)
+			{
+				it = requests->erase(it);
+			}
+			else
+			{
+				it++;
+			}
+		}
+	}
+}
+
 bool GLGSRender::LoadProgram()
 {
 	if (!m_cur_fragment_prog)
@@ -1123,6 +1433,7 @@ bool GLGSRender::LoadProgram()
 	}
 
 	m_cur_fragment_prog->ctrl = m_shader_ctrl;
+	m_cur_fragment_prog->size = GetFragmentProgramSize(m_cur_fragment_prog->addr);
 
 	if (!m_cur_vertex_prog)
 	{
@@ -1133,10 +1444,48 @@ bool GLGSRender::LoadProgram()
 	m_fp_buf_num = m_prog_buffer.SearchFp(*m_cur_fragment_prog, m_fragment_prog);
 	m_vp_buf_num = m_prog_buffer.SearchVp(*m_cur_vertex_prog, m_vertex_prog);
 
+	std::shared_ptr<GLDecompileRequest> fp_request, vp_request;
+	const u8 decompiler_mode = Ini.GSShaderDecompiler.GetValue();
+
+	if (decompiler_mode && (m_fp_buf_num == -1 || m_vp_buf_num == -1))
+	{
+		// both programs are decompiled at the same time on the decompiler threads
+		if (m_fp_buf_num == -1) fp_request = RequestFp();
+		if (m_vp_buf_num == -1) vp_request = RequestVp();
+
+		m_shader_queue = m_decompiler.m_pending;
+
+		if (decompiler_mode == 2 && ((fp_request && !fp_request->done) || (vp_request && !vp_request->done)))
+		{
+			m_program_pending = true;
+			m_skipped_draws++;
+			return false;
+		}
+
+		if ((fp_request && !m_decompiler.Wait(fp_request)) || (vp_request && !m_decompiler.Wait(vp_request)))
+		{
+			// the emulation was stopped
+			m_program_pending = true;
+			return false;
+		}
+	}
+
 	if (m_fp_buf_num == -1)
 	{
 		LOG_WARNING(RSX, "FP not found in buffer!");
-		m_fragment_prog.Decompile(*m_cur_fragment_prog);
+		if (fp_request)
+		{
+			m_fragment_prog.shader = fp_request->shader;
+			m_shader_decompile_time += fp_request->time;
+			m_fp_requests.erase(fp_request->hash);
+		}
+		else
+		{
+			const u64 stamp = get_system_time();
+			m_fragment_prog.Decompile(*m_cur_fragment_prog);
+			m_shader_decompile_time += get_system_time() - stamp;
+		}
+		m_shaders_decompiled++;
 		m_fragment_prog.Compile();
 		checkForGlError("m_fragment_prog.Compile");
 
@@ -1148,7 +1497,19 @@ bool GLGSRender::LoadProgram()
 	if (m_vp_buf_num == -1)
 	{
 		LOG_WARNING(RSX, "VP not found in buffer!");
-		m_vertex_prog.Decompile(*m_cur_vertex_prog);
+		if (vp_request)
+		{
+			m_vertex_prog.shader = vp_request->shader;
+			m_shader_decompile_time += vp_request->time;
+			m_vp_requests.erase(vp_request->hash);
+		}
+		else
+		{
+			const u64 stamp = get_system_time();
+			m_vertex_prog.Decompile(*m_cur_vertex_prog);
+			m_shader_decompile_time += get_system_time() - stamp;
+		}
+		m_shaders_decompiled++;
 		m_vertex_prog.Compile();
 		checkForGlError("m_vertex_prog.Compile");
 
@@ -1220,6 +1581,22 @@ bool GLGSRender::LoadProgram()
 
 void GLGSRender::WriteBuffers()
 {
+	if (Ini.GSBufferWriteBack.GetValue())
+	{
+		// read back later, when the surfaces are replaced, used or the frame ends
+		u32 addrs[5];
+		GetWriteBackSurfaces(addrs);
+
+		for (u32 i = 0; i < 5; i++)
+		{
+			if (addrs[i]) m_dirty_surfaces[i] = addrs[i];
+		}
+
+		m_dirty_width = RSXThread::m_width;
+		m_dirty_height = RSXThread::m_height;
+		return;
+	}
+
 	if (Ini.GSDumpDepthBuffer.GetValue())
 	{
 		glBindBuffer(GL_PIXEL_PACK_BUFFER, g_pbo[4]);
@@ -1458,6 +1835,210 @@ void GLGSRender::WriteColorBuffers()
 	}
 }
 
+void GLGSRender::GetWriteBackSurfaces(u32 (&addrs)[5])
+{
+	memset(addrs, 0, sizeof(addrs));
+
+	if (Ini.GSDumpColorBuffers.GetValue())
+	{
+		const bool set[4] = { m_set_context_dma_color_a, m_set_context_dma_color_b, m_set_context_dma_color_c, m_set_context_dma_color_d };
+		const u32 offset[4] = { m_surface_offset_a, m_surface_offset_b, m_surface_offset_c, m_surface_offset_d };
+		const u32 dma[4] = { m_context_dma_color_a, m_context_dma_color_b, m_context_dma_color_c, m_context_dma_color_d };
+
+		u32 first = 0, count = 0;
+
+		switch (m_surface_color_target)
+		{
+		case CELL_GCM_SURFACE_TARGET_0: first = 0; count = 1; break;
+		case CELL_GCM_SURFACE_TARGET_1: first = 1; count = 1; break;
+		case CELL_GCM_SURFACE_TARGET_MRT1: count = 2; break;
+		case CELL_GCM_SURFACE_TARGET_MRT2: count = 3; break;
+		case CELL_GCM_SURFACE_TARGET_MRT3: count = 4; break;
+		}
+
+		for (u32 i = first; i < first + count; i++)
+		{
+			const u32 address = set[i] ? GetAddress(offset[i], dma[i] - 0xfeed0000) : 0;
+
+			if (address && Memory.IsGoodAddr(address))
+			{
+				addrs[i] = address;
+			}
+		}
+	}
+
+	if (Ini.GSDumpDepthBuffer.GetValue() && m_set_context_dma_z)
+	{
+		const u32 address = GetAddress(m_surface_offset_z, m_context_dma_z - 0xfeed0000);
+
+		if (address && Memory.IsGoodAddr(address))
+		{
+			addrs[4] = address;
+		}
+	}
+}
+
+void GLGSRender::StartReadBacks()
+{
+	const bool on_demand = Ini.GSBufferWriteBack.GetValue() == 2;
+	bool bound = false;
+
+	for (u32 i = 0; i < 5; i++)
+	{
+		const u32 addr = m_dirty_surfaces[i];
+		m_dirty_surfaces[i] = 0;
+
+		if (!addr || !m_fbo.IsCreated() || (on_demand && !m_read_surfaces[addr]))
+		{
+			continue;
+		}
+
+		if (!bound)
+		{
+			m_fbo.Bind(GL_READ_FRAMEBUFFER);
+			glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+			glPixelStorei(GL_PACK_ALIGNMENT, 4);
+			bound = true;
+		}
+
+		// reuse the oldest buffer of the ring (its read-back is finished first if it's still pending)
+		GLReadBack& rb = m_read_backs[m_read_back_pos];
+		m_read_back_pos = (m_read_back_pos + 1) % g_gl_read_back_count;
+
+		if (rb.fence)
+		{
+			FinishReadBack(rb);
+		}
+
+		rb.addr = addr;
+		rb.width = m_dirty_width;
+		rb.height = m_dirty_height;
+		rb.depth = i == 4;
+		rb.flip = m_flip_count;
+		rb.dst.Take(addr, rb.width * rb.height * 4);
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, rb.pbo);
+		glBufferData(GL_PIXEL_PACK_BUFFER, rb.width * rb.height * 4, 0, GL_STREAM_READ);
+
+		if (rb.depth)
+		{
+			glReadPixels(0, 0, rb.width, rb.height, GL_DEPTH_COMPONENT, GL_UNSIGNED_BYTE, 0);
+			checkForGlError("StartReadBacks(): glReadPixels(GL_DEPTH_COMPONENT)");
+		}
+		else
+		{
+			glReadBuffer(GL_COLOR_ATTACHMENT0 + i);
+			checkForGlError("StartReadBacks(): glReadBuffer");
+			glReadPixels(0, 0, rb.width, rb.height, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8, 0);
+			checkForGlError("StartReadBacks(): glReadPixels(GL_BGRA)");
+		}
+
+		rb.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		checkForGlError("StartReadBacks(): glFenceSync");
+	}
+
+	if (bound)
+	{
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		m_fbo.Bind();
+	}
+}
+
+void GLGSRender::FinishReadBack(GLReadBack& rb)
+{
+	if (glClientWaitSync(rb.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0) == GL_TIMEOUT_EXPIRED)
+	{
+		m_write_back_waits++;
+
+		while (glClientWaitSync(rb.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED && !Emu.IsStopped())
+		{
+		}
+	}
+
+	glDeleteSync(rb.fence);
+	rb.fence = nullptr;
+
+	if (!Memory.IsGoodAddr(rb.addr))
+	{
+		return;
+	}
+
+	if (!rb.dst.Match(rb.addr, rb.width * rb.height * 4))
+	{
+		// the guest has written newer data since the read-back was started
+		m_write_back_skips++;
+		return;
+	}
+
+	auto ptr = vm::get_ptr<void>(rb.addr);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, rb.pbo);
+	GLubyte *packed = (GLubyte *)glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+	if (packed)
+	{
+		memcpy(ptr, packed, rb.width * rb.height * 4);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		checkForGlError("FinishReadBack(): glUnmapBuffer");
+	}
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	m_write_backs++;
+
+	// pending read-backs of the same surface are newer and should overwrite the data written now
+	for (auto& other : m_read_backs)
+	{
+		if (other.fence && other.addr == rb.addr)
+		{
+			other.dst.Take(other.dst.addr, other.dst.size);
+		}
+	}
+
+	if (rb.depth)
+	{
+		// same conversion as WriteDepthBuffer()
+		glBindTexture(GL_TEXTURE_2D, g_depth_tex);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, rb.width, rb.height, 0, GL_ALPHA, GL_UNSIGNED_BYTE, ptr);
+		checkForGlError("FinishReadBack(): glTexImage2D");
+		glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, ptr);
+		checkForGlError("FinishReadBack(): glGetTexImage");
+	}
+}
+
+void GLGSRender::SyncSurface(u32 addr)
+{
+	if (!Ini.GSBufferWriteBack.GetValue())
+	{
+		return;
+	}
+
+	bool dirty = false;
+
+	for (u32 i = 0; i < 5; i++)
+	{
+		dirty = dirty || m_dirty_surfaces[i] == addr;
+	}
+
+	// remembered for on-demand mode, the surface is written back from now on
+	if (dirty || m_read_surfaces.count(addr))
+	{
+		m_read_surfaces[addr] = true;
+	}
+
+	if (dirty)
+	{
+		StartReadBacks();
+	}
+
+	for (u32 i = 0; i < g_gl_read_back_count; i++)
+	{
+		GLReadBack& rb = m_read_backs[(m_read_back_pos + i) % g_gl_read_back_count];
+
+		if (rb.fence && rb.addr == addr)
+		{
+			FinishReadBack(rb);
+		}
+	}
+}
+
 void GLGSRender::OnInit()
 {
 	m_draw_frames = 1;
@@ -1489,10 +2070,21 @@ void GLGSRender::OnInitThread()
 	glGenTextures(1, &g_flip_tex);
 	glGenBuffers(6, g_pbo); // 4 for color buffers + 1 for depth buffer + 1 for flip()
 
+	for (auto& rb : m_read_backs)
+	{
+		glGenBuffers(1, &rb.pbo);
+		rb.fence = nullptr;
+	}
+
 #ifdef _WIN32
 	glSwapInterval(Ini.GSVSyncEnable.GetValue() ? 1 : 0);
 #endif
 
+	if (Emu.GetTitleID().length())
+	{
+		m_prog_buffer.Load(Emu.GetEmulatorPath() + "/cache/" + Emu.GetTitleID() + "/");
+	}
+
 }
 
 void GLGSRender::OnExitThread()
@@ -1501,14 +2093,33 @@ void GLGSRender::OnExitThread()
 	glDeleteTextures(1, &g_depth_tex);
 	glDeleteBuffers(6, g_pbo);
 
+	for (auto& rb : m_read_backs)
+	{
+		if (rb.fence)
+		{
+			glDeleteSync(rb.fence);
+			rb.fence = nullptr;
+		}
+
+		glDeleteBuffers(1, &rb.pbo);
+	}
+
+	memset(m_dirty_surfaces, 0, sizeof(m_dirty_surfaces));
+	m_read_surfaces.clear();
+
 	glDisable(GL_TEXTURE_2D);
 	glDisable(GL_VERTEX_PROGRAM_POINT_SIZE);
 
 	m_program.Delete();
 	m_rbo.Delete();
 	m_fbo.Delete();
-	m_vbo.Delete();
 	m_vao.Delete();
+	PurgeBufferCache(true);
+	PurgeTextureCache(true);
+	m_decompiler.Stop();
+	m_fp_requests.clear();
+	m_vp_requests.clear();
+	m_prog_buffer.Save();
 	m_prog_buffer.Clear();
 }
 
@@ -1516,17 +2127,31 @@ void GLGSRender::OnReset()
 {
 	m_program.UnUse();
 
-	if (m_vbo.IsCreated())
-	{
-		m_vbo.UnBind();
-		m_vbo.Delete();
-	}
-
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	m_vao.Delete();
 }
 
 void GLGSRender::InitDrawBuffers()
 {
+	if (Ini.GSBufferWriteBack.GetValue())
+	{
+		// read back surfaces rendered with the previous settings before they are overwritten
+		u32 addrs[5];
+		GetWriteBackSurfaces(addrs);
+
+		bool changed = RSXThread::m_width != m_dirty_width || RSXThread::m_height != m_dirty_height || last_depth_format != m_surface_depth_format;
+
+		for (u32 i = 0; i < 5; i++)
+		{
+			changed = changed || (m_dirty_surfaces[i] && m_dirty_surfaces[i] != addrs[i]);
+		}
+
+		if (changed)
+		{
+			StartReadBacks();
+		}
+	}
+
 	if (!m_fbo.IsCreated() || RSXThread::m_width != last_width || RSXThread::m_height != last_height || last_depth_format != m_surface_depth_format)
 	{
 		LOG_WARNING(RSX, "New FBO (%dx%d)", RSXThread::m_width, RSXThread::m_height);
@@ -1752,6 +2377,12 @@ void GLGSRender::ExecCMD()
 	//return;
 	if (!LoadProgram())
 	{
+		if (m_program_pending)
+		{
+			m_program_pending = false;
+			return;
+		}
+
 		LOG_ERROR(RSX, "LoadProgram failed.");
 		Emu.Pause();
 		return;
@@ -2025,18 +2656,17 @@ void GLGSRender::ExecCMD()
 		LOG_WARNING(RSX, "m_indexed_array.m_count && draw_array_count");
 	}
 
+	PurgeTextureCache(false);
+
 	for (u32 i = 0; i < m_textures_count; ++i)
 	{
 		if (!m_textures[i].IsEnabled()) continue;
 
 		glActiveTexture(GL_TEXTURE0 + i);
 		checkForGlError("glActiveTexture");
-		m_gl_textures[i].Create();
-		m_gl_textures[i].Bind();
-		checkForGlError(fmt::Format("m_gl_textures[%d].Bind", i));
 		m_program.SetTex(i);
-		m_gl_textures[i].Init(m_textures[i]);
-		checkForGlError(fmt::Format("m_gl_textures[%d].Init", i));
+		BindCachedTexture(m_textures[i]);
+		checkForGlError(fmt::Format("m_textures[%d] init", i));
 	}
 
 	for (u32 i = 0; i < m_textures_count; ++i)
@@ -2045,21 +2675,13 @@ void GLGSRender::ExecCMD()
 
 		glActiveTexture(GL_TEXTURE0 + m_textures_count + i);
 		checkForGlError("glActiveTexture");
-		m_gl_vertex_textures[i].Create();
-		m_gl_vertex_textures[i].Bind();
-		checkForGlError(fmt::Format("m_gl_vertex_textures[%d].Bind", i));
 		m_program.SetVTex(i);
-		m_gl_vertex_textures[i].Init(m_vertex_textures[i]);
-		checkForGlError(fmt::Format("m_gl_vertex_textures[%d].Init", i));
+		BindCachedTexture(m_vertex_textures[i]);
+		checkForGlError(fmt::Format("m_vertex_textures[%d] init", i));
 	}
 
 	m_vao.Bind();
 
-	if (m_indexed_array.m_count)
-	{
-		LoadVertexData(m_indexed_array.index_min, m_indexed_array.index_max - m_indexed_array.index_min + 1);
-	}
-
 	if (m_indexed_array.m_count || m_draw_array_count)
 	{
 		EnableVertexData(m_indexed_array.m_count ? true : false);
@@ -2104,6 +2726,22 @@ void GLGSRender::ExecCMD()
 
 void GLGSRender::Flip()
 {
+	if (Ini.GSBufferWriteBack.GetValue())
+	{
+		// surfaces rendered during this frame are copied to PS3 memory during the next one
+		StartReadBacks();
+
+		for (u32 i = 0; i < g_gl_read_back_count; i++)
+		{
+			GLReadBack& rb = m_read_backs[(m_read_back_pos + i) % g_gl_read_back_count];
+
+			if (rb.fence && rb.flip != m_flip_count)
+			{
+				FinishReadBack(rb);
+			}
+		}
+	}
+
 	// Set scissor to FBO size 
 	if (m_set_scissor_horizontal && m_set_scissor_vertical)
 	{
@@ -2142,6 +2780,7 @@ void GLGSRender::Flip()
 
 			if (Memory.IsGoodAddr(addr))
 			{
+				SyncSurface(addr);
 				width = buffers[m_gcm_current_buffer].width;
 				height = buffers[m_gcm_current_buffer].height;
 				src_buffer = vm::get_ptr<u8>(addr);
@@ -2239,34 +2878,9 @@ void GLGSRender::Flip()
 		checkForGlError("glScissor");
 	}
 
-}
-
-u32 LinearToSwizzleAddress(u32 x, u32 y, u32 z, u32 log2_width, u32 log2_height, u32 log2_depth)
-{
-	u32 offset = 0;
-	u32 shift_count = 0;
-	while (log2_width | log2_height | log2_depth){
-		if (log2_width)
-		{
-			offset |= (x & 0x01) << shift_count;
-			x >>= 1;
-			++shift_count;
-			--log2_width;
-		}
-		if (log2_height)
-		{
-			offset |= (y & 0x01) << shift_count;
-			y >>= 1;
-			++shift_count;
-			--log2_height;
-		}
-		if (log2_depth)
-		{
-			offset |= (z & 0x01) << shift_count;
-			z >>= 1;
-			++shift_count;
-			--log2_depth;
-		}
+	if (++m_flip_count % 60 == 0)
+	{
+		PurgeBufferCache(false);
+		PurgeDecompileRequests();
 	}
-	return offset;
 }
@@ -1,5 +1,8 @@
 #pragma once
+#include <unordered_map>
+#include <list>
 #include "Emu/RSX/GSRender.h"
+#include "Emu/RSX/RSXMemorySnapshot.h"
 #include "GLBuffers.h"
 #include "GLProgramBuffer.h"
 
@@ -10,7 +13,6 @@
 extern GLenum g_last_gl_error;
 void printGlError(GLenum err, const char* situation);
 void printGlError(GLenum err, const std::string& situation);
-u32 LinearToSwizzleAddress(u32 x, u32 y, u32 z, u32 log2_width, u32 log2_height, u32 log2_depth);
 
 #if RSX_DEBUG
 #define checkForGlError(sit) if((g_last_gl_error = glGetError()) != GL_NO_ERROR) printGlError(g_last_gl_error, sit)
@@ -18,6 +20,9 @@ u32 LinearToSwizzleAddress(u32 x, u32 y, u32 z, u32 log2_width, u32 log2_height,
 #define checkForGlError(sit)
 #endif
 
+static const u64 g_gl_texture_cache_size = 256 * 1024 * 1024; // max memory used by cached textures
+static const u32 g_gl_read_back_count = 16; // size of the pixel pack buffer ring used by asynchronous write-back
+
 class GLTexture
 {
 	u32 m_id;
@@ -29,29 +34,29 @@ public:
 
 	void Create();
 
+	bool IsCreated() const
+	{
+		return m_id != 0;
+	}
+
 	int GetGlWrap(int wrap);
 
 	float GetMaxAniso(int aniso);
 
-	inline static u8 Convert4To8(u8 v)
-	{
-		// Swizzle bits: 00001234 -> 12341234
-		return (v << 4) | (v);
-	}
+	// size of the first level of the texture data (the only one uploaded, tightly packed)
+	static u32 GetDataSize(RSXTexture& tex);
 
-	inline static u8 Convert5To8(u8 v)
-	{
-		// Swizzle bits: 00012345 -> 12345123
-		return (v << 3) | (v >> 2);
-	}
+	// size of the RSX memory range holding all levels of the texture (rows of linear textures are pitch bytes apart)
+	static u32 GetGuestSize(RSXTexture& tex);
 
-	inline static u8 Convert6To8(u8 v)
-	{
-		// Swizzle bits: 00123456 -> 12345612
-		return (v << 2) | (v >> 4);
-	}
+	// approximate GPU memory used by the uploaded texture, including the mipmaps generated by GL
+	static u32 GetUploadSize(RSXTexture& tex);
+
+	// upload the texture data to the bound texture, returns component remap table of the format
+	const GLint* Upload(RSXTexture& tex, const u8* pixels);
 
-	void Init(RSXTexture& tex);
+	// set sampling parameters of the bound texture
+	void Init(RSXTexture& tex, const GLint* glRemap);
 
 	void Save(RSXTexture& tex, const std::string& name);
 
@@ -136,7 +141,39 @@ class GLGSRender //TODO: find out why this used to inherit from wxWindow
 	/*,*/ public GSRender
 {
 private:
-	std::vector<u8> m_vdata;
+	// GL buffer holding converted vertex or index array, reused while the array doesn't change
+	struct GLCachedBuffer
+	{
+		GLuint id;
+		u32 layout; // format of the array
+		u32 first; // first element used
+		u32 count; // count of elements used
+		RSXMemorySnapshot src; // vertex array data in RSX memory (index arrays: hash of the converted data)
+		u32 last_used; // flip count when the buffer was used last time
+	};
+
+	std::unordered_map<u64, GLCachedBuffer> m_buffer_cache; // key: address, format, first element and count
+	u32 m_flip_count;
+
+	// GL texture decoded from RSX texture, reused while the texture data doesn't change
+	struct GLCachedTexture
+	{
+		GLTexture tex;
+		u8 format;
+		u16 width;
+		u16 height;
+		u16 mipmap;
+		u32 pitch;
+		u32 upload_size; // charged to m_texture_cache_size
+		const GLint* remap; // component remap table of the format
+		RSXMemorySnapshot src; // texture data the texture was decoded from
+		std::list<u64>::iterator lru; // position in m_texture_lru
+	};
+
+	std::unordered_map<u64, GLCachedTexture> m_texture_cache; // key: address, format, dimensions, pitch and mipmap count
+	std::list<u64> m_texture_lru; // keys of cached textures, the most recently used first
+	u64 m_texture_cache_size; // approximate memory used by cached textures
+
 	std::vector<PostDrawObj> m_post_draw_objs;
 
 	GLProgram m_program;
@@ -144,14 +181,35 @@ private:
 	int m_vp_buf_num;
 	GLProgramBuffer m_prog_buffer;
 
+	// pixel pack buffer receiving color or depth buffer, copied to PS3 memory when its fence is signaled
+	struct GLReadBack
+	{
+		GLuint pbo;
+		GLsync fence; // nullptr if the buffer is free
+		u32 addr;
+		u32 width;
+		u32 height;
+		bool depth;
+		u32 flip; // m_flip_count when the read-back was started
+		RSXMemorySnapshot dst; // PS3 memory when the read-back was started (it isn't overwritten if modified since then)
+	};
+
+	GLReadBack m_read_backs[g_gl_read_back_count];
+	u32 m_read_back_pos; // the oldest read-back in the ring
+	u32 m_dirty_surfaces[5]; // color buffers A..D and depth buffer rendered since they were read back (0 if not rendered)
+	u32 m_dirty_width;
+	u32 m_dirty_height;
+	std::unordered_map<u32, bool> m_read_surfaces; // rendered surfaces, value: the surface was used by RSX (only such surfaces are written back in on-demand mode)
+
+	GLDecompilerPool m_decompiler;
+	std::unordered_map<u64, std::shared_ptr<GLDecompileRequest>> m_fp_requests; // key: fragment program hash
+	std::unordered_map<u64, std::shared_ptr<GLDecompileRequest>> m_vp_requests; // key: vertex program hash
+	bool m_program_pending; // the draw was skipped because its programs are being decompiled
+
 	GLFragmentProgram m_fragment_prog;
 	GLVertexProgram m_vertex_prog;
 
-	GLTexture m_gl_textures[m_textures_count];
-	GLTexture m_gl_vertex_textures[m_textures_count];
-
 	GLvao m_vao;
-	GLvbo m_vbo;
 	GLrbo m_rbo;
 	GLfbo m_fbo;
 
@@ -166,6 +224,33 @@ public:
 	virtual ~GLGSRender();
 
 private:
+	// bind the buffer converted from the vertex array (convert and upload it if it isn't cached or the array was modified)
+	GLuint BindCachedVertexBuffer(u32 index, u32 first, u32 count, u32 data_offset);
+	// bind the buffer containing converted index array (upload it if it isn't cached)
+	void BindCachedIndexBuffer();
+	// delete buffers unused for a while (or all buffers)
+	void PurgeBufferCache(bool all);
+
+	// bind the texture decoded from specified RSX texture to the active texture unit (decode it if it isn't cached)
+	void BindCachedTexture(RSXTexture& tex);
+	// delete least recently used textures until the cache fits in g_gl_texture_cache_size (or all textures)
+	void PurgeTextureCache(bool all);
+
+	// find the decompilation request for the current program (enqueue it if it doesn't exist)
+	std::shared_ptr<GLDecompileRequest> RequestFp();
+	std::shared_ptr<GLDecompileRequest> RequestVp();
+	// remove finished requests which weren't taken by any draw recently (the game doesn't use the program anymore)
+	void PurgeDecompileRequests();
+
+	// addresses of color buffers A..D and depth buffer which should be written back after drawing (0 if not used)
+	void GetWriteBackSurfaces(u32 (&addrs)[5]);
+	// start reading back dirty surfaces to the pixel pack buffer ring
+	void StartReadBacks();
+	// wait for the read-back and copy it to PS3 memory
+	void FinishReadBack(GLReadBack& rb);
+	// make sure the surface at specified address was written back to PS3 memory before it's used
+	void SyncSurface(u32 addr);
+
 	void EnableVertexData(bool indexed_draw = false);
 	void DisableVertexData();
 	void InitVertexData();
@@ -97,6 +97,9 @@ OPENGL_PROC(PFNGLFRAMEBUFFERRENDERBUFFERPROC, FramebufferRenderbuffer);
 OPENGL_PROC(PFNGLBLITFRAMEBUFFERPROC, BlitFramebuffer);
 OPENGL_PROC(PFNGLDRAWBUFFERSPROC, DrawBuffers);
 OPENGL_PROC(PFNGLPRIMITIVERESTARTINDEXPROC, PrimitiveRestartIndex);
+OPENGL_PROC(PFNGLFENCESYNCPROC, FenceSync);
+OPENGL_PROC(PFNGLCLIENTWAITSYNCPROC, ClientWaitSync);
+OPENGL_PROC(PFNGLDELETESYNCPROC, DeleteSync);
 
 #ifndef __GNUG__
 OPENGL_PROC(PFNGLBLENDCOLORPROC, BlendColor);
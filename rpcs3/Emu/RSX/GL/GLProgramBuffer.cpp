@@ -1,19 +1,67 @@
 #include "stdafx.h"
+#include <fstream>
 #include "Utilities/Log.h"
+#include "Utilities/rFile.h"
+#include "Utilities/Thread.h"
 #include "Emu/Memory/Memory.h"
+#include "Emu/System.h"
+#include "Emu/SysCalls/lv2/sys_time.h"
 
 #include "GLProgramBuffer.h"
 
+static const u32 g_gl_program_cache_magic = 0x43504c47; // "GLPC"
+static const u32 g_gl_program_cache_version = 2; // layout of the file, the decompilers output is checked with HashDecompilerVersion()
+
+u64 GLProgramBuffer::HashFp(const u8* data, u32 size, u32 ctrl)
+{
+	// FNV-1a
+	u64 hash = 0xcbf29ce484222325ull ^ ctrl;
+
+	for (u32 i = 0; i < size; i++)
+	{
+		hash = (hash ^ data[i]) * 0x100000001b3ull;
+	}
+
+	return hash;
+}
+
+u64 GLProgramBuffer::HashDecompilerVersion()
+{
+	// any rebuild of the decompilers invalidates the cached shaders
+	const std::string version = std::string(GLFragmentProgram::GetDecompilerVersion()) + "|" + GLVertexProgram::GetDecompilerVersion();
+
+	return HashFp(reinterpret_cast<const u8*>(version.data()), (u32)version.size(), 0);
+}
+
+u64 GLProgramBuffer::HashVp(const u32* data, u32 size)
+{
+	// FNV-1a
+	u64 hash = 0xcbf29ce484222325ull;
+
+	for (u32 i = 0; i < size; i++)
+	{
+		hash = (hash ^ data[i]) * 0x100000001b3ull;
+	}
+
+	return hash;
+}
+
 int GLProgramBuffer::SearchFp(const RSXFragmentProgram& rsx_fp, GLFragmentProgram& gl_fp)
 {
-	for(u32 i=0; i<m_buf.size(); ++i)
+	const u32 size = rsx_fp.size;
+	const auto data = vm::get_ptr<const u8>(rsx_fp.addr);
+	const auto range = m_fp_index.equal_range(HashFp(data, size, rsx_fp.ctrl));
+
+	for (auto it = range.first; it != range.second; it++)
 	{
-		if(memcmp(&m_buf[i].fp_data[0], vm::get_ptr<void>(rsx_fp.addr), m_buf[i].fp_data.size()) != 0) continue;
+		const GLBufferInfo& buf = m_buf[it->second];
 
-		gl_fp.id = m_buf[i].fp_id;
-		gl_fp.shader = m_buf[i].fp_shader.c_str();
+		if (buf.fp_ctrl != rsx_fp.ctrl || buf.fp_data.size() != size || memcmp(buf.fp_data.data(), data, size) != 0) continue;
 
-		return i;
+		gl_fp.id = buf.fp_id;
+		gl_fp.shader = buf.fp_shader.c_str();
+
+		return it->second;
 	}
 
 	return -1;
@@ -21,15 +69,19 @@ int GLProgramBuffer::SearchFp(const RSXFragmentProgram& rsx_fp, GLFragmentProgra
 
 int GLProgramBuffer::SearchVp(const RSXVertexProgram& rsx_vp, GLVertexProgram& gl_vp)
 {
-	for(u32 i=0; i<m_buf.size(); ++i)
+	const auto range = m_vp_index.equal_range(HashVp(rsx_vp.data.data(), (u32)rsx_vp.data.size()));
+
+	for (auto it = range.first; it != range.second; it++)
 	{
-		if(m_buf[i].vp_data.size() != rsx_vp.data.size()) continue;
-		if(memcmp(m_buf[i].vp_data.data(), rsx_vp.data.data(), rsx_vp.data.size() * 4) != 0) continue;
+		const GLBufferInfo& buf = m_buf[it->second];
+
+		if (buf.vp_data.size() != rsx_vp.data.size()) continue;
+		if (memcmp(buf.vp_data.data(), rsx_vp.data.data(), rsx_vp.data.size() * 4) != 0) continue;
 
-		gl_vp.id = m_buf[i].vp_id;
-		gl_vp.shader = m_buf[i].vp_shader.c_str();
+		gl_vp.id = buf.vp_id;
+		gl_vp.shader = buf.vp_shader.c_str();
 
-		return i;
+		return it->second;
 	}
 
 	return -1;
@@ -43,6 +95,7 @@ bool GLProgramBuffer::CmpVP(const u32 a, const u32 b) const
 
 bool GLProgramBuffer::CmpFP(const u32 a, const u32 b) const
 {
+	if(m_buf[a].fp_ctrl != m_buf[b].fp_ctrl) return false;
 	if(m_buf[a].fp_data.size() != m_buf[b].fp_data.size()) return false;
 	return memcmp(m_buf[a].fp_data.data(), m_buf[b].fp_data.data(), m_buf[a].fp_data.size()) == 0;
 }
@@ -63,8 +116,12 @@ u32 GLProgramBuffer::GetProg(u32 fp, u32 vp) const
 		return m_buf[fp].prog_id;
 	}
 
-	for(u32 i=0; i<m_buf.size(); ++i)
+	const auto range = m_prog_index.equal_range(ProgKey(m_buf[fp].fp_hash, m_buf[vp].vp_hash));
+
+	for(auto it = range.first; it != range.second; it++)
 	{
+		const u32 i = it->second;
+
 		if(i == fp || i == vp) continue;
 
 		if(CmpVP(vp, i) && CmpFP(fp, i))
@@ -103,14 +160,136 @@ void GLProgramBuffer::Add(GLProgram& prog, GLFragmentProgram& gl_fp, RSXFragment
 	new_buf.prog_id = prog.id;
 	new_buf.vp_id = gl_vp.id;
 	new_buf.fp_id = gl_fp.id;
+	new_buf.fp_ctrl = rsx_fp.ctrl;
 
+	// SearchFp() compares the data up to rsx_fp.size, which may include a constant after the last instruction
 	new_buf.fp_data.insert(new_buf.fp_data.end(), vm::get_ptr<u8>(rsx_fp.addr), vm::get_ptr<u8>(rsx_fp.addr + rsx_fp.size));
 	new_buf.vp_data = rsx_vp.data;
 
 	new_buf.vp_shader = gl_vp.shader;
 	new_buf.fp_shader = gl_fp.shader;
 
-	m_buf.push_back(new_buf);
+	Insert(std::move(new_buf));
+}
+
+void GLProgramBuffer::Insert(GLBufferInfo&& info)
+{
+	const u32 index = (u32)m_buf.size();
+
+	info.fp_hash = HashFp(info.fp_data.data(), (u32)info.fp_data.size(), info.fp_ctrl);
+	info.vp_hash = HashVp(info.vp_data.data(), (u32)info.vp_data.size());
+
+	m_fp_index.insert(std::make_pair(info.fp_hash, index));
+	m_vp_index.insert(std::make_pair(info.vp_hash, index));
+	m_prog_index.insert(std::make_pair(ProgKey(info.fp_hash, info.vp_hash), index));
+
+	m_buf.push_back(std::move(info));
+}
+
+void GLProgramBuffer::Load(const std::string& path)
+{
+	m_path = path;
+
+	std::ifstream f(path + "gl_programs.bin", std::ios::binary);
+
+	u32 header[3] = {};
+	u64 decompiler_hash = 0;
+
+	if (!f.read(reinterpret_cast<char*>(header), sizeof(header)) || header[0] != g_gl_program_cache_magic || header[1] != g_gl_program_cache_version ||
+		!f.read(reinterpret_cast<char*>(&decompiler_hash), sizeof(decompiler_hash)))
+	{
+		return;
+	}
+
+	if (decompiler_hash != HashDecompilerVersion())
+	{
+		LOG_NOTICE(RSX, "GL program cache was created by another build of the decompilers, ignored ('%s')", path.c_str());
+		return;
+	}
+
+	for (u32 i = 0; i < header[2]; i++)
+	{
+		GLBufferInfo info;
+		u32 sizes[4]; // fragment program, vertex program, fragment shader, vertex shader
+		u64 hashes[2];
+
+		if (!f.read(reinterpret_cast<char*>(&info.fp_ctrl), sizeof(info.fp_ctrl)) ||
+			!f.read(reinterpret_cast<char*>(sizes), sizeof(sizes)) ||
+			!f.read(reinterpret_cast<char*>(hashes), sizeof(hashes)) ||
+			!sizes[0] || sizes[0] > 0x100000 || !sizes[1] || sizes[1] > 0x10000 || sizes[2] > 0x100000 || sizes[3] > 0x100000)
+		{
+			LOG_ERROR(RSX, "GL program cache is corrupted ('%s')", path.c_str());
+			break;
+		}
+
+		info.fp_data.resize(sizes[0]);
+		info.vp_data.resize(sizes[1]);
+		info.fp_shader.resize(sizes[2]);
+		info.vp_shader.resize(sizes[3]);
+
+		if (!f.read(reinterpret_cast<char*>(info.fp_data.data()), sizes[0]) ||
+			!f.read(reinterpret_cast<char*>(info.vp_data.data()), sizes[1] * sizeof(u32)) ||
+			!f.read(&info.fp_shader[0], sizes[2]) ||
+			!f.read(&info.vp_shader[0], sizes[3]) ||
+			HashFp(info.fp_data.data(), sizes[0], info.fp_ctrl) != hashes[0] ||
+			HashVp(info.vp_data.data(), sizes[1]) != hashes[1])
+		{
+			LOG_ERROR(RSX, "GL program cache is corrupted ('%s')", path.c_str());
+			break;
+		}
+
+		// compile the shaders, their ids are kept in the buffer
+		GLFragmentProgram gl_fp;
+		GLVertexProgram gl_vp;
+		GLProgram prog;
+
+		gl_fp.shader = info.fp_shader;
+		gl_fp.Compile();
+		gl_vp.shader = info.vp_shader;
+		gl_vp.Compile();
+		prog.Create(gl_vp.id, gl_fp.id);
+
+		info.prog_id = prog.id;
+		info.fp_id = gl_fp.id;
+		info.vp_id = gl_vp.id;
+		gl_fp.id = 0;
+		gl_vp.id = 0;
+
+		Insert(std::move(info));
+	}
+
+	LOG_NOTICE(RSX, "GL program cache: %d programs loaded", m_buf.size());
+}
+
+void GLProgramBuffer::Save()
+{
+	if (m_path.empty() || (!rExists(m_path) && !rMkpath(m_path)))
+	{
+		return;
+	}
+
+	std::ofstream f(m_path + "gl_programs.bin", std::ios::binary | std::ios::trunc);
+
+	const u32 header[3] = { g_gl_program_cache_magic, g_gl_program_cache_version, (u32)m_buf.size() };
+
+	const u64 decompiler_hash = HashDecompilerVersion();
+
+	f.write(reinterpret_cast<const char*>(header), sizeof(header));
+	f.write(reinterpret_cast<const char*>(&decompiler_hash), sizeof(decompiler_hash));
+
+	for (auto& info : m_buf)
+	{
+		const u32 sizes[4] = { (u32)info.fp_data.size(), (u32)info.vp_data.size(), (u32)info.fp_shader.size(), (u32)info.vp_shader.size() };
+		const u64 hashes[2] = { info.fp_hash, info.vp_hash };
+
+		f.write(reinterpret_cast<const char*>(&info.fp_ctrl), sizeof(info.fp_ctrl));
+		f.write(reinterpret_cast<const char*>(sizes), sizeof(sizes));
+		f.write(reinterpret_cast<const char*>(hashes), sizeof(hashes));
+		f.write(reinterpret_cast<const char*>(info.fp_data.data()), sizes[0]);
+		f.write(reinterpret_cast<const char*>(info.vp_data.data()), sizes[1] * sizeof(u32));
+		f.write(info.fp_shader.data(), sizes[2]);
+		f.write(info.vp_shader.data(), sizes[3]);
+	}
 }
 
 void GLProgramBuffer::Clear()
@@ -131,4 +310,71 @@ void GLProgramBuffer::Clear()
 	}
 
 	m_buf.clear();
+	m_fp_index.clear();
+	m_vp_index.clear();
+	m_prog_index.clear();
+	m_path.clear();
+}
+
+GLDecompilerPool::GLDecompilerPool()
+	: m_pool("GL Decompiler", std::thread::hardware_concurrency() / 2)
+	, m_pending(0)
+{
+}
+
+GLDecompilerPool::~GLDecompilerPool()
+{
+	Stop();
+}
+
+void GLDecompilerPool::Work(GLDecompileRequest& request)
+{
+	const u64 stamp = get_system_time();
+
+	// parameters are declared in the shader text, so they aren't needed after decompilation
+	GLParamArray parr;
+
+	if (request.fragment)
+	{
+		GLFragmentDecompilerThread decompiler(request.shader, parr, reinterpret_cast<const be_t<u32>*>(request.fp_data.data()), request.ctrl);
+		decompiler.Task();
+	}
+	else
+	{
+		GLVertexDecompilerThread decompiler(request.vp_data, request.shader, parr);
+		decompiler.Task();
+	}
+
+	request.time = get_system_time() - stamp;
+
+	LOG_NOTICE(RSX, "%s program 0x%llx decompiled in %lld us", request.fragment ? "Fragment" : "Vertex", request.hash, request.time);
+}
+
+void GLDecompilerPool::Enqueue(const std::shared_ptr<GLDecompileRequest>& request)
+{
+	m_pending++;
+
+	if (!m_pool.push([this, request](u32 worker)
+	{
+		Work(*request);
+		request->done = true;
+		m_pending--;
+	}))
+	{
+		// the pool is being stopped
+		m_pending--;
+	}
+}
+
+bool GLDecompilerPool::Wait(const std::shared_ptr<GLDecompileRequest>& request)
+{
+	m_pool.wait([&request]() { return request->done || Emu.IsStopped(); });
+
+	return request->done;
+}
+
+void GLDecompilerPool::Stop()
+{
+	m_pool.stop();
+	m_pending = 0;
 }
@@ -1,4 +1,6 @@
 #pragma once
+#include <unordered_map>
+#include "Utilities/Thread.h"
 #include "GLProgram.h"
 
 struct GLBufferInfo
@@ -6,6 +8,9 @@ struct GLBufferInfo
 	u32 prog_id;
 	u32 fp_id;
 	u32 vp_id;
+	u32 fp_ctrl;
+	u64 fp_hash;
+	u64 vp_hash;
 	std::vector<u8> fp_data;
 	std::vector<u32> vp_data;
 	std::string fp_shader;
@@ -15,6 +20,19 @@ struct GLBufferInfo
 struct GLProgramBuffer
 {
 	std::vector<GLBufferInfo> m_buf;
+	std::unordered_multimap<u64, u32> m_fp_index; // key: fragment program hash, value: index in m_buf
+	std::unordered_multimap<u64, u32> m_vp_index; // key: vertex program hash
+	std::unordered_multimap<u64, u32> m_prog_index; // key: fragment and vertex program hashes combined
+	std::string m_path; // cache directory of the current title
+
+	static u64 HashFp(const u8* data, u32 size, u32 ctrl);
+	static u64 HashVp(const u32* data, u32 size);
+	static u64 HashDecompilerVersion();
+
+	static u64 ProgKey(u64 fp_hash, u64 vp_hash)
+	{
+		return fp_hash * 0x100000001b3ull ^ vp_hash;
+	}
 
 	int SearchFp(const RSXFragmentProgram& rsx_fp, GLFragmentProgram& gl_fp);
 	int SearchVp(const RSXVertexProgram& rsx_vp, GLVertexProgram& gl_vp);
@@ -25,5 +43,59 @@ struct GLProgramBuffer
 	u32 GetProg(u32 fp, u32 vp) const;
 
 	void Add(GLProgram& prog, GLFragmentProgram& gl_fp, RSXFragmentProgram& rsx_fp, GLVertexProgram& gl_vp, RSXVertexProgram& rsx_vp);
+	void Insert(GLBufferInfo&& info);
+
+	// load programs decompiled in previous runs from the cache directory and compile them (requires GL context)
+	void Load(const std::string& path);
+
+	// save decompiled programs to the cache directory
+	void Save();
+
 	void Clear();
 };
+
+// program decompiled by GLDecompilerPool (the code is copied, so PS3 memory may change while it's decompiled)
+struct GLDecompileRequest
+{
+	bool fragment;
+	u64 hash; // GLProgramBuffer::HashFp() or HashVp()
+	u32 ctrl; // fragment program control
+	std::vector<u8> fp_data; // fragment program including embedded constants (followed by zeroed padding)
+	std::vector<u32> vp_data;
+	std::string shader; // result (valid when done is set)
+	u64 time; // time spent on decompilation (in microseconds)
+	u32 last_used; // flip count when the program was requested last time
+	std::atomic<bool> done;
+
+	GLDecompileRequest(bool fragment, u64 hash)
+		: fragment(fragment)
+		, hash(hash)
+		, ctrl(0)
+		, time(0)
+		, last_used(0)
+		, done(false)
+	{
+	}
+};
+
+// decompiles RSX programs to GLSL on separate threads (compilation of the result requires GL context and isn't done there)
+class GLDecompilerPool
+{
+	thread_pool_t m_pool;
+
+	void Work(GLDecompileRequest& request);
+
+public:
+	std::atomic<u32> m_pending; // requests queued or being decompiled
+
+	GLDecompilerPool();
+	~GLDecompilerPool();
+
+	void Enqueue(const std::shared_ptr<GLDecompileRequest>& request);
+
+	// wait until the request is done, returns false if the emulation was stopped before
+	bool Wait(const std::shared_ptr<GLDecompileRequest>& request);
+
+	// drop queued requests and join the threads
+	void Stop();
+};
@@ -796,6 +796,11 @@ void GLVertexProgram::Wait()
 	}
 }
 
+const char* GLVertexProgram::GetDecompilerVersion()
+{
+	return __DATE__ " " __TIME__;
+}
+
 void GLVertexProgram::Decompile(RSXVertexProgram& prog)
 {
 	GLVertexDecompilerThread decompiler(prog.data, shader, parr);
@@ -271,6 +271,8 @@ public:
 	void Wait();
 	void Compile();
 
+	static const char* GetDecompilerVersion(); // build time of the decompiler
+
 private:
 	GLVertexDecompilerThread* m_decompiler_thread;
 	void Delete();
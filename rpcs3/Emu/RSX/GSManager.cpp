@@ -37,6 +37,15 @@ void GSManager::Init()
 	//m_render->Init(GetInfo().outresolution.width, GetInfo().outresolution.height);
 }
 
+void GSManager::Init(GSRender* render)
+{
+	Close();
+
+	m_info.Init();
+
+	m_render = render;
+}
+
 void GSManager::Close()
 {
 	if(m_render)
@@ -31,6 +31,7 @@ public:
 	GSManager();
 
 	void Init();
+	void Init(GSRender* render); // use specified renderer (takes ownership)
 	void Close();
 
 	bool IsInited() const { return m_render != nullptr; }
@@ -0,0 +1,546 @@
+#include "stdafx.h"
+#include "Utilities/Log.h"
+#include "Emu/Memory/Memory.h"
+#include "Emu/System.h"
+#include "Emu/RSX/GSManager.h"
+#include "Emu/RSX/Null/NullGSRender.h"
+#include "RSXThread.h"
+#include "RSXCapture.h"
+
+#include "Emu/SysCalls/lv2/sys_time.h"
+
+// approximate size of texture data (enough for swizzled formats up to 32 bpp, including mipmaps)
+static u32 GetTextureSize(const RSXTexture& tex)
+{
+	u32 size = tex.m_pitch ? tex.m_pitch * tex.GetHeight() : tex.GetWidth() * tex.GetHeight() * 4;
+
+	if (tex.GetMipmap() > 1)
+	{
+		size += size / 2;
+	}
+
+	size *= std::max<u32>(tex.m_depth, 1);
+
+	return tex.isCubemap() ? size * 6 : size;
+}
+
+RSXCapture::RSXCapture(RSXThread& rsx, const std::string& path)
+	: m_file(path, std::ios::binary | std::ios::trunc)
+	, m_frames(0)
+	, m_frame_stamp(get_system_time())
+	, m_map_count(0)
+	, m_stop(false)
+{
+	RSXCaptureHeader header;
+	header.magic = g_rsx_capture_magic;
+	header.version = g_rsx_capture_version;
+	header.io_range = Memory.RSXIOMem.GetSize();
+	header.ctrl_addr = rsx.m_ctrlAddress;
+	header.local_addr = (u32)Memory.RSXFBMem.GetStartAddr();
+	header.local_size = Memory.RSXFBMem.GetUsedSize();
+	header.cmd_addr = (u32)Memory.RSXCMDMem.GetStartAddr();
+	header.cmd_size = Memory.RSXCMDMem.GetUsedSize();
+	header.buffers_addr = rsx.m_gcm_buffers_addr;
+	header.buffers_count = rsx.m_gcm_buffers_count;
+	header.current_buffer = rsx.m_gcm_current_buffer;
+
+	if (!m_file.write(reinterpret_cast<const char*>(&header), sizeof(header)))
+	{
+		LOG_ERROR(RSX, "RSX capture: failed to create '%s'", path.c_str());
+		m_frames = g_rsx_capture_frames;
+		return;
+	}
+
+	LOG_NOTICE(RSX, "RSX capture started ('%s')", path.c_str());
+
+	AddMappings();
+
+	m_writer.reset(new thread_t("RSX Capture Writer", true, [this]()
+	{
+		while (true)
+		{
+			std::vector<u8> frame;
+
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+
+				while (m_queue.empty() && !m_stop)
+				{
+					m_cv.wait(lock);
+				}
+
+				if (m_queue.empty())
+				{
+					break;
+				}
+
+				frame = std::move(m_queue.front());
+				m_queue.pop_front();
+			}
+
+			m_file.write(reinterpret_cast<const char*>(frame.data()), frame.size());
+		}
+	}));
+}
+
+RSXCapture::~RSXCapture()
+{
+	if (!m_writer)
+	{
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		if (!m_frame.empty())
+		{
+			m_queue.push_back(std::move(m_frame));
+		}
+
+		m_stop = true;
+		m_cv.notify_one();
+	}
+
+	m_writer.reset();
+	m_file.close();
+
+	LOG_NOTICE(RSX, "RSX capture finished (%d frames)", m_frames);
+}
+
+void RSXCapture::Write(u32 type, const void* data, u32 size, const void* data2, u32 size2)
+{
+	const RSXCaptureRecord record = { type, size + size2 };
+	const size_t pos = m_frame.size();
+
+	m_frame.resize(pos + sizeof(record) + size + size2);
+	memcpy(&m_frame[pos], &record, sizeof(record));
+	memcpy(&m_frame[pos + sizeof(record)], data, size);
+
+	if (size2)
+	{
+		memcpy(&m_frame[pos + sizeof(record) + size], data2, size2);
+	}
+}
+
+void RSXCapture::AddMappings()
+{
+	const auto& mapped = Memory.RSXIOMem.GetMappedMemory();
+
+	m_map_count = mapped.size();
+
+	for (auto& info : mapped)
+	{
+		if (m_maps.emplace((u32)info.addr, (u32)info.realAddress).second)
+		{
+			const RSXCaptureMapping map = { (u32)info.addr, (u32)info.realAddress, info.size };
+
+			Write(RSX_CAPTURE_MAP, &map, sizeof(map));
+		}
+	}
+}
+
+void RSXCapture::AddMemory(u32 addr, u32 size)
+{
+	if (!size || size > 0x10000000 || !Memory.IsGoodAddr(addr, size))
+	{
+		return;
+	}
+
+	auto data = vm::get_ptr<const u8>(addr);
+
+	// FNV-1a (8 bytes at once)
+	u64 hash = 0xcbf29ce484222325ull;
+	u32 i = 0;
+
+	for (; i + 8 <= size; i += 8)
+	{
+		hash = (hash ^ *(u64*)(data + i)) * 0x100000001b3ull;
+	}
+
+	for (; i < size; i++)
+	{
+		hash = (hash ^ data[i]) * 0x100000001b3ull;
+	}
+
+	auto& last = m_recorded[addr];
+
+	if (last.first == size && last.second == hash)
+	{
+		return;
+	}
+
+	last = std::make_pair(size, hash);
+
+	Write(RSX_CAPTURE_MEMORY, &addr, sizeof(addr), data, size);
+}
+
+void RSXCapture::AddVertexData(RSXThread& rsx, u32 first, u32 count)
+{
+	for (auto& vdata : rsx.m_vertex_data)
+	{
+		if (!vdata.IsEnabled() || !vdata.addr)
+		{
+			continue;
+		}
+
+		const u32 start = vdata.addr + rsx.m_vertex_data_base_offset + vdata.stride * (first + rsx.m_vertex_data_base_index);
+
+		AddMemory(start, vdata.stride * (count - 1) + vdata.size * vdata.GetTypeSize());
+	}
+}
+
+void RSXCapture::AddFrame()
+{
+	const u64 stamp = get_system_time();
+	const u64 time = stamp - m_frame_stamp;
+	m_frame_stamp = stamp;
+
+	Write(RSX_CAPTURE_FRAME, &time, sizeof(time));
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		m_queue.push_back(std::move(m_frame));
+		m_cv.notify_one();
+	}
+
+	m_frame.clear();
+
+	if (++m_frames == g_rsx_capture_frames)
+	{
+		LOG_NOTICE(RSX, "RSX capture: %d frames recorded", m_frames);
+	}
+}
+
+void RSXCapture::AddCommand(RSXThread& rsx, u32 cmd, u32 args_addr, u32 count)
+{
+	if (Memory.RSXIOMem.GetMappedMemory().size() != m_map_count)
+	{
+		AddMappings();
+	}
+
+	auto args = vm::ptr<u32>::make(args_addr);
+	const u32 method = cmd & 0x3ffff;
+
+	// record the memory read by the command
+	switch (method)
+	{
+	case NV4097_SET_SURFACE_FORMAT:
+	{
+		AddMemory(rsx.m_gcm_buffers_addr, sizeof(CellGcmDisplayInfo) * 8);
+		break;
+	}
+
+	case NV4097_DRAW_ARRAYS:
+	{
+		for (u32 i = 0; i < count; i++)
+		{
+			AddVertexData(rsx, args[i] & 0xffffff, (args[i] >> 24) + 1);
+		}
+		break;
+	}
+
+	case NV4097_DRAW_INDEX_ARRAY:
+	{
+		const u32 type_size = rsx.m_indexed_array.m_type ? 2 : 4;
+
+		for (u32 i = 0; i < count; i++)
+		{
+			AddMemory(rsx.m_indexed_array.m_addr + (args[i] & 0xffffff) * type_size, ((args[i] >> 24) + 1) * type_size);
+		}
+		break;
+	}
+
+	case NV4097_SET_BEGIN_END:
+	{
+		if (!count || args[0])
+		{
+			break;
+		}
+
+		// end of the draw, the renderer reads vertices, textures and the fragment program
+		if (rsx.m_indexed_array.m_count)
+		{
+			AddVertexData(rsx, rsx.m_indexed_array.index_min, rsx.m_indexed_array.index_max - rsx.m_indexed_array.index_min + 1);
+		}
+
+		for (auto& tex : rsx.m_textures)
+		{
+			if (tex.IsEnabled() && tex.GetLocation() <= 1)
+			{
+				AddMemory(GetAddress(tex.GetOffset(), tex.GetLocation()), GetTextureSize(tex));
+			}
+		}
+
+		if (rsx.m_cur_fragment_prog)
+		{
+			AddMemory(rsx.m_cur_fragment_prog->addr, RSXThread::GetFragmentProgramSize(rsx.m_cur_fragment_prog->addr));
+		}
+		break;
+	}
+
+	case NV0039_OFFSET_IN:
+	{
+		if (count >= 6 && args[5] == 1)
+		{
+			AddMemory(GetAddress(args[0], CELL_GCM_LOCATION_LOCAL), args[4]);
+		}
+		break;
+	}
+	}
+
+	// the command word and its arguments
+	const u32 data[2] = { args_addr, cmd };
+
+	Write(RSX_CAPTURE_COMMAND, data, sizeof(data), vm::get_ptr<const u32>(args_addr), count * sizeof(u32));
+
+	if (method == 0x3fead) // flip
+	{
+		AddFrame();
+	}
+}
+
+// allocate memory for data restored from the capture
+static bool ReplayAlloc(u32 addr, u32 size)
+{
+	if (!size || Memory.IsGoodAddr(addr, size))
+	{
+		return true;
+	}
+
+	DynamicMemoryBlock* const blocks[] =
+	{
+		&Memory.MainMem,
+		&Memory.PRXMem,
+		&Memory.RSXCMDMem,
+		&Memory.SPRXMem,
+		&Memory.MmaperMem,
+		&Memory.RSXFBMem,
+		&Memory.StackMem,
+	};
+
+	for (auto block : blocks)
+	{
+		if (!block->IsInMyRange(addr, size))
+		{
+			continue;
+		}
+
+		if (block->AllocFixed(addr, size))
+		{
+			return true;
+		}
+
+		// partially allocated
+		for (u32 page = addr & ~4095; page < addr + size; page += 4096)
+		{
+			if (!Memory.IsGoodAddr(page) && !block->AllocFixed(page, 4096))
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	return false;
+}
+
+// NullGSRender fed from the capture file instead of the FIFO (its thread isn't started)
+class RSXReplayRender : public NullGSRender
+{
+public:
+	RSXReplayRender(const RSXCaptureHeader& header)
+	{
+		m_ctrl = vm::get_ptr<CellGcmControl>(header.ctrl_addr);
+		m_ctrlAddress = header.ctrl_addr;
+		m_local_mem_addr = header.local_addr;
+		m_gcm_buffers_addr = header.buffers_addr;
+		m_gcm_buffers_count = header.buffers_count;
+		m_gcm_current_buffer = header.current_buffer;
+
+		m_cur_vertex_prog = nullptr;
+		m_cur_fragment_prog = nullptr;
+		m_cur_fragment_prog_num = 0;
+
+		memset(m_strict_ordering, 0, sizeof(m_strict_ordering));
+		InitMethods();
+		m_methods_count = 0;
+	}
+
+	void Exec(u32 cmd, u32 args_addr, u32 count)
+	{
+		if ((cmd & 0x3ffff) == 0x3fead)
+		{
+			// flip (not passed to DoCmd, it would apply the frame limit)
+			m_gcm_current_buffer = vm::read32(args_addr);
+			m_last_flip_time = get_system_time();
+			m_read_buffer = true;
+			m_flip_status = 0;
+			return;
+		}
+
+		ExecMethod(cmd, args_addr, count);
+	}
+};
+
+bool RSXReplay(const std::string& path)
+{
+	if (!Emu.IsStopped())
+	{
+		LOG_ERROR(RSX, "RSX replay: emulation must be stopped");
+		return false;
+	}
+
+	std::ifstream f(path, std::ios::binary);
+
+	RSXCaptureHeader header;
+
+	if (!f.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.magic != g_rsx_capture_magic || header.version != g_rsx_capture_version)
+	{
+		LOG_ERROR(RSX, "RSX replay: invalid capture file ('%s')", path.c_str());
+		return false;
+	}
+
+	Memory.Init(Memory_PS3);
+	Memory.RSXIOMem.SetRange(0, header.io_range);
+
+	if (!ReplayAlloc(header.local_addr, header.local_size) ||
+		!ReplayAlloc(header.cmd_addr, header.cmd_size) ||
+		!ReplayAlloc(header.ctrl_addr, sizeof(CellGcmControl)) ||
+		!ReplayAlloc(header.buffers_addr, sizeof(CellGcmDisplayInfo) * 8))
+	{
+		LOG_ERROR(RSX, "RSX replay: memory allocation failed");
+		Memory.Close();
+		return false;
+	}
+
+	auto render = new RSXReplayRender(header);
+	Emu.GetGSManager().Init(render);
+
+	bool result = true;
+	std::vector<u8> data;
+	Timer timer;
+	u32 frames = 0;
+	double frame_time = 0.0, total_time = 0.0, min_time = 0.0, max_time = 0.0; // in milliseconds
+	u64 frame_methods = 0;
+
+	try
+	{
+		RSXCaptureRecord record;
+
+		while (f.read(reinterpret_cast<char*>(&record), sizeof(record)))
+		{
+			data.resize(record.size);
+
+			if (!f.read(reinterpret_cast<char*>(data.data()), record.size))
+			{
+				LOG_ERROR(RSX, "RSX replay: unexpected end of file");
+				result = false;
+				break;
+			}
+
+			switch (record.type)
+			{
+			case RSX_CAPTURE_MAP:
+			{
+				RSXCaptureMapping map;
+				memcpy(&map, data.data(), sizeof(map));
+
+				u64 addr;
+				u32 size;
+
+				if (Memory.RSXIOMem.getRealAddr(map.io, addr))
+				{
+					Memory.RSXIOMem.UnmapAddress(map.io, size);
+				}
+
+				if (!ReplayAlloc(map.ea, map.size) || !Memory.RSXIOMem.Map(map.ea, map.size, map.io))
+				{
+					LOG_ERROR(RSX, "RSX replay: failed to map memory (io=0x%x, ea=0x%x, size=0x%x)", map.io, map.ea, map.size);
+				}
+				break;
+			}
+
+			case RSX_CAPTURE_MEMORY:
+			{
+				const u32 addr = *(u32*)data.data();
+				const u32 size = record.size - sizeof(u32);
+
+				if (!ReplayAlloc(addr, size))
+				{
+					LOG_ERROR(RSX, "RSX replay: failed to allocate memory (addr=0x%x, size=0x%x)", addr, size);
+					break;
+				}
+
+				memcpy(vm::get_ptr(addr), data.data() + sizeof(u32), size);
+				break;
+			}
+
+			case RSX_CAPTURE_COMMAND:
+			{
+				const u32 args_addr = *(u32*)data.data();
+				const u32 cmd = *(u32*)(data.data() + sizeof(u32));
+				const u32 count = (record.size - sizeof(u32) * 2) / sizeof(u32);
+
+				if (count && !Memory.IsGoodAddr(args_addr, count * sizeof(u32)))
+				{
+					LOG_ERROR(RSX, "RSX replay: arguments not mapped (cmd=0x%x, addr=0x%x)", cmd, args_addr);
+					break;
+				}
+
+				// restore the arguments in memory where they were read from
+				memcpy(vm::get_ptr(args_addr), data.data() + sizeof(u32) * 2, count * sizeof(u32));
+
+				timer.Start();
+				render->Exec(cmd, args_addr, count);
+				frame_time += timer.GetElapsedTimeInNanoSec() / 1000000.0;
+				break;
+			}
+
+			case RSX_CAPTURE_FRAME:
+			{
+				const u64 recorded = *(u64*)data.data();
+				const u64 methods = render->m_methods_count - frame_methods;
+				frame_methods = render->m_methods_count;
+
+				LOG_NOTICE(RSX, "RSX replay: frame %d: %.3f ms, %lld methods (recorded: %.3f ms)", frames, frame_time, methods, recorded / 1000.0);
+
+				if (!frames || frame_time < min_time) min_time = frame_time;
+				if (!frames || frame_time > max_time) max_time = frame_time;
+				total_time += frame_time;
+				frame_time = 0.0;
+				frames++;
+				break;
+			}
+
+			default:
+			{
+				LOG_ERROR(RSX, "RSX replay: unknown record type (%d)", record.type);
+				break;
+			}
+			}
+		}
+	}
+	catch (const std::string& e)
+	{
+		LOG_ERROR(RSX, "RSX replay: exception: %s", e.c_str());
+		result = false;
+	}
+	catch (const char* e)
+	{
+		LOG_ERROR(RSX, "RSX replay: exception: %s", e);
+		result = false;
+	}
+
+	if (frames)
+	{
+		LOG_NOTICE(RSX, "RSX replay: %d frames, total %.3f ms, average %.3f ms, min %.3f ms, max %.3f ms", frames, total_time, total_time / frames, min_time, max_time);
+	}
+
+	Emu.GetGSManager().Close();
+	Memory.Close();
+
+	return result;
+}
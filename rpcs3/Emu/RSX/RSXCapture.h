@@ -0,0 +1,88 @@
+#pragma once
+#include <deque>
+#include <fstream>
+#include <unordered_map>
+
+class thread_t;
+class RSXThread;
+
+// RSX capture file: RSXCaptureHeader followed by records (RSXCaptureRecord followed by its payload)
+// all values are stored in host byte order, command arguments and memory contents are stored as they were in PS3 memory
+
+static const u32 g_rsx_capture_magic = 0x43585352; // "RSXC"
+static const u32 g_rsx_capture_version = 1;
+static const u32 g_rsx_capture_frames = 600; // max number of frames recorded
+
+enum RSXCaptureRecordType : u32
+{
+	RSX_CAPTURE_MAP, // RSXCaptureMapping (RSX IO mapping added since the previous one was recorded)
+	RSX_CAPTURE_MEMORY, // u32 address followed by data (written before the command which reads it)
+	RSX_CAPTURE_COMMAND, // u32 address of the arguments, command word, arguments
+	RSX_CAPTURE_FRAME, // end of the frame (flip), u64 time spent on the frame when it was recorded (in microseconds)
+};
+
+struct RSXCaptureHeader
+{
+	u32 magic;
+	u32 version;
+	u32 io_range; // size of RSX IO address space
+	u32 ctrl_addr; // CellGcmControl
+	u32 local_addr; // RSX local memory
+	u32 local_size;
+	u32 cmd_addr; // labels and semaphores (RSXCMDMem)
+	u32 cmd_size;
+	u32 buffers_addr; // CellGcmDisplayInfo[8]
+	u32 buffers_count;
+	u32 current_buffer;
+};
+
+struct RSXCaptureMapping
+{
+	u32 io;
+	u32 ea;
+	u32 size;
+};
+
+struct RSXCaptureRecord
+{
+	u32 type; // RSXCaptureRecordType
+	u32 size; // size of the payload
+};
+
+// records RSX commands and the memory read by them, frames are written to the file by a separate thread
+class RSXCapture
+{
+	std::ofstream m_file;
+	std::vector<u8> m_frame; // records of the current frame
+	std::unordered_map<u32, std::pair<u32, u64>> m_recorded; // key: address, value: size and hash of the last recorded data
+	u32 m_frames;
+	u64 m_frame_stamp;
+	size_t m_map_count; // number of RSX IO mappings when they were checked last time
+	std::set<std::pair<u32, u32>> m_maps; // recorded RSX IO mappings (IO address and effective address)
+
+	std::unique_ptr<thread_t> m_writer;
+	std::deque<std::vector<u8>> m_queue; // frames waiting to be written
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	bool m_stop;
+
+	void Write(u32 type, const void* data, u32 size, const void* data2 = nullptr, u32 size2 = 0);
+	void AddMappings();
+	void AddVertexData(RSXThread& rsx, u32 first, u32 count);
+	void AddFrame();
+
+public:
+	RSXCapture(RSXThread& rsx, const std::string& path);
+	~RSXCapture();
+
+	bool IsActive() const { return m_frames < g_rsx_capture_frames; }
+
+	// record memory contents (skipped if it didn't change since it was recorded last time)
+	void AddMemory(u32 addr, u32 size);
+
+	// record the memory read by the command and the command itself
+	void AddCommand(RSXThread& rsx, u32 cmd, u32 args_addr, u32 count);
+};
+
+// replay the capture file with NullGSRender and report the time spent on every frame, returns false if the file is invalid
+bool RSXReplay(const std::string& path);
@@ -73,7 +73,7 @@ enum
 
 struct RSXFragmentProgram
 {
-	u32 size;
+	u32 size; // RSXThread::GetFragmentProgramSize(), updated by the renderer before the program is looked up
 	u32 addr;
 	u32 offset;
 	u32 ctrl;
@@ -0,0 +1,79 @@
+#include "stdafx.h"
+#include "Emu/Memory/Memory.h"
+#include "RSXMemorySnapshot.h"
+
+void RSXMemorySnapshot::Take(u32 addr, u32 size)
+{
+	this->addr = addr;
+	this->size = size;
+	this->hash = Hash(vm::get_ptr<const u8>(addr), size);
+}
+
+bool RSXMemorySnapshot::Match(u32 addr, u32 size) const
+{
+	return this->addr == addr && this->size == size && this->hash == Hash(vm::get_ptr<const u8>(addr), size);
+}
+
+std::atomic<u64> RSXMemorySnapshot::hashed_bytes(0);
+std::atomic<u64> RSXMemorySnapshot::hash_time(0);
+
+static __forceinline u64 rotl64(u64 v, u32 n)
+{
+	return (v << n) | (v >> (64 - n));
+}
+
+static const u64 g_hash_prime1 = 0x9e3779b185ebca87ull;
+static const u64 g_hash_prime2 = 0xc2b2ae3d27d4eb4full;
+static const u64 g_hash_prime3 = 0x165667b19e3779f9ull;
+
+// every 64-bit word is multiplied into its lane, so changes at any position and of any width affect the whole state
+static __forceinline u64 hash_round(u64 acc, u64 value)
+{
+	return rotl64(acc + value * g_hash_prime2, 31) * g_hash_prime1;
+}
+
+u64 RSXMemorySnapshot::Hash(const void* data, u32 size)
+{
+	const auto start = std::chrono::high_resolution_clock::now();
+	const u8* ptr = static_cast<const u8*>(data);
+
+	// four independent lanes (like xxHash64)
+	u64 lane0 = g_hash_prime1 + g_hash_prime2;
+	u64 lane1 = g_hash_prime2;
+	u64 lane2 = 0;
+	u64 lane3 = 0 - g_hash_prime1;
+
+	u32 i = 0;
+
+	for (; i + 32 <= size; i += 32)
+	{
+		lane0 = hash_round(lane0, *(const u64*)(ptr + i + 0));
+		lane1 = hash_round(lane1, *(const u64*)(ptr + i + 8));
+		lane2 = hash_round(lane2, *(const u64*)(ptr + i + 16));
+		lane3 = hash_round(lane3, *(const u64*)(ptr + i + 24));
+	}
+
+	u64 hash = rotl64(lane0, 1) + rotl64(lane1, 7) + rotl64(lane2, 12) + rotl64(lane3, 18) + size;
+
+	for (; i + 8 <= size; i += 8)
+	{
+		hash = rotl64(hash ^ hash_round(0, *(const u64*)(ptr + i)), 27) * g_hash_prime1 + g_hash_prime3;
+	}
+
+	for (; i < size; i++)
+	{
+		hash = rotl64(hash ^ (ptr[i] * g_hash_prime3), 11) * g_hash_prime1;
+	}
+
+	// final avalanche
+	hash ^= hash >> 33;
+	hash *= g_hash_prime2;
+	hash ^= hash >> 29;
+	hash *= g_hash_prime3;
+	hash ^= hash >> 32;
+
+	hashed_bytes += size;
+	hash_time += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - start).count();
+
+	return hash;
+}
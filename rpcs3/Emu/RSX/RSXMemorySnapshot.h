@@ -0,0 +1,32 @@
+#pragma once
+
+// snapshot of RSX memory range used to check if the data was modified since it was converted or written
+// (vertex buffer cache, texture cache and surface write-back use it)
+//
+// writes aren't detected by protecting guest pages because page protection is already used by vm reservations,
+// so the range is hashed when the snapshot is taken and hashed again when it's checked (the cost is shown in the RSX debugger)
+struct RSXMemorySnapshot
+{
+	static std::atomic<u64> hashed_bytes; // bytes hashed since the RSX thread was started
+	static std::atomic<u64> hash_time; // time spent on hashing (in nanoseconds)
+
+	u32 addr;
+	u32 size;
+	u64 hash;
+
+	RSXMemorySnapshot()
+		: addr(0)
+		, size(0)
+		, hash(0)
+	{
+	}
+
+	// take the snapshot before the data is read, so a write during the conversion is detected next time
+	void Take(u32 addr, u32 size);
+
+	// check if the snapshot was taken from the same range and its data wasn't modified
+	bool Match(u32 addr, u32 size) const;
+
+	// 64-bit hash of host data (reads each byte once, faster than comparing with a copy)
+	static u64 Hash(const void* data, u32 size);
+};
@@ -0,0 +1,388 @@
+#include "stdafx.h"
+#include "RSXTextureDecode.h"
+
+u32 LinearToSwizzleAddress(u32 x, u32 y, u32 z, u32 log2_width, u32 log2_height, u32 log2_depth)
+{
+	u32 offset = 0;
+	u32 shift_count = 0;
+	while (log2_width | log2_height | log2_depth){
+		if (log2_width)
+		{
+			offset |= (x & 0x01) << shift_count;
+			x >>= 1;
+			++shift_count;
+			--log2_width;
+		}
+		if (log2_height)
+		{
+			offset |= (y & 0x01) << shift_count;
+			y >>= 1;
+			++shift_count;
+			--log2_height;
+		}
+		if (log2_depth)
+		{
+			offset |= (z & 0x01) << shift_count;
+			z >>= 1;
+			++shift_count;
+			--log2_depth;
+		}
+	}
+	return offset;
+}
+
+static u32 Log2(u32 value)
+{
+	u32 result = 0;
+	while (value >>= 1) result++;
+	return result;
+}
+
+static u8 Convert5To8(u8 v)
+{
+	// Swizzle bits: 00012345 -> 12345123
+	return (v << 3) | (v >> 2);
+}
+
+static u8 Convert6To8(u8 v)
+{
+	// Swizzle bits: 00123456 -> 12345612
+	return (v << 2) | (v >> 4);
+}
+
+// swizzled offsets are advanced as (offset - mask) & mask, which increments the coordinate spread over the mask bits
+template<u32 bpp>
+static void UnswizzleTexels(u8* dst, const u8* src, u32 width, u32 height, u32 mask_x, u32 mask_y)
+{
+	for (u32 y = 0, oy = 0; y < height; y++, oy = (oy - mask_y) & mask_y)
+	{
+		for (u32 x = 0, ox = 0; x < width; x++, ox = (ox - mask_x) & mask_x)
+		{
+			memcpy(dst + (y * width + x) * bpp, src + (ox | oy) * bpp, bpp);
+		}
+	}
+}
+
+void UnswizzleTexture(void* dst, const void* src, u32 width, u32 height, u32 bpp)
+{
+	const u32 log2width = Log2(width);
+	const u32 log2height = Log2(height);
+	const u32 mask_x = LinearToSwizzleAddress(width - 1, 0, 0, log2width, log2height, 0);
+	const u32 mask_y = LinearToSwizzleAddress(0, height - 1, 0, log2width, log2height, 0);
+
+	if (bpp == 4 && width >= 4 && height >= 2)
+	{
+		// 4x2 texel blocks are stored contiguously as 2x2 block of x = 0..1 followed by 2x2 block of x = 2..3
+		const u32 mask_x2 = mask_x & (mask_x - 1);
+		const u32 mask_x4 = mask_x2 & (mask_x2 - 1); // without two lowest bits
+		const u32 mask_y2 = mask_y & (mask_y - 1); // without the lowest bit
+
+		for (u32 y = 0, oy = 0; y < height; y += 2, oy = (oy - mask_y2) & mask_y2)
+		{
+			__m128i* row0 = (__m128i*)((u8*)dst + y * width * 4);
+			__m128i* row1 = (__m128i*)((u8*)dst + (y + 1) * width * 4);
+
+			for (u32 x = 0, ox = 0; x < width; x += 4, ox = (ox - mask_x4) & mask_x4)
+			{
+				const __m128i* block = (const __m128i*)((const u8*)src + (ox | oy) * 4);
+				const __m128i a = _mm_loadu_si128(block);
+				const __m128i b = _mm_loadu_si128(block + 1);
+				_mm_storeu_si128(row0++, _mm_unpacklo_epi64(a, b));
+				_mm_storeu_si128(row1++, _mm_unpackhi_epi64(a, b));
+			}
+		}
+
+		return;
+	}
+
+	if (bpp == 2 && width >= 4 && height >= 2)
+	{
+		// the same 4x2 block layout fits into one 16-byte load
+		const u32 mask_x2 = mask_x & (mask_x - 1);
+		const u32 mask_x4 = mask_x2 & (mask_x2 - 1);
+		const u32 mask_y2 = mask_y & (mask_y - 1);
+
+		for (u32 y = 0, oy = 0; y < height; y += 2, oy = (oy - mask_y2) & mask_y2)
+		{
+			u8* row0 = (u8*)dst + y * width * 2;
+			u8* row1 = (u8*)dst + (y + 1) * width * 2;
+
+			for (u32 x = 0, ox = 0; x < width; x += 4, ox = (ox - mask_x4) & mask_x4, row0 += 8, row1 += 8)
+			{
+				// 32-bit lanes: row 0 of x = 0..1, row 1 of x = 0..1, row 0 of x = 2..3, row 1 of x = 2..3
+				const __m128i block = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)((const u8*)src + (ox | oy) * 2)), _MM_SHUFFLE(3, 1, 2, 0));
+				_mm_storel_epi64((__m128i*)row0, block);
+				_mm_storel_epi64((__m128i*)row1, _mm_unpackhi_epi64(block, block));
+			}
+		}
+
+		return;
+	}
+
+	switch (bpp)
+	{
+	case 1: UnswizzleTexels<1>((u8*)dst, (const u8*)src, width, height, mask_x, mask_y); break;
+	case 2: UnswizzleTexels<2>((u8*)dst, (const u8*)src, width, height, mask_x, mask_y); break;
+	case 4: UnswizzleTexels<4>((u8*)dst, (const u8*)src, width, height, mask_x, mask_y); break;
+	case 8: UnswizzleTexels<8>((u8*)dst, (const u8*)src, width, height, mask_x, mask_y); break;
+	case 16: UnswizzleTexels<16>((u8*)dst, (const u8*)src, width, height, mask_x, mask_y); break;
+	default: UnswizzleTextureRef(dst, src, width, height, bpp); break;
+	}
+}
+
+void UnswizzleTextureRef(void* dst, const void* src, u32 width, u32 height, u32 bpp)
+{
+	const u32 log2width = Log2(width);
+	const u32 log2height = Log2(height);
+
+	for (u32 y = 0; y < height; y++)
+	{
+		for (u32 x = 0; x < width; x++)
+		{
+			memcpy((u8*)dst + (y * width + x) * bpp, (const u8*)src + LinearToSwizzleAddress(x, y, 0, log2width, log2height, 0) * bpp, bpp);
+		}
+	}
+}
+
+static u8 Convert4To8(u8 v)
+{
+	return (v << 4) | v;
+}
+
+// swap bytes in 16-bit lanes
+static __m128i SwapBytes16(__m128i v)
+{
+	return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+void ConvertA1R5G5B5(u8* dst, const u8* src, u32 count)
+{
+	u32 i = 0;
+
+	for (; i + 8 <= count; i += 8)
+	{
+		const __m128i c = SwapBytes16(_mm_loadu_si128((const __m128i*)(src + i * 2)));
+
+		const __m128i r = _mm_and_si128(_mm_srli_epi16(c, 10), _mm_set1_epi16(0x1f));
+		const __m128i g = _mm_and_si128(_mm_srli_epi16(c, 5), _mm_set1_epi16(0x1f));
+		const __m128i b = _mm_and_si128(c, _mm_set1_epi16(0x1f));
+
+		const __m128i r8 = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+		const __m128i g8 = _mm_or_si128(_mm_slli_epi16(g, 3), _mm_srli_epi16(g, 2));
+		const __m128i b8 = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+
+		// 16-bit lanes: red and green, blue and alpha (the alpha bit is replicated by the arithmetic shift)
+		const __m128i rg = _mm_or_si128(r8, _mm_slli_epi16(g8, 8));
+		const __m128i ba = _mm_or_si128(b8, _mm_and_si128(_mm_srai_epi16(c, 15), _mm_set1_epi16((s16)0xff00)));
+
+		_mm_storeu_si128((__m128i*)(dst + i * 4), _mm_unpacklo_epi16(rg, ba));
+		_mm_storeu_si128((__m128i*)(dst + i * 4 + 16), _mm_unpackhi_epi16(rg, ba));
+	}
+
+	ConvertA1R5G5B5Ref(dst + i * 4, src + i * 2, count - i);
+}
+
+void ConvertA1R5G5B5Ref(u8* dst, const u8* src, u32 count)
+{
+	for (u32 i = 0; i < count; ++i)
+	{
+		u16 c = reinterpret_cast<const be_t<u16> *>(src)[i];
+		dst[i * 4 + 0] = Convert5To8((c >> 10) & 0x1F);
+		dst[i * 4 + 1] = Convert5To8((c >> 5) & 0x1F);
+		dst[i * 4 + 2] = Convert5To8((c >> 0) & 0x1F);
+		dst[i * 4 + 3] = (c & 0x8000) ? 255 : 0;
+	}
+}
+
+void ConvertA4R4G4B4(u8* dst, const u8* src, u32 count)
+{
+	u32 i = 0;
+
+	for (; i + 8 <= count; i += 8)
+	{
+		const __m128i c = SwapBytes16(_mm_loadu_si128((const __m128i*)(src + i * 2)));
+
+		// 16-bit lanes: red and green, blue and alpha (4-bit components in the low bits of every byte)
+		const __m128i rg = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(c, 8), _mm_set1_epi16(0xf)), _mm_and_si128(_mm_slli_epi16(c, 4), _mm_set1_epi16(0xf00)));
+		const __m128i ba = _mm_or_si128(_mm_and_si128(c, _mm_set1_epi16(0xf)), _mm_and_si128(_mm_srli_epi16(c, 4), _mm_set1_epi16(0xf00)));
+
+		const __m128i rg8 = _mm_or_si128(rg, _mm_slli_epi16(rg, 4));
+		const __m128i ba8 = _mm_or_si128(ba, _mm_slli_epi16(ba, 4));
+
+		_mm_storeu_si128((__m128i*)(dst + i * 4), _mm_unpacklo_epi16(rg8, ba8));
+		_mm_storeu_si128((__m128i*)(dst + i * 4 + 16), _mm_unpackhi_epi16(rg8, ba8));
+	}
+
+	ConvertA4R4G4B4Ref(dst + i * 4, src + i * 2, count - i);
+}
+
+void ConvertA4R4G4B4Ref(u8* dst, const u8* src, u32 count)
+{
+	for (u32 i = 0; i < count; ++i)
+	{
+		u16 c = reinterpret_cast<const be_t<u16> *>(src)[i];
+		dst[i * 4 + 0] = Convert4To8((c >> 8) & 0xF);
+		dst[i * 4 + 1] = Convert4To8((c >> 4) & 0xF);
+		dst[i * 4 + 2] = Convert4To8((c >> 0) & 0xF);
+		dst[i * 4 + 3] = Convert4To8((c >> 12) & 0xF);
+	}
+}
+
+void ConvertR6G5B5(u8* dst, const u8* src, u32 count)
+{
+	u32 i = 0;
+
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i c = _mm_loadu_si128((const __m128i*)(src + i * 2));
+		c = _mm_or_si128(_mm_slli_epi16(c, 8), _mm_srli_epi16(c, 8));
+
+		const __m128i r = _mm_srli_epi16(c, 10);
+		const __m128i g = _mm_and_si128(_mm_srli_epi16(c, 5), _mm_set1_epi16(0x1f));
+		const __m128i b = _mm_and_si128(c, _mm_set1_epi16(0x1f));
+
+		const __m128i r8 = _mm_or_si128(_mm_slli_epi16(r, 2), _mm_srli_epi16(r, 4));
+		const __m128i g8 = _mm_or_si128(_mm_slli_epi16(g, 3), _mm_srli_epi16(g, 2));
+		const __m128i b8 = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+
+		// 16-bit lanes: red and green, blue and alpha
+		const __m128i rg = _mm_or_si128(r8, _mm_slli_epi16(g8, 8));
+		const __m128i ba = _mm_or_si128(b8, _mm_set1_epi16((s16)0xff00));
+
+		_mm_storeu_si128((__m128i*)(dst + i * 4), _mm_unpacklo_epi16(rg, ba));
+		_mm_storeu_si128((__m128i*)(dst + i * 4 + 16), _mm_unpackhi_epi16(rg, ba));
+	}
+
+	ConvertR6G5B5Ref(dst + i * 4, src + i * 2, count - i);
+}
+
+void ConvertR6G5B5Ref(u8* dst, const u8* src, u32 count)
+{
+	for (u32 i = 0; i < count; ++i)
+	{
+		u16 c = reinterpret_cast<const be_t<u16> *>(src)[i];
+		dst[i * 4 + 0] = Convert6To8((c >> 10) & 0x3F);
+		dst[i * 4 + 1] = Convert5To8((c >> 5) & 0x1F);
+		dst[i * 4 + 2] = Convert5To8((c >> 0) & 0x1F);
+		dst[i * 4 + 3] = 255;
+	}
+}
+
+void ConvertB8R8_G8R8(u8* dst, const u8* src, u32 count)
+{
+	u32 i = 0;
+
+	for (; i + 8 <= count; i += 8)
+	{
+		// every 32-bit lane contains two texels: B, R (of the second texel), G, R (of the first texel)
+		const __m128i w = _mm_loadu_si128((const __m128i*)(src + i * 2));
+		const __m128i common = _mm_or_si128(_mm_or_si128(
+			_mm_and_si128(_mm_srli_epi32(w, 8), _mm_set1_epi32(0xff00)),
+			_mm_slli_epi32(_mm_and_si128(w, _mm_set1_epi32(0xff)), 16)),
+			_mm_set1_epi32(0xff000000));
+		const __m128i first = _mm_or_si128(common, _mm_srli_epi32(w, 24));
+		const __m128i second = _mm_or_si128(common, _mm_and_si128(_mm_srli_epi32(w, 8), _mm_set1_epi32(0xff)));
+
+		_mm_storeu_si128((__m128i*)(dst + i * 4), _mm_unpacklo_epi32(first, second));
+		_mm_storeu_si128((__m128i*)(dst + i * 4 + 16), _mm_unpackhi_epi32(first, second));
+	}
+
+	ConvertB8R8_G8R8Ref(dst + i * 4, src + i * 2, count - i);
+}
+
+void ConvertB8R8_G8R8Ref(u8* dst, const u8* src, u32 count)
+{
+	for (u32 i = 0; i < count; i += 2)
+	{
+		dst[i * 4 + 0 + 0] = src[i * 2 + 3];
+		dst[i * 4 + 0 + 1] = src[i * 2 + 2];
+		dst[i * 4 + 0 + 2] = src[i * 2 + 0];
+		dst[i * 4 + 0 + 3] = 255;
+
+		// The second pixel is the same, except for red.
+		dst[i * 4 + 4 + 0] = src[i * 2 + 1];
+		dst[i * 4 + 4 + 1] = src[i * 2 + 2];
+		dst[i * 4 + 4 + 2] = src[i * 2 + 0];
+		dst[i * 4 + 4 + 3] = 255;
+	}
+}
+
+void ConvertR8B8_R8G8(u8* dst, const u8* src, u32 count)
+{
+	u32 i = 0;
+
+	for (; i + 8 <= count; i += 8)
+	{
+		// every 32-bit lane contains two texels: R (of the second texel), B, R (of the first texel), G
+		const __m128i w = _mm_loadu_si128((const __m128i*)(src + i * 2));
+		const __m128i common = _mm_or_si128(_mm_or_si128(
+			_mm_and_si128(_mm_srli_epi32(w, 16), _mm_set1_epi32(0xff00)),
+			_mm_and_si128(_mm_slli_epi32(w, 8), _mm_set1_epi32(0xff0000))),
+			_mm_set1_epi32(0xff000000));
+		const __m128i first = _mm_or_si128(common, _mm_and_si128(_mm_srli_epi32(w, 16), _mm_set1_epi32(0xff)));
+		const __m128i second = _mm_or_si128(common, _mm_and_si128(w, _mm_set1_epi32(0xff)));
+
+		_mm_storeu_si128((__m128i*)(dst + i * 4), _mm_unpacklo_epi32(first, second));
+		_mm_storeu_si128((__m128i*)(dst + i * 4 + 16), _mm_unpackhi_epi32(first, second));
+	}
+
+	ConvertR8B8_R8G8Ref(dst + i * 4, src + i * 2, count - i);
+}
+
+void ConvertR8B8_R8G8Ref(u8* dst, const u8* src, u32 count)
+{
+	for (u32 i = 0; i < count; i += 2)
+	{
+		dst[i * 4 + 0 + 0] = src[i * 2 + 2];
+		dst[i * 4 + 0 + 1] = src[i * 2 + 3];
+		dst[i * 4 + 0 + 2] = src[i * 2 + 1];
+		dst[i * 4 + 0 + 3] = 255;
+
+		// The second pixel is the same, except for red.
+		dst[i * 4 + 4 + 0] = src[i * 2 + 0];
+		dst[i * 4 + 4 + 1] = src[i * 2 + 3];
+		dst[i * 4 + 4 + 2] = src[i * 2 + 1];
+		dst[i * 4 + 4 + 3] = 255;
+	}
+}
+
+void ConvertX16(u8* dst, const u8* src, u32 count)
+{
+	u32 i = 0;
+
+	for (; i + 8 <= count; i += 8)
+	{
+		_mm_storeu_si128((__m128i*)(dst + i * 2), SwapBytes16(_mm_loadu_si128((const __m128i*)(src + i * 2))));
+	}
+
+	ConvertX16Ref(dst + i * 2, src + i * 2, count - i);
+}
+
+void ConvertX16Ref(u8* dst, const u8* src, u32 count)
+{
+	for (u32 i = 0; i < count; ++i)
+	{
+		reinterpret_cast<u16*>(dst)[i] = reinterpret_cast<const be_t<u16> *>(src)[i];
+	}
+}
+
+void ConvertDepth24(u8* dst, const u8* src, u32 count)
+{
+	u32 i = 0;
+
+	for (; i + 4 <= count; i += 4)
+	{
+		const __m128i v = SwapBytes16(_mm_loadu_si128((const __m128i*)(src + i * 4)));
+		_mm_storeu_si128((__m128i*)(dst + i * 4), _mm_or_si128(_mm_slli_epi32(v, 16), _mm_srli_epi32(v, 16)));
+	}
+
+	ConvertDepth24Ref(dst + i * 4, src + i * 4, count - i);
+}
+
+void ConvertDepth24Ref(u8* dst, const u8* src, u32 count)
+{
+	for (u32 i = 0; i < count; ++i)
+	{
+		reinterpret_cast<u32*>(dst)[i] = reinterpret_cast<const be_t<u32> *>(src)[i];
+	}
+}
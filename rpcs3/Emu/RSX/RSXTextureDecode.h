@@ -0,0 +1,44 @@
+#pragma once
+
+// conversion of RSX texture data to the layouts accepted by the host graphics API (no GPU required)
+// every conversion has SSE2 version and scalar reference version (with Ref suffix) which it must match
+
+u32 LinearToSwizzleAddress(u32 x, u32 y, u32 z, u32 log2_width, u32 log2_height, u32 log2_depth);
+
+// convert swizzled (Morton order) 2D texture to linear order, width and height must be powers of 2
+// bpp: bytes per texel (1, 2, 4, 8 or 16)
+void UnswizzleTexture(void* dst, const void* src, u32 width, u32 height, u32 bpp);
+void UnswizzleTextureRef(void* dst, const void* src, u32 width, u32 height, u32 bpp);
+
+// convert big-endian A1R5G5B5 texels to RGBA8
+void ConvertA1R5G5B5(u8* dst, const u8* src, u32 count);
+void ConvertA1R5G5B5Ref(u8* dst, const u8* src, u32 count);
+
+// convert big-endian A4R4G4B4 texels to RGBA8
+void ConvertA4R4G4B4(u8* dst, const u8* src, u32 count);
+void ConvertA4R4G4B4Ref(u8* dst, const u8* src, u32 count);
+
+// convert big-endian R6G5B5 texels to RGBA8
+void ConvertR6G5B5(u8* dst, const u8* src, u32 count);
+void ConvertR6G5B5Ref(u8* dst, const u8* src, u32 count);
+
+// convert COMPRESSED_B8R8_G8R8 texels (two texels share blue and green) to RGBA8, count must be even
+void ConvertB8R8_G8R8(u8* dst, const u8* src, u32 count);
+void ConvertB8R8_G8R8Ref(u8* dst, const u8* src, u32 count);
+
+// convert COMPRESSED_R8B8_R8G8 texels (two texels share blue and green) to RGBA8, count must be even
+void ConvertR8B8_R8G8(u8* dst, const u8* src, u32 count);
+void ConvertR8B8_R8G8Ref(u8* dst, const u8* src, u32 count);
+
+// convert big-endian 16-bit components (X16, Y16_X16 and DEPTH16 texels) to host byte order
+void ConvertX16(u8* dst, const u8* src, u32 count);
+void ConvertX16Ref(u8* dst, const u8* src, u32 count);
+
+// convert big-endian DEPTH24_D8 texels to host byte order (depth in the upper 24 bits)
+void ConvertDepth24(u8* dst, const u8* src, u32 count);
+void ConvertDepth24Ref(u8* dst, const u8* src, u32 count);
+
+// compare every conversion with its reference version, mismatches are logged (returns false if any was found)
+bool texture_decode_test();
+// measure throughput of every conversion and its reference version, results are logged
+void texture_decode_benchmark();
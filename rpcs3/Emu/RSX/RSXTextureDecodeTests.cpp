@@ -0,0 +1,132 @@
+#include "stdafx.h"
+#include <random>
+#include "Utilities/Log.h"
+#include "RSXTextureDecode.h"
+
+typedef void(*texture_convert_t)(u8* dst, const u8* src, u32 count);
+
+struct texture_convert_info
+{
+	const char* name;
+	texture_convert_t func;
+	texture_convert_t ref;
+	u32 src_size; // bytes per texel
+	u32 dst_size;
+	u32 align; // count must be a multiple of it
+};
+
+static const texture_convert_info g_texture_converts[] =
+{
+	{ "A1R5G5B5", ConvertA1R5G5B5, ConvertA1R5G5B5Ref, 2, 4, 1 },
+	{ "A4R4G4B4", ConvertA4R4G4B4, ConvertA4R4G4B4Ref, 2, 4, 1 },
+	{ "R6G5B5", ConvertR6G5B5, ConvertR6G5B5Ref, 2, 4, 1 },
+	{ "B8R8_G8R8", ConvertB8R8_G8R8, ConvertB8R8_G8R8Ref, 2, 4, 2 },
+	{ "R8B8_R8G8", ConvertR8B8_R8G8, ConvertR8B8_R8G8Ref, 2, 4, 2 },
+	{ "X16", ConvertX16, ConvertX16Ref, 2, 2, 1 },
+	{ "Depth24", ConvertDepth24, ConvertDepth24Ref, 4, 4, 1 },
+};
+
+static void fill_random(std::vector<u8>& data, std::mt19937& rng)
+{
+	for (auto& v : data)
+	{
+		v = (u8)rng();
+	}
+}
+
+bool texture_decode_test()
+{
+	std::mt19937 rng(0);
+	bool result = true;
+
+	for (auto& conv : g_texture_converts)
+	{
+		// odd counts and offsets check the scalar tail and unaligned accesses
+		for (u32 count = 0; count <= 300; count += conv.align)
+		{
+			for (u32 offset = 0; offset < 4; offset++)
+			{
+				std::vector<u8> src(offset + count * conv.src_size);
+				std::vector<u8> dst(count * conv.dst_size + 16, 0xcd), ref(count * conv.dst_size + 16, 0xcd);
+				fill_random(src, rng);
+
+				conv.func(dst.data(), src.data() + offset, count);
+				conv.ref(ref.data(), src.data() + offset, count);
+
+				if (dst != ref)
+				{
+					LOG_ERROR(RSX, "Texture decode test: %s doesn't match the reference (count=%d, offset=%d)", conv.name, count, offset);
+					result = false;
+					break;
+				}
+			}
+		}
+	}
+
+	for (u32 bpp : { 1, 2, 4, 8, 16 })
+	{
+		for (u32 width = 1; width <= 512; width *= 2)
+		{
+			for (u32 height = 1; height <= 512; height *= 2)
+			{
+				std::vector<u8> src(width * height * bpp);
+				std::vector<u8> dst(src.size() + 16, 0xcd), ref(src.size() + 16, 0xcd);
+				fill_random(src, rng);
+
+				UnswizzleTexture(dst.data(), src.data(), width, height, bpp);
+				UnswizzleTextureRef(ref.data(), src.data(), width, height, bpp);
+
+				if (dst != ref)
+				{
+					LOG_ERROR(RSX, "Texture decode test: unswizzle doesn't match the reference (%dx%d, %d bytes per texel)", width, height, bpp);
+					result = false;
+				}
+			}
+		}
+	}
+
+	LOG_NOTICE(RSX, "Texture decode test %s", result ? "passed" : "failed");
+	return result;
+}
+
+// run the function several times, returns the best time in microseconds
+template<typename F>
+static u64 measure(F func)
+{
+	u64 best = UINT64_MAX;
+
+	for (u32 i = 0; i < 8; i++)
+	{
+		const auto start = std::chrono::high_resolution_clock::now();
+		func();
+		const auto time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
+		best = std::min<u64>(best, std::max<u64>(time, 1));
+	}
+
+	return best;
+}
+
+void texture_decode_benchmark()
+{
+	const u32 width = 1024, height = 1024; // texels
+	std::mt19937 rng(0);
+	std::vector<u8> src(width * height * 16);
+	std::vector<u8> dst(width * height * 16);
+	fill_random(src, rng);
+
+	for (auto& conv : g_texture_converts)
+	{
+		const u64 time = measure([&]() { conv.func(dst.data(), src.data(), width * height); });
+		const u64 ref_time = measure([&]() { conv.ref(dst.data(), src.data(), width * height); });
+
+		LOG_NOTICE(RSX, "Texture decode (%s, %dx%d): %lldus (reference: %lldus)", conv.name, width, height, time, ref_time);
+	}
+
+	for (u32 bpp : { 1, 2, 4, 8, 16 })
+	{
+		const u64 time = measure([&]() { UnswizzleTexture(dst.data(), src.data(), width, height, bpp); });
+		const u64 ref_time = measure([&]() { UnswizzleTextureRef(dst.data(), src.data(), width, height, bpp); });
+
+		LOG_NOTICE(RSX, "Texture unswizzle (%d bytes per texel, %dx%d): %lldus (reference: %lldus)", bpp, width, height, time, ref_time);
+	}
+}
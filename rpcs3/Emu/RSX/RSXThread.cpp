@@ -5,6 +5,7 @@
 #include "Emu/System.h"
 #include "Emu/RSX/GSManager.h"
 #include "Emu/RSX/RSXDMA.h"
+#include "Emu/RSX/RSXMemorySnapshot.h"
 #include "RSXThread.h"
 
 #include "Emu/SysCalls/Callback.h"
@@ -95,6 +96,39 @@ u32 GetAddress(u32 offset, u32 location)
 	return res;
 }
 
+u32 RSXThread::GetFragmentProgramSize(u32 addr)
+{
+	// same layout as read by GLFragmentDecompilerThread: 16-byte instructions,
+	// an instruction reading a constant is followed by the constant
+	u32 size = 0;
+
+	for (u32 i = 0; i < 0x1000 && Memory.IsGoodAddr(addr + size, 16); i++)
+	{
+		u32 data[4];
+
+		for (u32 j = 0; j < 4; j++)
+		{
+			// halfwords are swapped
+			const u32 value = vm::read32(addr + size + j * 4);
+			data[j] = value << 16 | value >> 16;
+		}
+
+		size += 16;
+
+		if (!(data[2] >> 31) && ((data[1] & 3) == 2 || (data[2] & 3) == 2 || (data[3] & 3) == 2))
+		{
+			size += 16;
+		}
+
+		if (data[0] & 1) // end
+		{
+			break;
+		}
+	}
+
+	return size;
+}
+
 RSXVertexData::RSXVertexData()
 	: frequency(0)
 	, stride(0)
@@ -115,46 +149,95 @@ void RSXVertexData::Reset()
 	data.clear();
 }
 
-void RSXVertexData::Load(u32 start, u32 count, u32 baseOffset, u32 baseIndex = 0)
+// byte-swap every element of the vector (tsize = element size)
+template<u32 tsize> static __forceinline __m128i sse_bswap(__m128i v)
 {
-	if (!addr) return;
+	if (tsize == 4)
+	{
+		// swap halfwords, then bytes
+		v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xb1), 0xb1);
+	}
 
-	const u32 tsize = GetTypeSize();
+	return tsize == 1 ? v : _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
 
-	data.resize((start + count) * tsize * size);
+template<u32 tsize> static __forceinline void bswap_scalar(u8* dst, const u8* src, u32 bytes)
+{
+	switch (tsize)
+	{
+	case 1: memcpy(dst, src, bytes); break;
+	case 2: for (u32 i = 0; i < bytes; i += 2) *(u16*)(dst + i) = re16(*(u16*)(src + i)); break;
+	case 4: for (u32 i = 0; i < bytes; i += 4) *(u32*)(dst + i) = re32(*(u32*)(src + i)); break;
+	}
+}
 
-	for (u32 i = start; i < start + count; ++i)
+// copy count vertices (item_size bytes each, located every stride bytes) to the packed buffer with byte swapping
+template<u32 tsize> static void LoadVertices(u8* dst, const u8* src, u32 stride, u32 item_size, u32 count)
+{
+	if (stride == item_size)
 	{
-		auto src = vm::get_ptr<const u8>(addr + baseOffset + stride * (i + baseIndex));
-		u8* dst = &data[i * tsize * size];
+		// packed: convert everything at once
+		const u32 bytes = item_size * count;
+		u32 i = 0;
 
-		switch (tsize)
+		for (; i + 16 <= bytes; i += 16)
 		{
-		case 1:
-		{
-			memcpy(dst, src, size);
-			break;
+			_mm_storeu_si128((__m128i*)(dst + i), sse_bswap<tsize>(_mm_loadu_si128((const __m128i*)(src + i))));
 		}
 
-		case 2:
+		bswap_scalar<tsize>(dst + i, src + i, bytes - i);
+		return;
+	}
+
+	// interleaved: one vector load per vertex (an attribute takes at most 16 bytes)
+	const u32 src_end = stride * (count - 1) + item_size;
+	const u32 dst_end = item_size * count;
+
+	for (u32 i = 0, s = 0, d = 0; i < count; i++, s += stride, d += item_size)
+	{
+		if (item_size > 16 || s + 16 > src_end)
 		{
-			const u16* c_src = (const u16*)src;
-			u16* c_dst = (u16*)dst;
-			for (u32 j = 0; j < size; ++j) *c_dst++ = re16(*c_src++);
-			break;
+			bswap_scalar<tsize>(dst + d, src + s, item_size);
+			continue;
 		}
 
-		case 4:
+		const __m128i v = sse_bswap<tsize>(_mm_loadu_si128((const __m128i*)(src + s)));
+
+		if (d + 16 <= dst_end)
 		{
-			const u32* c_src = (const u32*)src;
-			u32* c_dst = (u32*)dst;
-			for (u32 j = 0; j < size; ++j) *c_dst++ = re32(*c_src++);
-			break;
+			// the rest is overwritten by the following vertices
+			_mm_storeu_si128((__m128i*)(dst + d), v);
 		}
+		else
+		{
+			u8 tmp[16];
+			_mm_storeu_si128((__m128i*)tmp, v);
+			memcpy(dst + d, tmp, item_size);
 		}
 	}
 }
 
+void RSXVertexData::Load(u32 start, u32 count, u32 baseOffset, u32 baseIndex = 0)
+{
+	if (!addr || !count) return;
+
+	const u32 tsize = GetTypeSize();
+	const u32 item_size = tsize * size;
+
+	// the buffer keeps its capacity between draws (it's only cleared in RSXThread::End())
+	data.resize((start + count) * item_size);
+
+	auto src = vm::get_ptr<const u8>(addr + baseOffset + stride * (start + baseIndex));
+	u8* dst = &data[start * item_size];
+
+	switch (tsize)
+	{
+	case 1: LoadVertices<1>(dst, src, stride, item_size, count); break;
+	case 2: LoadVertices<2>(dst, src, stride, item_size, count); break;
+	case 4: LoadVertices<4>(dst, src, stride, item_size, count); break;
+	}
+}
+
 u32 RSXVertexData::GetTypeSize()
 {
 	switch (type)
@@ -204,7 +287,196 @@ u32 RSXThread::OutOfArgsCount(const uint x, const u32 cmd, const u32 count, cons
     case_##n(offset, step) \
     index = (cmd - offset) / step
 
-void RSXThread::DoCmd(const u32 fcmd, const u32 cmd, const u32 args_addr, const u32 count)
+void RSXThread::MethodTextureControl3(const u32 cmd, const u32 args_addr, const u32 count)
+{
+	auto args = vm::ptr<u32>::make(args_addr);
+
+	RSXTexture& tex = m_textures[(cmd - NV4097_SET_TEXTURE_CONTROL3) / 4];
+	const u32 a0 = ARGS(0);
+	u32 pitch = a0 & 0xFFFFF;
+	u16 depth = a0 >> 20;
+	tex.SetControl3(depth, pitch);
+}
+
+void RSXThread::MethodVertexTextureControl3(const u32 cmd, const u32 args_addr, const u32 count)
+{
+	auto args = vm::ptr<u32>::make(args_addr);
+
+	RSXVertexTexture& tex = m_vertex_textures[(cmd - NV4097_SET_VERTEX_TEXTURE_CONTROL3) / 0x20];
+	const u32 a0 = ARGS(0);
+	u32 pitch = a0 & 0xFFFFF;
+	u16 depth = a0 >> 20;
+	tex.SetControl3(depth, pitch);
+}
+
+void RSXThread::MethodVertexDataArrayOffset(const u32 cmd, const u32 args_addr, const u32 count)
+{
+	auto args = vm::ptr<u32>::make(args_addr);
+
+	const u32 index = (cmd - NV4097_SET_VERTEX_DATA_ARRAY_OFFSET) / 4;
+	const u32 addr = GetAddress(ARGS(0) & 0x7fffffff, ARGS(0) >> 31);
+
+	m_vertex_data[index].addr = addr;
+	m_vertex_data[index].data.clear();
+
+	//LOG_WARNING(RSX, "NV4097_SET_VERTEX_DATA_ARRAY_OFFSET: num=%d, addr=0x%x", index, addr);
+}
+
+void RSXThread::MethodVertexDataArrayFormat(const u32 cmd, const u32 args_addr, const u32 count)
+{
+	auto args = vm::ptr<u32>::make(args_addr);
+
+	const u32 index = (cmd - NV4097_SET_VERTEX_DATA_ARRAY_FORMAT) / 4;
+	const u32 a0 = ARGS(0);
+	u16 frequency = a0 >> 16;
+	u8 stride = (a0 >> 8) & 0xff;
+	u8 size = (a0 >> 4) & 0xf;
+	u8 type = a0 & 0xf;
+
+	RSXVertexData& cv = m_vertex_data[index];
+	cv.frequency = frequency;
+	cv.stride = stride;
+	cv.size = size;
+	cv.type = type;
+
+	//LOG_WARNING(RSX, "NV4097_SET_VERTEX_DATA_ARRAY_FORMAT: index=%d, frequency=%d, stride=%d, size=%d, type=%d", index, frequency, stride, size, type);
+}
+
+void RSXThread::MethodDrawArrays(const u32 cmd, const u32 args_addr, const u32 count)
+{
+	auto args = vm::ptr<u32>::make(args_addr);
+
+	for (u32 c = 0; c<count; ++c)
+	{
+		u32 ac = ARGS(c);
+		const u32 first = ac & 0xffffff;
+		const u32 _count = (ac >> 24) + 1;
+
+		//LOG_WARNING(RSX, "NV4097_DRAW_ARRAYS: %d - %d", first, _count);
+
+		// vertex arrays are loaded by the renderer when the draw is executed (unless they are cached)
+		if (first < m_draw_array_first)
+		{
+			m_draw_array_first = first;
+		}
+
+		m_draw_array_count += _count;
+	}
+}
+
+void RSXThread::MethodTransformProgram(const u32 cmd, const u32 args_addr, const u32 count)
+{
+	auto args = vm::ptr<u32>::make(args_addr);
+
+	//LOG_WARNING(RSX, "NV4097_SET_TRANSFORM_PROGRAM[%d](%d)", (cmd - NV4097_SET_TRANSFORM_PROGRAM) / 4, count);
+
+	if (!m_cur_vertex_prog)
+	{
+		LOG_ERROR(RSX, "NV4097_SET_TRANSFORM_PROGRAM: m_cur_vertex_prog is null");
+		return;
+	}
+
+	for (u32 i = 0; i < count; ++i)
+	{
+		m_cur_vertex_prog->data.push_back(ARGS(i));
+	}
+}
+
+void RSXThread::MethodTransformConstantLoad(const u32 cmd, const u32 args_addr, const u32 count)
+{
+	auto args = vm::ptr<u32>::make(args_addr);
+
+	if ((count - 1) % 4)
+	{
+		LOG_ERROR(RSX, "NV4097_SET_TRANSFORM_CONSTANT_LOAD: bad count %d", count);
+		return;
+	}
+
+	for (u32 id = ARGS(0), i = 1; i<count; ++id)
+	{
+		const u32 x = ARGS(i); i++;
+		const u32 y = ARGS(i); i++;
+		const u32 z = ARGS(i); i++;
+		const u32 w = ARGS(i); i++;
+
+		RSXTransformConstant c(id, (float&)x, (float&)y, (float&)z, (float&)w);
+
+		m_transform_constants.push_back(c);
+
+		//LOG_NOTICE(RSX, "NV4097_SET_TRANSFORM_CONSTANT_LOAD: [%d : %d] = (%f, %f, %f, %f)", i, id, c.x, c.y, c.z, c.w);
+	}
+}
+
+RSXThread::rsx_method_t RSXThread::GetMethodHandler(const u32 cmd)
+{
+	switch (cmd)
+	{
+	// Done using methodRegisters in RSXTexture.cpp
+	case_16(NV4097_SET_TEXTURE_FORMAT, 0x20)
+	case_16(NV4097_SET_TEXTURE_OFFSET, 0x20)
+	case_16(NV4097_SET_TEXTURE_FILTER, 0x20)
+	case_16(NV4097_SET_TEXTURE_ADDRESS, 0x20)
+	case_16(NV4097_SET_TEXTURE_IMAGE_RECT, 0x20)
+	case_16(NV4097_SET_TEXTURE_BORDER_COLOR, 0x20)
+	case_16(NV4097_SET_TEXTURE_CONTROL0, 0x20)
+	case_16(NV4097_SET_TEXTURE_CONTROL1, 0x20)
+	case_4(NV4097_SET_VERTEX_TEXTURE_FORMAT, 0x20)
+	case_4(NV4097_SET_VERTEX_TEXTURE_OFFSET, 0x20)
+	case_4(NV4097_SET_VERTEX_TEXTURE_FILTER, 0x20)
+	case_4(NV4097_SET_VERTEX_TEXTURE_ADDRESS, 0x20)
+	case_4(NV4097_SET_VERTEX_TEXTURE_IMAGE_RECT, 0x20)
+	case_4(NV4097_SET_VERTEX_TEXTURE_BORDER_COLOR, 0x20)
+	case_4(NV4097_SET_VERTEX_TEXTURE_CONTROL0, 0x20)
+		return nullptr;
+
+	case_16(NV4097_SET_TEXTURE_CONTROL3, 4)
+		return &RSXThread::MethodTextureControl3;
+
+	case_4(NV4097_SET_VERTEX_TEXTURE_CONTROL3, 0x20)
+		return &RSXThread::MethodVertexTextureControl3;
+
+	case_16(NV4097_SET_VERTEX_DATA_ARRAY_OFFSET, 4)
+		return &RSXThread::MethodVertexDataArrayOffset;
+
+	case_16(NV4097_SET_VERTEX_DATA_ARRAY_FORMAT, 4)
+		return &RSXThread::MethodVertexDataArrayFormat;
+
+	case NV4097_DRAW_ARRAYS:
+		return &RSXThread::MethodDrawArrays;
+
+	case_32(NV4097_SET_TRANSFORM_PROGRAM, 4)
+		return &RSXThread::MethodTransformProgram;
+
+	case NV4097_SET_TRANSFORM_CONSTANT_LOAD:
+		return &RSXThread::MethodTransformConstantLoad;
+
+	default:
+		return &RSXThread::DoCmd;
+	}
+}
+
+void RSXThread::MethodFirstUse(const u32 cmd, const u32 args_addr, const u32 count)
+{
+	m_used_gcm_commands.insert(cmd);
+
+	// following commands are dispatched directly
+	const rsx_method_t handler = m_methods[cmd >> 2] = GetMethodHandler(cmd);
+
+	if (handler)
+	{
+		(this->*handler)(cmd, args_addr, count);
+	}
+}
+
+void RSXThread::InitMethods()
+{
+	for (auto& handler : m_methods)
+	{
+		handler = &RSXThread::MethodFirstUse;
+	}
+}
+
+void RSXThread::DoCmd(const u32 cmd, const u32 args_addr, const u32 count)
 {
 	auto args = vm::ptr<u32>::make(args_addr);
 
@@ -218,8 +490,6 @@ void RSXThread::DoCmd(const u32 fcmd, const u32 cmd, const u32 args_addr, const
 
 	u32 index = 0;
 
-	m_used_gcm_commands.insert(cmd);
-
 	switch (cmd)
 	{
 	// NV406E
@@ -368,58 +638,12 @@ void RSXThread::DoCmd(const u32 fcmd, const u32 cmd, const u32 args_addr, const
 	}
 
 	// Texture
-	case_range(16, NV4097_SET_TEXTURE_FORMAT, 0x20);
-	case_range(16, NV4097_SET_TEXTURE_OFFSET, 0x20);
-	case_range(16, NV4097_SET_TEXTURE_FILTER, 0x20);
-	case_range(16, NV4097_SET_TEXTURE_ADDRESS, 0x20);
-	case_range(16, NV4097_SET_TEXTURE_IMAGE_RECT, 32);
-	case_range(16, NV4097_SET_TEXTURE_BORDER_COLOR, 0x20);
-	case_range(16, NV4097_SET_TEXTURE_CONTROL0, 0x20);
-	case_range(16, NV4097_SET_TEXTURE_CONTROL1, 0x20);
-	{
-		// Done using methodRegisters in RSXTexture.cpp
-		break;
-	}
-
 	case_range(16, NV4097_SET_TEX_COORD_CONTROL, 4);
 	{
 		LOG_WARNING(RSX, "TODO: NV4097_SET_TEX_COORD_CONTROL");
 		break;
 	}
 
-	case_range(16, NV4097_SET_TEXTURE_CONTROL3, 4);
-	{
-		RSXTexture& tex = m_textures[index];
-		const u32 a0 = ARGS(0);
-		u32 pitch = a0 & 0xFFFFF;
-		u16 depth = a0 >> 20;
-		tex.SetControl3(depth, pitch);
-		break;
-	}
-
-		// Vertex Texture
-	case_range(4, NV4097_SET_VERTEX_TEXTURE_FORMAT, 0x20);
-	case_range(4, NV4097_SET_VERTEX_TEXTURE_OFFSET, 0x20);
-	case_range(4, NV4097_SET_VERTEX_TEXTURE_FILTER, 0x20);
-	case_range(4, NV4097_SET_VERTEX_TEXTURE_ADDRESS, 0x20);
-	case_range(4, NV4097_SET_VERTEX_TEXTURE_IMAGE_RECT, 0x20);
-	case_range(4, NV4097_SET_VERTEX_TEXTURE_BORDER_COLOR, 0x20);
-	case_range(4, NV4097_SET_VERTEX_TEXTURE_CONTROL0, 0x20);
-	{
-		// Done using methodRegisters in RSXTexture.cpp
-		break;
-	}
-
-	case_range(4, NV4097_SET_VERTEX_TEXTURE_CONTROL3, 0x20);
-	{
-		RSXVertexTexture& tex = m_vertex_textures[index];
-		const u32 a0 = ARGS(0);
-		u32 pitch = a0 & 0xFFFFF;
-		u16 depth = a0 >> 20;
-		tex.SetControl3(depth, pitch);
-		break;
-	}
-
 		// Vertex data
 	case_range(16, NV4097_SET_VERTEX_DATA4UB_M, 4);
 	{
@@ -487,36 +711,6 @@ void RSXThread::DoCmd(const u32 fcmd, const u32 cmd, const u32 args_addr, const
 		break;
 	}
 
-	case_range(16, NV4097_SET_VERTEX_DATA_ARRAY_OFFSET, 4);
-	{
-		const u32 addr = GetAddress(ARGS(0) & 0x7fffffff, ARGS(0) >> 31);
-
-		m_vertex_data[index].addr = addr;
-		m_vertex_data[index].data.clear();
-
-		//LOG_WARNING(RSX, "NV4097_SET_VERTEX_DATA_ARRAY_OFFSET: num=%d, addr=0x%x", index, addr);
-		break;
-	}
-
-	case_range(16, NV4097_SET_VERTEX_DATA_ARRAY_FORMAT, 4);
-	{
-		const u32 a0 = ARGS(0);
-		u16 frequency = a0 >> 16;
-		u8 stride = (a0 >> 8) & 0xff;
-		u8 size = (a0 >> 4) & 0xf;
-		u8 type = a0 & 0xf;
-
-		RSXVertexData& cv = m_vertex_data[index];
-		cv.frequency = frequency;
-		cv.stride = stride;
-		cv.size = size;
-		cv.type = type;
-
-		//LOG_WARNING(RSX, "NV4097_SET_VERTEX_DATA_ARRAY_FORMAT: index=%d, frequency=%d, stride=%d, size=%d, type=%d", index, frequency, stride, size, type);
-
-		break;
-	}
-
 	// Vertex Attribute
 	case NV4097_SET_VERTEX_ATTRIB_INPUT_MASK:
 	{
@@ -938,28 +1132,6 @@ void RSXThread::DoCmd(const u32 fcmd, const u32 cmd, const u32 args_addr, const
 		break;
 	}
 
-	case NV4097_DRAW_ARRAYS:
-	{
-		for (u32 c = 0; c<count; ++c)
-		{
-			u32 ac = ARGS(c);
-			const u32 first = ac & 0xffffff;
-			const u32 _count = (ac >> 24) + 1;
-
-			//LOG_WARNING(RSX, "NV4097_DRAW_ARRAYS: %d - %d", first, _count);
-
-			LoadVertexData(first, _count);
-
-			if (first < m_draw_array_first)
-			{
-				m_draw_array_first = first;
-			}
-
-			m_draw_array_count += _count;
-		}
-		break;
-	}
-
 	case NV4097_SET_INDEX_ARRAY_ADDRESS:
 	{
 		m_indexed_array.m_addr = GetAddress(ARGS(0), ARGS(1) & 0xf);
@@ -1138,23 +1310,6 @@ void RSXThread::DoCmd(const u32 fcmd, const u32 cmd, const u32 args_addr, const
 		break;
 	}
 
-	case_range(32, NV4097_SET_TRANSFORM_PROGRAM, 4);
-	{
-		//LOG_WARNING(RSX, "NV4097_SET_TRANSFORM_PROGRAM[%d](%d)", index, count);
-
-		if (!m_cur_vertex_prog)
-		{
-			LOG_ERROR(RSX, "NV4097_SET_TRANSFORM_PROGRAM: m_cur_vertex_prog is null");
-			break;
-		}
-
-		for (u32 i = 0; i < count; ++i)
-		{
-			m_cur_vertex_prog->data.push_back(ARGS(i));
-		}
-		break;
-	}
-
 	case NV4097_SET_TRANSFORM_TIMEOUT:
 	{
 		// TODO:
@@ -1179,30 +1334,6 @@ void RSXThread::DoCmd(const u32 fcmd, const u32 cmd, const u32 args_addr, const
 		break;
 	}
 
-	case NV4097_SET_TRANSFORM_CONSTANT_LOAD:
-	{
-		if ((count - 1) % 4)
-		{
-			LOG_ERROR(RSX, "NV4097_SET_TRANSFORM_CONSTANT_LOAD: bad count %d", count);
-			break;
-		}
-
-		for (u32 id = ARGS(0), i = 1; i<count; ++id)
-		{
-			const u32 x = ARGS(i); i++;
-			const u32 y = ARGS(i); i++;
-			const u32 z = ARGS(i); i++;
-			const u32 w = ARGS(i); i++;
-
-			RSXTransformConstant c(id, (float&)x, (float&)y, (float&)z, (float&)w);
-
-			m_transform_constants.push_back(c);
-
-			//LOG_NOTICE(RSX, "NV4097_SET_TRANSFORM_CONSTANT_LOAD: [%d : %d] = (%f, %f, %f, %f)", i, id, c.x, c.y, c.z, c.w);
-		}
-		break;
-	}
-
 	// Invalidation
 	case NV4097_INVALIDATE_L2:
 	{
@@ -2431,11 +2562,35 @@ void RSXThread::DoCmd(const u32 fcmd, const u32 cmd, const u32 args_addr, const
 		}
 		log += ")";
 		LOG_ERROR(RSX, "TODO: %s", log.c_str());
+
+		// not handled, following commands will only update registers
+		m_methods[cmd >> 2] = nullptr;
 		break;
 	}
 	}
 }
 
+void RSXThread::ExecMethod(const u32 cmd, const u32 args_addr, const u32 count)
+{
+	auto args = vm::ptr<u32>::make(args_addr);
+
+	const u32 inc = cmd & CELL_GCM_METHOD_FLAG_NON_INCREMENT ? 0 : 4;
+	const u32 method = cmd & 0x3ffff;
+
+	for (u32 i = 0; i < count; i++)
+	{
+		methodRegisters[(cmd & 0xffff) + i * inc] = args[i].value();
+	}
+
+	// plain register writes have no handler
+	if (const rsx_method_t handler = m_methods[method >> 2])
+	{
+		(this->*handler)(method, args_addr, count);
+	}
+
+	m_methods_count += count ? count : 1;
+}
+
 void RSXThread::Begin(u32 draw_mode)
 {
 	m_begin_end = 1;
@@ -2466,7 +2621,6 @@ void RSXThread::End()
 
 void RSXThread::Task()
 {
-	u8 inc;
 	LOG_NOTICE(RSX, "RSX thread started");
 
 	OnInitThread();
@@ -2508,10 +2662,8 @@ void RSXThread::Task()
 		}
 		std::lock_guard<std::mutex> lock(m_cs_main);
 
-		inc = 1;
-
 		u32 get = m_ctrl->get.read_sync();
-		u32 put = m_ctrl->put.read_sync();
+		const u32 put = m_ctrl->put.read_sync();
 
 		if (put == get || !Emu.IsRunning())
 		{
@@ -2527,65 +2679,80 @@ void RSXThread::Task()
 			continue;
 		}
 
-		const u32 cmd = ReadIO32(get);
-		const u32 count = (cmd >> 18) & 0x7ff;
+		const bool log = Ini.RSXLogging.GetValue();
 
-		if (Ini.RSXLogging.GetValue())
-		{
-			LOG_NOTICE(Log::RSX, "%s (cmd=0x%x)", GetMethodName(cmd & 0xffff).c_str(), cmd);
-		}
-	
-		if (cmd & CELL_GCM_METHOD_FLAG_JUMP)
-		{
-			u32 offs = cmd & 0x1fffffff;
-			//LOG_WARNING(RSX, "rsx jump(0x%x) #addr=0x%x, cmd=0x%x, get=0x%x, put=0x%x", offs, m_ioAddress + get, cmd, get, put);
-			m_ctrl->get.exchange(be_t<u32>::make(offs));
-			continue;
-		}
-		if (cmd & CELL_GCM_METHOD_FLAG_CALL)
-		{
-			m_call_stack.push(get + 4);
-			u32 offs = cmd & ~3;
-			//LOG_WARNING(RSX, "rsx call(0x%x) #0x%x - 0x%x", offs, cmd, get);
-			m_ctrl->get.exchange(be_t<u32>::make(offs));
-			continue;
-		}
-		if (cmd == CELL_GCM_METHOD_FLAG_RETURN)
-		{
-			u32 get = m_call_stack.top();
-			m_call_stack.pop();
-			//LOG_WARNING(RSX, "rsx return(0x%x)", get);
-			m_ctrl->get.exchange(be_t<u32>::make(get));
-			continue;
-		}
-		if (cmd & CELL_GCM_METHOD_FLAG_NON_INCREMENT)
+		// decode the whole window between get and put (the number of commands is limited to release the lock periodically)
+		for (u32 n = 0; n < 0x1000 && get != put; n++)
 		{
-			//LOG_WARNING(RSX, "rsx non increment cmd! 0x%x", cmd);
-			inc = 0;
-		}
+			// translate the address once for the command and its arguments (IO pages are 1 MB)
+			u64 cmd_addr;
+			if (!Memory.RSXIOMem.getRealAddr(get, cmd_addr))
+			{
+				throw fmt::Format("%s(get=0x%x): RSXIO memory not mapped", __FUNCTION__, get);
+			}
 
-		if (cmd == 0) //nop
-		{
-			m_ctrl->get.atomic_op([](be_t<u32>& value)
+			const u32 cmd = vm::read32((u32)cmd_addr);
+			const u32 count = (cmd >> 18) & 0x7ff;
+
+			if (log)
 			{
-				value += 4;
-			});
-			continue;
-		}
+				LOG_NOTICE(Log::RSX, "%s (cmd=0x%x)", GetMethodName(cmd & 0xffff).c_str(), cmd);
+			}
 
-		auto args = vm::ptr<u32>::make((u32)Memory.RSXIOMem.RealAddr(get + 4));
+			if (cmd & CELL_GCM_METHOD_FLAG_JUMP)
+			{
+				u32 offs = cmd & 0x1fffffff;
+				//LOG_WARNING(RSX, "rsx jump(0x%x) #addr=0x%x, cmd=0x%x, get=0x%x, put=0x%x", offs, m_ioAddress + get, cmd, get, put);
+				get = offs;
+				m_ctrl->get.exchange(be_t<u32>::make(get));
+				continue;
+			}
+			if (cmd & CELL_GCM_METHOD_FLAG_CALL)
+			{
+				m_call_stack.push(get + 4);
+				u32 offs = cmd & ~3;
+				//LOG_WARNING(RSX, "rsx call(0x%x) #0x%x - 0x%x", offs, cmd, get);
+				get = offs;
+				m_ctrl->get.exchange(be_t<u32>::make(get));
+				continue;
+			}
+			if (cmd == CELL_GCM_METHOD_FLAG_RETURN)
+			{
+				get = m_call_stack.top();
+				m_call_stack.pop();
+				//LOG_WARNING(RSX, "rsx return(0x%x)", get);
+				m_ctrl->get.exchange(be_t<u32>::make(get));
+				continue;
+			}
 
-		for (u32 i = 0; i < count; i++)
-		{
-			methodRegisters[(cmd & 0xffff) + (i * 4 * inc)] = ARGS(i);
+			if (cmd == 0) //nop
+			{
+				get += 4;
+				m_ctrl->get.exchange(be_t<u32>::make(get));
+				continue;
+			}
+
+			const u32 args_addr = (get & 0xfffff) != 0xffffc ? (u32)cmd_addr + 4 : (u32)Memory.RSXIOMem.RealAddr(get + 4);
+
+			if (m_capture && m_capture->IsActive())
+			{
+				m_capture->AddCommand(*this, cmd, args_addr, count);
+			}
+
+			ExecMethod(cmd, args_addr, count);
+
+			get += (count + 1) * 4;
+			m_ctrl->get.exchange(be_t<u32>::make(get));
 		}
 
-		DoCmd(cmd, cmd & 0x3ffff, args.addr(), count);
+		const u64 stamp = get_system_time();
 
-		m_ctrl->get.atomic_op([count](be_t<u32>& value)
+		if (stamp - m_methods_stamp >= 1000000)
 		{
-			value += (count + 1) * 4;
-		});
+			m_methods_per_sec = (u32)(m_methods_count * 1000000 / (stamp - m_methods_stamp));
+			m_methods_count = 0;
+			m_methods_stamp = stamp;
+		}
 	}
 	catch (const std::string& e)
 	{
@@ -2600,6 +2767,9 @@ void RSXThread::Task()
 
 	LOG_NOTICE(RSX, "RSX thread ended");
 
+	// write remaining frames
+	m_capture.reset();
+
 	OnExitThread();
 }
 
@@ -2616,6 +2786,29 @@ void RSXThread::Init(const u32 ioAddress, const u32 ioSize, const u32 ctrlAddres
 	m_cur_fragment_prog_num = 0;
 
 	m_used_gcm_commands.clear();
+	InitMethods();
+	m_methods_count = 0;
+	m_methods_stamp = get_system_time();
+	m_methods_per_sec = 0;
+	m_buffer_cache_hits = 0;
+	m_buffer_cache_misses = 0;
+	m_buffer_cache_saved = 0;
+	m_texture_cache_hits = 0;
+	m_texture_cache_misses = 0;
+	m_shader_queue = 0;
+	m_shaders_decompiled = 0;
+	m_shader_decompile_time = 0;
+	m_skipped_draws = 0;
+	m_write_backs = 0;
+	m_write_back_waits = 0;
+	m_write_back_skips = 0;
+	RSXMemorySnapshot::hashed_bytes = 0;
+	RSXMemorySnapshot::hash_time = 0;
+
+	if (Ini.RSXCapture.GetValue())
+	{
+		m_capture.reset(new RSXCapture(*this, fmt::Format("rsx_capture_%s.rsxc", Emu.GetTitleID().c_str())));
+	}
 
 	OnInit();
 	ThreadBase::Start();
@@ -3,6 +3,7 @@
 #include "RSXTexture.h"
 #include "RSXVertexProgram.h"
 #include "RSXFragmentProgram.h"
+#include "RSXCapture.h"
 
 #include <stack>
 #include "Utilities/SSemaphore.h"
@@ -40,6 +41,12 @@ struct RSXVertexData
 	u32 GetTypeSize();
 };
 
+// compare RSXVertexData::Load with the element by element conversion on F, S1 and UB layouts (memory must be initialized)
+bool vertex_load_test();
+
+// measure RSXVertexData::Load and the reference conversion on F, S1 and UB layouts, results are logged
+void vertex_load_benchmark();
+
 struct RSXIndexArrayData
 {
 	std::vector<u8> m_data;
@@ -443,6 +450,30 @@ public:
 
 	std::set<u32> m_used_gcm_commands;
 
+	// method handler (called after methodRegisters is updated with the arguments)
+	typedef void (RSXThread::*rsx_method_t)(const u32 cmd, const u32 args_addr, const u32 count);
+
+	rsx_method_t m_methods[0x10000]; // indexed by method >> 2, nullptr if the method only sets its register
+
+	u64 m_methods_count; // methods processed since m_methods_stamp
+	u64 m_methods_stamp;
+	u32 m_methods_per_sec; // methods processed during the last second
+
+	u64 m_buffer_cache_hits; // vertex and index arrays reused without uploading
+	u64 m_buffer_cache_misses; // vertex and index arrays uploaded
+	u64 m_buffer_cache_saved; // bytes not uploaded because of cache hits
+	u64 m_texture_cache_hits; // textures reused without decoding
+	u64 m_texture_cache_misses; // textures decoded and uploaded
+	u32 m_shader_queue; // programs waiting for the decompiler threads
+	u64 m_shaders_decompiled; // fragment and vertex programs decompiled
+	u64 m_shader_decompile_time; // time spent on decompilation (in microseconds)
+	u64 m_skipped_draws; // draws skipped while their programs were decompiled
+	u64 m_write_backs; // color and depth buffers copied to PS3 memory by asynchronous write-back
+	u64 m_write_back_waits; // write-backs which had to wait for the GPU
+	u64 m_write_back_skips; // write-backs skipped because the guest had modified the memory
+
+	std::unique_ptr<RSXCapture> m_capture; // RSX capture (if enabled)
+
 protected:
 	RSXThread()
 		: ThreadBase("RSXThread")
@@ -637,7 +668,22 @@ protected:
 	void End();
 
 	u32 OutOfArgsCount(const uint x, const u32 cmd, const u32 count, const u32 args_addr);
-	void DoCmd(const u32 fcmd, const u32 cmd, const u32 args_addr, const u32 count);
+	void DoCmd(const u32 cmd, const u32 args_addr, const u32 count);
+	void ExecMethod(const u32 cmd, const u32 args_addr, const u32 count);
+
+	// handlers of frequently used methods (other methods are handled by DoCmd)
+	void MethodTextureControl3(const u32 cmd, const u32 args_addr, const u32 count);
+	void MethodVertexTextureControl3(const u32 cmd, const u32 args_addr, const u32 count);
+	void MethodVertexDataArrayOffset(const u32 cmd, const u32 args_addr, const u32 count);
+	void MethodVertexDataArrayFormat(const u32 cmd, const u32 args_addr, const u32 count);
+	void MethodDrawArrays(const u32 cmd, const u32 args_addr, const u32 count);
+	void MethodTransformProgram(const u32 cmd, const u32 args_addr, const u32 count);
+	void MethodTransformConstantLoad(const u32 cmd, const u32 args_addr, const u32 count);
+
+	// find the handler of the method when it's executed for the first time
+	void MethodFirstUse(const u32 cmd, const u32 args_addr, const u32 count);
+	static rsx_method_t GetMethodHandler(const u32 cmd);
+	void InitMethods();
 	void NativeRescale(float width, float height);
 
 	virtual void OnInit() = 0;
@@ -648,16 +694,6 @@ protected:
 	virtual void ExecCMD(u32 cmd) = 0;
 	virtual void Flip() = 0;
 
-	void LoadVertexData(u32 first, u32 count)
-	{
-		for (u32 i = 0; i < m_vertex_count; ++i)
-		{
-			if (!m_vertex_data[i].IsEnabled()) continue;
-
-			m_vertex_data[i].Load(first, count, m_vertex_data_base_offset, m_vertex_data_base_index);
-		}
-	}
-
 	virtual void Task();
 
 public:
@@ -666,4 +702,7 @@ public:
 	u32 ReadIO32(u32 addr);
 
 	void WriteIO32(u32 addr, u32 value);
+
+	// size of the fragment program including embedded constants (stops at 0x1000 instructions or unmapped memory)
+	static u32 GetFragmentProgramSize(u32 addr);
 };
@@ -0,0 +1,151 @@
+#include "stdafx.h"
+#include <random>
+#include "Utilities/Log.h"
+#include "Emu/Memory/Memory.h"
+#include "RSXThread.h"
+
+struct vertex_layout_info
+{
+	const char* name;
+	u32 type;
+	u32 tsize; // bytes per element
+};
+
+static const vertex_layout_info g_vertex_layouts[] =
+{
+	{ "F", CELL_GCM_VERTEX_F, 4 },
+	{ "S1", CELL_GCM_VERTEX_S1, 2 },
+	{ "UB", CELL_GCM_VERTEX_UB, 1 },
+};
+
+// element by element conversion of count vertices (reference for RSXVertexData::Load)
+static void vertex_load_ref(std::vector<u8>& dst, const u8* src, u32 tsize, u32 size, u32 stride, u32 count)
+{
+	dst.resize(count * size * tsize);
+
+	for (u32 i = 0; i < count; i++)
+	{
+		for (u32 j = 0; j < size; j++)
+		{
+			const u8* s = src + i * stride + j * tsize;
+			u8* d = &dst[(i * size + j) * tsize];
+
+			for (u32 k = 0; k < tsize; k++)
+			{
+				d[k] = s[tsize - 1 - k];
+			}
+		}
+	}
+}
+
+static void vertex_setup(RSXVertexData& data, const vertex_layout_info& layout, u32 size, u32 stride, u32 addr)
+{
+	data.Reset();
+	data.type = layout.type;
+	data.size = size;
+	data.stride = stride;
+	data.addr = addr;
+}
+
+bool vertex_load_test()
+{
+	const u32 max_count = 300;
+	const u32 buf_size = max_count * 255 + 16;
+	const u32 addr = vm::alloc(buf_size, vm::main);
+	std::mt19937 rng(0);
+	bool result = true;
+
+	for (u32 i = 0; i < buf_size; i++)
+	{
+		vm::get_ref<u8>(addr + i) = (u8)rng();
+	}
+
+	for (auto& layout : g_vertex_layouts)
+	{
+		for (u32 size = 1; size <= 4 && result; size++)
+		{
+			const u32 item_size = layout.tsize * size;
+
+			// packed, interleaved and odd strides check the scalar tail and unaligned accesses
+			for (u32 stride : { item_size, item_size + layout.tsize, 16u, 32u, 36u, 255u })
+			{
+				if (stride < item_size)
+				{
+					continue;
+				}
+
+				for (u32 count = 1; count <= max_count; count += rng() % 16 + 1)
+				{
+					const u32 offset = rng() % 16;
+
+					RSXVertexData data;
+					vertex_setup(data, layout, size, stride, addr);
+					data.Load(0, count, offset, 0);
+
+					std::vector<u8> ref;
+					vertex_load_ref(ref, vm::get_ptr<u8>(addr + offset), layout.tsize, size, stride, count);
+
+					if (data.data != ref)
+					{
+						LOG_ERROR(RSX, "Vertex load test: %s[%d] doesn't match the reference (stride=%d, count=%d, offset=%d)", layout.name, size, stride, count, offset);
+						result = false;
+						break;
+					}
+				}
+			}
+		}
+	}
+
+	vm::dealloc(addr, vm::main);
+
+	LOG_NOTICE(RSX, "Vertex load test %s", result ? "passed" : "failed");
+	return result;
+}
+
+// run the function several times, returns the best time in microseconds
+template<typename F>
+static u64 measure(F func)
+{
+	u64 best = UINT64_MAX;
+
+	for (u32 i = 0; i < 8; i++)
+	{
+		const auto start = std::chrono::high_resolution_clock::now();
+		func();
+		const auto time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
+		best = std::min<u64>(best, std::max<u64>(time, 1));
+	}
+
+	return best;
+}
+
+void vertex_load_benchmark()
+{
+	const u32 count = 0x40000; // vertices
+	const u32 max_stride = 32;
+	const u32 addr = vm::alloc(count * max_stride, vm::main);
+
+	for (auto& layout : g_vertex_layouts)
+	{
+		for (u32 size : { 1, 3, 4 })
+		{
+			const u32 item_size = layout.tsize * size;
+
+			// packed and interleaved (with another attribute taking the rest of the vertex)
+			for (u32 stride : { item_size, max_stride })
+			{
+				RSXVertexData data;
+				vertex_setup(data, layout, size, stride, addr);
+
+				std::vector<u8> ref;
+
+				const u64 time = measure([&]() { data.Load(0, count, 0, 0); });
+				const u64 ref_time = measure([&]() { vertex_load_ref(ref, vm::get_ptr<u8>(addr), layout.tsize, size, stride, count); });
+
+				LOG_NOTICE(RSX, "Vertex load (%s[%d], stride %d, %d vertices): %lldus (reference: %lldus)", layout.name, size, stride, count, time, ref_time);
+			}
+		}
+	}
+
+	vm::dealloc(addr, vm::main);
+}
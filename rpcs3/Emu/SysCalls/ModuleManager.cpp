@@ -65,6 +65,7 @@ extern void sysPrxForUser_init(Module *pxThis);
 extern void sysPrxForUser_load();
 extern void sys_fs_init(Module *pxThis);
 extern void sys_fs_load();
+extern void sys_fs_unload();
 extern void sys_io_init(Module *pxThis);
 extern void sys_net_init(Module *pxThis);
 
@@ -92,7 +93,7 @@ static const g_modules_list[] =
 	{ 0x000b, "cellOvis", cellOvis_init, nullptr, nullptr },
 	{ 0x000c, "cellSheap", nullptr, nullptr, nullptr },
 	{ 0x000d, "sys_sync", nullptr, nullptr, nullptr },
-	{ 0x000e, "sys_fs", sys_fs_init, sys_fs_load, nullptr },
+	{ 0x000e, "sys_fs", sys_fs_init, sys_fs_load, sys_fs_unload },
 	{ 0x000f, "cellJpgDec", cellJpgDec_init, nullptr, nullptr },
 	{ 0x0010, "cellGcmSys", cellGcmSys_init, cellGcmSys_load, cellGcmSys_unload },
 	{ 0x0011, "cellAudio", cellAudio_init, nullptr, nullptr },
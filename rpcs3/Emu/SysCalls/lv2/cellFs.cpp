@@ -1,4 +1,5 @@
 #include "stdafx.h"
+#include <deque>
 #include "Emu/Memory/Memory.h"
 #include "Emu/System.h"
 #include "Emu/SysCalls/Modules.h"
@@ -16,27 +17,344 @@
 #include "Emu/FS/VFS.h"
 #include "Emu/FS/vfsFile.h"
 #include "Emu/FS/vfsDir.h"
+#include "Emu/FS/vfsEDATFile.h"
 #include "cellFs.h"
+#include "sys_time.h"
 
 Module *sys_fs = nullptr;
 
-struct FsRingBufferConfig
+// seek + read/write sequences on the same file are serialized between the guest calls, AIO threads and stream threads
+// (the file position is shared, so the mutex is selected by fd)
+static std::mutex g_fs_file_mutex[16];
+
+static std::mutex& GetFileMutex(u32 fd)
+{
+	return g_fs_file_mutex[fd % 16];
+}
+
+typedef void(CellFsStReadCallback)(int xfd, u64 xsize);
+
+// cellFsStRead stream of one file: the ring buffer is filled by a separate thread, the data is consumed by cellFsStRead
+// or cellFsStReadGetCurrentAddr/cellFsStReadPutCurrentAddr (positions in the stream are counted in bytes since the start)
+class FsStream
 {
-	CellFsRingBuffer m_ring_buffer; // Currently unused after assignment
+	u32 m_fd;
+	std::shared_ptr<vfsStream> m_file;
+	std::unique_ptr<thread_t> m_thread;
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	bool m_stop;
+
+	u64 m_offset; // file offset where the stream started
+	u64 m_end; // file offset where the stream ends
+	u64 m_written; // bytes stored in the ring buffer
+	u64 m_read; // bytes consumed
+	bool m_eof; // no more data will be written
+	vm::ptr<CellFsStReadCallback> m_callback;
+	u64 m_callback_size;
+
+	// called with the mutex locked, returns the callback if the awaited amount of data is available
+	vm::ptr<CellFsStReadCallback> CheckCallback(u64& size);
+	void Callback(vm::ptr<CellFsStReadCallback> func, u64 size);
+	u64 Fill(u64 pos, u64 count);
+	void Work();
+
+public:
+	CellFsRingBuffer m_ring_buffer;
 	u32 m_buffer;
-	u64 m_fs_status;
-	u64 m_regid;
 	u32 m_alloc_mem_size;
-	u32 m_current_addr;
+	u64 m_ringbuf_size;
+	u64 m_block_size;
+	std::atomic<u64> m_status;
+	u64 m_regid; // bytes read
+
+	FsStream(u32 fd, const std::shared_ptr<vfsStream>& file, const CellFsRingBuffer& ringbuf);
+	~FsStream();
+
+	void Start(u64 offset, u64 size);
+	void Stop();
+
+	// wait until size bytes are available (or the stream ends), returns the number of available bytes
+	u64 Wait(u64 size);
+	void SetCallback(vm::ptr<CellFsStReadCallback> func, u64 size);
+
+	u64 Read(u8* dst, u64 size);
+	u32 GetCurrentAddr(u64& size);
+	bool PutCurrentAddr(u32 addr, u64 size);
+};
+
+std::unordered_map<u32, std::shared_ptr<FsStream>> g_fs_streams; // key: fd
+std::mutex g_fs_streams_mutex;
+
+static std::shared_ptr<FsStream> GetStream(u32 fd)
+{
+	std::lock_guard<std::mutex> lock(g_fs_streams_mutex);
+
+	auto found = g_fs_streams.find(fd);
+	return found == g_fs_streams.end() ? nullptr : found->second;
+}
+
+FsStream::FsStream(u32 fd, const std::shared_ptr<vfsStream>& file, const CellFsRingBuffer& ringbuf)
+	: m_fd(fd)
+	, m_file(file)
+	, m_stop(false)
+	, m_offset(0)
+	, m_end(0)
+	, m_written(0)
+	, m_read(0)
+	, m_eof(false)
+	, m_callback_size(0)
+	, m_ring_buffer(ringbuf)
+	, m_ringbuf_size(ringbuf.ringbuf_size)
+	, m_block_size(ringbuf.block_size)
+	, m_status(CELL_FS_ST_INITIALIZED)
+	, m_regid(0)
+{
+	m_callback.set(0);
+
+	// If the size is less than 1MB
+	if (m_ringbuf_size < 0x40000000)
+		m_alloc_mem_size = (((u32)m_ringbuf_size + 64 * 1024 - 1) / (64 * 1024)) * (64 * 1024);
+	else
+		m_alloc_mem_size = (((u32)m_ringbuf_size + 1024 * 1024 - 1) / (1024 * 1024)) * (1024 * 1024);
+
+	// alloc memory
+	m_buffer = (u32)Memory.Alloc(m_alloc_mem_size, 1024);
+	memset(vm::get_ptr<void>(m_buffer), 0, m_alloc_mem_size);
+}
+
+FsStream::~FsStream()
+{
+	Stop();
+
+	Memory.Free(m_buffer);
+}
+
+void FsStream::Start(u64 offset, u64 size)
+{
+	Stop();
+
+	m_offset = offset;
+	m_end = size ? offset + size : m_file->GetSize();
+	m_written = 0;
+	m_read = 0;
+	m_eof = false;
+	m_stop = false;
+	m_status = CELL_FS_ST_PROGRESS;
+
+	m_thread.reset(new thread_t(fmt::Format("CellFsSt Thread[0x%x]", m_fd), true, [this]() { Work(); }));
+}
 
-	FsRingBufferConfig()
-		: m_fs_status(CELL_FS_ST_NOT_INITIALIZED)
-		, m_regid(0)
-		, m_alloc_mem_size(0)
-		, m_current_addr(0)
-		, m_ring_buffer() { }
+void FsStream::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		m_stop = true;
+		m_cv.notify_all();
+	}
+
+	m_thread.reset();
 
-} fs_config;
+	u64 status = CELL_FS_ST_PROGRESS;
+	m_status.compare_exchange_strong(status, CELL_FS_ST_STOP);
+}
+
+vm::ptr<CellFsStReadCallback> FsStream::CheckCallback(u64& size)
+{
+	auto func = m_callback;
+	size = m_written - m_read;
+
+	if (!func || (size < m_callback_size && !m_eof))
+	{
+		func.set(0);
+		return func;
+	}
+
+	m_callback.set(0);
+	return func;
+}
+
+void FsStream::Callback(vm::ptr<CellFsStReadCallback> func, u64 size)
+{
+	if (func)
+	{
+		const u32 fd = m_fd;
+
+		Emu.GetCallbackManager().Async([func, fd, size](PPUThread& CPU)
+		{
+			func(CPU, fd, size);
+		});
+	}
+}
+
+// read count bytes of the file at position pos of the stream to the ring buffer
+u64 FsStream::Fill(u64 pos, u64 count)
+{
+	const u64 ring_pos = pos % m_ringbuf_size;
+	const u64 first = std::min(count, m_ringbuf_size - ring_pos);
+
+	std::lock_guard<std::mutex> lock(GetFileMutex(m_fd));
+
+	vfsStream& file = *m_file;
+	const u64 old_pos = file.Tell();
+	file.Seek(m_offset + pos);
+
+	u64 res = file.Read(vm::get_ptr<u8>(m_buffer + (u32)ring_pos), first);
+
+	// wrap around
+	if (res == first && count > first)
+	{
+		res += file.Read(vm::get_ptr<u8>(m_buffer), count - first);
+	}
+
+	file.Seek(old_pos);
+
+	return res;
+}
+
+void FsStream::Work()
+{
+	const u64 rate = m_ring_buffer.transfer_rate; // bytes per second (unlimited if zero)
+	const u64 start = get_system_time();
+
+	while (true)
+	{
+		u64 pos, count;
+
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+
+			// wait for a free block in the ring buffer
+			while (!m_stop && !Emu.IsStopped() && m_ringbuf_size - (m_written - m_read) < m_block_size)
+			{
+				m_cv.wait_for(lock, std::chrono::milliseconds(10));
+			}
+
+			if (m_stop || Emu.IsStopped())
+			{
+				return;
+			}
+
+			pos = m_written;
+			count = std::min(m_block_size, m_end - std::min(m_end, m_offset + pos));
+		}
+
+		// the block isn't visible to the reader until m_written is updated
+		const u64 res = count ? Fill(pos, count) : 0;
+
+		if (rate)
+		{
+			const u64 due = start + (pos + res) * 1000000 / rate;
+			const u64 now = get_system_time();
+
+			if (due > now)
+			{
+				// interrupted by Stop()
+				std::unique_lock<std::mutex> lock(m_mutex);
+
+				m_cv.wait_for(lock, std::chrono::microseconds(due - now), [this]() { return m_stop; });
+			}
+		}
+
+		vm::ptr<CellFsStReadCallback> func;
+		u64 size;
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+
+			m_written += res;
+			m_eof = res < count || !count;
+			func = CheckCallback(size);
+			m_cv.notify_all();
+		}
+
+		Callback(func, size);
+
+		if (m_eof)
+		{
+			sys_fs->Notice("cellFsStRead: fd=0x%x: end of stream (0x%llx bytes read)", m_fd, m_written);
+			return;
+		}
+	}
+}
+
+u64 FsStream::Wait(u64 size)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	// the ring buffer can't hold more
+	size = std::min(size, m_ringbuf_size);
+
+	while (m_written - m_read < size && !m_eof && !m_stop && !Emu.IsStopped())
+	{
+		m_cv.wait_for(lock, std::chrono::milliseconds(10));
+	}
+
+	return m_written - m_read;
+}
+
+void FsStream::SetCallback(vm::ptr<CellFsStReadCallback> func, u64 size)
+{
+	u64 available;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		m_callback = func;
+		m_callback_size = std::min(size, m_ringbuf_size);
+		func = CheckCallback(available);
+	}
+
+	Callback(func, available);
+}
+
+u64 FsStream::Read(u8* dst, u64 size)
+{
+	const u64 count = std::min(Wait(size), size);
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	const u64 ring_pos = m_read % m_ringbuf_size;
+	const u64 first = std::min(count, m_ringbuf_size - ring_pos);
+
+	memcpy(dst, vm::get_ptr<u8>(m_buffer + (u32)ring_pos), first);
+	memcpy(dst + first, vm::get_ptr<u8>(m_buffer), count - first);
+
+	m_read += count;
+	m_regid += count;
+	m_cv.notify_all();
+
+	return count;
+}
+
+u32 FsStream::GetCurrentAddr(u64& size)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	const u64 ring_pos = m_read % m_ringbuf_size;
+
+	// contiguous data only
+	size = std::min(m_written - m_read, m_ringbuf_size - ring_pos);
+
+	return m_buffer + (u32)ring_pos;
+}
+
+bool FsStream::PutCurrentAddr(u32 addr, u64 size)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (addr != m_buffer + (u32)(m_read % m_ringbuf_size) || size > m_written - m_read)
+	{
+		return false;
+	}
+
+	m_read += size;
+	m_regid += size;
+	m_cv.notify_all();
+
+	return true;
+}
 
 
 s32 cellFsOpen(vm::ptr<const char> path, s32 flags, vm::ptr<be_t<u32>> fd, vm::ptr<const void> arg, u64 size)
@@ -134,6 +452,8 @@ s32 cellFsRead(u32 fd, vm::ptr<void> buf, u64 nbytes, vm::ptr<be_t<u64>> nread)
 
 	// TODO: checks
 
+	std::lock_guard<std::mutex> lock(GetFileMutex(fd));
+
 	const u64 res = nbytes ? file->Read(buf.get_ptr(), nbytes) : 0;
 
 	if (nread) *nread = res;
@@ -152,6 +472,8 @@ s32 cellFsWrite(u32 fd, vm::ptr<const void> buf, u64 nbytes, vm::ptr<u64> nwrite
 
 	// TODO: checks
 
+	std::lock_guard<std::mutex> lock(GetFileMutex(fd));
+
 	const u64 res = nbytes ? file->Write(buf.get_ptr(), nbytes) : 0;
 
 	if (nwrite) *nwrite = res;
@@ -166,6 +488,22 @@ s32 cellFsClose(u32 fd)
 	if (!Emu.GetIdManager().RemoveID(fd))
 		return CELL_ESRCH;
 
+	std::shared_ptr<FsStream> stream;
+
+	{
+		std::lock_guard<std::mutex> lock(g_fs_streams_mutex);
+
+		auto found = g_fs_streams.find(fd);
+		if (found != g_fs_streams.end())
+		{
+			stream = std::move(found->second);
+			g_fs_streams.erase(found);
+		}
+	}
+
+	// stop the stream of the file (if initialized), its thread is joined without the global lock
+	stream.reset();
+
 	return CELL_OK;
 }
 
@@ -449,6 +787,8 @@ s32 cellFsLseek(u32 fd, s64 offset, u32 whence, vm::ptr<be_t<u64>> pos)
 	if (!sys_fs->CheckId(fd, file, type) || type != TYPE_FS_FILE)
 		return CELL_ESRCH;
 
+	std::lock_guard<std::mutex> lock(GetFileMutex(fd));
+
 	*pos = file->Seek(offset, seek_mode);
 	return CELL_OK;
 }
@@ -466,6 +806,8 @@ s32 cellFsFtruncate(u32 fd, u64 size)
 
 	if (initialSize < size)
 	{
+		std::lock_guard<std::mutex> lock(GetFileMutex(fd));
+
 		u64 last_pos = file->Tell();
 		file->Seek(0, vfsSeekEnd);
 		static const char nullbyte = 0;
@@ -593,19 +935,15 @@ s32 cellFsStReadInit(u32 fd, vm::ptr<CellFsRingBuffer> ringbuf)
 	if (!sys_fs->CheckId(fd, file))
 		return CELL_ESRCH;
 
-	fs_config.m_ring_buffer = *ringbuf;
+	if (!ringbuf->ringbuf_size || !ringbuf->block_size || ringbuf->ringbuf_size % ringbuf->block_size)
+		return CELL_EINVAL;
 
-    // If the size is less than 1MB
-	if (ringbuf->ringbuf_size < 0x40000000)
-		fs_config.m_alloc_mem_size = (((u32)ringbuf->ringbuf_size + 64 * 1024 - 1) / (64 * 1024)) * (64 * 1024);
-    else
-	    fs_config.m_alloc_mem_size = (((u32)ringbuf->ringbuf_size + 1024 * 1024 - 1) / (1024 * 1024)) * (1024 * 1024);
+	std::lock_guard<std::mutex> lock(g_fs_streams_mutex);
 
-	// alloc memory
-	fs_config.m_buffer = (u32)Memory.Alloc(fs_config.m_alloc_mem_size, 1024);
-	memset(vm::get_ptr<void>(fs_config.m_buffer), 0, fs_config.m_alloc_mem_size);
+	if (g_fs_streams.count(fd))
+		return CELL_EBUSY;
 
-	fs_config.m_fs_status = CELL_FS_ST_INITIALIZED;
+	g_fs_streams[fd].reset(new FsStream(fd, file, *ringbuf));
 
 	return CELL_OK;
 }
@@ -618,8 +956,21 @@ s32 cellFsStReadFinish(u32 fd)
 	if (!sys_fs->CheckId(fd, file))
 		return CELL_ESRCH;
 
-	Memory.Free(fs_config.m_buffer);
-	fs_config.m_fs_status = CELL_FS_ST_NOT_INITIALIZED;
+	std::shared_ptr<FsStream> stream;
+
+	{
+		std::lock_guard<std::mutex> lock(g_fs_streams_mutex);
+
+		auto found = g_fs_streams.find(fd);
+		if (found == g_fs_streams.end())
+			return CELL_ENXIO;
+
+		stream = found->second;
+		g_fs_streams.erase(found);
+	}
+
+	// the thread is joined and the buffer is freed when the last reference is released
+	stream.reset();
 
 	return CELL_OK;
 }
@@ -632,7 +983,11 @@ s32 cellFsStReadGetRingBuf(u32 fd, vm::ptr<CellFsRingBuffer> ringbuf)
 	if (!sys_fs->CheckId(fd, file))
 		return CELL_ESRCH;
 
-	*ringbuf = fs_config.m_ring_buffer;
+	auto stream = GetStream(fd);
+	if (!stream)
+		return CELL_ENXIO;
+
+	*ringbuf = stream->m_ring_buffer;
 
 	sys_fs->Warning("*** fs stream config: block_size=0x%llx, copy=0x%x, ringbuf_size=0x%llx, transfer_rate=0x%llx",
 		ringbuf->block_size, ringbuf->copy, ringbuf->ringbuf_size, ringbuf->transfer_rate);
@@ -641,40 +996,52 @@ s32 cellFsStReadGetRingBuf(u32 fd, vm::ptr<CellFsRingBuffer> ringbuf)
 
 s32 cellFsStReadGetStatus(u32 fd, vm::ptr<u64> status)
 {
-	sys_fs->Warning("cellFsStReadGetRingBuf(fd=0x%x, status=0x%x)", fd, status);
+	sys_fs->Warning("cellFsStReadGetStatus(fd=0x%x, status=0x%x)", fd, status);
 
 	std::shared_ptr<vfsStream> file;
 	if (!sys_fs->CheckId(fd, file))
 		return CELL_ESRCH;
 
-	*status = fs_config.m_fs_status;
+	auto stream = GetStream(fd);
+
+	*status = stream ? stream->m_status.load() : (u64)CELL_FS_ST_NOT_INITIALIZED;
 
 	return CELL_OK;
 }
 
 s32 cellFsStReadGetRegid(u32 fd, vm::ptr<u64> regid)
 {
-	sys_fs->Warning("cellFsStReadGetRingBuf(fd=0x%x, regid=0x%x)", fd, regid);
+	sys_fs->Warning("cellFsStReadGetRegid(fd=0x%x, regid=0x%x)", fd, regid);
 
 	std::shared_ptr<vfsStream> file;
 	if (!sys_fs->CheckId(fd, file))
 		return CELL_ESRCH;
 
-	*regid = fs_config.m_regid;
+	auto stream = GetStream(fd);
+	if (!stream)
+		return CELL_ENXIO;
+
+	*regid = stream->m_regid;
 
 	return CELL_OK;
 }
 
 s32 cellFsStReadStart(u32 fd, u64 offset, u64 size)
 {
-	sys_fs->Todo("cellFsStReadStart(fd=0x%x, offset=0x%llx, size=0x%llx)", fd, offset, size);
+	sys_fs->Warning("cellFsStReadStart(fd=0x%x, offset=0x%llx, size=0x%llx)", fd, offset, size);
 
 	std::shared_ptr<vfsStream> file;
 	if (!sys_fs->CheckId(fd, file))
 		return CELL_ESRCH;
 
-	fs_config.m_current_addr = fs_config.m_buffer + (u32)offset;
-	fs_config.m_fs_status = CELL_FS_ST_PROGRESS;
+	auto stream = GetStream(fd);
+	if (!stream)
+		return CELL_ENXIO;
+
+	if (stream->m_status == CELL_FS_ST_PROGRESS)
+		return CELL_EBUSY;
+
+	stream->Start(offset, size);
 
 	return CELL_OK;
 }
@@ -687,267 +1054,437 @@ s32 cellFsStReadStop(u32 fd)
 	if (!sys_fs->CheckId(fd, file))
 		return CELL_ESRCH;
 
-	fs_config.m_fs_status = CELL_FS_ST_STOP;
+	auto stream = GetStream(fd);
+	if (!stream)
+		return CELL_ENXIO;
+
+	stream->Stop();
 
 	return CELL_OK;
 }
 
 s32 cellFsStRead(u32 fd, vm::ptr<u8> buf, u64 size, vm::ptr<u64> rsize)
 {
-	sys_fs->Warning("cellFsStRead(fd=0x%x, buf=0x%x, size=0x%llx, rsize=0x%x)", fd, buf, size, rsize);
+	sys_fs->Log("cellFsStRead(fd=0x%x, buf=0x%x, size=0x%llx, rsize=0x%x)", fd, buf, size, rsize);
 	
 	std::shared_ptr<vfsStream> file;
 	if (!sys_fs->CheckId(fd, file))
 		return CELL_ESRCH;
 
-	// TODO: use ringbuffer (fs_config)
-	fs_config.m_regid += size;
+	auto stream = GetStream(fd);
+	if (!stream)
+		return CELL_ENXIO;
+
+	if (stream->m_status == CELL_FS_ST_INITIALIZED)
+	{
+		// not started: read the file directly
+		std::lock_guard<std::mutex> lock(GetFileMutex(fd));
+
+		if (file->Eof())
+			return CELL_FS_ERANGE;
 
-	if (file->Eof())
+		*rsize = file->Read(buf.get_ptr(), size);
+		stream->m_regid += *rsize;
+		return CELL_OK;
+	}
+
+	const u64 res = stream->Read(buf.get_ptr(), size);
+
+	if (!res && size)
 		return CELL_FS_ERANGE;
 
-	*rsize = file->Read(buf.get_ptr(), size);
+	*rsize = res;
 
 	return CELL_OK;
 }
 
 s32 cellFsStReadGetCurrentAddr(u32 fd, vm::ptr<vm::ptr<u8>> addr, vm::ptr<u64> size)
 {
-	sys_fs->Todo("cellFsStReadGetCurrentAddr(fd=0x%x, addr=0x%x, size=0x%x)", fd, addr, size);
+	sys_fs->Log("cellFsStReadGetCurrentAddr(fd=0x%x, addr=0x%x, size=0x%x)", fd, addr, size);
 
 	std::shared_ptr<vfsStream> file;
 	if (!sys_fs->CheckId(fd, file))
 		return CELL_ESRCH;
 
+	auto stream = GetStream(fd);
+	if (!stream)
+		return CELL_ENXIO;
+
+	u64 available;
+	*addr = vm::ptr<u8>::make(stream->GetCurrentAddr(available));
+	*size = available;
+
 	return CELL_OK;
 }
 
 s32 cellFsStReadPutCurrentAddr(u32 fd, vm::ptr<u8> addr, u64 size)
 {
-	sys_fs->Todo("cellFsStReadPutCurrentAddr(fd=0x%x, addr=0x%x, size=0x%llx)", fd, addr, size);
+	sys_fs->Log("cellFsStReadPutCurrentAddr(fd=0x%x, addr=0x%x, size=0x%llx)", fd, addr, size);
 	
 	std::shared_ptr<vfsStream> file;
 	if (!sys_fs->CheckId(fd, file))
 		return CELL_ESRCH;
 
+	auto stream = GetStream(fd);
+	if (!stream)
+		return CELL_ENXIO;
+
+	if (!stream->PutCurrentAddr(addr.addr(), size))
+		return CELL_EINVAL;
+
 	return CELL_OK;
 }
 
 s32 cellFsStReadWait(u32 fd, u64 size)
 {
-	sys_fs->Todo("cellFsStReadWait(fd=0x%x, size=0x%llx)", fd, size);
+	sys_fs->Log("cellFsStReadWait(fd=0x%x, size=0x%llx)", fd, size);
 	
 	std::shared_ptr<vfsStream> file;
 	if (!sys_fs->CheckId(fd, file))
 		return CELL_ESRCH;
+
+	auto stream = GetStream(fd);
+	if (!stream)
+		return CELL_ENXIO;
+
+	stream->Wait(size);
 	
 	return CELL_OK;
 }
 
-s32 cellFsStReadWaitCallback(u32 fd, u64 size, vm::ptr<void(int xfd, u64 xsize)> func)
+s32 cellFsStReadWaitCallback(u32 fd, u64 size, vm::ptr<CellFsStReadCallback> func)
 {
-	sys_fs->Todo("cellFsStReadWaitCallback(fd=0x%x, size=0x%llx, func=0x%x)", fd, size, func);
+	sys_fs->Log("cellFsStReadWaitCallback(fd=0x%x, size=0x%llx, func=0x%x)", fd, size, func);
 
 	std::shared_ptr<vfsStream> file;
 	if (!sys_fs->CheckId(fd, file))
 		return CELL_ESRCH;
+
+	auto stream = GetStream(fd);
+	if (!stream)
+		return CELL_ENXIO;
+
+	stream->SetCallback(func, size);
 	
 	return CELL_OK;
 }
 
-bool sdata_check(u32 version, u32 flags, u64 filesizeInput, u64 filesizeTmp)
+s32 cellFsSdataOpen(vm::ptr<const char> path, s32 flags, vm::ptr<be_t<u32>> fd, vm::ptr<const void> arg, u64 size)
 {
-	if (version > 4 || flags & 0x7EFFFFC0){
-		printf("ERROR: unknown version");
-		return false;
-	}
+	sys_fs->Warning("cellFsSdataOpen(path=0x%x, flags=0x%x, fd=0x%x, arg=0x%x, size=0x%llx)", path, flags, fd, arg, size);
 
-	if ((version == 1 && (flags & 0x7FFFFFFE)) ||
-		(version == 2 && (flags & 0x7EFFFFC0))){
-		printf("ERROR: unknown or unsupported type");
-		return false;
-	}
+	// SDATA files can only be read (the firmware rejects other flags the same way)
+	if (flags != CELL_O_RDONLY)
+		return CELL_EINVAL;
 
-	if (filesizeTmp > filesizeInput){
-		printf("ERROR: input file size is too short.");
-		return false;
-	}
+	// the blocks are decrypted when they are read
+	std::shared_ptr<vfsEDATFile> sdata(new vfsEDATFile());
 
-	if (!(flags & 0x80000000)){
-		printf("ERROR: cannot extract finalized edata.");
-		return false;
+	if (!sdata->Open(path.get_ptr(), vfsRead))
+	{
+		sys_fs->Warning("cellFsSdataOpen(): '%s' isn't valid SDATA file, opened as regular file", path.get_ptr());
+		return cellFsOpen(path, flags, fd, arg, size);
 	}
 
-	return true;
+	std::shared_ptr<vfsStream> stream(sdata);
+
+	u32 id = sys_fs->GetNewId(stream, TYPE_FS_FILE);
+	*fd = id;
+	sys_fs->Notice("cellFsSdataOpen(): '%s' opened, id -> 0x%x", path.get_ptr(), id);
+
+	return CELL_OK;
 }
 
-int sdata_unpack(const std::string& packed_file, const std::string& unpacked_file)
+s32 cellFsSdataOpenByFd(u32 mself_fd, s32 flags, vm::ptr<u32> sdata_fd, u64 offset, vm::ptr<const void> arg, u64 size)
 {
-	std::shared_ptr<vfsFileBase> packed_stream(Emu.GetVFS().OpenFile(packed_file, vfsRead));
-	std::shared_ptr<vfsFileBase> unpacked_stream(Emu.GetVFS().OpenFile(unpacked_file, vfsWrite));
+	sys_fs->Todo("cellFsSdataOpenByFd(mself_fd=0x%x, flags=0x%x, sdata_fd=0x%x, offset=0x%llx, arg=0x%x, size=0x%llx)", mself_fd, flags, sdata_fd, offset, arg, size);
 
-	if (!packed_stream || !packed_stream->IsOpened())
-	{
-		sys_fs->Error("'%s' not found! flags: 0x%02x", packed_file.c_str(), vfsRead);
-		return CELL_ENOENT;
-	}
+	// TODO:
+
+	return CELL_OK;
+}
+
+typedef void(CellFsAioCallback)(vm::ptr<CellFsAio> xaio, s32 error, s32 xid, u64 size);
+
+static const u32 g_fs_aio_threads = 4;
+
+struct FsAioRequest
+{
+	s32 id;
+	u32 fd;
+	u64 offset;
+	vm::ptr<void> buf;
+	u64 size;
+	vm::ptr<CellFsAio> aio;
+	vm::ptr<CellFsAioCallback> func;
+	u64 stamp; // time when the request was queued
+	s32 error;
+	u64 res;
+};
+
+// AIO requests are processed by a fixed number of threads (never two requests for the same file at once),
+// callbacks of requests completed in the meantime are called by the same job of the callback thread
+class FsAioManager
+{
+	std::deque<FsAioRequest> m_queue;
+	std::vector<FsAioRequest> m_done; // completed requests waiting for the callback thread
+	std::set<u32> m_busy; // files being read
+	std::unordered_map<u32, u64> m_next_offset; // key: fd, value: offset following the last request
+	std::mutex m_mutex;
+	bool m_callbacks_queued;
+	s32 m_next_id;
+
+	// statistics
+	u64 m_requests;
+	u64 m_cancelled;
+	u64 m_batches;
+	u64 m_latency; // sum of times between queueing and completion (in microseconds)
+	u64 m_max_latency;
+	size_t m_max_depth;
+
+	std::deque<FsAioRequest>::iterator Select();
+	void Read(FsAioRequest& req);
+	void RunCallbacks(PPUThread& CPU);
+	void Work();
+
+	thread_pool_t m_pool; // every queued request adds one job processing the requests which can be selected
+
+public:
+	FsAioManager();
+	~FsAioManager();
+
+	s32 Enqueue(FsAioRequest& req);
+
+	// remove the request from the queue, returns false if it isn't queued (already processed)
+	bool Cancel(s32 id);
+
+	// log the statistics
+	void Report();
+
+	// drop queued requests, join the threads and reset the statistics
+	void Stop();
+};
+
+FsAioManager::FsAioManager()
+	: m_callbacks_queued(false)
+	, m_next_id(0)
+	, m_requests(0)
+	, m_cancelled(0)
+	, m_batches(0)
+	, m_latency(0)
+	, m_max_latency(0)
+	, m_max_depth(0)
+	, m_pool("CellFsAio Thread", g_fs_aio_threads)
+{
+}
 
-	if (!unpacked_stream || !unpacked_stream->IsOpened())
+FsAioManager::~FsAioManager()
+{
+	// may be called during static destruction, nothing is logged
+	Stop();
+}
+
+s32 FsAioManager::Enqueue(FsAioRequest& req)
+{
 	{
-		sys_fs->Error("'%s' couldn't be created! flags: 0x%02x", unpacked_file.c_str(), vfsWrite);
-		return CELL_ENOENT;
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		req.id = m_next_id++;
+		req.stamp = get_system_time();
+		req.error = CELL_OK;
+		req.res = 0;
+
+		m_queue.push_back(req);
+		m_max_depth = std::max(m_max_depth, m_queue.size());
 	}
 
-	char buffer[10200];
-	packed_stream->Read(buffer, 256);
-	u32 format = re32(*(u32*)&buffer[0]);
-	if (format != 0x4E504400) // "NPD\x00"
+	m_pool.push([this](u32 worker) { Work(); });
+
+	return req.id;
+}
+
+bool FsAioManager::Cancel(s32 id)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	for (auto it = m_queue.begin(); it != m_queue.end(); it++)
 	{
-		sys_fs->Error("Illegal format. Expected 0x4E504400, but got 0x%08x", format);
-		return CELL_EFSSPECIFIC;
+		if (it->id == id)
+		{
+			m_queue.erase(it);
+			m_cancelled++;
+			return true;
+		}
 	}
 
-	u32 version = re32(*(u32*)&buffer[0x04]);
-	u32 flags = re32(*(u32*)&buffer[0x80]);
-	u32 blockSize = re32(*(u32*)&buffer[0x84]);
-	u64 filesizeOutput = re64(*(u64*)&buffer[0x88]);
-	u64 filesizeInput = packed_stream->GetSize();
-	u32 blockCount = (u32)((filesizeOutput + blockSize - 1) / blockSize);
+	return false;
+}
 
-	// SDATA file is compressed
-	if (flags & 0x1)
+void FsAioManager::Report()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (m_requests || m_cancelled)
 	{
-		sys_fs->Warning("cellFsSdataOpen: Compressed SDATA files are not supported yet.");
-		return CELL_EFSSPECIFIC;
+		sys_fs->Notice("cellFsAio: %lld requests (%lld cancelled), max queue depth %d, latency avg %lld us, max %lld us, %lld callback batches",
+			m_requests, m_cancelled, (u32)m_max_depth, m_requests ? m_latency / m_requests : 0, m_max_latency, m_batches);
 	}
+}
 
-	// SDATA file is NOT compressed
-	else
-	{
-		u32 t1 = (flags & 0x20) ? 0x20 : 0x10;
-		u32 startOffset = (blockCount * t1) + 0x100;
-		u64 filesizeTmp = (filesizeOutput + 0xF) & 0xFFFFFFF0 + startOffset;
+void FsAioManager::Stop()
+{
+	m_pool.stop();
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	m_queue.clear();
+	m_done.clear();
+	m_busy.clear();
+	m_next_offset.clear();
+	m_callbacks_queued = false;
+	m_next_id = 0;
+	m_requests = m_cancelled = m_batches = m_latency = m_max_latency = 0;
+	m_max_depth = 0;
+}
 
-		if (!sdata_check(version, flags, filesizeInput, filesizeTmp))
+std::deque<FsAioRequest>::iterator FsAioManager::Select()
+{
+	auto best = m_queue.end();
+
+	for (auto it = m_queue.begin(); it != m_queue.end(); it++)
+	{
+		if (m_busy.count(it->fd))
 		{
-			sys_fs->Error("cellFsSdataOpen: Wrong header information.");
-			return CELL_EFSSPECIFIC;
+			continue;
 		}
 
-		if (flags & 0x20)
-			packed_stream->Seek(0x100);
-		else
-			packed_stream->Seek(startOffset);
-
-		for (u32 i = 0; i < blockCount; i++)
+		// continue reading where the previous request for the file ended
+		auto next = m_next_offset.find(it->fd);
+		if (next != m_next_offset.end() && next->second == it->offset)
 		{
-			if (flags & 0x20)
-				packed_stream->Seek(packed_stream->Tell() + t1);
-
-			if (!(blockCount - i - 1))
-				blockSize = (u32)(filesizeOutput - i * blockSize);
+			return it;
+		}
 
-			packed_stream->Read(buffer + 256, blockSize);
-			unpacked_stream->Write(buffer + 256, blockSize);
+		// otherwise the oldest request, or a request for the same file with lower offset
+		if (best == m_queue.end() || (it->fd == best->fd && it->offset < best->offset))
+		{
+			best = it;
 		}
 	}
 
-	return CELL_OK;
+	return best;
 }
 
-s32 cellFsSdataOpen(vm::ptr<const char> path, s32 flags, vm::ptr<be_t<u32>> fd, vm::ptr<const void> arg, u64 size)
+void FsAioManager::Read(FsAioRequest& req)
 {
-	sys_fs->Warning("cellFsSdataOpen(path=0x%x, flags=0x%x, fd=0x%x, arg=0x%x, size=0x%llx) -> cellFsOpen()", path, flags, fd, arg, size);
-
-	/*if (flags != CELL_O_RDONLY)
-	return CELL_EINVAL;
+	std::shared_ptr<vfsStream> orig_file;
+	if (!sys_fs->CheckId(req.fd, orig_file))
+	{
+		req.error = CELL_EBADF;
+		return;
+	}
 
-	std::string suffix = path.substr(path.length() - 5, 5);
-	if (suffix != ".sdat" && suffix != ".SDAT")
-	return CELL_ENOTSDATA;
+	std::lock_guard<std::mutex> lock(GetFileMutex(req.fd));
 
-	std::string::size_type last_slash = path.rfind('/'); //TODO: use a filesystem library to solve this more robustly
-	last_slash = last_slash == std::string::npos ? 0 : last_slash+1;
-	std::string unpacked_path = "/dev_hdd1/"+path.substr(last_slash,path.length()-last_slash)+".unpacked";
-	int ret = sdata_unpack(path, unpacked_path);
-	if (ret) return ret;
+	vfsStream& file = *orig_file;
+	const u64 old_pos = file.Tell();
+	file.Seek(req.offset);
 
-	fd = sys_fs->GetNewId(Emu.GetVFS().OpenFile(unpacked_path, vfsRead), TYPE_FS_FILE);
+	if (req.size != (u32)req.size)
+	{
+		req.error = CELL_ENOMEM;
+	}
+	else
+	{
+		req.res = req.size ? file.Read(req.buf.get_ptr(), req.size) : 0;
+	}
 
-	return CELL_OK;*/
+	file.Seek(old_pos);
 
-	return cellFsOpen(path, flags, fd, arg, size);
+	sys_fs->Log("*** fsAioRead(fd=%d, offset=0x%llx, buf=0x%x, size=0x%llx, error=0x%x, res=0x%llx, xid=0x%x)",
+		req.fd, req.offset, req.buf, req.size, req.error, req.res, req.id);
 }
 
-s32 cellFsSdataOpenByFd(u32 mself_fd, s32 flags, vm::ptr<u32> sdata_fd, u64 offset, vm::ptr<const void> arg, u64 size)
+void FsAioManager::RunCallbacks(PPUThread& CPU)
 {
-	sys_fs->Todo("cellFsSdataOpenByFd(mself_fd=0x%x, flags=0x%x, sdata_fd=0x%x, offset=0x%llx, arg=0x%x, size=0x%llx)", mself_fd, flags, sdata_fd, offset, arg, size);
-
-	// TODO:
+	std::vector<FsAioRequest> done;
 
-	return CELL_OK;
-}
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
 
-std::atomic<s32> g_FsAioReadID(0);
-std::atomic<s32> g_FsAioReadCur(0);
-bool aio_init = false;
+		done.swap(m_done);
+		m_callbacks_queued = false;
+		m_batches++;
+	}
 
-void fsAioRead(u32 fd, vm::ptr<CellFsAio> aio, int xid, vm::ptr<void(vm::ptr<CellFsAio> xaio, int error, int xid, u64 size)> func)
-{
-	while (g_FsAioReadCur != xid)
+	for (auto& req : done)
 	{
-		std::this_thread::sleep_for(std::chrono::milliseconds(1)); // hack
-		if (Emu.IsStopped())
-		{
-			sys_fs->Warning("fsAioRead() aborted");
-			return;
-		}
+		req.func(CPU, req.aio, req.error, req.id, req.res);
 	}
+}
 
-	u32 error = CELL_OK;
-	u64 res = 0;
+void FsAioManager::Work()
+{
+	// requests skipped because their file was busy are selected by the thread reading it when it's done
+	while (!Emu.IsStopped())
 	{
-		std::shared_ptr<vfsStream> orig_file;
-		if (!sys_fs->CheckId(fd, orig_file))
+		FsAioRequest req;
+
 		{
-			sys_fs->Error("Wrong fd (%s)", fd);
-			Emu.Pause();
-			return;
-		}
+			std::lock_guard<std::mutex> lock(m_mutex);
 
-		u64 nbytes = aio->size;
+			const auto it = Select();
 
-		vfsStream& file = *orig_file;
-		const u64 old_pos = file.Tell();
-		file.Seek((u64)aio->offset);
+			if (it == m_queue.end())
+			{
+				return;
+			}
 
-		if (nbytes != (u32)nbytes)
-		{
-			error = CELL_ENOMEM;
+			req = *it;
+			m_queue.erase(it);
+			m_busy.insert(req.fd);
 		}
-		else
+
+		Read(req);
+
+		bool queue_callbacks = false;
+
 		{
-			res = nbytes ? file.Read(aio->buf.get_ptr(), nbytes) : 0;
-		}
+			std::lock_guard<std::mutex> lock(m_mutex);
 
-		file.Seek(old_pos);
+			const u64 latency = get_system_time() - req.stamp;
 
-		sys_fs->Log("*** fsAioRead(fd=%d, offset=0x%llx, buf=0x%x, size=0x%llx, error=0x%x, res=0x%llx, xid=0x%x)",
-			fd, aio->offset, aio->buf, aio->size, error, res, xid);
-	}
+			m_busy.erase(req.fd);
+			m_next_offset[req.fd] = req.offset + req.res;
+			m_requests++;
+			m_latency += latency;
+			m_max_latency = std::max(m_max_latency, latency);
 
-	if (func)
-	{
-		Emu.GetCallbackManager().Async([func, aio, error, xid, res](PPUThread& CPU)
+			if (req.func)
+			{
+				m_done.push_back(req);
+
+				if (!m_callbacks_queued)
+				{
+					m_callbacks_queued = queue_callbacks = true;
+				}
+			}
+		}
+
+		if (queue_callbacks)
 		{
-			func(CPU, aio, error, xid, res);
-		});
+			Emu.GetCallbackManager().Async([this](PPUThread& CPU)
+			{
+				RunCallbacks(CPU);
+			});
+		}
 	}
-
-	g_FsAioReadCur++;
 }
 
-s32 cellFsAioRead(vm::ptr<CellFsAio> aio, vm::ptr<s32> id, vm::ptr<void(vm::ptr<CellFsAio> xaio, s32 error, s32 xid, u64 size)> func)
+FsAioManager g_fs_aio;
+bool aio_init = false;
+
+s32 cellFsAioRead(vm::ptr<CellFsAio> aio, vm::ptr<s32> id, vm::ptr<CellFsAioCallback> func)
 {
 	sys_fs->Warning("cellFsAioRead(aio=0x%x, id=0x%x, func=0x%x)", aio, id, func);
 
@@ -964,15 +1501,21 @@ s32 cellFsAioRead(vm::ptr<CellFsAio> aio, vm::ptr<s32> id, vm::ptr<void(vm::ptr<
 		return CELL_EBADF;
 	}
 
+	FsAioRequest req;
+	req.fd = fd;
+	req.offset = aio->offset;
+	req.buf = aio->buf;
+	req.size = aio->size;
+	req.aio = aio;
+	req.func = func;
+
 	//get a unique id for the callback (may be used by cellFsAioCancel)
-	const s32 xid = g_FsAioReadID++;
-	*id = xid;
+	*id = g_fs_aio.Enqueue(req);
 
-	thread_t t("CellFsAio Reading Thread", std::bind(fsAioRead, fd, aio, xid, func));
 	return CELL_OK;
 }
 
-s32 cellFsAioWrite(vm::ptr<CellFsAio> aio, vm::ptr<s32> id, vm::ptr<void(vm::ptr<CellFsAio> xaio, s32 error, s32 xid, u64 size)> func)
+s32 cellFsAioWrite(vm::ptr<CellFsAio> aio, vm::ptr<s32> id, vm::ptr<CellFsAioCallback> func)
 {
 	sys_fs->Todo("cellFsAioWrite(aio=0x%x, id=0x%x, func=0x%x)", aio, id, func);
 
@@ -981,6 +1524,18 @@ s32 cellFsAioWrite(vm::ptr<CellFsAio> aio, vm::ptr<s32> id, vm::ptr<void(vm::ptr
 	return CELL_OK;
 }
 
+s32 cellFsAioCancel(s32 id)
+{
+	sys_fs->Warning("cellFsAioCancel(id=%d)", id);
+
+	if (!aio_init)
+	{
+		return CELL_ENXIO;
+	}
+
+	return g_fs_aio.Cancel(id) ? CELL_OK : CELL_EINVAL;
+}
+
 s32 cellFsAioInit(vm::ptr<const char> mount_point)
 {
 	sys_fs->Warning("cellFsAioInit(mount_point=0x%x)", mount_point);
@@ -1042,6 +1597,7 @@ void sys_fs_init(Module *pxThis)
 	sys_fs->AddFunc(0xcb588dba, cellFsFGetBlockSize);
 	sys_fs->AddFunc(0xc1c507e7, cellFsAioRead);
 	sys_fs->AddFunc(0x4cef342e, cellFsAioWrite);
+	sys_fs->AddFunc(0x7f13fc8c, cellFsAioCancel);
 	sys_fs->AddFunc(0xdb869f20, cellFsAioInit);
 	sys_fs->AddFunc(0x9f951810, cellFsAioFinish);
 	sys_fs->AddFunc(0x1a108ab7, cellFsGetBlockSize);
@@ -1064,7 +1620,29 @@ void sys_fs_init(Module *pxThis)
 
 void sys_fs_load()
 {
-	g_FsAioReadID = 0;
-	g_FsAioReadCur = 0;
+	g_fs_aio.Stop();
 	aio_init = false;
+
+	// the stream threads are joined when the local map is destroyed (without the global lock)
+	std::unordered_map<u32, std::shared_ptr<FsStream>> streams;
+
+	{
+		std::lock_guard<std::mutex> lock(g_fs_streams_mutex);
+		streams.swap(g_fs_streams);
+	}
+}
+
+void sys_fs_unload()
+{
+	g_fs_aio.Report();
+	g_fs_aio.Stop();
+	aio_init = false;
+
+	// the stream threads are joined when the local map is destroyed (without the global lock)
+	std::unordered_map<u32, std::shared_ptr<FsStream>> streams;
+
+	{
+		std::lock_guard<std::mutex> lock(g_fs_streams_mutex);
+		streams.swap(g_fs_streams);
+	}
 }
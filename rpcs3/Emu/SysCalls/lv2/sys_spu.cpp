@@ -184,6 +184,8 @@ s32 sys_spu_thread_get_exit_status(u32 id, vm::ptr<u32> status)
 		return CELL_ESTAT;
 	}
 
+	thr->Notify();
+
 	*status = res;
 	return CELL_OK;
 }
@@ -618,6 +620,7 @@ s32 sys_spu_thread_write_spu_mb(u32 id, u32 value)
 	}
 
 	(*(SPUThread*)thr.get()).SPU.In_MBox.PushUncond(value);
+	thr->Notify();
 
 	return CELL_OK;
 }
@@ -1068,6 +1071,7 @@ s32 sys_raw_spu_read_puint_mb(u32 id, vm::ptr<u32> value)
 
 	u32 v;
 	t->SPU.Out_IntrMBox.PopUncond(v);
+	t->Notify();
 	*value = v;
 	return CELL_OK;
 }
@@ -1,4 +1,5 @@
 #include "stdafx.h"
+#include "rpcs3/Ini.h"
 #include "Utilities/Log.h"
 #include "Utilities/rFile.h"
 #include "Emu/Memory/Memory.h"
@@ -11,6 +12,7 @@
 #include "Emu/SysCalls/ModuleManager.h"
 #include "Emu/Cell/PPUThread.h"
 #include "Emu/Cell/SPUThread.h"
+#include "Emu/Cell/SPURecompilerCache.h"
 #include "Emu/Cell/PPUInstrTable.h"
 #include "Emu/FS/vfsFile.h"
 #include "Emu/FS/vfsLocalFile.h"
@@ -290,6 +292,11 @@ void Emulator::Load()
 
 	m_status = Ready;
 
+	if (Ini.SPUDecoderMode.GetValue() == 2 && m_title_id.length())
+	{
+		g_spu_rec_cache.Load(GetEmulatorPath() + "/cache/" + m_title_id + "/");
+	}
+
 	GetGSManager().Init();
 	GetCallbackManager().Init();
 	GetAudioManager().Init();
@@ -389,6 +396,8 @@ void Emulator::Stop()
 	GetAudioManager().Close();
 	GetEventManager().Clear();
 	GetCPU().Close();
+	g_spu_rec_cache.Save();
+	g_spu_rec_cache.Clear();
 	GetIdManager().Clear();
 	GetPadManager().Close();
 	GetKeyboardManager().Close();
@@ -1,6 +1,7 @@
 #include "stdafx_gui.h"
 #include "Emu/Memory/Memory.h"
 #include "Emu/System.h"
+#include "Emu/RSX/GSManager.h"
 #include "GLGSFrame.h"
 #include "Utilities/Timer.h"
 
@@ -67,7 +68,7 @@ void GLGSFrame::Flip(void* context)
 	if (fps_t.GetElapsedTimeInSec() >= 0.5)
 	{
 		// can freeze on exit
-		SetTitle(wxString(sub_title.c_str(), wxConvUTF8) + wxString::Format("FPS: %.2f", (double)m_frames / fps_t.GetElapsedTimeInSec()));
+		SetTitle(wxString(sub_title.c_str(), wxConvUTF8) + wxString::Format("FPS: %.2f | Methods/s: %d", (double)m_frames / fps_t.GetElapsedTimeInSec(), Emu.GetGSManager().GetRender().m_methods_per_sec));
 		m_frames = 0;
 		fps_t.Start();
 	}
@@ -24,6 +24,7 @@
 #include "Gui/LLEModulesManager.h"
 
 #include <wx/dynlib.h>
+#include <wx/progdlg.h>
 
 #include "Loader/PKG.h"
 
@@ -248,8 +249,13 @@ void MainFrame::InstallPkg(wxCommandEvent& WXUNUSED(event))
 
 	if (pkg_f.IsOpened())
 	{
+		wxProgressDialog pdlg("PKG Decrypter / Installer", "Please wait, unpacking...", 1000, this, wxPD_AUTO_HIDE | wxPD_APP_MODAL);
+
 		PKGLoader pkg(pkg_f);
-		pkg.Install("/dev_hdd0/game/");
+		pkg.Install("/dev_hdd0/game/", [&pdlg](u64 done, u64 total)
+		{
+			pdlg.Update(total ? (int)(done * 1000 / total) : 1000);
+		});
 		pkg.Close();
 
 		// Refresh game list
@@ -373,12 +379,15 @@ void MainFrame::Config(wxCommandEvent& WXUNUSED(event))
 	// CPU/SPU settings
 	wxStaticBoxSizer* s_round_cpu_decoder = new wxStaticBoxSizer(wxVERTICAL, p_cpu, _("CPU"));
 	wxStaticBoxSizer* s_round_spu_decoder = new wxStaticBoxSizer(wxVERTICAL, p_cpu, _("SPU"));
+	wxStaticBoxSizer* s_round_reservation = new wxStaticBoxSizer(wxVERTICAL, p_cpu, _("Reservations"));
 
 	// Graphics
 	wxStaticBoxSizer* s_round_gs_render = new wxStaticBoxSizer(wxVERTICAL, p_graphics, _("Render"));
 	wxStaticBoxSizer* s_round_gs_res    = new wxStaticBoxSizer(wxVERTICAL, p_graphics, _("Default resolution"));
 	wxStaticBoxSizer* s_round_gs_aspect = new wxStaticBoxSizer(wxVERTICAL, p_graphics, _("Default aspect ratio"));
 	wxStaticBoxSizer* s_round_gs_frame_limit = new wxStaticBoxSizer(wxVERTICAL, p_graphics, _("Frame limit"));
+	wxStaticBoxSizer* s_round_gs_decompiler = new wxStaticBoxSizer(wxVERTICAL, p_graphics, _("Shader decompiler"));
+	wxStaticBoxSizer* s_round_gs_write_back = new wxStaticBoxSizer(wxVERTICAL, p_graphics, _("Buffer write-back"));
 
 	// Input / Output
 	wxStaticBoxSizer* s_round_io_pad_handler      = new wxStaticBoxSizer(wxVERTICAL, p_io, _("Pad Handler"));
@@ -400,10 +409,13 @@ void MainFrame::Config(wxCommandEvent& WXUNUSED(event))
 
 	wxComboBox* cbox_cpu_decoder      = new wxComboBox(p_cpu, wxID_ANY);
 	wxComboBox* cbox_spu_decoder      = new wxComboBox(p_cpu, wxID_ANY);
+	wxComboBox* cbox_reservation      = new wxComboBox(p_cpu, wxID_ANY);
 	wxComboBox* cbox_gs_render        = new wxComboBox(p_graphics, wxID_ANY);
 	wxComboBox* cbox_gs_resolution    = new wxComboBox(p_graphics, wxID_ANY);
 	wxComboBox* cbox_gs_aspect        = new wxComboBox(p_graphics, wxID_ANY);
 	wxComboBox* cbox_gs_frame_limit   = new wxComboBox(p_graphics, wxID_ANY);
+	wxComboBox* cbox_gs_decompiler    = new wxComboBox(p_graphics, wxID_ANY);
+	wxComboBox* cbox_gs_write_back    = new wxComboBox(p_graphics, wxID_ANY);
 	wxComboBox* cbox_pad_handler      = new wxComboBox(p_io, wxID_ANY);
 	wxComboBox* cbox_keyboard_handler = new wxComboBox(p_io, wxID_ANY);
 	wxComboBox* cbox_mouse_handler    = new wxComboBox(p_io, wxID_ANY);
@@ -413,6 +425,8 @@ void MainFrame::Config(wxCommandEvent& WXUNUSED(event))
 	wxComboBox* cbox_hle_loglvl       = new wxComboBox(p_hle, wxID_ANY);
 	wxComboBox* cbox_sys_lang         = new wxComboBox(p_system, wxID_ANY);
 
+	wxCheckBox* chbox_spu_bg_compile      = new wxCheckBox(p_cpu, wxID_ANY, "Compile SPU code in background");
+	wxCheckBox* chbox_spu_log_jit         = new wxCheckBox(p_cpu, wxID_ANY, "Log SPU JIT output");
 	wxCheckBox* chbox_gs_log_prog         = new wxCheckBox(p_graphics, wxID_ANY, "Log vertex/fragment programs");
 	wxCheckBox* chbox_gs_dump_depth       = new wxCheckBox(p_graphics, wxID_ANY, "Write Depth Buffer");
 	wxCheckBox* chbox_gs_dump_color       = new wxCheckBox(p_graphics, wxID_ANY, "Write Color Buffers");
@@ -423,6 +437,7 @@ void MainFrame::Config(wxCommandEvent& WXUNUSED(event))
 	wxCheckBox* chbox_audio_conv          = new wxCheckBox(p_audio, wxID_ANY, "Convert to 16 bit");
 	wxCheckBox* chbox_hle_logging         = new wxCheckBox(p_hle, wxID_ANY, "Log all SysCalls");
 	wxCheckBox* chbox_rsx_logging         = new wxCheckBox(p_hle, wxID_ANY, "RSX Logging");
+	wxCheckBox* chbox_rsx_capture         = new wxCheckBox(p_hle, wxID_ANY, "RSX Capture");
 	wxCheckBox* chbox_hle_hook_stfunc     = new wxCheckBox(p_hle, wxID_ANY, "Hook static functions");
 	wxCheckBox* chbox_hle_savetty         = new wxCheckBox(p_hle, wxID_ANY, "Save TTY output to file");
 	wxCheckBox* chbox_hle_exitonstop      = new wxCheckBox(p_hle, wxID_ANY, "Exit RPCS3 when process finishes");
@@ -438,6 +453,9 @@ void MainFrame::Config(wxCommandEvent& WXUNUSED(event))
 	cbox_spu_decoder->Append("SPU Interpreter");
 	cbox_spu_decoder->Append("SPU JIT (ASMJIT)");
 
+	cbox_reservation->Append("Page protection");
+	cbox_reservation->Append("Lock-free");
+
 	cbox_gs_render->Append("Null");
 	cbox_gs_render->Append("OpenGL");
 	//cbox_gs_render->Append("Software");
@@ -453,6 +471,14 @@ void MainFrame::Config(wxCommandEvent& WXUNUSED(event))
 	for (auto item : { "Off", "50", "59.94", "30", "60", "Auto" })
 		cbox_gs_frame_limit->Append(item);
 
+	cbox_gs_decompiler->Append("Synchronous");
+	cbox_gs_decompiler->Append("Asynchronous (wait)");
+	cbox_gs_decompiler->Append("Asynchronous (skip draws)");
+
+	cbox_gs_write_back->Append("Synchronous");
+	cbox_gs_write_back->Append("Asynchronous");
+	cbox_gs_write_back->Append("On demand");
+
 	cbox_pad_handler->Append("Null");
 	cbox_pad_handler->Append("Windows");
 #if defined (_WIN32)
@@ -507,6 +533,8 @@ void MainFrame::Config(wxCommandEvent& WXUNUSED(event))
 	cbox_sys_lang->Append("English (UK)");
 
 	// Get values from .ini
+	chbox_spu_bg_compile     ->SetValue(Ini.SPUBackgroundCompile.GetValue());
+	chbox_spu_log_jit        ->SetValue(Ini.SPULogJit.GetValue());
 	chbox_gs_log_prog        ->SetValue(Ini.GSLogPrograms.GetValue());
 	chbox_gs_dump_depth      ->SetValue(Ini.GSDumpDepthBuffer.GetValue());
 	chbox_gs_dump_color      ->SetValue(Ini.GSDumpColorBuffers.GetValue());
@@ -517,6 +545,7 @@ void MainFrame::Config(wxCommandEvent& WXUNUSED(event))
 	chbox_audio_conv         ->SetValue(Ini.AudioConvertToU16.GetValue());
 	chbox_hle_logging        ->SetValue(Ini.HLELogging.GetValue());
 	chbox_rsx_logging        ->SetValue(Ini.RSXLogging.GetValue());
+	chbox_rsx_capture        ->SetValue(Ini.RSXCapture.GetValue());
 	chbox_hle_hook_stfunc    ->SetValue(Ini.HLEHookStFunc.GetValue());
 	chbox_hle_savetty        ->SetValue(Ini.HLESaveTTY.GetValue());
 	chbox_hle_exitonstop     ->SetValue(Ini.HLEExitOnStop.GetValue());
@@ -528,10 +557,13 @@ void MainFrame::Config(wxCommandEvent& WXUNUSED(event))
 
 	cbox_cpu_decoder     ->SetSelection(Ini.CPUDecoderMode.GetValue() ? Ini.CPUDecoderMode.GetValue() - 1 : 0);
 	cbox_spu_decoder     ->SetSelection(Ini.SPUDecoderMode.GetValue() ? Ini.SPUDecoderMode.GetValue() - 1 : 0);
+	cbox_reservation     ->SetSelection(Ini.CPUReservationMode.GetValue());
 	cbox_gs_render       ->SetSelection(Ini.GSRenderMode.GetValue());
 	cbox_gs_resolution   ->SetSelection(ResolutionIdToNum(Ini.GSResolution.GetValue()) - 1);
 	cbox_gs_aspect       ->SetSelection(Ini.GSAspectRatio.GetValue() - 1);
 	cbox_gs_frame_limit  ->SetSelection(Ini.GSFrameLimit.GetValue());
+	cbox_gs_decompiler   ->SetSelection(Ini.GSShaderDecompiler.GetValue());
+	cbox_gs_write_back   ->SetSelection(Ini.GSBufferWriteBack.GetValue());
 	cbox_pad_handler     ->SetSelection(Ini.PadHandlerMode.GetValue());
 	cbox_keyboard_handler->SetSelection(Ini.KeyboardHandlerMode.GetValue());
 	cbox_mouse_handler   ->SetSelection(Ini.MouseHandlerMode.GetValue());
@@ -546,15 +578,21 @@ void MainFrame::Config(wxCommandEvent& WXUNUSED(event))
 	chbox_audio_conv->Enable(Emu.IsStopped());
 	chbox_hle_logging->Enable(Emu.IsStopped());
 	chbox_rsx_logging->Enable(Emu.IsStopped());
+	chbox_rsx_capture->Enable(Emu.IsStopped());
 	chbox_hle_hook_stfunc->Enable(Emu.IsStopped());
+	cbox_reservation->Enable(Emu.IsStopped());
+	chbox_spu_bg_compile->Enable(Emu.IsStopped());
 
 	s_round_cpu_decoder->Add(cbox_cpu_decoder, wxSizerFlags().Border(wxALL, 5).Expand());
 	s_round_spu_decoder->Add(cbox_spu_decoder, wxSizerFlags().Border(wxALL, 5).Expand());
+	s_round_reservation->Add(cbox_reservation, wxSizerFlags().Border(wxALL, 5).Expand());
 
 	s_round_gs_render->Add(cbox_gs_render, wxSizerFlags().Border(wxALL, 5).Expand());
 	s_round_gs_res->Add(cbox_gs_resolution, wxSizerFlags().Border(wxALL, 5).Expand());
 	s_round_gs_aspect->Add(cbox_gs_aspect, wxSizerFlags().Border(wxALL, 5).Expand());
 	s_round_gs_frame_limit->Add(cbox_gs_frame_limit, wxSizerFlags().Border(wxALL, 5).Expand());
+	s_round_gs_decompiler->Add(cbox_gs_decompiler, wxSizerFlags().Border(wxALL, 5).Expand());
+	s_round_gs_write_back->Add(cbox_gs_write_back, wxSizerFlags().Border(wxALL, 5).Expand());
 
 	s_round_io_pad_handler->Add(cbox_pad_handler, wxSizerFlags().Border(wxALL, 5).Expand());
 	s_round_io_keyboard_handler->Add(cbox_keyboard_handler, wxSizerFlags().Border(wxALL, 5).Expand());
@@ -572,12 +610,17 @@ void MainFrame::Config(wxCommandEvent& WXUNUSED(event))
 	// Core
 	s_subpanel_cpu->Add(s_round_cpu_decoder, wxSizerFlags().Border(wxALL, 5).Expand());
 	s_subpanel_cpu->Add(s_round_spu_decoder, wxSizerFlags().Border(wxALL, 5).Expand());
+	s_subpanel_cpu->Add(s_round_reservation, wxSizerFlags().Border(wxALL, 5).Expand());
+	s_subpanel_cpu->Add(chbox_spu_bg_compile, wxSizerFlags().Border(wxALL, 5).Expand());
+	s_subpanel_cpu->Add(chbox_spu_log_jit, wxSizerFlags().Border(wxALL, 5).Expand());
 
 	// Graphics
 	s_subpanel_graphics->Add(s_round_gs_render, wxSizerFlags().Border(wxALL, 5).Expand());
 	s_subpanel_graphics->Add(s_round_gs_res, wxSizerFlags().Border(wxALL, 5).Expand());
 	s_subpanel_graphics->Add(s_round_gs_aspect, wxSizerFlags().Border(wxALL, 5).Expand());
 	s_subpanel_graphics->Add(s_round_gs_frame_limit, wxSizerFlags().Border(wxALL, 5).Expand());
+	s_subpanel_graphics->Add(s_round_gs_decompiler, wxSizerFlags().Border(wxALL, 5).Expand());
+	s_subpanel_graphics->Add(s_round_gs_write_back, wxSizerFlags().Border(wxALL, 5).Expand());
 	s_subpanel_graphics->Add(chbox_gs_log_prog, wxSizerFlags().Border(wxALL, 5).Expand());
 	s_subpanel_graphics->Add(chbox_gs_dump_depth, wxSizerFlags().Border(wxALL, 5).Expand());
 	s_subpanel_graphics->Add(chbox_gs_dump_color, wxSizerFlags().Border(wxALL, 5).Expand());
@@ -603,6 +646,7 @@ void MainFrame::Config(wxCommandEvent& WXUNUSED(event))
 	s_subpanel_hle->Add(s_round_hle_log_lvl, wxSizerFlags().Border(wxALL, 5).Expand());
 	s_subpanel_hle->Add(chbox_hle_logging, wxSizerFlags().Border(wxALL, 5).Expand());
 	s_subpanel_hle->Add(chbox_rsx_logging, wxSizerFlags().Border(wxALL, 5).Expand());
+	s_subpanel_hle->Add(chbox_rsx_capture, wxSizerFlags().Border(wxALL, 5).Expand());
 	s_subpanel_hle->Add(chbox_hle_hook_stfunc, wxSizerFlags().Border(wxALL, 5).Expand());
 	s_subpanel_hle->Add(chbox_hle_savetty, wxSizerFlags().Border(wxALL, 5).Expand());
 	s_subpanel_hle->Add(chbox_hle_exitonstop, wxSizerFlags().Border(wxALL, 5).Expand());
@@ -636,10 +680,15 @@ void MainFrame::Config(wxCommandEvent& WXUNUSED(event))
 	{
 		Ini.CPUDecoderMode.SetValue(cbox_cpu_decoder->GetSelection() + 1);
 		Ini.SPUDecoderMode.SetValue(cbox_spu_decoder->GetSelection() + 1);
+		Ini.CPUReservationMode.SetValue(cbox_reservation->GetSelection());
+		Ini.SPUBackgroundCompile.SetValue(chbox_spu_bg_compile->GetValue());
+		Ini.SPULogJit.SetValue(chbox_spu_log_jit->GetValue());
 		Ini.GSRenderMode.SetValue(cbox_gs_render->GetSelection());
 		Ini.GSResolution.SetValue(ResolutionNumToId(cbox_gs_resolution->GetSelection() + 1));
 		Ini.GSAspectRatio.SetValue(cbox_gs_aspect->GetSelection() + 1);
 		Ini.GSFrameLimit.SetValue(cbox_gs_frame_limit->GetSelection());
+		Ini.GSShaderDecompiler.SetValue(cbox_gs_decompiler->GetSelection());
+		Ini.GSBufferWriteBack.SetValue(cbox_gs_write_back->GetSelection());
 		Ini.GSLogPrograms.SetValue(chbox_gs_log_prog->GetValue());
 		Ini.GSDumpDepthBuffer.SetValue(chbox_gs_dump_depth->GetValue());
 		Ini.GSDumpColorBuffers.SetValue(chbox_gs_dump_color->GetValue());
@@ -656,6 +705,7 @@ void MainFrame::Config(wxCommandEvent& WXUNUSED(event))
 		Ini.CameraType.SetValue(cbox_camera_type->GetSelection());
 		Ini.HLELogging.SetValue(chbox_hle_logging->GetValue());
 		Ini.RSXLogging.SetValue(chbox_rsx_logging->GetValue());
+		Ini.RSXCapture.SetValue(chbox_rsx_capture->GetValue());
 		Ini.HLEHookStFunc.SetValue(chbox_hle_hook_stfunc->GetValue());
 		Ini.HLESaveTTY.SetValue(chbox_hle_savetty->GetValue());
 		Ini.HLEExitOnStop.SetValue(chbox_hle_exitonstop->GetValue());
@@ -8,6 +8,7 @@
 #include "RSXDebugger.h"
 #include "Emu/RSX/sysutil_video.h"
 #include "Emu/RSX/GSManager.h"
+#include "Emu/RSX/RSXMemorySnapshot.h"
 //#include "Emu/RSX/GCM.h"
 
 #include "MemoryViewer.h"
@@ -599,6 +600,10 @@ void RSXDebugger::GetSettings()
 		render.m_blend_color_g,
 		render.m_blend_color_b,
 		render.m_blend_color_a));
+	LIST_SETTINGS_ADD("Buffer cache", wxString::Format("Hits:%llu, Misses:%llu, Saved:%llu KB",
+		render.m_buffer_cache_hits, render.m_buffer_cache_misses, render.m_buffer_cache_saved / 1024));
+	LIST_SETTINGS_ADD("Buffer write-back", wxString::Format("Written:%llu, Waits:%llu, Skipped:%llu",
+		render.m_write_backs, render.m_write_back_waits, render.m_write_back_skips));
 	LIST_SETTINGS_ADD("Clipping", wxString::Format("Min:%f, Max:%f", render.m_clip_min, render.m_clip_max));
 	LIST_SETTINGS_ADD("Color mask", !(render.m_set_color_mask) ? "(none)" : wxString::Format("R:%d, G:%d, B:%d, A:%d",
 		render.m_color_mask_r,
@@ -617,11 +622,15 @@ void RSXDebugger::GetSettings()
 	LIST_SETTINGS_ADD("Draw mode", wxString::Format("%d (%s)",
 		render.m_draw_mode,
 		ParseGCMEnum(render.m_draw_mode, CELL_GCM_PRIMITIVE_ENUM)));
+	LIST_SETTINGS_ADD("Memory snapshots", wxString::Format("Hashed:%llu KB, Time:%llu ms",
+		RSXMemorySnapshot::hashed_bytes.load() / 1024, RSXMemorySnapshot::hash_time.load() / 1000000));
 	LIST_SETTINGS_ADD("Scissor", wxString::Format("X:%d, Y:%d, W:%d, H:%d",
 		render.m_scissor_x,
 		render.m_scissor_y,
 		render.m_scissor_w,
 		render.m_scissor_h));
+	LIST_SETTINGS_ADD("Shader decompiler", wxString::Format("Queued:%d, Decompiled:%llu, Time:%llu ms, Skipped draws:%llu",
+		render.m_shader_queue, render.m_shaders_decompiled, render.m_shader_decompile_time / 1000, render.m_skipped_draws));
 	LIST_SETTINGS_ADD("Stencil func", !(render.m_set_stencil_func) ? "(none)" : wxString::Format("0x%x (%s)",
 		render.m_stencil_func,
 		ParseGCMEnum(render.m_stencil_func, CELL_GCM_ENUM)));
@@ -635,6 +644,8 @@ void RSXDebugger::GetSettings()
 	LIST_SETTINGS_ADD("Surface Offset C", wxString::Format("0x%x", render.m_surface_offset_c));
 	LIST_SETTINGS_ADD("Surface Offset D", wxString::Format("0x%x", render.m_surface_offset_d));
 	LIST_SETTINGS_ADD("Surface Offset Z", wxString::Format("0x%x", render.m_surface_offset_z));
+	LIST_SETTINGS_ADD("Texture cache", wxString::Format("Hits:%llu, Misses:%llu",
+		render.m_texture_cache_hits, render.m_texture_cache_misses));
 	LIST_SETTINGS_ADD("Viewport", wxString::Format("X:%d, Y:%d, W:%d, H:%d",
 		render.m_viewport_x,
 		render.m_viewport_y,
@@ -99,15 +99,20 @@ public:
 	// Core
 	IniEntry<u8> CPUDecoderMode;
 	IniEntry<u8> SPUDecoderMode;
+	IniEntry<u8> CPUReservationMode;
+	IniEntry<bool> SPUBackgroundCompile;
+	IniEntry<bool> SPULogJit;
 
 	// Graphics
 	IniEntry<u8> GSRenderMode;
 	IniEntry<u8> GSResolution;
 	IniEntry<u8> GSAspectRatio;
 	IniEntry<u8> GSFrameLimit;
+	IniEntry<u8> GSShaderDecompiler;
 	IniEntry<bool> GSLogPrograms;
 	IniEntry<bool> GSDumpColorBuffers;
 	IniEntry<bool> GSDumpDepthBuffer;
+	IniEntry<u8> GSBufferWriteBack;
 	IniEntry<bool> GSReadColorBuffer;
 	IniEntry<bool> GSVSyncEnable;
 	IniEntry<bool> GS3DTV;
@@ -154,6 +159,7 @@ public:
 	IniEntry<u8>   HLELogLvl;
 	IniEntry<bool> HLELogging;
 	IniEntry<bool> RSXLogging;
+	IniEntry<bool> RSXCapture;
 	IniEntry<bool> HLEHookStFunc;
 	IniEntry<bool> HLESaveTTY;
 	IniEntry<bool> HLEExitOnStop;
@@ -176,15 +182,20 @@ public:
 		// Core
 		CPUDecoderMode.Init("CPU_DecoderMode", path);
 		SPUDecoderMode.Init("CPU_SPUDecoderMode", path);
+		CPUReservationMode.Init("CPU_ReservationMode", path);
+		SPUBackgroundCompile.Init("CPU_SPUBackgroundCompile", path);
+		SPULogJit.Init("CPU_SPULogJit", path);
 
 		// Graphics
 		GSRenderMode.Init("GS_RenderMode", path);
 		GSResolution.Init("GS_Resolution", path);
 		GSAspectRatio.Init("GS_AspectRatio", path);
 		GSFrameLimit.Init("GS_FrameLimit", path);
+		GSShaderDecompiler.Init("GS_ShaderDecompiler", path);
 		GSLogPrograms.Init("GS_LogPrograms", path);
 		GSDumpColorBuffers.Init("GS_DumpColorBuffers", path);
 		GSDumpDepthBuffer.Init("GS_DumpDepthBuffer", path);
+		GSBufferWriteBack.Init("GS_BufferWriteBack", path);
 		GSReadColorBuffer.Init("GS_GSReadColorBuffer", path);
 		GSVSyncEnable.Init("GS_VSyncEnable", path);
 		GS3DTV.Init("GS_3DTV", path);
@@ -230,6 +241,7 @@ public:
 		// HLE/Misc
 		HLELogging.Init("HLE_HLELogging", path);
 		RSXLogging.Init("RSX_Logging", path);
+		RSXCapture.Init("RSX_Capture", path);
 		HLEHookStFunc.Init("HLE_HLEHookStFunc", path);
 		HLESaveTTY.Init("HLE_HLESaveTTY", path);
 		HLEExitOnStop.Init("HLE_HLEExitOnStop", path);
@@ -249,15 +261,20 @@ public:
 		// Core
 		CPUDecoderMode.Load(1);
 		SPUDecoderMode.Load(1);
+		CPUReservationMode.Load(0);
+		SPUBackgroundCompile.Load(true);
+		SPULogJit.Load(false);
 
 		// Graphics
 		GSRenderMode.Load(1);
 		GSResolution.Load(4);
 		GSAspectRatio.Load(2);
 		GSFrameLimit.Load(0);
+		GSShaderDecompiler.Load(1);
 		GSLogPrograms.Load(false);
 		GSDumpColorBuffers.Load(false);
 		GSDumpDepthBuffer.Load(false);
+		GSBufferWriteBack.Load(0);
 		GSReadColorBuffer.Load(false);
 		GSVSyncEnable.Load(false);
 		GS3DTV.Load(false);
@@ -303,6 +320,7 @@ public:
 		// HLE/Miscs
 		HLELogging.Load(false);
 		RSXLogging.Load(false);
+		RSXCapture.Load(false);
 		HLEHookStFunc.Load(false);
 		HLESaveTTY.Load(false);
 		HLEExitOnStop.Load(false);
@@ -323,15 +341,20 @@ public:
 		// CPU/SPU
 		CPUDecoderMode.Save();
 		SPUDecoderMode.Save();
+		CPUReservationMode.Save();
+		SPUBackgroundCompile.Save();
+		SPULogJit.Save();
 
 		// Graphics
 		GSRenderMode.Save();
 		GSResolution.Save();
 		GSAspectRatio.Save();
 		GSFrameLimit.Save();
+		GSShaderDecompiler.Save();
 		GSLogPrograms.Save();
 		GSDumpColorBuffers.Save();
 		GSDumpDepthBuffer.Save();
+		GSBufferWriteBack.Save();
 		GSReadColorBuffer.Save();
 		GSVSyncEnable.Save();
 		GS3DTV.Save();
@@ -377,6 +400,7 @@ public:
 		// HLE/Miscs
 		HLELogging.Save();
 		RSXLogging.Save();
+		RSXCapture.Save();
 		HLEHookStFunc.Save();
 		HLESaveTTY.Save();
 		HLEExitOnStop.Save();
@@ -9,7 +9,7 @@ PKGLoader::PKGLoader(rFile& f) : pkg_f(f)
 {
 }
 
-bool PKGLoader::Install(std::string dest)
+bool PKGLoader::Install(std::string dest, const std::function<void(u64 done, u64 total)>& progress)
 {
 	// Initial checks
 	if (!pkg_f.IsOpened())
@@ -39,7 +39,7 @@ bool PKGLoader::Install(std::string dest)
 	}
 
 	// Decrypt and unpack the PKG file.
-	if (Unpack(pkg_f, titleID, dest) < 0)
+	if (Unpack(pkg_f, titleID, dest, progress) < 0)
 	{
 		LOG_ERROR(LOADER, "PKG Loader: Failed to install package!");
 		return false;
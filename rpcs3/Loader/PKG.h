@@ -8,6 +8,7 @@ class PKGLoader
 
 public:
 	PKGLoader(rFile& f);
-	virtual bool Install(std::string dest);
+	// progress: called with the count of extracted bytes and the total count (optional)
+	virtual bool Install(std::string dest, const std::function<void(u64 done, u64 total)>& progress = nullptr);
 	virtual bool Close();
 };
@@ -6,6 +6,10 @@
 #include "Utilities/Log.h"
 #include "Gui/ConLogFrame.h"
 #include "Emu/GameInfo.h"
+#include "Emu/Cell/SPURecompilerCache.h"
+#include "Emu/RSX/RSXThread.h"
+#include "Emu/RSX/RSXTextureDecode.h"
+#include "Crypto/aesni.h"
 
 #include "Emu/Io/Keyboard.h"
 #include "Emu/Io/Null/NullKeyboardHandler.h"
@@ -26,6 +30,7 @@
 #include "Gui/MsgDialog.h"
 
 #include "Gui/GLGSFrame.h"
+#include "Emu/RSX/RSXCapture.h"
 #include <wx/stdpaths.h>
 
 #ifdef _WIN32
@@ -204,8 +209,10 @@ bool Rpcs3App::OnInit()
 {
 	static const wxCmdLineEntryDesc desc[]
 	{
-		{ wxCMD_LINE_SWITCH, "h", "help", "Command line options:\nh (help): Help and commands\nt (test): For directly executing a (S)ELF", wxCMD_LINE_VAL_NONE, wxCMD_LINE_OPTION_HELP },
+		{ wxCMD_LINE_SWITCH, "h", "help", "Command line options:\nh (help): Help and commands\nt (test): For directly executing a (S)ELF\nr (replay): Replay RSX capture\nb (benchmark): Run built-in benchmarks", wxCMD_LINE_VAL_NONE, wxCMD_LINE_OPTION_HELP },
 		{ wxCMD_LINE_SWITCH, "t", "test", "Run in test mode on (S)ELF", wxCMD_LINE_VAL_NONE },
+		{ wxCMD_LINE_OPTION, "r", "replay", "Replay RSX capture file with Null renderer and exit", wxCMD_LINE_VAL_STRING },
+		{ wxCMD_LINE_SWITCH, "b", "benchmark", "Run built-in benchmarks (results are written to the log) and exit", wxCMD_LINE_VAL_NONE },
 		{ wxCMD_LINE_PARAM, NULL, NULL, "(S)ELF", wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL },
 		{ wxCMD_LINE_NONE }
 	};
@@ -325,6 +332,41 @@ void Rpcs3App::OnArguments(const wxCmdLineParser& parser)
 	// Usage:
 	//   rpcs3-*.exe               Initializes RPCS3
 	//   rpcs3-*.exe [(S)ELF]      Initializes RPCS3, then loads and runs the specified (S)ELF file.
+	//   rpcs3-*.exe -r [capture]  Replays RSX capture file (frame times are written to the log), then exits.
+	//   rpcs3-*.exe -b            Runs built-in benchmarks (results are written to the log), then exits.
+
+	wxString replay;
+	if (parser.Found("r", &replay))
+	{
+		RSXReplay(fmt::ToUTF8(replay));
+		this->Exit();
+		return;
+	}
+
+	if (parser.FoundSwitch("b"))
+	{
+		vm::ps3::init();
+		vm::reservation_benchmark();
+		vm::alloc_benchmark();
+		spu_dispatch_benchmark();
+
+		if (vertex_load_test())
+		{
+			vertex_load_benchmark();
+		}
+
+		vm::close();
+
+		if (texture_decode_test())
+		{
+			texture_decode_benchmark();
+		}
+
+		aesni_self_test();
+
+		this->Exit();
+		return;
+	}
 
 	if (parser.FoundSwitch("t"))
 	{